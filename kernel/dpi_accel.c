@@ -18,11 +18,21 @@
  */
 
 #include "dpi_accel.h"
+#include "dpi_chrdev.h"
+#include "dpi_ruleset.h"
 
 
 /** Initialize instance-specific driver-internal data structure */
 static struct DPIDriverLocal Dpi_Local;
 
+/** Match requests with the software matcher of the rule image instead of the accelerator */
+static bool emulate;
+module_param(emulate, bool, 0444);
+MODULE_PARM_DESC(emulate, "Use the software matcher of the rule image as accelerator backend (no hardware needed)");
+
+/** Busy-time accounting of the emulated backend, kept by every submitting CPU */
+static DEFINE_PER_CPU(struct dpi_emulated_busy, Dpi_Emulated_Busy);
+
 
 /** Initialize of_match_table for device tree */
 #ifdef CONFIG_OF
@@ -41,33 +51,29 @@ void dpi_reset_filter_table(void)
 {
 	/**
 	 *  IMPORTANT: NOT FUNCTIONAL YET
+	 *  Filter table registers are not written; the core does not load a table through them yet
 	 */
-	/*
-	// Set device status as busy
-	Dpi_Local.device_status = STATUS_BUSY;
-
-	printk(KERN_NOTICE "Filter table on DPI Hardware is being reset\n");
-
-	// Write filter table info and reset device
-	iowrite32(5, &Dpi_Local->accel_ptr + REG_OFFSET_NUM_STATES);
-	iowrite32(1, &Dpi_Local->accel_ptr + REG_OFFSET_NUM_FINALS);
-	iowrite32(REG_CTRL_RST, &Dpi_Local->accel_ptr + REG_OFFSET_CTRL);
-	*/
 }
 
 
-void dpi_push_packet_payload(char* payload, unsigned int p_size)
+/** Function that kicks off the DMA transfer of a request */
+static void dpi_push_request(struct dpi_request *req)
 {
+	// Make payload buffer accessible for DMA
+	if(req->map)
+	{
+		req->phys = dma_map_single(Dpi_Local.dev->parent, req->virt, req->len, DMA_TO_DEVICE);
+	}
+
 	// Set device status as busy
 	Dpi_Local.device_status = STATUS_BUSY;
+	Dpi_Local.inflight = req;
 
-	// Make payload buffer accessible for DMA
-	// Hold references for DMA and future unmap
+	// Hold references for DMA
 	Dpi_Local.tx_bd_virt->next = Dpi_Local.tx_bd_phys;
-	Dpi_Local.tx_bd_virt->len = p_size;
+	Dpi_Local.tx_bd_virt->len = req->len;
 	Dpi_Local.tx_bd_virt->app0 = STS_CTRL_APP0_SOP | STS_CTRL_APP0_EOP;
-	Dpi_Local.tx_bd_virt->phys = dma_map_single(Dpi_Local.dev->parent, payload, 
-												p_size, DMA_TO_DEVICE);
+	Dpi_Local.tx_bd_virt->phys = req->phys;
 
 	printk(KERN_DEBUG "Pushing packet payload into DPI hardware -- Addr: %08x, Size: %u\n",
 		(uint32_t) Dpi_Local.tx_bd_virt->phys, Dpi_Local.tx_bd_virt->len);
@@ -77,53 +83,401 @@ void dpi_push_packet_payload(char* payload, unsigned int p_size)
 	 */
 	// iowrite32(REG_CTRL_FILTER, &Dpi_Local->accel_ptr + REG_OFFSET_CTRL);
 
+	// The waiter measures its timeout from here
+	req->dispatched = ktime_get();
+	smp_wmb();
+	ACCESS_ONCE(req->state) = DPI_REQ_INFLIGHT;
+
 	// Kick off DMA transfer for payload filtering
 	Dpi_Local.dma_out(TX_TAILDESC_PTR, Dpi_Local.tx_bd_phys);
 }
 
 
-int dpi_get_filter_result(void)
+/** Function that releases the streaming mapping of a request, if any */
+static void dpi_unmap_request(struct dpi_request *req)
+{
+	// Buffers from /dev/dpi are coherent and stay mapped
+	if(req->map)
+	{
+		dma_unmap_single(Dpi_Local.dev->parent, req->phys, req->len, DMA_TO_DEVICE);
+	}
+}
+
+
+/** Function that accounts the time of a filter call (called under lock) */
+static void dpi_account_busy(ktime_t start, unsigned int p_size)
+{
+	u32 delta = (u32) ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	Dpi_Local.busy_ns += delta;
+	Dpi_Local.busy_scans++;
+	Dpi_Local.busy_bytes += p_size;
+
+	// Moving average over the last ~16 calls; admission control reads it without the lock
+	if(Dpi_Local.scan_cost_ns)
+		Dpi_Local.scan_cost_ns = Dpi_Local.scan_cost_ns - (Dpi_Local.scan_cost_ns >> 4) + (delta >> 4);
+	else
+		Dpi_Local.scan_cost_ns = delta;
+}
+
+
+/** Function that completes the request in flight (called under lock) */
+static void dpi_complete_inflight(int result)
+{
+	struct dpi_request *req = Dpi_Local.inflight;
+
+	dpi_unmap_request(req);
+	dpi_account_busy(req->dispatched, req->len);
+
+	Dpi_Local.inflight = NULL;
+	if(Dpi_Local.device_status == STATUS_BUSY)
+	{
+		Dpi_Local.device_status = STATUS_NOT_SET;
+	}
+
+	dpi_queue_complete(req, result);
+}
+
+
+/**
+ *	Function that takes the device out of service and schedules its reset.
+ *	Until recovery completes, filter calls fail fast and callers use the
+ *	software matcher instead of waiting for timeouts.
+ */
+static void dpi_watchdog_trip(void)
+{
+	// Stop the engine so that it no longer reads the buffer in flight
+	Dpi_Local.dma_out(DMA_CONTROL_REG, DMA_CONTROL_RST);
+
+	Dpi_Local.device_status = STATUS_RECOVERING;
+	if(Dpi_Local.inflight)
+	{
+		dpi_complete_inflight(-1);
+	}
+
+	Dpi_Local.recovery_start = ktime_get();
+	schedule_delayed_work(&Dpi_Local.recovery_work, 0);
+}
+
+
+/**
+ *	Function that matches a request with the software matcher of the rule
+ *	image. It runs on the submitting CPU without the device lock, so the
+ *	emulated backend scales with the CPUs that submit.
+ */
+static void dpi_emulate_request(struct dpi_request *req)
+{
+	struct dpi_emulated_busy *busy;
+	struct dpi_ruleset *rs;
+	ktime_t start = ktime_get();
+	int result = -1;
+	u32 delta;
+
+	rcu_read_lock();
+	rs = dpi_ruleset_get();
+	if(rs && rs->dfa)
+	{
+		result = dpi_dfa_match(rs, req->virt, req->len, NULL) ? 1 : 0;
+	}
+	rcu_read_unlock();
+
+	delta = (u32) ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	busy = get_cpu_ptr(&Dpi_Emulated_Busy);
+	busy->dispatched++;
+	busy->busy_ns += delta;
+	busy->busy_scans++;
+	busy->busy_bytes += req->len;
+	if(busy->scan_cost_ns)
+		busy->scan_cost_ns = busy->scan_cost_ns - (busy->scan_cost_ns >> 4) + (delta >> 4);
+	else
+		busy->scan_cost_ns = delta;
+	put_cpu_ptr(&Dpi_Emulated_Busy);
+
+	dpi_queue_complete(req, result);
+}
+
+
+/**
+ *	Function that hands queued requests to the accelerator (called under
+ *	lock). It takes one request at a time; the TX interrupt calls this
+ *	again when it completes. Emulated requests are never queued here.
+ */
+static void dpi_dispatch(void)
+{
+	struct dpi_request *req;
+
+	Dpi_Local.dispatching = true;
+
+	for(;;)
+	{
+		req = dpi_queue_next();
+		if(!req)
+		{
+			// A submitter that saw dispatching set before it was cleared
+			// relies on this check to have its request picked up
+			Dpi_Local.dispatching = false;
+			smp_mb();
+			if(!dpi_queue_pending())
+			{
+				return;
+			}
+
+			Dpi_Local.dispatching = true;
+			continue;
+		}
+
+		Dpi_Local.dispatched++;
+
+		if(Dpi_Local.device_status == STATUS_RECOVERING || !Dpi_Local.tx_bd_virt)
+		{
+			// Fail fast, waiters fall back to the software matcher
+			dpi_queue_complete(req, -1);
+		}
+		else
+		{
+			dpi_push_request(req);
+			return;
+		}
+	}
+}
+
+
+/** Function that gives up a request that stayed on the accelerator too long */
+static void dpi_request_timeout(struct dpi_request *req)
 {
 	uint32_t stat_reg_val;
-	int timeout = 1000;
+	unsigned long flags;
 
-	printk(KERN_DEBUG "Xtables is fetching the filter result from driver...\n");
+	spin_lock_irqsave(&Dpi_Local.lock, flags);
 
-	// If device is not set, quickly return error
-	if(Dpi_Local.device_status == STATUS_NOT_SET)
+	// The interrupt may have completed it meanwhile
+	if(Dpi_Local.inflight != req)
 	{
-		return -1;
+		spin_unlock_irqrestore(&Dpi_Local.lock, flags);
+		return;
 	}
 
-	// If status is busy, wait until the value is loaded
-	while(Dpi_Local.device_status == STATUS_BUSY)
+	// If timeout is occurred, report the error
+	printk(KERN_INFO "dpi: Timeout in fetching filter result from driver\n");
+
+	// If timeout is occured, report current device status in debug mode
+	stat_reg_val = ioread32((void*) Dpi_Local.accel_ptr + REG_OFFSET_STATUS);
+	printk(KERN_DEBUG "DPI Status register at timeout: 0x%08x\n", stat_reg_val);
+
+	// The DMA and the scan of the request may still be running, and its late
+	// interrupt would complete the next one: halt the device and reset it
+	// before its descriptor is used again
+	Dpi_Local.watchdog_timeouts++;
+	dev_err(Dpi_Local.dev, "Request timed out, resetting the device\n");
+	dpi_watchdog_trip();
+
+	// Fail the queued requests while recovering
+	dpi_dispatch();
+
+	spin_unlock_irqrestore(&Dpi_Local.lock, flags);
+}
+
+
+struct dpi_request *dpi_submit(unsigned int class, dma_addr_t phys, void *virt,
+							unsigned int p_size, bool map)
+{
+	struct dpi_request *req;
+	unsigned long flags;
+
+	// If device is not probed or being recovered, quickly return error
+	if(!dpi_accel_online())
+	{
+		return NULL;
+	}
+
+	// Submitters of a class cannot interrupt each other on this CPU
+	if(class == DPI_SQ_USER)
+	{
+		preempt_disable();
+	}
+
+	if(emulate)
+	{
+		req = dpi_queue_submit_local(class, virt, p_size);
+	}
+	else
+	{
+		req = dpi_queue_submit(class, phys, virt, p_size, map);
+	}
+
+	if(class == DPI_SQ_USER)
+	{
+		preempt_enable();
+	}
+
+	if(!req)
+	{
+		return NULL;
+	}
+
+	// The emulated backend owns no device: the submitter matches its own request
+	if(emulate)
+	{
+		dpi_emulate_request(req);
+		return req;
+	}
+
+	// Pairs with the barrier in dpi_dispatch(): either the dispatcher sees
+	// the new request, or we see that nobody dispatches and start it
+	smp_mb();
+	if(!ACCESS_ONCE(Dpi_Local.dispatching))
+	{
+		spin_lock_irqsave(&Dpi_Local.lock, flags);
+		if(!Dpi_Local.dispatching)
+		{
+			dpi_dispatch();
+		}
+		spin_unlock_irqrestore(&Dpi_Local.lock, flags);
+	}
+
+	return req;
+}
+
+
+int dpi_wait(struct dpi_request *req)
+{
+	int result;
+
+	// Spin on the own slot only; the dispatcher writes it once
+	while(ACCESS_ONCE(req->state) != DPI_REQ_DONE)
 	{
 		udelay(1);
-		timeout--;
 
-		if(! timeout)
+		if(ACCESS_ONCE(req->state) == DPI_REQ_INFLIGHT)
 		{
-			// If timeout is occurred, report the error
-			printk(KERN_INFO "dpi: Timeout in fetching filter result from driver\n");
+			smp_rmb();
+			if(ktime_us_delta(ktime_get(), req->dispatched) > DPI_REQUEST_TIMEOUT_US)
+			{
+				dpi_request_timeout(req);
+			}
+		}
+	}
+
+	smp_rmb();
+	result = req->result;
+	dpi_queue_release(req);
+
+	return result;
+}
+
+
+int dpi_filter_payload(char *payload, unsigned int p_size)
+{
+	struct dpi_request *req;
+
+	req = dpi_submit(DPI_SQ_NET, 0, payload, p_size, true);
+
+	return req ? dpi_wait(req) : -1;
+}
+
+
+int dpi_filter_buffer(dma_addr_t phys, void *virt, unsigned int p_size)
+{
+	struct dpi_request *req;
 
-			// If timeout is occured, report current device status in debug mode
-			stat_reg_val = ioread32((void*) Dpi_Local.accel_ptr + REG_OFFSET_STATUS);
-			printk(KERN_DEBUG "DPI Status register at timeout: 0x%08x\n", stat_reg_val);
+	req = dpi_submit(DPI_SQ_USER, phys, virt, p_size, false);
 
-			return -1;
+	return req ? dpi_wait(req) : -1;
+}
+
+
+bool dpi_accel_online(void)
+{
+	if(emulate)
+	{
+		return true;
+	}
+
+	return Dpi_Local.tx_bd_virt && ACCESS_ONCE(Dpi_Local.device_status) != STATUS_RECOVERING;
+}
+
+
+bool dpi_accel_emulated(void)
+{
+	return emulate;
+}
+
+
+u32 dpi_accel_reset_generation(void)
+{
+	return ACCESS_ONCE(Dpi_Local.reset_generation);
+}
+
+
+u32 dpi_accel_scan_cost_ns(void)
+{
+	if(emulate)
+	{
+		return this_cpu_read(Dpi_Emulated_Busy.scan_cost_ns);
+	}
+
+	return ACCESS_ONCE(Dpi_Local.scan_cost_ns);
+}
+
+
+void dpi_get_health(struct dpi_health *health)
+{
+	const struct dpi_emulated_busy *busy;
+	unsigned long flags;
+	u64 scan_cost = 0;
+	int cpu, scanning = 0;
+
+	spin_lock_irqsave(&Dpi_Local.lock, flags);
+	health->device_status = Dpi_Local.device_status;
+	health->reset_generation = Dpi_Local.reset_generation;
+	health->watchdog_timeouts = Dpi_Local.watchdog_timeouts;
+	health->dma_errors = Dpi_Local.dma_errors;
+	health->recoveries = Dpi_Local.recoveries;
+	health->recovery_failures = Dpi_Local.recovery_failures;
+	health->last_recovery_us = Dpi_Local.last_recovery_us;
+	health->total_recovery_us = Dpi_Local.total_recovery_us;
+	health->scan_cost_ns = Dpi_Local.scan_cost_ns;
+	health->busy_ns = Dpi_Local.busy_ns;
+	health->busy_scans = Dpi_Local.busy_scans;
+	health->busy_bytes = Dpi_Local.busy_bytes;
+	health->dispatched = Dpi_Local.dispatched;
+	spin_unlock_irqrestore(&Dpi_Local.lock, flags);
+
+	if(!emulate)
+	{
+		return;
+	}
+
+	// Sum of every CPU; the scan cost is the average of the CPUs that scanned
+	for_each_possible_cpu(cpu)
+	{
+		busy = per_cpu_ptr(&Dpi_Emulated_Busy, cpu);
+		health->busy_ns += busy->busy_ns;
+		health->busy_scans += busy->busy_scans;
+		health->busy_bytes += busy->busy_bytes;
+		health->dispatched += busy->dispatched;
+		if(busy->scan_cost_ns)
+		{
+			scan_cost += busy->scan_cost_ns;
+			scanning++;
 		}
 	}
+	health->scan_cost_ns = scanning ? div_u64(scan_cost, scanning) : 0;
+}
 
-	// Set new device status 
-	Dpi_Local.device_status = STATUS_NOT_SET;
 
-	// Return packet result that is set
-	return Dpi_Local.packet_result;
+struct device *dpi_get_dma_device(void)
+{
+	return Dpi_Local.tx_bd_virt ? Dpi_Local.dev->parent : NULL;
 }
 
 
-/** Function that evaluates device status */
-static void dpi_evaluate_dev_status(void *lp, uint32_t stat_reg_val)
+/**
+ *	Function that evaluates device status.
+ *		returns false if the device has not finished yet
+ */
+static bool dpi_evaluate_dev_status(void *lp, uint32_t stat_reg_val, int *result)
 {
 	struct DPIDriverLocal *local_ptr = (struct DPIDriverLocal *) lp;
 
@@ -131,14 +485,14 @@ static void dpi_evaluate_dev_status(void *lp, uint32_t stat_reg_val)
 	if(stat_reg_val & REG_STATUS_BUSY)
 	{
 		printk(KERN_INFO "Device is busy. The result of last operation cannot be fetched!\n");
-		return ;
+		return false;
 	}
 
 	if(stat_reg_val & REG_STATUS_RST_END)
 	{
-		// If last finished operation is reset, update device status and quickly return
+		// If last finished operation is reset, there is no filter result
 		dev_info(local_ptr->dev, "Filter table reset on DPI Hardware is completed!\n");
-		Dpi_Local.device_status = STATUS_NOT_SET;
+		*result = -1;
 	}
 	else if(stat_reg_val & REG_STATUS_FILTER_END)
 	{
@@ -147,28 +501,22 @@ static void dpi_evaluate_dev_status(void *lp, uint32_t stat_reg_val)
 		if(stat_reg_val & REG_STATUS_ERR)
 		{
 			dev_info(local_ptr->dev, "Error occured in the last operation on device!\n");
-			Dpi_Local.packet_result = -1;
+			*result = -1;
 		}
 		else
 		{
-			Dpi_Local.packet_result = stat_reg_val & REG_STATUS_FILTER_MATCH;
-			printk(KERN_DEBUG "Does DPI Accelerator match packet? : %d\n", (Dpi_Local.packet_result > 0));
+			*result = (stat_reg_val & REG_STATUS_FILTER_MATCH) ? 1 : 0;
+			printk(KERN_DEBUG "Does DPI Accelerator match packet? : %d\n", *result);
 		}
-
-		// Unmap DMA reference
-		dma_unmap_single(Dpi_Local.dev->parent, Dpi_Local.tx_bd_virt->phys, 
-						Dpi_Local.tx_bd_virt->len, DMA_TO_DEVICE);
-
-		// Set device status as ready to read
-		Dpi_Local.device_status = STATUS_READ_READY;
 	}
 	else
 	{
-		// In unrecognized signal, update device status and allow package
+		// In unrecognized signal, allow package
 		dev_info(local_ptr->dev, "Unrecognized DPI decision on packet. Allowing it! \n");
-		Dpi_Local.packet_result = -1;
-		Dpi_Local.device_status = STATUS_NOT_SET;		
+		*result = -1;
 	}
+
+	return true;
 }
 
 
@@ -177,30 +525,57 @@ static irqreturn_t dpi_tx_interrupt(int irq, void *lp)
 {
 	unsigned int dma_status;
 	uint32_t stat_reg_val;
+	int result;
 	struct DPIDriverLocal *local_ptr = (struct DPIDriverLocal *) lp;
 
 	// Get DMA IRQ status and re-write it (to inform that interrupt is received) 
 	dma_status = local_ptr->dma_in(TX_IRQ_REG);
 	local_ptr->dma_out(TX_IRQ_REG, dma_status);
 
+	spin_lock(&local_ptr->lock);
+
+	// The watchdog owns the device while it is recovering, and a request
+	// given up on timeout has nobody waiting for it anymore
+	if (local_ptr->device_status == STATUS_RECOVERING || !local_ptr->inflight)
+	{
+		spin_unlock(&local_ptr->lock);
+		return IRQ_HANDLED;
+	}
+
 	// Get Tx state and evaluate it
 	dma_status = local_ptr->dma_in(TX_CHNL_STS);
 
-	if (dma_status & CHNL_STS_CMPLT)
+	if (dma_status & (CHNL_STS_ERR | CHNL_STS_FATAL_MASK))
+	{
+		// If DMA error is occured, log it and reset the channel
+		dev_err(local_ptr->dev, "DMA transfer error 0x%x, resetting the device\n", dma_status);
+		local_ptr->dma_errors++;
+		dpi_watchdog_trip();
+	}
+	else if (dma_status & CHNL_STS_CMPLT)
 	{
 		// If DMA is successful, read and evaluate device status
 		stat_reg_val = ioread32((void*) local_ptr->accel_ptr + REG_OFFSET_STATUS);
 		printk(KERN_DEBUG "DPI status at TX Interrupt: 0x%08x\n", stat_reg_val);
 
-		dpi_evaluate_dev_status(local_ptr, stat_reg_val);
+		if (!dpi_evaluate_dev_status(local_ptr, stat_reg_val, &result))
+		{
+			spin_unlock(&local_ptr->lock);
+			return IRQ_HANDLED;
+		}
+
+		dpi_complete_inflight(result);
 	}
-	else if (dma_status & CHNL_STS_ERR)
+	else
 	{
-		// If DMA error is occured, log it and force error state
-		dev_err(local_ptr->dev, "DMA transfer error 0x%x\n", dma_status);
-		dpi_evaluate_dev_status(local_ptr, REG_STATUS_ERR);
+		spin_unlock(&local_ptr->lock);
+		return IRQ_HANDLED;
 	}
 
+	// Hand the next queued request to the device
+	dpi_dispatch();
+
+	spin_unlock(&local_ptr->lock);
 	return IRQ_HANDLED;
 }
 
@@ -244,21 +619,11 @@ static int dpi_dcr_setup(struct DPIDriverLocal *lp, struct platform_device *op,
 }
 
 
-/** The function that resets and initalizes DMA */
-static int dpi_dma_init(struct DPIDriverLocal *lp)
+/** The function that resets DMA and rebuilds its buffer descriptor */
+static int dpi_dma_reset(struct DPIDriverLocal *lp)
 {
 	u32 timeout;
-
-	// Allocate the tx buffer descriptor
-	// It returns a virtual address and a physical address
-	lp->tx_bd_virt = dma_zalloc_coherent(lp->dev->parent, sizeof(*lp->tx_bd_virt),
-					  					&lp->tx_bd_phys, GFP_KERNEL);
-
-	// If error occurs during coherent memory allocation, return an error
-	if (!lp->tx_bd_virt)
-	{
-		return -ENOMEM;
-	}
+	int retval = 0;
 
 	// Reset Local Link (DMA)
 	lp->dma_out(DMA_CONTROL_REG, DMA_CONTROL_RST);
@@ -269,6 +634,7 @@ static int dpi_dma_init(struct DPIDriverLocal *lp)
 		if (--timeout == 0) 
 		{
 			dev_err(lp->dev, "dpi_dma_bd_init: DMA reset timed out!!\n");
+			retval = -ETIMEDOUT;
 			break;
 		}
 	}
@@ -284,15 +650,109 @@ static int dpi_dma_init(struct DPIDriverLocal *lp)
 				  CHNL_CTRL_IRQ_COAL_EN |
 				  CHNL_CTRL_IRQ_IOE);
 
-	// Set the physical address of tx buffer descriptor into DMA
+	// Acknowledge interrupts left over from before the reset
+	lp->dma_out(TX_IRQ_REG, lp->dma_in(TX_IRQ_REG));
+
+	// Rebuild the buffer descriptor and set its physical address into DMA
+	memset(lp->tx_bd_virt, 0, sizeof(*lp->tx_bd_virt));
+	lp->tx_bd_virt->next = lp->tx_bd_phys;
 	lp->dma_out(TX_CURDESC_PTR, lp->tx_bd_phys);
 
 	dev_notice(lp->dev, "TX channel of DMA 1 is enabled.\n");
 
+	return retval;
+}
+
+
+/** The function that allocates the buffer descriptor, resets and initalizes DMA */
+static int dpi_dma_init(struct DPIDriverLocal *lp)
+{
+	// Allocate the tx buffer descriptor
+	// It returns a virtual address and a physical address
+	lp->tx_bd_virt = dma_zalloc_coherent(lp->dev->parent, sizeof(*lp->tx_bd_virt),
+					  					&lp->tx_bd_phys, GFP_KERNEL);
+
+	// If error occurs during coherent memory allocation, return an error
+	if (!lp->tx_bd_virt)
+	{
+		return -ENOMEM;
+	}
+
+	// A slow reset is reported but the channel is still usable after it
+	dpi_dma_reset(lp);
+
+	return 0;
+}
+
+
+/** The function that resets the accelerator core */
+static int dpi_core_reset(struct DPIDriverLocal *lp)
+{
+	uint32_t stat_reg_val;
+	u32 timeout = 1000;
+
+	iowrite32(REG_CTRL_RST, (void *) lp->accel_ptr + REG_OFFSET_CTRL);
+
+	do
+	{
+		udelay(1);
+		stat_reg_val = ioread32((void *) lp->accel_ptr + REG_OFFSET_STATUS);
+	}
+	while (!(stat_reg_val & REG_STATUS_RST_END) && --timeout);
+
+	// Cores without reset completion reporting are fine as long as they are idle
+	if (!timeout && (stat_reg_val & REG_STATUS_BUSY))
+	{
+		dev_err(lp->dev, "Core reset timed out, status 0x%08x\n", stat_reg_val);
+		return -ETIMEDOUT;
+	}
+
 	return 0;
 }
 
 
+/** The function that resets DMA and core after the watchdog took the device out of service */
+static void dpi_recovery_work(struct work_struct *work)
+{
+	u64 elapsed;
+	int retval;
+
+	dev_notice(Dpi_Local.dev, "Recovering the DPI device...\n");
+
+	// Nobody touches the device while it is recovering,
+	// the lock is only needed to publish the result
+	retval = dpi_dma_reset(&Dpi_Local);
+	if (!retval)
+	{
+		retval = dpi_core_reset(&Dpi_Local);
+	}
+
+	if (retval)
+	{
+		spin_lock_irq(&Dpi_Local.lock);
+		Dpi_Local.recovery_failures++;
+		spin_unlock_irq(&Dpi_Local.lock);
+
+		dev_err(Dpi_Local.dev, "Recovery failed, retrying in %d ms\n", DPI_RECOVERY_RETRY_MS);
+		schedule_delayed_work(&Dpi_Local.recovery_work, msecs_to_jiffies(DPI_RECOVERY_RETRY_MS));
+		return;
+	}
+
+	// The filter table is not reprogrammed, see dpi_reset_filter_table()
+	elapsed = ktime_us_delta(ktime_get(), Dpi_Local.recovery_start);
+
+	spin_lock_irq(&Dpi_Local.lock);
+	Dpi_Local.recoveries++;
+	Dpi_Local.last_recovery_us = elapsed;
+	Dpi_Local.total_recovery_us += elapsed;
+	Dpi_Local.reset_generation++;
+	Dpi_Local.device_status = STATUS_NOT_SET;
+	spin_unlock_irq(&Dpi_Local.lock);
+
+	dev_notice(Dpi_Local.dev, "The DPI device is recovered in %llu us.\n", (unsigned long long) elapsed);
+}
+
+
 /** The function that resets DMA (and leaves it disabled) **/
 static void dpi_dma_release(struct DPIDriverLocal *lp)
 {
@@ -304,6 +764,7 @@ static void dpi_dma_release(struct DPIDriverLocal *lp)
 	{
 		dma_free_coherent(lp->dev->parent, sizeof(*lp->tx_bd_virt),
 							lp->tx_bd_virt, lp->tx_bd_phys);
+		lp->tx_bd_virt = NULL;
 	}
 
 	dev_notice(lp->dev, "DMA 1 is disabled.\n");
@@ -427,6 +888,24 @@ static int dpi_driver_remove (struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;	// Generic device contained in platform device
 	
+	// Stop the watchdog before the device goes away
+	cancel_delayed_work_sync(&Dpi_Local.recovery_work);
+
+	// Take the device out of service; the request in flight and queued ones fail
+	spin_lock_irq(&Dpi_Local.lock);
+	Dpi_Local.device_status = STATUS_RECOVERING;
+	if(Dpi_Local.inflight)
+	{
+		dpi_complete_inflight(-1);
+	}
+
+	// Emulated requests are taken out by their submitters, never by a dispatcher
+	if(!emulate)
+	{
+		dpi_dispatch();
+	}
+	spin_unlock_irq(&Dpi_Local.lock);
+
 	// Reset DMA 
 	dpi_dma_release(&Dpi_Local);
 	
@@ -465,6 +944,9 @@ int dpi_init(void)
 
 	printk(KERN_NOTICE "Trying to register the DPI Accelerator driver... \n");
 
+	spin_lock_init(&Dpi_Local.lock);
+	INIT_DELAYED_WORK(&Dpi_Local.recovery_work, dpi_recovery_work);
+
 	// Register platform device driver first
 	retval = platform_driver_register(&Dpi_Driver);
 	if (retval) 
@@ -473,6 +955,15 @@ int dpi_init(void)
 		return retval;
 	}
 
+	// Expose the accelerator to userspace
+	retval = dpi_cdev_init();
+	if (retval)
+	{
+		printk(KERN_ERR "Unable to register DPI character device... \n");
+		platform_driver_unregister(&Dpi_Driver);
+		return retval;
+	}
+
 	// Report driver load success
 	printk(KERN_NOTICE "The DPI Accelerator driver is registered. \n");
 	return 0;
@@ -481,8 +972,14 @@ int dpi_init(void)
 
 void dpi_exit(void)
 {
+	// Remove userspace access first
+	dpi_cdev_exit();
+
 	// Unregister platform driver
 	platform_driver_unregister(&Dpi_Driver);
 
+	// Drop the loaded rule image
+	dpi_ruleset_exit();
+
 	printk(KERN_NOTICE "The DPI Accelerator driver is unregistered.\n");
 }
\ No newline at end of file
@@ -26,10 +26,13 @@
 #include <linux/dma-mapping.h>
 #include <linux/interrupt.h>
 #include <linux/fs.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/dcr.h>
 #include <asm/dcr-regs.h>
+#include "dpi_queue.h"
 
 /** Driver property macros */
 #define DRIVER_NAME 					"dpi"
@@ -38,7 +41,13 @@
 /** Status macros */
 #define STATUS_NOT_SET					0 		// Not set yet
 #define STATUS_BUSY						1 		// Processing data
-#define STATUS_READ_READY				2 		// There is a result to read
+#define STATUS_RECOVERING				2 		// Watchdog is resetting the device
+
+/** Time a request may spend on the accelerator before it is given up */
+#define DPI_REQUEST_TIMEOUT_US			1000
+
+/** Watchdog macros */
+#define DPI_RECOVERY_RETRY_MS			100		// Delay before retrying a failed recovery
 
 /** Hardware Accelerator Registers macros */
 #define REG_OFFSET_CTRL 				0x00
@@ -117,9 +126,20 @@
  31       0       Reserved
 */
 #define TX_CHNL_STS         			0x07	// r
+#define CHNL_STS_TAILP_ERR				(1 << 21)
+#define CHNL_STS_CMP_ERR				(1 << 20)
+#define CHNL_STS_ADDR_ERR				(1 << 19)
+#define CHNL_STS_NXTP_ERR				(1 << 18)
+#define CHNL_STS_CURP_ERR				(1 << 17)
+#define CHNL_STS_BSY_WR					(1 << 16)
 #define CHNL_STS_CMPLT					(1 << 4)
 #define CHNL_STS_ERR					(1 << 7)
 
+/** Errors that leave the SDMA channel unusable until it is reset */
+#define CHNL_STS_FATAL_MASK				(CHNL_STS_TAILP_ERR | CHNL_STS_CMP_ERR | \
+										 CHNL_STS_ADDR_ERR | CHNL_STS_NXTP_ERR | \
+										 CHNL_STS_CURP_ERR | CHNL_STS_BSY_WR)
+
 /*
  DMA control register bit definitions
  2 		DMA Tail Transfer enabled
@@ -152,6 +172,16 @@ struct cdmac_bd
 	u32 app4;	/* skb for TX length for RX */
 };
 
+/** Busy-time accounting of the emulated backend on one CPU */
+struct dpi_emulated_busy
+{
+	u32 scan_cost_ns;
+	u64 busy_ns;
+	u64 busy_scans;
+	u64 busy_bytes;
+	u64 dispatched;
+};
+
 /** Instance-specific driver-internal data structure */
 struct DPIDriverLocal
 {
@@ -168,7 +198,35 @@ struct DPIDriverLocal
 
 	// Device status
 	unsigned int device_status;
-	int packet_result;
+
+	// Protects the single TX descriptor and dispatching (taken by the TX interrupt)
+	spinlock_t lock;
+
+	// Request on the accelerator, completed by the TX interrupt
+	struct dpi_request *inflight;
+
+	// A dispatcher owns the device: a request is in flight or a CPU drains the queues
+	bool dispatching;
+	u64 dispatched;
+
+	// Watchdog state (updated under lock)
+	struct delayed_work recovery_work;
+	ktime_t recovery_start;
+
+	// Health counters, see struct dpi_health
+	u32 reset_generation;
+	u64 watchdog_timeouts;
+	u64 dma_errors;
+	u64 recoveries;
+	u64 recovery_failures;
+	u64 last_recovery_us;
+	u64 total_recovery_us;
+
+	// Busy-time accounting of filter calls (updated under lock)
+	u32 scan_cost_ns;
+	u64 busy_ns;
+	u64 busy_scans;
+	u64 busy_bytes;
 
 	// DMA buffer descriptors
 	struct cdmac_bd *tx_bd_virt;
@@ -180,14 +238,80 @@ struct DPIDriverLocal
 	void (*dma_out)(int, u32);
 };
 
-/** The function that resets filter table on accelerator */
+/** Accelerator health as reported to statistics */
+struct dpi_health
+{
+	unsigned int device_status;
+
+	// Increases with every device reset; results from before a reset are stale
+	u32 reset_generation;
+
+	u64 watchdog_timeouts;
+	u64 dma_errors;
+	u64 recoveries;
+	u64 recovery_failures;
+	u64 last_recovery_us;
+	u64 total_recovery_us;
+
+	// Time the device spent on filter calls, and average time per call
+	u32 scan_cost_ns;
+	u64 busy_ns;
+	u64 busy_scans;
+	u64 busy_bytes;
+
+	// Requests the dispatcher handed to the backend
+	u64 dispatched;
+};
+
+/** The function that resets filter table on accelerator (not functional yet, does nothing) */
 void dpi_reset_filter_table(void);
 
-/** The function that pushes packet payload for filtering */
-void dpi_push_packet_payload(char *, unsigned int);
+/**
+ *	This function queues a buffer for filtering on the submission queue of
+ *	the current CPU and starts dispatching if the device is idle.
+ *	The buffer is either DMA-able already (phys) or mapped at dispatch (virt).
+ *		returns the request to wait for, NULL on full queue or missing device
+ */
+struct dpi_request *dpi_submit(unsigned int, dma_addr_t, void *, unsigned int, bool);
+
+/**
+ *	This function waits for a submitted request and gives its slot back.
+ *		returns 1 on match, 0 on no match, -1 on error or timeout
+ */
+int dpi_wait(struct dpi_request *);
+
+/**
+ *	This function filters a payload on the accelerator.
+ *		returns 1 on match, 0 on no match, -1 on error or missing device
+ */
+int dpi_filter_payload(char *, unsigned int);
+
+/**
+ *	This function filters an already DMA-able (coherent) buffer on the accelerator.
+ *		returns 1 on match, 0 on no match, -1 on error or missing device
+ */
+int dpi_filter_buffer(dma_addr_t, void *, unsigned int);
+
+/** The function that returns true if the accelerator is probed and not recovering */
+bool dpi_accel_online(void);
+
+/** The function that returns true if requests are matched by the emulated backend */
+bool dpi_accel_emulated(void);
+
+/** The function that returns the number of device resets so far (no lock needed) */
+u32 dpi_accel_reset_generation(void);
+
+/**
+ *	This function returns the average time of a filter call in ns, or 0 if
+ *	not measured yet. The emulated backend reports the current CPU.
+ */
+u32 dpi_accel_scan_cost_ns(void);
+
+/** The function that copies accelerator health counters */
+void dpi_get_health(struct dpi_health *);
 
-/** The function that gets filter result of payload */
-int dpi_get_filter_result(void);
+/** The function that returns the device to allocate DMA buffers for, NULL if not probed */
+struct device *dpi_get_dma_device(void);
 
 /** The function that registers driver into kernel */
 int dpi_init(void);
@@ -0,0 +1,591 @@
+/**
+ * Character Device for DPI (Deep Packet Inspection) Hardware Accelerator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/capability.h>
+#include "dpi_accel.h"
+#include "dpi_chrdev.h"
+#include "dpi_ruleset.h"
+
+
+/** Function that returns number of completions userspace has not consumed */
+static u32 dpi_cdev_cq_ready(struct dpi_cdev_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->cq_tail) - ACCESS_ONCE(ctx->cq_ctrl->head);
+}
+
+
+/** Function that returns number of submissions kernel has not consumed */
+static u32 dpi_cdev_sq_pending(struct dpi_cdev_ctx *ctx)
+{
+	u32 pending = ACCESS_ONCE(ctx->sq_ctrl->tail) - ctx->sq_head;
+
+	// A corrupt tail can never make the kernel walk past the ring
+	return min(pending, ctx->params.sq_entries);
+}
+
+
+/** Function that matches a buffer with the software matcher, -1 if the rule set has none */
+static int dpi_cdev_software_match(const u8 *buf, u32 len, u32 *pattern_id)
+{
+	struct dpi_ruleset *rs;
+	int result = -1;
+	u32 match;
+
+	rcu_read_lock();
+	rs = dpi_ruleset_get();
+	if(rs && rs->dfa)
+	{
+		match = dpi_dfa_match(rs, buf, len, NULL);
+		*pattern_id = dpi_ruleset_pattern_id(rs, match);
+		result = match ? 1 : 0;
+	}
+	rcu_read_unlock();
+
+	return result;
+}
+
+
+/** Function that checks the regex tails of an accelerator match, if the rule set has any */
+static int dpi_cdev_confirm(const u8 *buf, u32 len, u32 *pattern_id)
+{
+	struct dpi_ruleset *rs;
+	int result = 1;
+	u32 match;
+
+	rcu_read_lock();
+	rs = dpi_ruleset_get();
+	if(rs && rs->nfa && rs->dfa)
+	{
+		match = dpi_dfa_match(rs, buf, len, NULL);
+		*pattern_id = dpi_ruleset_pattern_id(rs, match);
+		result = match ? 1 : 0;
+	}
+	rcu_read_unlock();
+
+	return result;
+}
+
+
+/**
+ *	Function that returns the offset of the buffer of an SQ entry in the
+ *	region, 0 if the entry is invalid (buffers start after the rings).
+ */
+static size_t dpi_cdev_buf_off(const struct dpi_cdev_ctx *ctx, const struct dpi_sqe *sqe)
+{
+	if(sqe->buf_index >= ctx->params.buf_count || !sqe->len || sqe->len > ctx->params.buf_size)
+	{
+		return 0;
+	}
+
+	// buf_count x buf_size is bounded by DPI_RING_MAX_REGION at setup
+	return ctx->params.buf_off + (size_t) sqe->buf_index * ctx->params.buf_size;
+}
+
+
+/**
+ *	Function that consumes up to to_submit SQ entries, filters their buffers
+ *	and posts one CQ entry for each. Returns number of consumed entries.
+ */
+static unsigned int dpi_cdev_submit(struct dpi_cdev_ctx *ctx, unsigned int to_submit)
+{
+	struct dpi_sqe sqes[DPI_CDEV_BUDGET];
+	struct dpi_request *reqs[DPI_CDEV_BUDGET];
+	size_t offs[DPI_CDEV_BUDGET];
+	struct dpi_cqe *cqe;
+	unsigned int done = 0, batch, i;
+	u32 pending, room;
+	int result;
+
+	pending = dpi_cdev_sq_pending(ctx);
+	smp_rmb();
+
+	while(done < to_submit && done < pending)
+	{
+		// Leave entries queued when there is no room for their completions
+		room = ctx->params.cq_entries - (ctx->cq_tail - ACCESS_ONCE(ctx->cq_ctrl->head));
+		if(!room)
+		{
+			ctx->cq_ctrl->overflow++;
+			break;
+		}
+
+		batch = min3(to_submit - done, pending - done, (unsigned int) DPI_CDEV_BUDGET);
+		batch = min(batch, room);
+
+		// Queue the whole batch first, so that the accelerator does not
+		// wait for this thread between buffers
+		for(i = 0; i < batch; i++)
+		{
+			// Copy the entry so that userspace cannot change it under us
+			sqes[i] = ctx->sqes[(ctx->sq_head + i) & (ctx->params.sq_entries - 1)];
+			offs[i] = dpi_cdev_buf_off(ctx, &sqes[i]);
+			reqs[i] = NULL;
+
+			if(!offs[i])
+			{
+				continue;
+			}
+
+			// Buffers are coherent, the accelerator reads them in place
+			reqs[i] = dpi_submit(DPI_SQ_USER, ctx->region_phys + offs[i], ctx->region + offs[i],
+								sqes[i].len, false);
+		}
+
+		for(i = 0; i < batch; i++)
+		{
+			cqe = &ctx->cqes[(ctx->cq_tail + i) & (ctx->params.cq_entries - 1)];
+			cqe->user_data = sqes[i].user_data;
+			cqe->pattern_id = DPI_PATTERN_UNKNOWN;
+
+			if(!offs[i])
+			{
+				cqe->result = -EINVAL;
+				continue;
+			}
+
+			result = reqs[i] ? dpi_wait(reqs[i]) : -1;
+
+			// Drain to the software matcher while the accelerator is down
+			if(result < 0)
+			{
+				result = dpi_cdev_software_match(ctx->region + offs[i], sqes[i].len, &cqe->pattern_id);
+			}
+			else if(result > 0 && !dpi_accel_emulated())
+			{
+				result = dpi_cdev_confirm(ctx->region + offs[i], sqes[i].len, &cqe->pattern_id);
+			}
+
+			cqe->result = (result < 0) ? -EIO :
+						(result > 0) ? DPI_RESULT_MATCH : DPI_RESULT_CLEAN;
+		}
+
+		// Publish the completions before moving the indices
+		ctx->sq_head += batch;
+		ctx->cq_tail += batch;
+		smp_wmb();
+		ctx->sq_ctrl->head = ctx->sq_head;
+		ctx->cq_ctrl->tail = ctx->cq_tail;
+		done += batch;
+
+		// Give other users a turn
+		wake_up_interruptible(&ctx->cq_wait);
+		cond_resched();
+	}
+
+	return done;
+}
+
+
+/** SQ poll thread: submits without syscalls until the ring stays idle */
+static int dpi_cdev_sq_thread(void *data)
+{
+	struct dpi_cdev_ctx *ctx = (struct dpi_cdev_ctx *) data;
+	unsigned long idle = msecs_to_jiffies(ctx->params.sq_idle_ms);
+	unsigned long last_active = jiffies;
+
+	while(!kthread_should_stop())
+	{
+		if(dpi_cdev_submit(ctx, ctx->params.sq_entries))
+		{
+			last_active = jiffies;
+			cond_resched();
+			continue;
+		}
+
+		if(time_before(jiffies, last_active + idle))
+		{
+			cond_resched();
+			continue;
+		}
+
+		// Idle: ask userspace to wake us with DPI_ENTER_SQ_WAKEUP
+		ctx->sq_ctrl->flags |= DPI_SQ_NEED_WAKEUP;
+		smp_mb();
+
+		wait_event_interruptible(ctx->sq_wait,
+					dpi_cdev_sq_pending(ctx) || kthread_should_stop());
+
+		ctx->sq_ctrl->flags &= ~DPI_SQ_NEED_WAKEUP;
+		last_active = jiffies;
+	}
+
+	return 0;
+}
+
+
+/** Function that frees a shared region allocated for the context */
+static void dpi_cdev_free_region(struct dpi_cdev_ctx *ctx, void *region)
+{
+	if(!region)
+	{
+		return;
+	}
+
+	if(ctx->dma_dev)
+	{
+		dma_free_coherent(ctx->dma_dev, ctx->region_alloc, region, ctx->region_phys);
+	}
+	else
+	{
+		vfree(region);
+	}
+}
+
+
+/**
+ *	Function that validates ring parameters and allocates the shared region.
+ *	ENTER, mmap and poll do not take the lock, so the region is published
+ *	last, after everything they read from the context.
+ */
+static int dpi_cdev_setup(struct dpi_cdev_ctx *ctx, struct dpi_ring_params *p)
+{
+	size_t sq_size, cq_size, buf_size, region_size;
+	struct task_struct *thread;
+	void *region;
+
+	if(!p->sq_entries || p->sq_entries > DPI_RING_MAX_ENTRIES ||
+		p->cq_entries > DPI_RING_MAX_ENTRIES ||
+		!p->buf_count || !p->buf_size || p->buf_size > DPI_RING_MAX_BUF_SIZE ||
+		(p->flags & ~DPI_SETUP_SQPOLL))
+	{
+		return -EINVAL;
+	}
+
+	// Compute layout: SQ and CQ on their own cache lines, buffers page aligned
+	p->sq_entries = roundup_pow_of_two(p->sq_entries);
+	p->cq_entries = roundup_pow_of_two(p->cq_entries ? p->cq_entries : 2 * p->sq_entries);
+	p->buf_size = ALIGN(p->buf_size, L1_CACHE_BYTES);
+
+	// buf_count x buf_size must not wrap on 32-bit size_t
+	if(p->buf_count > DPI_RING_MAX_REGION / p->buf_size)
+	{
+		return -ENOMEM;
+	}
+
+	sq_size = sizeof(struct dpi_ring_ctrl) + p->sq_entries * sizeof(struct dpi_sqe);
+	cq_size = sizeof(struct dpi_ring_ctrl) + p->cq_entries * sizeof(struct dpi_cqe);
+	buf_size = (size_t) p->buf_count * p->buf_size;
+
+	p->sq_off = 0;
+	p->cq_off = ALIGN(sq_size, L1_CACHE_BYTES);
+	p->buf_off = PAGE_ALIGN(p->cq_off + cq_size);
+
+	// Open-coded overflow check of buf_off + buf_size
+	if(p->buf_off > DPI_RING_MAX_REGION || buf_size > DPI_RING_MAX_REGION - p->buf_off)
+	{
+		return -ENOMEM;
+	}
+	region_size = p->buf_off + buf_size;
+	p->region_size = region_size;
+
+	if(!p->sq_idle_ms)
+	{
+		p->sq_idle_ms = DPI_CDEV_SQ_IDLE_MS;
+	}
+
+	// Region is coherent so the accelerator can read the buffers in place.
+	// The emulated backend reads them through the kernel mapping only.
+	ctx->dma_dev = dpi_get_dma_device();
+	if(!ctx->dma_dev && !dpi_accel_emulated())
+	{
+		return -ENODEV;
+	}
+
+	ctx->region_alloc = PAGE_ALIGN(region_size);
+	if(ctx->dma_dev)
+	{
+		region = dma_zalloc_coherent(ctx->dma_dev, ctx->region_alloc, &ctx->region_phys, GFP_KERNEL);
+	}
+	else
+	{
+		region = vmalloc_user(ctx->region_alloc);
+		ctx->region_phys = 0;
+	}
+
+	if(!region)
+	{
+		return -ENOMEM;
+	}
+
+	ctx->params = *p;
+	ctx->sq_ctrl = region + p->sq_off;
+	ctx->sqes = (struct dpi_sqe *) (ctx->sq_ctrl + 1);
+	ctx->cq_ctrl = region + p->cq_off;
+	ctx->cqes = (struct dpi_cqe *) (ctx->cq_ctrl + 1);
+
+	ctx->sq_ctrl->entries = p->sq_entries;
+	ctx->sq_ctrl->mask = p->sq_entries - 1;
+	ctx->cq_ctrl->entries = p->cq_entries;
+	ctx->cq_ctrl->mask = p->cq_entries - 1;
+
+	if(p->flags & DPI_SETUP_SQPOLL)
+	{
+		// Started once the region is published, the thread submits from it
+		thread = kthread_create(dpi_cdev_sq_thread, ctx, "dpi_sqpoll");
+		if(IS_ERR(thread))
+		{
+			dpi_cdev_free_region(ctx, region);
+			return PTR_ERR(thread);
+		}
+		ctx->sq_thread = thread;
+	}
+
+	// Pairs with smp_load_acquire() of the lockless readers
+	smp_store_release(&ctx->region, region);
+
+	if(ctx->sq_thread)
+	{
+		wake_up_process(ctx->sq_thread);
+	}
+
+	return 0;
+}
+
+
+/** Function that submits pending entries and optionally waits for completions */
+static int dpi_cdev_enter(struct dpi_cdev_ctx *ctx, struct dpi_enter *e)
+{
+	u32 wanted;
+
+	if(!smp_load_acquire(&ctx->region))
+	{
+		return -EINVAL;
+	}
+
+	e->submitted = 0;
+
+	if(ctx->sq_thread)
+	{
+		// Poll thread owns the SQ; only wake it up
+		if(e->flags & DPI_ENTER_SQ_WAKEUP)
+		{
+			wake_up_interruptible(&ctx->sq_wait);
+		}
+	}
+	else
+	{
+		mutex_lock(&ctx->lock);
+		e->submitted = dpi_cdev_submit(ctx, e->to_submit);
+		mutex_unlock(&ctx->lock);
+	}
+
+	// Completions only arrive asynchronously when a poll thread submits
+	if((e->flags & DPI_ENTER_GETEVENTS) && ctx->sq_thread)
+	{
+		wanted = min(e->min_complete, ctx->params.cq_entries);
+		return wait_event_interruptible(ctx->cq_wait, dpi_cdev_cq_ready(ctx) >= wanted);
+	}
+
+	return 0;
+}
+
+
+static long dpi_cdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct dpi_cdev_ctx *ctx = filp->private_data;
+	void __user *uarg = (void __user *) arg;
+	struct dpi_ring_params params;
+	struct dpi_enter enter;
+	struct dpi_image_blob blob;
+	struct dpi_firmware_name fw_name;
+	struct dpi_profile_query query;
+	long retval;
+
+	switch(cmd)
+	{
+		case DPI_IOC_SETUP:
+			if(copy_from_user(&params, uarg, sizeof(params)))
+				return -EFAULT;
+
+			mutex_lock(&ctx->lock);
+			retval = ctx->region ? -EBUSY : dpi_cdev_setup(ctx, &params);
+			mutex_unlock(&ctx->lock);
+
+			if(!retval && copy_to_user(uarg, &params, sizeof(params)))
+				retval = -EFAULT;
+			return retval;
+
+		case DPI_IOC_ENTER:
+			if(copy_from_user(&enter, uarg, sizeof(enter)))
+				return -EFAULT;
+
+			retval = dpi_cdev_enter(ctx, &enter);
+
+			if(copy_to_user(uarg, &enter, sizeof(enter)))
+				retval = -EFAULT;
+			return retval;
+
+		case DPI_IOC_LOAD_IMAGE:
+			if(!capable(CAP_NET_ADMIN))
+				return -EPERM;
+			if(copy_from_user(&blob, uarg, sizeof(blob)))
+				return -EFAULT;
+
+			return dpi_ruleset_load((const void __user *) (unsigned long) blob.data, blob.size);
+
+		case DPI_IOC_LOAD_FIRMWARE:
+			if(!capable(CAP_NET_ADMIN))
+				return -EPERM;
+			if(copy_from_user(&fw_name, uarg, sizeof(fw_name)))
+				return -EFAULT;
+
+			fw_name.name[DPI_FIRMWARE_NAME_MAX - 1] = '\0';
+			return dpi_ruleset_load_firmware(fw_name.name, dpi_cdev_device());
+
+		case DPI_IOC_GET_PROFILE:
+			if(!capable(CAP_NET_ADMIN))
+				return -EPERM;
+			if(copy_from_user(&query, uarg, sizeof(query)))
+				return -EFAULT;
+
+			retval = dpi_ruleset_get_profile(&query, (u32 __user *) (unsigned long) query.data);
+
+			if(!retval && copy_to_user(uarg, &query, sizeof(query)))
+				retval = -EFAULT;
+			return retval;
+
+		default:
+			return -ENOTTY;
+	}
+}
+
+
+static int dpi_cdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct dpi_cdev_ctx *ctx = filp->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if(!smp_load_acquire(&ctx->region) || vma->vm_pgoff || size > ctx->region_alloc)
+	{
+		return -EINVAL;
+	}
+
+	if(!ctx->dma_dev)
+	{
+		return remap_vmalloc_range(vma, ctx->region, 0);
+	}
+
+	return dma_mmap_coherent(ctx->dma_dev, vma, ctx->region, ctx->region_phys, size);
+}
+
+
+static unsigned int dpi_cdev_poll(struct file *filp, poll_table *wait)
+{
+	struct dpi_cdev_ctx *ctx = filp->private_data;
+
+	poll_wait(filp, &ctx->cq_wait, wait);
+
+	if(smp_load_acquire(&ctx->region) && dpi_cdev_cq_ready(ctx))
+	{
+		return POLLIN | POLLRDNORM;
+	}
+
+	return 0;
+}
+
+
+static int dpi_cdev_open(struct inode *inode, struct file *filp)
+{
+	struct dpi_cdev_ctx *ctx;
+
+	// Rings need a probed accelerator or the emulated backend (checked at DPI_IOC_SETUP),
+	// rule images do not
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if(!ctx)
+	{
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->lock);
+	init_waitqueue_head(&ctx->cq_wait);
+	init_waitqueue_head(&ctx->sq_wait);
+
+	filp->private_data = ctx;
+	return 0;
+}
+
+
+static int dpi_cdev_release(struct inode *inode, struct file *filp)
+{
+	struct dpi_cdev_ctx *ctx = filp->private_data;
+
+	if(ctx->sq_thread)
+	{
+		kthread_stop(ctx->sq_thread);
+	}
+
+	dpi_cdev_free_region(ctx, ctx->region);
+
+	kfree(ctx);
+	return 0;
+}
+
+
+/** File operations of /dev/dpi */
+static const struct file_operations Dpi_Cdev_Fops =
+{
+	.owner			= THIS_MODULE,
+	.open			= dpi_cdev_open,
+	.release		= dpi_cdev_release,
+	.unlocked_ioctl	= dpi_cdev_ioctl,
+	.mmap			= dpi_cdev_mmap,
+	.poll			= dpi_cdev_poll,
+	.llseek			= noop_llseek,
+};
+
+
+/** Misc device entry for /dev/dpi */
+static struct miscdevice Dpi_Cdev =
+{
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= DPI_DEVICE_NAME,
+	.fops		= &Dpi_Cdev_Fops,
+};
+
+
+int dpi_cdev_init(void)
+{
+	int retval;
+
+	retval = misc_register(&Dpi_Cdev);
+	if(retval)
+	{
+		return retval;
+	}
+
+	printk(KERN_NOTICE "The DPI character device is registered as /dev/%s\n", DPI_DEVICE_NAME);
+	return 0;
+}
+
+
+struct device *dpi_cdev_device(void)
+{
+	return Dpi_Cdev.this_device;
+}
+
+
+void dpi_cdev_exit(void)
+{
+	misc_deregister(&Dpi_Cdev);
+}
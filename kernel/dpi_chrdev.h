@@ -0,0 +1,75 @@
+#ifndef _DPI_CHRDEV_H
+#define _DPI_CHRDEV_H
+
+/**
+ * Character Device for DPI (Deep Packet Inspection) Hardware Accelerator
+ * Exposes mmap'd submission/completion rings on /dev/dpi
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include "dpi_user.h"
+
+/** Buffers queued at once before waiting for their results (at most DPI_SQ_DEPTH) */
+#define DPI_CDEV_BUDGET					16
+
+/** Default idle time before the SQ poll thread sleeps */
+#define DPI_CDEV_SQ_IDLE_MS				10
+
+/** Per-open ring context */
+struct dpi_cdev_ctx
+{
+	// Serializes setup and syscall-driven submission
+	struct mutex lock;
+
+	// Ring layout as returned to userspace
+	struct dpi_ring_params params;
+
+	// Shared DMA-able region (rings + data buffers); set last by setup,
+	// read with smp_load_acquire() where the lock is not held
+	struct device *dma_dev;
+	void *region;
+	dma_addr_t region_phys;
+	size_t region_alloc;
+
+	// Pointers into the region
+	struct dpi_ring_ctrl *sq_ctrl;
+	struct dpi_ring_ctrl *cq_ctrl;
+	struct dpi_sqe *sqes;
+	struct dpi_cqe *cqes;
+
+	// Kernel-owned indices (userspace copies are never trusted)
+	u32 sq_head;
+	u32 cq_tail;
+
+	// Completion waiters and SQ poll thread
+	wait_queue_head_t cq_wait;
+	wait_queue_head_t sq_wait;
+	struct task_struct *sq_thread;
+};
+
+/** The function that registers /dev/dpi */
+int dpi_cdev_init(void);
+
+/** The function that returns the device of /dev/dpi */
+struct device *dpi_cdev_device(void);
+
+/** The function that deregisters /dev/dpi */
+void dpi_cdev_exit(void);
+
+#endif
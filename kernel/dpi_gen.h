@@ -0,0 +1,47 @@
+#ifndef _DPI_GEN_H
+#define _DPI_GEN_H
+
+/**
+ * Generated Software Matcher for DPI (Deep Packet Inspection) Hardware Accelerator
+ * Interface of the C code written by "dpi_compile --emit-c". The code walks
+ * the automaton of one rule image with a label per state and constant
+ * switch tables instead of loading transitions from the image. It is built
+ * into the kernel module (dpi_gen.c, DPI_HAVE_GEN) and into dpi_bench.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+
+/**
+ *	Runs the regex tails of a start list on the bytes after a head match.
+ *	Returns index of the matched pattern plus one, 0 if no tail matches.
+ */
+typedef __u32 (*dpi_gen_confirm_t)(const void *, __u32, const __u8 *, unsigned int);
+
+/** Checksum (header crc32) of the rule image the code is generated from */
+extern const __u32 dpi_gen_image_crc;
+
+/** Number of states of the automaton */
+extern const __u32 dpi_gen_num_states;
+
+/**
+ *	This function scans a buffer with the generated automaton. Confirm
+ *	finals call the given function with the given context.
+ *		returns 0 if no pattern matches
+ *		returns index of the matched pattern plus one otherwise
+ */
+__u32 dpi_gen_match(const __u8 *, unsigned int, dpi_gen_confirm_t, const void *);
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ * Per-CPU Submission Queues for DPI (Deep Packet Inspection) Hardware Accelerator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/cpumask.h>
+#include "dpi_queue.h"
+
+
+/** Rings of one CPU, one per class */
+struct dpi_cpu_queues
+{
+	struct dpi_submit_queue sq[DPI_SQ_CLASSES];
+};
+
+static DEFINE_PER_CPU_ALIGNED(struct dpi_cpu_queues, Dpi_Queues);
+
+/** CPU the dispatcher looks at first (under the device lock) */
+static int Dpi_Queue_Cursor;
+
+
+struct dpi_request *dpi_queue_submit(unsigned int class, dma_addr_t phys, void *virt,
+									unsigned int len, bool map)
+{
+	struct dpi_submit_queue *sq = &this_cpu_ptr(&Dpi_Queues)->sq[class];
+	struct dpi_request *req;
+
+	// Take back slots whose waiters have read the result
+	while(sq->reap != sq->head && ACCESS_ONCE(sq->reqs[sq->reap & DPI_SQ_MASK].state) == DPI_REQ_FREE)
+	{
+		sq->reap++;
+	}
+
+	if(sq->head - sq->reap >= DPI_SQ_DEPTH)
+	{
+		sq->full++;
+		return NULL;
+	}
+
+	req = &sq->reqs[sq->head & DPI_SQ_MASK];
+	req->phys = phys;
+	req->virt = virt;
+	req->len = len;
+	req->map = map;
+	req->result = -1;
+	req->state = DPI_REQ_QUEUED;
+
+	// Publish the request before the new head
+	smp_wmb();
+	ACCESS_ONCE(sq->head) = sq->head + 1;
+	sq->submitted++;
+
+	return req;
+}
+
+
+struct dpi_request *dpi_queue_submit_local(unsigned int class, void *virt, unsigned int len)
+{
+	struct dpi_submit_queue *sq = &this_cpu_ptr(&Dpi_Queues)->sq[class];
+	struct dpi_request *req;
+
+	req = dpi_queue_submit(class, 0, virt, len, false);
+	if(req)
+	{
+		ACCESS_ONCE(sq->tail) = sq->head;
+	}
+
+	return req;
+}
+
+
+struct dpi_request *dpi_queue_next(void)
+{
+	struct dpi_submit_queue *sq;
+	struct dpi_request *req;
+	int cpu = Dpi_Queue_Cursor, n;
+	unsigned int class;
+
+	// Start after the CPU served last, so that no CPU can starve the others
+	for(n = 0; n < nr_cpu_ids; n++)
+	{
+		cpu = cpumask_next(cpu, cpu_possible_mask);
+		if(cpu >= nr_cpu_ids)
+		{
+			cpu = cpumask_first(cpu_possible_mask);
+		}
+
+		sq = per_cpu(Dpi_Queues, cpu).sq;
+		for(class = 0; class < DPI_SQ_CLASSES; class++, sq++)
+		{
+			if(sq->tail == ACCESS_ONCE(sq->head))
+			{
+				continue;
+			}
+
+			// Read the request only after seeing the head that published it
+			smp_rmb();
+			req = &sq->reqs[sq->tail & DPI_SQ_MASK];
+			sq->tail++;
+
+			Dpi_Queue_Cursor = cpu;
+			return req;
+		}
+	}
+
+	return NULL;
+}
+
+
+bool dpi_queue_pending(void)
+{
+	struct dpi_submit_queue *sq;
+	unsigned int class;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		sq = per_cpu(Dpi_Queues, cpu).sq;
+		for(class = 0; class < DPI_SQ_CLASSES; class++)
+		{
+			if(ACCESS_ONCE(sq[class].tail) != ACCESS_ONCE(sq[class].head))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+void dpi_queue_complete(struct dpi_request *req, int result)
+{
+	req->result = result;
+
+	// The waiter reads the result after it sees the state
+	smp_wmb();
+	ACCESS_ONCE(req->state) = DPI_REQ_DONE;
+}
+
+
+void dpi_queue_release(struct dpi_request *req)
+{
+	// The submitting CPU reaps the slot at its next submission
+	smp_mb();
+	ACCESS_ONCE(req->state) = DPI_REQ_FREE;
+}
+
+
+void dpi_queue_get_stats(struct dpi_queue_stats *stats)
+{
+	struct dpi_submit_queue *sq;
+	unsigned int class;
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for_each_possible_cpu(cpu)
+	{
+		sq = per_cpu(Dpi_Queues, cpu).sq;
+		for(class = 0; class < DPI_SQ_CLASSES; class++)
+		{
+			stats->submitted[class] += sq[class].submitted;
+			stats->full[class] += sq[class].full;
+			stats->backlog += ACCESS_ONCE(sq[class].head) - ACCESS_ONCE(sq[class].tail);
+		}
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef _DPI_QUEUE_H
+#define _DPI_QUEUE_H
+
+/**
+ * Per-CPU Submission Queues for DPI (Deep Packet Inspection) Hardware Accelerator
+ *
+ * Every CPU owns one single-producer ring per submission class. Requests
+ * are written into the ring of the submitting CPU without any shared lock;
+ * the dispatcher (the accelerator interrupt, or the submitter that finds
+ * the device idle) takes them out in round-robin order and writes the
+ * result back into the same slot, so a completion only touches the cache
+ * lines of the CPU that waits for it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/cache.h>
+#include <linux/ktime.h>
+#include <linux/dma-mapping.h>
+
+/** Slots per CPU and class (power of two) */
+#define DPI_SQ_DEPTH					16
+#define DPI_SQ_MASK						(DPI_SQ_DEPTH - 1)
+
+/** Submission classes; each has its own producer context on a CPU */
+#define DPI_SQ_NET						0		// Netfilter (bottom halves disabled)
+#define DPI_SQ_USER						1		// /dev/dpi (preemption disabled)
+#define DPI_SQ_CLASSES					2
+
+/** Request states */
+#define DPI_REQ_FREE					0		// Slot can be reused by its CPU
+#define DPI_REQ_QUEUED					1		// Waiting for the dispatcher
+#define DPI_REQ_INFLIGHT				2		// On the accelerator
+#define DPI_REQ_DONE					3		// Result is valid
+
+/** One filter request */
+struct dpi_request
+{
+	// Written by the submitter
+	dma_addr_t phys;
+	void *virt;
+	unsigned int len;
+	bool map;				// phys is mapped from virt at dispatch and unmapped on completion
+
+	// Written by the dispatcher
+	ktime_t dispatched;
+	int result;
+	unsigned int state;
+};
+
+/** Ring of one class on one CPU */
+struct dpi_submit_queue
+{
+	// Written by the submitting CPU only
+	u32 head;
+	u32 reap;
+	u64 submitted;
+	u64 full;
+
+	// Written by the dispatcher only (under the device lock), or by the
+	// submitting CPU when nobody dispatches (see dpi_queue_submit_local())
+	u32 tail ____cacheline_aligned;
+
+	struct dpi_request reqs[DPI_SQ_DEPTH] ____cacheline_aligned;
+};
+
+/** Queue counters summed over all CPUs */
+struct dpi_queue_stats
+{
+	u64 submitted[DPI_SQ_CLASSES];
+	u64 full[DPI_SQ_CLASSES];
+	u32 backlog;
+};
+
+/**
+ *	This function puts a request into the ring of the current CPU.
+ *	Callers of a class must not be able to interrupt each other on a CPU
+ *	(DPI_SQ_NET: bottom halves disabled, DPI_SQ_USER: preemption disabled).
+ *		returns the request, NULL if the ring is full
+ */
+struct dpi_request *dpi_queue_submit(unsigned int, dma_addr_t, void *, unsigned int, bool);
+
+/**
+ *	This function puts a request into the ring of the current CPU and takes
+ *	it out again at once, for a backend that completes it on the submitting
+ *	CPU without a dispatcher. Same caller rules as dpi_queue_submit().
+ *		returns the request, NULL if the ring is full
+ */
+struct dpi_request *dpi_queue_submit_local(unsigned int, void *, unsigned int);
+
+/**
+ *	This function takes the next queued request in round-robin order over
+ *	CPUs. Caller must hold the device lock.
+ *		returns NULL if every ring is empty
+ */
+struct dpi_request *dpi_queue_next(void);
+
+/** The function that returns true if some ring has a queued request (no lock needed) */
+bool dpi_queue_pending(void);
+
+/** The function that publishes the result of a request to its waiter */
+void dpi_queue_complete(struct dpi_request *, int);
+
+/** The function that gives a completed request back to its ring */
+void dpi_queue_release(struct dpi_request *);
+
+/** The function that sums queue counters of all CPUs */
+void dpi_queue_get_stats(struct dpi_queue_stats *);
+
+#endif
@@ -0,0 +1,828 @@
+/**
+ * Compiled Rule Set for DPI (Deep Packet Inspection) Hardware Accelerator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/swab.h>
+#include <linux/bitops.h>
+#include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <asm/uaccess.h>
+#include "dpi_ruleset.h"
+#ifdef DPI_HAVE_GEN
+#include "dpi_gen.h"
+#endif
+
+
+/** Image loaded at module load and by DPI_IOC_LOAD_FIRMWARE without a name */
+static char *image = DPI_FIRMWARE_DEFAULT;
+module_param(image, charp, 0444);
+MODULE_PARM_DESC(image, "Rule image loaded from the firmware path at module load (empty string disables)");
+
+/** Count software matcher visits per state in rule sets loaded from now on */
+static bool profile;
+module_param(profile, bool, 0644);
+MODULE_PARM_DESC(profile, "Count visits of every software matcher state in images loaded afterwards (read with dpi_ctl profile)");
+
+#ifdef DPI_HAVE_GEN
+/** Use the generated matcher for rule sets loaded from now on; it is slower than the table for large automata */
+static bool gen;
+module_param(gen, bool, 0644);
+MODULE_PARM_DESC(gen, "Use the generated matcher for images loaded afterwards that it was generated from (measure with dpi_bench first)");
+#endif
+
+/** Active rule set, replaced under Dpi_Ruleset_Lock and read under RCU */
+static struct dpi_ruleset __rcu *Dpi_Ruleset;
+static DEFINE_MUTEX(Dpi_Ruleset_Lock);
+static u32 Dpi_Ruleset_Generation;
+
+
+/** Function that releases a rule set that no reader can see anymore */
+static void dpi_ruleset_free(struct dpi_ruleset *rs)
+{
+	if(!rs)
+	{
+		return;
+	}
+
+	vfree(rs->visits);
+	if(rs->fw)
+	{
+		release_firmware(rs->fw);
+	}
+	else
+	{
+		vfree(rs->image);
+	}
+	kfree(rs);
+}
+
+
+/** Function that returns a section of an image, NULL if it is missing */
+static const void *dpi_ruleset_section(const struct dpi_ruleset *rs, u32 type, u32 *size)
+{
+	const struct dpi_image_header *hdr = rs->image;
+	const struct dpi_image_section *sec = (const struct dpi_image_section *) (hdr + 1);
+	unsigned int i;
+
+	for(i = 0; i < hdr->num_sections; i++)
+	{
+		if(sec[i].type == type)
+		{
+			*size = sec[i].size;
+			return rs->image + sec[i].offset;
+		}
+	}
+
+	return NULL;
+}
+
+
+/** Function that validates the image layout and binds known sections in place */
+static int dpi_ruleset_parse(struct dpi_ruleset *rs)
+{
+	const struct dpi_image_header *hdr = rs->image;
+	const struct dpi_image_section *sec;
+	const struct dpi_prefilter_table *pf;
+	const struct dpi_bloom_filter *bf;
+	const struct dpi_dfa_table *dfa;
+	const struct dpi_nfa_table *nfa;
+	const struct dpi_hw_table *hw;
+	unsigned int i, b;
+	u32 size;
+
+	if(rs->size < sizeof(*hdr))
+	{
+		return -EINVAL;
+	}
+
+	// Images must be compiled for the byte order of this CPU
+	if(hdr->magic != DPI_IMAGE_MAGIC)
+	{
+		printk(KERN_ERR "dpi: rule image has %s\n", (hdr->magic == swab32(DPI_IMAGE_MAGIC)) ?
+				"wrong byte order" : "bad magic");
+		return -ENOEXEC;
+	}
+
+	if(hdr->version != DPI_IMAGE_VERSION || hdr->image_size != rs->size ||
+		hdr->num_sections > DPI_IMAGE_MAX_SECTIONS ||
+		sizeof(*hdr) + hdr->num_sections * sizeof(*sec) > rs->size)
+	{
+		printk(KERN_ERR "dpi: rule image header is invalid\n");
+		return -EINVAL;
+	}
+
+	// Catches truncated or corrupted files before any table is trusted
+	if((crc32_le(~0, rs->image + sizeof(*hdr), rs->size - sizeof(*hdr)) ^ ~0) != hdr->crc32)
+	{
+		printk(KERN_ERR "dpi: rule image checksum mismatch\n");
+		return -EBADMSG;
+	}
+
+	// Every section must be aligned and inside the image
+	sec = (const struct dpi_image_section *) (hdr + 1);
+	for(i = 0; i < hdr->num_sections; i++)
+	{
+		if((sec[i].offset % DPI_IMAGE_ALIGN) || sec[i].offset > rs->size ||
+			sec[i].size > rs->size - sec[i].offset)
+		{
+			printk(KERN_ERR "dpi: rule image section %u is out of bounds\n", i);
+			return -EINVAL;
+		}
+	}
+
+	// Prefilter
+	pf = dpi_ruleset_section(rs, DPI_SECTION_PREFILTER, &size);
+	if(pf)
+	{
+		if(size != sizeof(*pf) || !pf->width || pf->width > DPI_PREFILTER_MAX_WIDTH)
+		{
+			printk(KERN_ERR "dpi: rule image prefilter is invalid\n");
+			return -EINVAL;
+		}
+
+		// Combine both nibble masks of the first byte into one lookup
+		for(b = 0; b < 256; b++)
+		{
+			rs->prefilter_first[b] = pf->lo[0][b & 0xf] & pf->hi[0][b >> 4];
+		}
+		rs->prefilter = pf;
+	}
+
+	// Bloom filter
+	bf = dpi_ruleset_section(rs, DPI_SECTION_BLOOM, &size);
+	if(bf)
+	{
+		if(size < sizeof(*bf) || !bf->q || bf->q > DPI_BLOOM_MAX_Q ||
+			bf->bits_log2 < DPI_BLOOM_MIN_BITS_LOG2 || bf->bits_log2 > DPI_BLOOM_MAX_BITS_LOG2 ||
+			size != sizeof(*bf) + (1 << bf->bits_log2) / 8)
+		{
+			printk(KERN_ERR "dpi: rule image bloom filter is invalid\n");
+			return -EINVAL;
+		}
+
+		rs->bloom_out_factor = 1;
+		for(i = 1; i < bf->q; i++)
+		{
+			rs->bloom_out_factor *= DPI_BLOOM_BASE;
+		}
+		rs->bloom = bf;
+	}
+
+	// Software matcher; every transition must stay inside the table
+	dfa = dpi_ruleset_section(rs, DPI_SECTION_DFA, &size);
+	if(dfa)
+	{
+		if(size < sizeof(*dfa) || !dfa->num_states || dfa->num_states > DPI_DFA_MAX_STATES ||
+			size != sizeof(*dfa) + dfa->num_states * (256 * sizeof(u16) + sizeof(u32)))
+		{
+			printk(KERN_ERR "dpi: rule image software matcher is invalid\n");
+			return -EINVAL;
+		}
+
+		for(i = 0; i < dfa->num_states * 256; i++)
+		{
+			if(dfa->next[i] >= dfa->num_states)
+			{
+				printk(KERN_ERR "dpi: rule image software matcher has a bad transition\n");
+				return -EINVAL;
+			}
+		}
+
+		rs->dfa_final = (const u32 *) (dfa->next + dfa->num_states * 256);
+		rs->dfa = dfa;
+	}
+
+	// Regex tails
+	nfa = dpi_ruleset_section(rs, DPI_SECTION_NFA, &size);
+	if(nfa)
+	{
+		if(size < sizeof(*nfa) || !nfa->num_states || nfa->num_states > DPI_NFA_MAX_STATES ||
+			!nfa->num_lists || nfa->num_lists > DPI_DFA_MAX_STATES ||
+			nfa->words != (nfa->num_states + 31) / 32 ||
+			size != sizeof(*nfa) + nfa->num_states * (32 + sizeof(u32) + nfa->words * sizeof(u32)) +
+					nfa->num_lists * nfa->words * sizeof(u32))
+		{
+			printk(KERN_ERR "dpi: rule image regex tails are invalid\n");
+			return -EINVAL;
+		}
+
+		rs->nfa_cls = (const u8 (*)[32]) (nfa + 1);
+		rs->nfa_accept = (const u32 *) (rs->nfa_cls + nfa->num_states);
+		rs->nfa_follow = rs->nfa_accept + nfa->num_states;
+		rs->nfa_start = rs->nfa_follow + nfa->num_states * nfa->words;
+
+		// Bitmaps must not name positions past the table
+		if(nfa->num_states % 32)
+		{
+			for(i = 0; i < nfa->num_states + nfa->num_lists; i++)
+			{
+				if(rs->nfa_follow[(i + 1) * nfa->words - 1] & ~((1u << (nfa->num_states % 32)) - 1))
+				{
+					printk(KERN_ERR "dpi: rule image regex tails have a bad position\n");
+					return -EINVAL;
+				}
+			}
+		}
+		rs->nfa = nfa;
+	}
+
+	// Signature ids
+	rs->pattern_ids = dpi_ruleset_section(rs, DPI_SECTION_PATTERN_IDS, &size);
+	if(rs->pattern_ids)
+	{
+		if(size % sizeof(u32))
+		{
+			printk(KERN_ERR "dpi: rule image pattern ids are invalid\n");
+			return -EINVAL;
+		}
+		rs->num_patterns = size / sizeof(u32);
+	}
+
+	// Accelerator table registers
+	hw = dpi_ruleset_section(rs, DPI_SECTION_HW_TABLE, &size);
+	if(hw)
+	{
+		if(size != sizeof(*hw) || !hw->num_states || hw->num_states > DPI_DFA_MAX_STATES ||
+			hw->num_finals > hw->num_states || (rs->dfa && hw->num_states != rs->dfa->num_states))
+		{
+			printk(KERN_ERR "dpi: rule image accelerator table is invalid\n");
+			return -EINVAL;
+		}
+		rs->hw = hw;
+	}
+
+	// Every confirm final must select an existing start list
+	if(rs->dfa)
+	{
+		for(i = 0; i < rs->dfa->num_states; i++)
+		{
+			if((rs->dfa_final[i] & DPI_DFA_FINAL_CONFIRM) &&
+				(!rs->nfa || (rs->dfa_final[i] & ~DPI_DFA_FINAL_CONFIRM) >= rs->nfa->num_lists))
+			{
+				printk(KERN_ERR "dpi: rule image software matcher has a bad confirm list\n");
+				return -EINVAL;
+			}
+		}
+	}
+
+	// Counters are best effort: a failed allocation only disables profiling
+	if(profile && rs->dfa)
+	{
+		rs->visits = vzalloc(rs->dfa->num_states * sizeof(u32));
+		if(!rs->visits)
+		{
+			printk(KERN_WARNING "dpi: no memory for the visit profile\n");
+		}
+	}
+
+#ifdef DPI_HAVE_GEN
+	// Code generated from another image walks another automaton
+	rs->gen = gen && rs->dfa && hdr->crc32 == dpi_gen_image_crc && rs->dfa->num_states == dpi_gen_num_states;
+#endif
+
+	return 0;
+}
+
+
+/** Function that makes a parsed rule set (or none) active and releases the old one */
+static void dpi_ruleset_publish(struct dpi_ruleset *rs)
+{
+	struct dpi_ruleset *old;
+
+	// Publish the new rule set and wait for readers of the old one
+	mutex_lock(&Dpi_Ruleset_Lock);
+	if(rs)
+	{
+		rs->generation = ++Dpi_Ruleset_Generation;
+	}
+	old = rcu_dereference_protected(Dpi_Ruleset, lockdep_is_held(&Dpi_Ruleset_Lock));
+	rcu_assign_pointer(Dpi_Ruleset, rs);
+	mutex_unlock(&Dpi_Ruleset_Lock);
+
+	synchronize_rcu();
+	dpi_ruleset_free(old);
+
+	if(rs)
+	{
+		printk(KERN_NOTICE "dpi: rule image loaded (%zu bytes, generation %u, prefilter width %u, "
+			"bloom q %u, %u software states%s, %u regex tail positions, %u pattern ids)\n",
+			rs->size, rs->generation, rs->prefilter ? rs->prefilter->width : 0,
+			rs->bloom ? rs->bloom->q : 0, rs->dfa ? rs->dfa->num_states : 0,
+			rs->gen ? " (generated code)" : "", rs->nfa ? rs->nfa->num_states : 0, rs->num_patterns);
+	}
+	else
+	{
+		printk(KERN_NOTICE "dpi: rule image unloaded\n");
+	}
+}
+
+
+int dpi_ruleset_load(const void __user *data, size_t size)
+{
+	struct dpi_ruleset *rs = NULL;
+	int retval;
+
+	if(size > DPI_IMAGE_MAX_SIZE)
+	{
+		return -E2BIG;
+	}
+
+	if(size)
+	{
+		rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+		if(!rs)
+		{
+			return -ENOMEM;
+		}
+
+		rs->size = size;
+		rs->image = vmalloc(size);
+		if(!rs->image)
+		{
+			kfree(rs);
+			return -ENOMEM;
+		}
+
+		if(copy_from_user(rs->image, data, size))
+		{
+			retval = -EFAULT;
+			goto error;
+		}
+
+		retval = dpi_ruleset_parse(rs);
+		if(retval)
+		{
+			goto error;
+		}
+	}
+
+	dpi_ruleset_publish(rs);
+	return 0;
+
+error:
+	dpi_ruleset_free(rs);
+	return retval;
+}
+
+
+int dpi_ruleset_load_firmware(const char *name, struct device *dev)
+{
+	const struct firmware *fw;
+	struct dpi_ruleset *rs;
+	ktime_t start = ktime_get();
+	int retval;
+
+	if(!name || !*name)
+	{
+		name = image;
+	}
+
+	if(!*name)
+	{
+		return -ENOENT;
+	}
+
+	// Look in the firmware path only; a missing image must not stall
+	// module load waiting for a usermode helper
+	retval = request_firmware_direct(&fw, name, dev);
+	if(retval)
+	{
+		return retval;
+	}
+
+	if(fw->size > DPI_IMAGE_MAX_SIZE)
+	{
+		release_firmware(fw);
+		return -E2BIG;
+	}
+
+	rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+	if(!rs)
+	{
+		release_firmware(fw);
+		return -ENOMEM;
+	}
+
+	// Tables are used in place, the firmware buffer is kept until unload
+	rs->fw = fw;
+	rs->image = (void *) fw->data;
+	rs->size = fw->size;
+
+	retval = dpi_ruleset_parse(rs);
+	if(retval)
+	{
+		printk(KERN_ERR "dpi: rule image %s is rejected\n", name);
+		dpi_ruleset_free(rs);
+		return retval;
+	}
+
+	dpi_ruleset_publish(rs);
+	printk(KERN_NOTICE "dpi: rule image %s is ready in %lld us\n", name,
+		(long long) ktime_us_delta(ktime_get(), start));
+
+	return 0;
+}
+
+
+struct dpi_ruleset *dpi_ruleset_get(void)
+{
+	return rcu_dereference(Dpi_Ruleset);
+}
+
+
+u32 dpi_ruleset_generation(void)
+{
+	struct dpi_ruleset *rs;
+	u32 generation;
+
+	rcu_read_lock();
+	rs = rcu_dereference(Dpi_Ruleset);
+	generation = rs ? rs->generation : 0;
+	rcu_read_unlock();
+
+	return generation;
+}
+
+
+bool dpi_prefilter_candidate(const struct dpi_ruleset *rs, const u8 *p, unsigned int len)
+{
+	const struct dpi_prefilter_table *pf = rs->prefilter;
+	unsigned int i, width = pf->width;
+	u8 m;
+
+	if(len < width)
+	{
+		return false;
+	}
+
+	// Portable version of the vectorized userspace scan: one table lookup
+	// rejects most positions, remaining bytes are checked only on a hit
+	for(i = 0; i + width <= len; i++)
+	{
+		m = rs->prefilter_first[p[i]];
+		if(likely(!m))
+		{
+			continue;
+		}
+
+		if(width > 1)
+		{
+			m &= pf->lo[1][p[i + 1] & 0xf] & pf->hi[1][p[i + 1] >> 4];
+		}
+		if(width > 2)
+		{
+			m &= pf->lo[2][p[i + 2] & 0xf] & pf->hi[2][p[i + 2] >> 4];
+		}
+
+		if(m)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+bool dpi_bloom_candidate(const struct dpi_ruleset *rs, const u8 *p, unsigned int len)
+{
+	const struct dpi_bloom_filter *bf = rs->bloom;
+	unsigned int i, q = bf->q, shift = bf->bits_log2;
+	u32 hash = 0, bit;
+
+	if(len < q)
+	{
+		return false;
+	}
+
+	for(i = 0; i < q - 1; i++)
+	{
+		hash = hash * DPI_BLOOM_BASE + p[i];
+	}
+
+	// Slide a q-byte window over the payload
+	for(i = q - 1; i < len; i++)
+	{
+		hash = hash * DPI_BLOOM_BASE + p[i];
+
+		bit = dpi_bloom_bit(hash, shift, 0);
+		if(bf->bits[bit >> 3] & (1 << (bit & 7)))
+		{
+			bit = dpi_bloom_bit(hash, shift, 1);
+			if(bf->bits[bit >> 3] & (1 << (bit & 7)))
+			{
+				return true;
+			}
+		}
+
+		hash -= p[i + 1 - q] * rs->bloom_out_factor;
+	}
+
+	return false;
+}
+
+
+/** Function that adds the tail positions of a start list to the active ones */
+static void dpi_nfa_start(const struct dpi_ruleset *rs, u32 list, u32 *active, bool *tails)
+{
+	const u32 *start = rs->nfa_start + list * rs->nfa->words;
+	unsigned int w;
+
+	if(!*tails)
+	{
+		memcpy(active, start, rs->nfa->words * sizeof(u32));
+		*tails = true;
+		return;
+	}
+
+	for(w = 0; w < rs->nfa->words; w++)
+	{
+		active[w] |= start[w];
+	}
+}
+
+
+/**
+ *	Function that feeds one byte to the active tail positions. tails is
+ *	cleared when no position is left. Returns index of the matched pattern
+ *	plus one, 0 if no tail ends at the byte.
+ */
+static u32 dpi_nfa_step(const struct dpi_ruleset *rs, u32 *active, u8 c, bool *tails)
+{
+	u32 next[DPI_NFA_MAX_STATES / 32];
+	unsigned int w, k, pos, words = rs->nfa->words;
+	unsigned long bits;
+	u32 any = 0;
+
+	memset(next, 0, words * sizeof(u32));
+
+	for(w = 0; w < words; w++)
+	{
+		for(bits = active[w]; bits; bits &= bits - 1)
+		{
+			pos = w * 32 + __ffs(bits);
+			if(!(rs->nfa_cls[pos][c >> 3] & (1 << (c & 7))))
+			{
+				continue;
+			}
+
+			if(rs->nfa_accept[pos])
+			{
+				return rs->nfa_accept[pos];
+			}
+
+			for(k = 0; k < words; k++)
+			{
+				next[k] |= rs->nfa_follow[pos * words + k];
+			}
+		}
+	}
+
+	for(w = 0; w < words; w++)
+	{
+		active[w] = next[w];
+		any |= next[w];
+	}
+	*tails = any != 0;
+
+	return 0;
+}
+
+
+#ifdef DPI_HAVE_GEN
+/** Context of the generated matcher: tail bytes it may still confirm */
+struct dpi_gen_ctx
+{
+	const struct dpi_ruleset *rs;
+	unsigned int budget;
+};
+
+/** Value of a confirm that ran out of budget; never a pattern index */
+#define DPI_GEN_OVER_BUDGET				DPI_DFA_FINAL_CONFIRM
+
+/**
+ *	Confirm callback of the generated matcher. It runs the tails of one head
+ *	at a time, which is quadratic on a payload full of heads, so every byte
+ *	a tail takes is charged; the budget is one pass over the payload.
+ */
+static u32 dpi_gen_confirm(const void *data, u32 list, const u8 *p, unsigned int len)
+{
+	struct dpi_gen_ctx *ctx = (struct dpi_gen_ctx *) data;
+	u32 active[DPI_NFA_MAX_STATES / 32], match;
+	unsigned int i;
+	bool tails = false;
+
+	dpi_nfa_start(ctx->rs, list, active, &tails);
+	for(i = 0; i < len && tails; i++)
+	{
+		if(!ctx->budget--)
+		{
+			return DPI_GEN_OVER_BUDGET;
+		}
+
+		match = dpi_nfa_step(ctx->rs, active, p[i], &tails);
+		if(match)
+		{
+			return match;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+
+/**
+ *	Function that walks the software matcher. With a visit array, the state
+ *	that reads each byte is counted; callers pass a constant NULL to get
+ *	the loop without counting. The end of a match is stored into end. A
+ *	stream state is where the walk starts and stops; NULL starts at 0.
+ *
+ *	Regex tails run in the same forward pass: every head that ends adds its
+ *	start list to one set of active tail positions, which takes each later
+ *	byte once. The work per byte is bounded by the tail automaton however
+ *	many heads end in the payload. Tails are followed within one call only.
+ */
+static __always_inline u32 dpi_dfa_walk(const struct dpi_ruleset *rs, const u8 *p, unsigned int len, u32 *visits,
+										unsigned int *end, u32 *stream)
+{
+	const u16 *next = rs->dfa->next;
+	const u32 *final = rs->dfa_final;
+	unsigned int i, state = stream ? *stream : 0;
+	u32 active[DPI_NFA_MAX_STATES / 32];
+	bool tails = false;
+	u32 match = 0;
+
+	for(i = 0; i < len; i++)
+	{
+		if(visits)
+		{
+			visits[state]++;
+		}
+
+		// Tails of heads that ended before this byte
+		if(unlikely(tails))
+		{
+			match = dpi_nfa_step(rs, active, p[i], &tails);
+			if(match)
+			{
+				state = next[state * 256 + p[i]];
+				break;
+			}
+		}
+
+		state = next[state * 256 + p[i]];
+		if(unlikely(final[state]))
+		{
+			match = final[state];
+
+			// End of a regex head; its tails start with the next byte
+			if(!(match & DPI_DFA_FINAL_CONFIRM))
+			{
+				break;
+			}
+
+			dpi_nfa_start(rs, match & ~DPI_DFA_FINAL_CONFIRM, active, &tails);
+			match = 0;
+		}
+	}
+
+	if(match)
+	{
+		*end = i + 1;
+	}
+
+	if(stream)
+	{
+		*stream = state;
+	}
+
+	return match;
+}
+
+
+u32 dpi_dfa_match(const struct dpi_ruleset *rs, const u8 *p, unsigned int len, unsigned int *end)
+{
+	unsigned int dummy;
+#ifdef DPI_HAVE_GEN
+	struct dpi_gen_ctx ctx;
+	u32 match;
+#endif
+
+	if(!end)
+	{
+		end = &dummy;
+	}
+
+	// Counters are not atomic: concurrent CPUs may lose a few increments
+	if(unlikely(rs->visits))
+	{
+		return dpi_dfa_walk(rs, p, len, rs->visits, end, NULL);
+	}
+
+#ifdef DPI_HAVE_GEN
+	if(rs->gen)
+	{
+		// Confirms may walk the payload once in total, then the table walk takes over
+		ctx.rs = rs;
+		ctx.budget = len;
+
+		match = dpi_gen_match(p, len, dpi_gen_confirm, &ctx);
+		if(match != DPI_GEN_OVER_BUDGET)
+		{
+			*end = DPI_OFFSET_UNKNOWN;
+			return match;
+		}
+	}
+#endif
+
+	return dpi_dfa_walk(rs, p, len, NULL, end, NULL);
+}
+
+
+u32 dpi_dfa_stream(const struct dpi_ruleset *rs, u32 *state, const u8 *p, unsigned int len, unsigned int *end)
+{
+	// A state of another rule set is meaningless in this one
+	if(*state >= rs->dfa->num_states)
+	{
+		*state = 0;
+	}
+
+	return dpi_dfa_walk(rs, p, len, NULL, end, state);
+}
+
+
+int dpi_ruleset_get_profile(struct dpi_profile_query *q, u32 __user *data)
+{
+	struct dpi_ruleset *rs;
+	u32 n;
+	int retval = 0;
+
+	// Holding the lock keeps the rule set from being replaced while copying
+	mutex_lock(&Dpi_Ruleset_Lock);
+	rs = rcu_dereference_protected(Dpi_Ruleset, lockdep_is_held(&Dpi_Ruleset_Lock));
+	if(!rs || !rs->visits)
+	{
+		mutex_unlock(&Dpi_Ruleset_Lock);
+		return -ENOENT;
+	}
+
+	n = min(q->num_states, rs->dfa->num_states);
+	if(copy_to_user(data, rs->visits, n * sizeof(u32)))
+	{
+		retval = -EFAULT;
+	}
+	else if(q->flags & DPI_PROFILE_RESET)
+	{
+		memset(rs->visits, 0, rs->dfa->num_states * sizeof(u32));
+	}
+
+	q->num_states = rs->dfa->num_states;
+	q->generation = rs->generation;
+	q->flags = rs->dfa->flags;
+	mutex_unlock(&Dpi_Ruleset_Lock);
+
+	return retval;
+}
+
+
+u32 dpi_ruleset_pattern_id(const struct dpi_ruleset *rs, u32 match)
+{
+	if(!match || match > rs->num_patterns)
+	{
+		return DPI_PATTERN_UNKNOWN;
+	}
+
+	return rs->pattern_ids[match - 1];
+}
+
+
+void dpi_ruleset_exit(void)
+{
+	struct dpi_ruleset *old;
+
+	mutex_lock(&Dpi_Ruleset_Lock);
+	old = rcu_dereference_protected(Dpi_Ruleset, lockdep_is_held(&Dpi_Ruleset_Lock));
+	RCU_INIT_POINTER(Dpi_Ruleset, NULL);
+	mutex_unlock(&Dpi_Ruleset_Lock);
+
+	synchronize_rcu();
+	dpi_ruleset_free(old);
+}
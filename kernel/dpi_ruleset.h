@@ -0,0 +1,151 @@
+#ifndef _DPI_RULESET_H
+#define _DPI_RULESET_H
+
+/**
+ * Compiled Rule Set for DPI (Deep Packet Inspection) Hardware Accelerator
+ * Holds the tables of the currently loaded rule image
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+#include <linux/firmware.h>
+#include "dpi_user.h"
+
+/** A loaded rule image; sections point into the image itself */
+struct dpi_ruleset
+{
+	// Increases with every load, lets users detect table changes
+	u32 generation;
+
+	// Image storage; firmware images are used straight from the firmware buffer
+	void *image;
+	size_t size;
+	const struct firmware *fw;
+
+	// Sections (NULL when missing from the image)
+	const struct dpi_prefilter_table *prefilter;
+	const struct dpi_bloom_filter *bloom;
+
+	const struct dpi_dfa_table *dfa;
+	const u32 *dfa_final;
+
+	// Regex tails, confirm finals of the software matcher
+	const struct dpi_nfa_table *nfa;
+	const u8 (*nfa_cls)[32];
+	const u32 *nfa_accept;
+	const u32 *nfa_follow;
+	const u32 *nfa_start;
+
+	// Signature ids of the patterns, accelerator table registers
+	const u32 *pattern_ids;
+	u32 num_patterns;
+	const struct dpi_hw_table *hw;
+
+	// Generated matcher (dpi_gen.c) was built from this image
+	bool gen;
+
+	// Visits of every software matcher state (NULL unless profiling)
+	u32 *visits;
+
+	// DPI_BLOOM_BASE^(q-1), removes the oldest byte from the rolling hash
+	u32 bloom_out_factor;
+
+	// First-byte bucket masks derived from the prefilter
+	u8 prefilter_first[256];
+};
+
+/**
+ *	This function validates an image copied from userspace and makes it
+ *	the active rule set. Size 0 unloads the active rule set.
+ *		returns 0 on success, negative error code otherwise
+ */
+int dpi_ruleset_load(const void __user *, size_t);
+
+/**
+ *	This function loads an image from the firmware search path (normally
+ *	/lib/firmware) and makes it the active rule set. NULL or an empty name
+ *	loads the 'image' module parameter. The device is used for firmware
+ *	lookup messages only.
+ *		returns 0 on success, negative error code otherwise
+ */
+int dpi_ruleset_load_firmware(const char *, struct device *);
+
+/**
+ *	This function returns the active rule set, NULL if none is loaded.
+ *	Caller must be inside rcu_read_lock().
+ */
+struct dpi_ruleset *dpi_ruleset_get(void);
+
+/** The function that returns the generation of the active rule set (0 if none) */
+u32 dpi_ruleset_generation(void);
+
+/**
+ *	This function runs the prefilter of a rule set over a payload.
+ *		returns true if some pattern may start in the payload
+ *		returns false if no pattern can match
+ */
+bool dpi_prefilter_candidate(const struct dpi_ruleset *, const u8 *, unsigned int);
+
+/**
+ *	This function checks every q-byte window of a payload against the
+ *	bloom filter of a rule set.
+ *		returns true if some window hits the filter
+ *		returns false if the payload contains no pattern
+ */
+bool dpi_bloom_candidate(const struct dpi_ruleset *, const u8 *, unsigned int);
+
+/**
+ *	This function scans a payload with the software matcher of a rule set.
+ *	It is used while the accelerator is not available, and to confirm
+ *	accelerator matches of regex heads when the rule set has tails. On a
+ *	match, the offset after its last byte is stored if the pointer is not
+ *	NULL; the generated matcher stores DPI_OFFSET_UNKNOWN. Regex tails take
+ *	one pass over the payload; the generated matcher runs them per head
+ *	and gives the payload to the table walker if that takes longer.
+ *		returns 0 if no pattern matches
+ *		returns index of the matched pattern plus one otherwise
+ */
+u32 dpi_dfa_match(const struct dpi_ruleset *, const u8 *, unsigned int, unsigned int *);
+
+/**
+ *	This function scans one piece of a stream with the table walker of the
+ *	software matcher (never the generated one), starting from the state the
+ *	previous piece stopped in (0 for the first). The state is updated, so a
+ *	pattern may span pieces; regex tails are confirmed within the piece. The
+ *	end of a match is relative to the piece.
+ *		returns 0 if no pattern matches
+ *		returns index of the matched pattern plus one otherwise
+ */
+u32 dpi_dfa_stream(const struct dpi_ruleset *, u32 *, const u8 *, unsigned int, unsigned int *);
+
+/**
+ *	This function copies the visit profile of the active rule set to
+ *	userspace, see struct dpi_profile_query.
+ *		returns 0 on success, -ENOENT if the rule set is not profiled
+ */
+int dpi_ruleset_get_profile(struct dpi_profile_query *, u32 __user *);
+
+/**
+ *	This function maps a match (index of the pattern plus one) to the id
+ *	of its signature.
+ *		returns DPI_PATTERN_UNKNOWN if the image has no pattern ids
+ */
+u32 dpi_ruleset_pattern_id(const struct dpi_ruleset *, u32);
+
+/** The function that drops the active rule set (module unload) */
+void dpi_ruleset_exit(void);
+
+#endif
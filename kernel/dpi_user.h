@@ -0,0 +1,381 @@
+#ifndef _DPI_USER_H
+#define _DPI_USER_H
+
+/**
+ * Userspace interface of DPI (Deep Packet Inspection) Hardware Accelerator
+ * Shared by the kernel module and userspace tools.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/** Character device node (/dev/dpi) */
+#define DPI_DEVICE_NAME					"dpi"
+#define DPI_DEVICE_PATH					"/dev/dpi"
+
+/**
+ *	Submission/completion rings
+ *
+ *	DPI_IOC_SETUP allocates one DMA-able region per open file. Userspace maps
+ *	it with mmap(fd, offset 0, region_size) and finds the parts at the
+ *	returned offsets:
+ *
+ *		sq_off:  struct dpi_ring_ctrl + sq_entries x struct dpi_sqe
+ *		cq_off:  struct dpi_ring_ctrl + cq_entries x struct dpi_cqe
+ *		buf_off: buf_count x buf_size bytes of data buffers
+ *
+ *	Userspace owns SQ tail and CQ head, kernel owns SQ head and CQ tail.
+ *	Indices run freely and are masked with (entries - 1).
+ */
+#define DPI_RING_MAX_ENTRIES			1024
+#define DPI_RING_MAX_BUF_SIZE			16384
+#define DPI_RING_MAX_REGION				(1 << 20)
+
+/** Setup flags */
+#define DPI_SETUP_SQPOLL				(1 << 0)	// Kernel thread polls the SQ
+
+/** SQ control flags (written by kernel) */
+#define DPI_SQ_NEED_WAKEUP				(1 << 0)	// Poll thread sleeps, enter with DPI_ENTER_SQ_WAKEUP
+
+/** Enter flags */
+#define DPI_ENTER_GETEVENTS				(1 << 0)	// Wait for min_complete completions
+#define DPI_ENTER_SQ_WAKEUP				(1 << 1)	// Wake up the SQ poll thread
+
+/** Completion results */
+#define DPI_RESULT_CLEAN				0
+#define DPI_RESULT_MATCH				1
+
+/** Reported when the matcher cannot tell which pattern matched, or where */
+#define DPI_PATTERN_UNKNOWN				0
+#define DPI_OFFSET_UNKNOWN				0xffffffff
+
+/** Ring setup parameters */
+struct dpi_ring_params
+{
+	// In: requested sizes (entries are rounded up to a power of two)
+	__u32 sq_entries;
+	__u32 cq_entries;
+	__u32 buf_count;
+	__u32 buf_size;
+	__u32 flags;
+	__u32 sq_idle_ms;
+
+	// Out: layout of the mmap'd region
+	__u32 sq_off;
+	__u32 cq_off;
+	__u32 buf_off;
+	__u32 region_size;
+};
+
+/** Ring control block, one cache line each for SQ and CQ */
+struct dpi_ring_ctrl
+{
+	__u32 head;
+	__u32 tail;
+	__u32 mask;
+	__u32 entries;
+	__u32 flags;
+	__u32 overflow;
+	__u32 reserved[2];
+};
+
+/** Submission queue entry */
+struct dpi_sqe
+{
+	__u64 user_data;
+	__u32 buf_index;
+	__u32 len;
+};
+
+/** Completion queue entry */
+struct dpi_cqe
+{
+	__u64 user_data;
+	__s32 result;			// DPI_RESULT_* or negative errno
+	__u32 pattern_id;
+};
+
+/** Enter arguments */
+struct dpi_enter
+{
+	__u32 to_submit;
+	__u32 min_complete;
+	__u32 flags;
+	__u32 submitted;		// Out: consumed SQ entries
+};
+
+/**
+ *	Compiled rule images
+ *
+ *	An image is produced by dpi_compile from the signature set and loaded
+ *	with DPI_IOC_LOAD_IMAGE, or from /lib/firmware with request_firmware()
+ *	at module load and with DPI_IOC_LOAD_FIRMWARE. It is used in place:
+ *	every section is a flat, 8-byte aligned table in the byte order of the
+ *	target CPU.
+ *
+ *		struct dpi_image_header
+ *		num_sections x struct dpi_image_section
+ *		section data ...
+ *
+ *	crc32 is the CRC-32 (zlib polynomial, inverted) of all bytes after the
+ *	header, including padding.
+ */
+#define DPI_IMAGE_MAGIC					0x44504931	// "DPI1" in target byte order
+#define DPI_IMAGE_VERSION				2
+#define DPI_IMAGE_ALIGN					8
+#define DPI_IMAGE_MAX_SIZE				(32 << 20)
+#define DPI_IMAGE_MAX_SECTIONS			16
+
+/** Section types */
+#define DPI_SECTION_PREFILTER			1		// struct dpi_prefilter_table
+#define DPI_SECTION_BLOOM				2		// struct dpi_bloom_filter + bit array
+#define DPI_SECTION_DFA					3		// struct dpi_dfa_table + transitions + outputs
+#define DPI_SECTION_NFA					4		// struct dpi_nfa_table + regex tails
+#define DPI_SECTION_PATTERN_IDS			5		// __u32 id of every pattern, by index
+#define DPI_SECTION_HW_TABLE			6		// struct dpi_hw_table
+
+/** Image header */
+struct dpi_image_header
+{
+	__u32 magic;
+	__u16 version;
+	__u16 num_sections;
+	__u32 image_size;
+	__u32 crc32;
+};
+
+/** Section table entry */
+struct dpi_image_section
+{
+	__u32 type;
+	__u32 offset;			// From start of image, DPI_IMAGE_ALIGN aligned
+	__u32 size;
+	__u32 reserved;
+};
+
+/**
+ *	Prefilter (Teddy-style nibble masks)
+ *
+ *	Patterns are spread over 8 buckets. For each of the first 'width' bytes
+ *	of a pattern, the bucket bit is set in lo[k][byte & 0xf] and
+ *	hi[k][byte >> 4]. A payload position can start a match only if
+ *	AND(k < width) lo[k][p[i+k] & 0xf] & hi[k][p[i+k] >> 4] is not zero.
+ */
+#define DPI_PREFILTER_MAX_WIDTH			3
+#define DPI_PREFILTER_BUCKETS			8
+
+struct dpi_prefilter_table
+{
+	__u32 width;
+	__u32 reserved;
+	__u8 lo[DPI_PREFILTER_MAX_WIDTH][16];
+	__u8 hi[DPI_PREFILTER_MAX_WIDTH][16];
+};
+
+/**
+ *	Bloom filter of q-grams
+ *
+ *	The first q bytes of every pattern are hashed into a bit array of
+ *	(1 << bits_log2) bits. q is never longer than the shortest pattern, so a
+ *	payload in which no q-byte window hits the filter contains no pattern.
+ *	Windows are hashed with a rolling polynomial hash (base DPI_BLOOM_BASE,
+ *	modulo 2^32) and every hash sets/tests DPI_BLOOM_PROBES bits. Bit n is
+ *	bit (n & 7) of byte (n >> 3), so the array is byte order independent.
+ */
+#define DPI_BLOOM_BASE					257
+#define DPI_BLOOM_PROBES				2
+#define DPI_BLOOM_MAX_Q					8
+#define DPI_BLOOM_MIN_BITS_LOG2			6
+#define DPI_BLOOM_MAX_BITS_LOG2			16
+
+struct dpi_bloom_filter
+{
+	__u32 q;
+	__u32 bits_log2;
+	__u8 bits[];
+};
+
+/** The function that returns bit index of a probe for a window hash */
+static inline __u32 dpi_bloom_bit(__u32 hash, __u32 bits_log2, unsigned int probe)
+{
+	static const __u32 mult[DPI_BLOOM_PROBES] = { 0x9e3779b1, 0x85ebca77 };
+
+	return (hash * mult[probe]) >> (32 - bits_log2);
+}
+
+/**
+ *	Software matcher (the automaton the accelerator walks)
+ *
+ *	Followed by __u16 next[num_states * 256] (next state for each state and
+ *	byte) and __u32 final[num_states] (0 if the state is not final, else the
+ *	index of the matched pattern plus one). State 0 is the start state.
+ *
+ *	A final value with DPI_DFA_FINAL_CONFIRM set marks the end of a regex
+ *	head only: the low bits select a start list of the NFA section, and the
+ *	match holds if one of its tails matches the bytes after this position.
+ */
+#define DPI_DFA_MAX_STATES				65535
+#define DPI_DFA_FINAL_CONFIRM			0x80000000
+
+/** Table flags */
+#define DPI_DFA_REORDERED				0x1		// States renumbered by a visit profile, hot ones first
+
+struct dpi_dfa_table
+{
+	__u32 num_states;
+	__u32 flags;
+	__u16 next[];
+};
+
+/**
+ *	Regex tails (position automaton run on the CPU after a head match)
+ *
+ *	Followed by __u8 cls[num_states][32] (bit (b & 7) of cls[p][b >> 3] set
+ *	if position p takes byte b), __u32 accept[num_states] (index of the
+ *	pattern plus one if the tail ends at p), __u32 follow[num_states][words]
+ *	(bitmap of positions that may take the byte after p) and
+ *	__u32 start[num_lists][words] (positions that may take the first byte
+ *	after a head of the list). words is (num_states + 31) / 32.
+ */
+#define DPI_NFA_MAX_STATES				1024
+
+struct dpi_nfa_table
+{
+	__u32 num_states;
+	__u32 num_lists;
+	__u32 words;
+	__u32 reserved;
+};
+
+/**
+ *	Accelerator filter table
+ *
+ *	Register settings of the table the accelerator walks; the transitions
+ *	are those of the software matcher section.
+ */
+struct dpi_hw_table
+{
+	__u32 num_states;
+	__u32 num_finals;
+};
+
+/** Image load argument (size 0 unloads the current image) */
+struct dpi_image_blob
+{
+	__u64 data;
+	__u32 size;
+	__u32 reserved;
+};
+
+/** Firmware load argument (empty name loads the 'image' module parameter) */
+#define DPI_FIRMWARE_NAME_MAX			64
+#define DPI_FIRMWARE_DEFAULT			"xt_fpga.img"
+
+struct dpi_firmware_name
+{
+	char name[DPI_FIRMWARE_NAME_MAX];
+};
+
+/**
+ *	Visit profile of the software matcher (module parameter 'profile')
+ *
+ *	In: data points to an array of num_states __u32 counters. Out:
+ *	num_states of the loaded table (counters copied up to the smaller of
+ *	both), its generation and table flags. DPI_PROFILE_RESET clears the
+ *	counters after they are read.
+ */
+#define DPI_PROFILE_RESET				0x1
+
+struct dpi_profile_query
+{
+	__u64 data;
+	__u32 num_states;
+	__u32 generation;
+	__u32 flags;			// In: DPI_PROFILE_*, out: DPI_DFA_* of the table
+	__u32 reserved;
+};
+
+/**
+ *	Match events (/dev/dpi_events)
+ *
+ *	Rules with --print write one event per matching packet into the ring
+ *	of the CPU that matched it. Userspace gets the layout with
+ *	DPI_IOC_EVENT_PARAMS, maps all rings with mmap(fd, offset 0,
+ *	num_rings x ring_stride) and finds ring n at n x ring_stride:
+ *
+ *		struct dpi_event_ring_ctrl + entries x struct dpi_event
+ *
+ *	The kernel owns head and dropped, the (single) reader owns tail.
+ *	Indices run freely and are masked with (entries - 1). A full ring
+ *	drops new events and counts them; packets never wait for the reader.
+ */
+#define DPI_EVENTS_DEVICE_NAME			"dpi_events"
+#define DPI_EVENTS_DEVICE_PATH			"/dev/dpi_events"
+#define DPI_EVENT_RULE_LEN				16
+
+/** Event ring layout */
+struct dpi_event_params
+{
+	__u32 num_rings;
+	__u32 entries;
+	__u32 ring_stride;
+	__u32 event_size;
+};
+
+/** Event ring control block; head and tail are in separate cache lines */
+struct dpi_event_ring_ctrl
+{
+	__u32 head;
+	__u32 reserved0;
+	__u64 dropped;
+	__u8 pad0[48];
+
+	__u32 tail;
+	__u32 reserved1[15];
+};
+
+/** Event flags */
+#define DPI_EVENT_INFLATED				0x01	// Offset and len count decompressed bytes of an HTTP body
+
+/** A match event */
+struct dpi_event
+{
+	__u64 timestamp;		// Nanoseconds since the epoch
+	__u8 saddr[16];			// IPv4 addresses take the first 4 bytes
+	__u8 daddr[16];
+	__u16 sport;			// Host byte order, 0 for protocols without ports
+	__u16 dport;
+	__u8 family;			// AF_INET, AF_INET6 or 0 if the packet is not IP
+	__u8 protocol;
+	__u8 field;				// Inspected field of the rule, 0 for the whole packet
+	__u8 flags;				// DPI_EVENT_*
+	__u32 pattern_id;		// DPI_PATTERN_UNKNOWN if only the accelerator saw the match
+	__u32 offset;			// End of the match in the inspected bytes (field), or DPI_OFFSET_UNKNOWN
+	__u32 len;				// Inspected bytes
+	__u32 reserved1;
+	char rule[DPI_EVENT_RULE_LEN];	// --name of the rule, empty if it has none
+};
+
+/** ioctl commands */
+#define DPI_IOC_MAGIC					'D'
+#define DPI_IOC_SETUP					_IOWR(DPI_IOC_MAGIC, 1, struct dpi_ring_params)
+#define DPI_IOC_ENTER					_IOWR(DPI_IOC_MAGIC, 2, struct dpi_enter)
+#define DPI_IOC_LOAD_IMAGE				_IOW(DPI_IOC_MAGIC, 3, struct dpi_image_blob)
+#define DPI_IOC_LOAD_FIRMWARE			_IOW(DPI_IOC_MAGIC, 4, struct dpi_firmware_name)
+#define DPI_IOC_GET_PROFILE				_IOWR(DPI_IOC_MAGIC, 5, struct dpi_profile_query)
+#define DPI_IOC_EVENT_PARAMS			_IOR(DPI_IOC_MAGIC, 6, struct dpi_event_params)
+
+#endif
@@ -20,37 +20,241 @@
 #include "xtables_fpga.h"
 
 
-static bool matches(char *payload, unsigned int p_len)
+/** Last inspected packet of every CPU */
+static DEFINE_PER_CPU(struct xt_fpga_memo, Xt_Fpga_Memo);
+
+
+/**
+ *	Function that hashes the first bytes of a packet. A freed skb can come
+ *	back at the same address with the same length; its headers (IP id,
+ *	checksums, sequence numbers) tell it apart.
+ */
+static u32 xt_fpga_memo_hash(const struct sk_buff *skb)
 {
-	// Push packet payload into DPI hardware
-	dpi_push_packet_payload(payload, p_len);
+	return jhash(skb->data, min_t(unsigned int, skb_headlen(skb), XT_FPGA_MEMO_HASH_BYTES), skb->len);
+}
+
+
+static bool matches(const struct sk_buff *skb, char *payload, unsigned int p_len, u8 field,
+					struct xt_fpga_rule *rule, struct xt_fpga_hit *hit)
+{
+	struct dpi_ruleset *rs;
+	struct xt_fpga_memo *memo;
+	bool candidate = true, bloom_hit = false, inspected = false;
+	int result = 0;
+	unsigned int end;
+	u32 match, generation, reset_generation, hash;
+
+	hit->pattern_id = DPI_PATTERN_UNKNOWN;
+	hit->offset = DPI_OFFSET_UNKNOWN;
+	hit->len = p_len;
+	hit->field = field;
+	hit->flags = 0;
+
+	rcu_read_lock();
+	rs = dpi_ruleset_get();
+
+	// An earlier fpga rule (in this chain or an earlier hook) may have
+	// inspected the same bytes with the same tables already
+	memo = this_cpu_ptr(&Xt_Fpga_Memo);
+	generation = rs ? rs->generation : 0;
+	reset_generation = dpi_accel_reset_generation();
+	hash = xt_fpga_memo_hash(skb);
+
+	if(memo->skb == skb && memo->data == payload && memo->len == p_len && memo->field == field &&
+		memo->generation == generation && memo->reset_generation == reset_generation && memo->hash == hash)
+	{
+		XT_FPGA_STAT_INC(memo_hits);
+		*hit = memo->hit;
+		rcu_read_unlock();
+
+		return memo->matched;
+	}
+
+	// Skip the accelerator when no pattern of the loaded rule set can be
+	// in the payload. The bloom filter proves it for most clean payloads,
+	// the prefilter checks the rest.
+	if(rs && rs->bloom)
+	{
+		candidate = dpi_bloom_candidate(rs, payload, p_len);
+		bloom_hit = candidate;
+
+		if(candidate)
+			XT_FPGA_STAT_INC(bloom_hits);
+		else
+			XT_FPGA_STAT_INC(bloom_skipped);
+	}
+	if(candidate && rs && rs->prefilter)
+	{
+		candidate = dpi_prefilter_candidate(rs, payload, p_len);
+
+		if(candidate)
+			XT_FPGA_STAT_INC(prefilter_candidates);
+		else
+			XT_FPGA_STAT_INC(prefilter_skipped);
+	}
+
+	if(!candidate)
+	{
+		inspected = true;
+		goto out;
+	}
+
+	// Keep the accelerator within the budget of the rule
+	// (result -1 means the payload is not inspected)
+	if(rule)
+	{
+		switch(xt_fpga_rule_admit(rule, p_len))
+		{
+			case XT_FPGA_PASS:
+				result = -1;
+				goto out;
+
+			case XT_FPGA_BLOCK:
+				result = 1;
+				goto out;
+
+			case XT_FPGA_SOFTWARE:
+				result = -1;
+				goto software;
+
+			default:
+				break;
+		}
+	}
+
+	// Push packet payload into DPI hardware and get filter result.
+	// The payload is queued on this CPU and the device dispatches it.
+	// While the watchdog recovers the device, go to software directly.
+	if(dpi_accel_online() || !(rs && rs->dfa))
+	{
+		XT_FPGA_STAT_INC(accel_scans);
+		result = dpi_filter_payload(payload, p_len);
+		inspected = (result >= 0);
+
+		if(result < 0)
+		{
+			XT_FPGA_STAT_INC(accel_errors);
+		}
+		else if(result > 0)
+		{
+			XT_FPGA_STAT_INC(accel_matches);
+
+			// The accelerator only knows regex heads; their tails are
+			// confirmed here (the emulated backend has done it already)
+			if(rs && rs->nfa && rs->dfa && !dpi_accel_emulated())
+			{
+				XT_FPGA_STAT_INC(accel_confirms);
+				match = dpi_dfa_match(rs, payload, p_len, &end);
+				result = match ? 1 : 0;
+
+				if(match)
+				{
+					hit->pattern_id = dpi_ruleset_pattern_id(rs, match);
+					hit->offset = end;
+				}
+				else
+					XT_FPGA_STAT_INC(accel_confirm_rejects);
+			}
+		}
+	}
+	else
+	{
+		result = -1;
+	}
+
+software:
+	// Use the software matcher of the rule set when the accelerator failed
+	if(result < 0 && rs && rs->dfa)
+	{
+		XT_FPGA_STAT_INC(software_scans);
+		match = dpi_dfa_match(rs, payload, p_len, &end);
+		result = match ? 1 : 0;
+		inspected = true;
+
+		if(match)
+		{
+			XT_FPGA_STAT_INC(software_matches);
+			hit->pattern_id = dpi_ruleset_pattern_id(rs, match);
+			hit->offset = end;
+		}
+	}
 
-	// Get and return filter result from DPI hardware
-	return (dpi_get_filter_result() > 0);
+out:
+	rcu_read_unlock();
+
+	// Budget decisions and errors depend on the rule, only results of
+	// inspection are reused
+	if(inspected)
+	{
+		memo->skb = skb;
+		memo->data = payload;
+		memo->len = p_len;
+		memo->field = field;
+		memo->generation = generation;
+		memo->reset_generation = reset_generation;
+		memo->hash = hash;
+		memo->matched = (result > 0);
+		memo->hit = *hit;
+	}
+
+	if(bloom_hit && result == 0)
+	{
+		XT_FPGA_STAT_INC(bloom_false_positives);
+	}
+
+	return (result > 0);
 }
 
 
-static bool fpga_mt(const struct sk_buff *skb, struct xt_action_param *par)
+/** Function that matches a packet and applies filter and print settings of its rule */
+static bool fpga_mt_common(const struct sk_buff *skb, const struct xt_action_param *par,
+						bool filter_enabled, bool print_enabled, u8 field, u8 flags, struct xt_fpga_rule *rule)
 {
-	int result;
-	const struct xt_fpga_info *conf;
+	struct xt_fpga_hit hit;
+	const u8 *data = skb->data;
+	unsigned int len = skb->len - skb->data_len;
+	int result = 0;
 
-	// Get rule info for given packet
-	conf = (const struct xt_fpga_info *) (par->matchinfo);
-	
-	// Check if packet payload matches with filter
-	result = matches(skb->data, (skb->len - skb->data_len));
+	XT_FPGA_STAT_INC(packets);
+	XT_FPGA_STAT_ADD(bytes, len);
+
+	// Only the field of the rule goes to the matcher. A packet without
+	// the field cannot match.
+	if(field != XT_FPGA_FIELD_PACKET && !xt_fpga_field_find(skb, par, field, &data, &len))
+	{
+		len = 0;
+	}
+
+	if(rule)
+	{
+		xt_fpga_rule_account(rule, skb->len - skb->data_len, len);
+	}
+
+	// Check if payload matches with filter
+	if(len)
+	{
+		result = matches(skb, (char *) data, len, field, rule, &hit);
+	}
+
+	// Compressed HTTP bodies are matched after they are inflated
+	if(!result && (flags & XT_FPGA_F_INFLATE))
+	{
+		result = xt_fpga_inflate_match(skb, par, &hit);
+	}
 
 	if(result)
 	{
-		if(conf->print_enabled)
+		// Logged into the event ring of this CPU (/dev/dpi_events);
+		// printk would hold the console lock at the match rate
+		if(print_enabled)
 		{
-			PINFO("Packet payload matches with filter.\n");
+			xt_fpga_event_log(skb, par, rule ? rule->name : NULL, &hit);
 		}
 
 		// When payload matches
 		// return true if filter is enabled, return false otherwise
-		return conf->filter_enabled;
+		return filter_enabled;
 	}
 	else 
 	{
@@ -60,13 +264,167 @@ static bool fpga_mt(const struct sk_buff *skb, struct xt_action_param *par)
 }
 
 
+static bool fpga_mt(const struct sk_buff *skb, struct xt_action_param *par)
+{
+	const struct xt_fpga_info *conf;
+
+	// Get rule info for given packet
+	conf = (const struct xt_fpga_info *) (par->matchinfo);
+
+	return fpga_mt_common(skb, par, conf->filter_enabled, conf->print_enabled, conf->field, conf->flags,
+						conf->rule);
+}
+
+
+static bool fpga_mt_v2(const struct sk_buff *skb, struct xt_action_param *par)
+{
+	const struct xt_fpga_info_v2 *conf;
+
+	// Get rule info for given packet
+	conf = (const struct xt_fpga_info_v2 *) (par->matchinfo);
+
+	return fpga_mt_common(skb, par, conf->filter_enabled, conf->print_enabled, XT_FPGA_FIELD_PACKET, 0,
+						conf->rule);
+}
+
+
+static bool fpga_mt_v0(const struct sk_buff *skb, struct xt_action_param *par)
+{
+	const struct xt_fpga_info_v0 *conf;
+
+	// Get rule info for given packet
+	conf = (const struct xt_fpga_info_v0 *) (par->matchinfo);
+
+	return fpga_mt_common(skb, par, conf->filter_enabled, conf->print_enabled, XT_FPGA_FIELD_PACKET, 0,
+						NULL);
+}
+
+
+/** Function that validates the settings of a rule and creates its state */
+static struct xt_fpga_rule *fpga_mt_rule_create(const struct xt_fpga_info *conf, int *err)
+{
+	struct xt_fpga_rule *rule;
+
+	// Report rule load
+	PNOTICE("Appending/Inserting an fpga matcher rule into iptables... \n");
+
+	// Validate admission control settings; an auto budget replaces the packet rate
+	if(conf->policy > XT_FPGA_POLICY_SAMPLE || conf->auto_percent > 100 ||
+		(conf->auto_percent && conf->rate_packets) ||
+		(conf->policy == XT_FPGA_POLICY_SAMPLE && !conf->sample_rate) ||
+		conf->burst_ms > XT_FPGA_MAX_BURST_MS)
+	{
+		PERR("Invalid admission control settings!\n");
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	rule = kzalloc(sizeof(*rule), GFP_KERNEL);
+	if(!rule)
+	{
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	memcpy(rule->name, conf->name, sizeof(rule->name));
+	rule->name[sizeof(rule->name) - 1] = '\0';
+	rule->policy = conf->policy;
+	rule->auto_percent = conf->auto_percent;
+	rule->sample_rate = conf->sample_rate;
+	rule->rate_bytes = conf->rate_bytes;
+	rule->rate_packets = conf->rate_packets;
+	rule->burst_ns = (u64) (conf->burst_ms ? conf->burst_ms : XT_FPGA_DEFAULT_BURST_MS) * NSEC_PER_MSEC;
+	rule->field = conf->field;
+
+	*err = xt_fpga_rule_register(rule);
+	if(*err)
+	{
+		kfree(rule);
+		return NULL;
+	}
+
+	// Reset Filter Table(FSM) in DPI Accelerator
+	dpi_reset_filter_table();
+
+	// Report rule settings
+	PINFO("is status enabled? : %d\n", (int) conf->print_enabled);
+	PINFO("is filter enabled? : %d\n", (int) conf->filter_enabled);
+
+	return rule;
+}
+
+
 static int fpga_mt_check(const struct xt_mtchk_param *par)
 {
 	struct xt_fpga_info *conf;
+	unsigned int i;
+	int err;
 
 	// Get rule info
 	conf = (struct xt_fpga_info *) par->matchinfo;
 
+	// Reserved bytes are kept zero for later settings
+	for(i = 0; i < sizeof(conf->reserved); i++)
+	{
+		if(conf->reserved[i])
+		{
+			PERR("Invalid rule settings!\n");
+			return -EINVAL;
+		}
+	}
+
+	if(conf->field > XT_FPGA_FIELD_LAST)
+	{
+		PERR("Invalid field %u!\n", conf->field);
+		return -EINVAL;
+	}
+
+	if(conf->flags & ~XT_FPGA_F_ALL)
+	{
+		PERR("Invalid flags 0x%x!\n", conf->flags);
+		return -EINVAL;
+	}
+
+	// The slot pool is allocated at module load
+	if((conf->flags & XT_FPGA_F_INFLATE) && !xt_fpga_inflate_enabled())
+	{
+		PERR("--inflate needs the inflate_flows module parameter!\n");
+		return -EOPNOTSUPP;
+	}
+
+	conf->rule = fpga_mt_rule_create(conf, &err);
+
+	return err;
+}
+
+
+static int fpga_mt_check_v2(const struct xt_mtchk_param *par)
+{
+	struct xt_fpga_info_v2 *conf;
+	struct xt_fpga_info info;
+	int err;
+
+	// Revision 3 adds the field after the settings of revision 2
+	BUILD_BUG_ON(offsetof(struct xt_fpga_info_v2, rule) != offsetof(struct xt_fpga_info, field));
+
+	// Get rule info
+	conf = (struct xt_fpga_info_v2 *) par->matchinfo;
+
+	memset(&info, 0, sizeof(info));
+	memcpy(&info, conf, offsetof(struct xt_fpga_info_v2, rule));
+	conf->rule = fpga_mt_rule_create(&info, &err);
+
+	return err;
+}
+
+
+static int fpga_mt_check_v0(const struct xt_mtchk_param *par)
+{
+	struct xt_fpga_info_v0 *conf;
+
+	// Get rule info
+	conf = (struct xt_fpga_info_v0 *) par->matchinfo;
+
 	// Report rule load
 	PNOTICE("Appending/Inserting an fpga matcher rule into iptables... \n");
 
@@ -81,9 +439,29 @@ static int fpga_mt_check(const struct xt_mtchk_param *par)
 }
 
 
-static void fpga_mt_destroy(const struct xt_mtdtor_param *par)
+/** Function that removes the state of a rule */
+static void fpga_mt_rule_destroy(struct xt_fpga_rule *rule)
 {
 	PNOTICE("Removing an fpga matcher rule from iptables... \n");
+
+	xt_fpga_rule_unregister(rule);
+	kfree(rule);
+}
+
+
+static void fpga_mt_destroy(const struct xt_mtdtor_param *par)
+{
+	const struct xt_fpga_info *conf = (const struct xt_fpga_info *) par->matchinfo;
+
+	fpga_mt_rule_destroy(conf->rule);
+}
+
+
+static void fpga_mt_destroy_v2(const struct xt_mtdtor_param *par)
+{
+	const struct xt_fpga_info_v2 *conf = (const struct xt_fpga_info_v2 *) par->matchinfo;
+
+	fpga_mt_rule_destroy(conf->rule);
 }
 
 
@@ -101,11 +479,75 @@ static int __init fpga_mt_init(void)
 		return retval; 
 	}
 
+	// Have the rules ready before the first packet. Without an image,
+	// rules wait for one to be loaded through /dev/dpi
+	retval = dpi_ruleset_load_firmware(NULL, dpi_cdev_device());
+	if(retval)
+	{
+		PNOTICE("No rule image is loaded from the firmware path (error %d).\n", retval);
+	}
+
+	// Try to create statistics in proc. If it fails, unload DPI driver
+	retval = xt_fpga_stats_init();
+	if(retval)
+	{
+		PERR("Creating /proc/net/%s failed. Unloading DPI driver...\n", XT_FPGA_PROC_DIR);
+		dpi_exit();
+		return retval;
+	}
+
+	retval = xt_fpga_rules_init();
+	if(retval)
+	{
+		PERR("Creating /proc/net/%s/rules failed. Unloading DPI driver...\n", XT_FPGA_PROC_DIR);
+		xt_fpga_stats_exit();
+		dpi_exit();
+		return retval;
+	}
+
+	retval = xt_fpga_events_init();
+	if(retval)
+	{
+		PERR("Creating /dev/%s failed. Unloading DPI driver...\n", DPI_EVENTS_DEVICE_NAME);
+		xt_fpga_rules_exit();
+		xt_fpga_stats_exit();
+		dpi_exit();
+		return retval;
+	}
+
+	retval = xt_fpga_field_init();
+	if(retval)
+	{
+		PERR("Allocating field buffers failed. Unloading DPI driver...\n");
+		xt_fpga_events_exit();
+		xt_fpga_rules_exit();
+		xt_fpga_stats_exit();
+		dpi_exit();
+		return retval;
+	}
+
+	retval = xt_fpga_inflate_init();
+	if(retval)
+	{
+		PERR("Allocating inflate slots failed. Unloading DPI driver...\n");
+		xt_fpga_field_exit();
+		xt_fpga_events_exit();
+		xt_fpga_rules_exit();
+		xt_fpga_stats_exit();
+		dpi_exit();
+		return retval;
+	}
+
 	// Try to register this module into Xtables. If it fails, unload DPI driver
 	retval = xt_register_matches(xt_fpga_mt_reg, ARRAY_SIZE(xt_fpga_mt_reg));
 	if(retval)
 	{
 		PERR("FPGA matcher registration into Xtables is failed. Unloading DPI driver...\n");
+		xt_fpga_inflate_exit();
+		xt_fpga_field_exit();
+		xt_fpga_events_exit();
+		xt_fpga_rules_exit();
+		xt_fpga_stats_exit();
 		dpi_exit();
 	}
 	else
@@ -123,6 +565,12 @@ static void __exit fpga_mt_exit(void)
 	xt_unregister_matches(xt_fpga_mt_reg, ARRAY_SIZE(xt_fpga_mt_reg));
 	PNOTICE("Xtables FPGA matcher is unloaded\n");
 
+	xt_fpga_inflate_exit();
+	xt_fpga_field_exit();
+	xt_fpga_events_exit();
+	xt_fpga_rules_exit();
+	xt_fpga_stats_exit();
+
 	// Secondly, unload DPI driver
 	dpi_exit();
 }
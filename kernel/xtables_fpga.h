@@ -22,7 +22,16 @@
 
 #include <linux/module.h>
 #include <linux/netfilter/x_tables.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
 #include "dpi_accel.h"
+#include "dpi_ruleset.h"
+#include "dpi_chrdev.h"
+#include "xtables_fpga_stats.h"
+#include "xtables_fpga_budget.h"
+#include "xtables_fpga_events.h"
+#include "xtables_fpga_field.h"
+#include "xtables_fpga_inflate.h"
 
 #define PERR(fmt, args...) printk(KERN_ERR "xt_fpga: " fmt, ## args)
 #define PNOTICE(fmt, args...) printk(KERN_NOTICE "xt_fpga: " fmt, ## args)
@@ -34,19 +43,93 @@ MODULE_DESCRIPTION("Xtables: FPGA-Based String Matching");
 MODULE_ALIAS("ipt_fpga");
 MODULE_ALIAS("ip6t_fpga");
 
-/** Packet-specific filter info */
+/** Packet-specific filter info (revisions 0 and 1) */
+struct xt_fpga_info_v0
+{
+	bool filter_enabled;
+	bool print_enabled;
+};
+
+/** Packet-specific filter info (revision 2) */
+struct xt_fpga_info_v2
+{
+	bool filter_enabled;
+	bool print_enabled;
+	__u8 policy;
+	__u8 auto_percent;
+	__u32 sample_rate;
+	__u64 rate_bytes;
+	__u32 rate_packets;
+	__u32 burst_ms;
+	char name[XT_FPGA_NAME_LEN];
+
+	// Kernel-private rule state
+	struct xt_fpga_rule *rule __attribute__((aligned(8)));
+};
+
+/** Rule flags (revision 3) */
+#define XT_FPGA_F_INFLATE				0x01	// Also match decompressed HTTP response bodies
+#define XT_FPGA_F_ALL					XT_FPGA_F_INFLATE
+
+/** Packet-specific filter info (revision 3) */
 struct xt_fpga_info 
 {
 	bool filter_enabled;
 	bool print_enabled;
+
+	// Admission control in front of the accelerator (0 rates are unlimited).
+	// With auto_percent, the budget is that share of measured accelerator time.
+	__u8 policy;
+	__u8 auto_percent;
+	__u32 sample_rate;
+	__u64 rate_bytes;
+	__u32 rate_packets;
+	__u32 burst_ms;
+	char name[XT_FPGA_NAME_LEN];
+
+	// Inspected field (XT_FPGA_FIELD_*), the whole packet by default
+	__u8 field;
+	__u8 flags;
+	__u8 reserved[6];
+
+	// Kernel-private rule state
+	struct xt_fpga_rule *rule __attribute__((aligned(8)));
+};
+
+/** Packet bytes hashed into the key of the last inspection */
+#define XT_FPGA_MEMO_HASH_BYTES			64
+
+/**
+ *	Result of the last packet a CPU inspected. A packet meets the fpga match
+ *	of several rules and hooks on the same CPU; the key tells whether the
+ *	bytes and the tables are still those of the stored result.
+ */
+struct xt_fpga_memo
+{
+	// Key
+	const struct sk_buff *skb;
+	const void *data;
+	unsigned int len;
+	u32 generation;				// Rule set generation
+	u32 reset_generation;		// Accelerator resets
+	u32 hash;					// First bytes of the packet
+	u8 field;
+
+	// Result
+	bool matched;
+	struct xt_fpga_hit hit;
 };
 
 /** 
  *	This function checks if the filter matches given payload via DPI hardware
+ *	(the rule may be NULL for rules without admission control). The payload
+ *	is the field of the rule, or the packet. The pattern and offset of a
+ *	match are stored into the hit, as far as they are known.
  *		returns 1 if the filter matches the packet payload 
  * 		returns 0 otherwise
  */
-static bool matches(char *, unsigned int);
+static bool matches(const struct sk_buff *, char *, unsigned int, u8, struct xt_fpga_rule *,
+					struct xt_fpga_hit *);
 
 /**
  *  This function is called when a packet is received. 
@@ -54,12 +137,21 @@ static bool matches(char *, unsigned int);
  *		returns false to allow it to pass
  */
 static bool fpga_mt(const struct sk_buff *, struct xt_action_param *);
+static bool fpga_mt_v2(const struct sk_buff *, struct xt_action_param *);
+static bool fpga_mt_v0(const struct sk_buff *, struct xt_action_param *);
 
 /** called when a rule including fpga module is added into an iptables chain */
 static int fpga_mt_check(const struct xt_mtchk_param *);
+static int fpga_mt_check_v2(const struct xt_mtchk_param *);
+static int fpga_mt_check_v0(const struct xt_mtchk_param *);
+
+/** The functions that create and remove the state of a revision 2 or 3 rule */
+static struct xt_fpga_rule *fpga_mt_rule_create(const struct xt_fpga_info *, int *);
+static void fpga_mt_rule_destroy(struct xt_fpga_rule *);
 
 /** called when a rule including fpga module is removed from the iptables chain */
 static void fpga_mt_destroy(const struct xt_mtdtor_param *);
+static void fpga_mt_destroy_v2(const struct xt_mtdtor_param *);
 
 /** The function that initializes module */
 static int __init fpga_mt_init(void);
@@ -74,16 +166,34 @@ static struct xt_match xt_fpga_mt_reg[] __read_mostly =
 		.name 		= "fpga",
 		.revision	= 0,
 		.family		= NFPROTO_UNSPEC,
-		.checkentry	= fpga_mt_check,
-		.match 		= fpga_mt,
-		.destroy 	= fpga_mt_destroy,
-		.matchsize	= sizeof(struct xt_fpga_info),
+		.checkentry	= fpga_mt_check_v0,
+		.match 		= fpga_mt_v0,
+		.matchsize	= sizeof(struct xt_fpga_info_v0),
 		.me 		= THIS_MODULE
 	},
 	{
 		.name 		= "fpga",
 		.revision	= 1,
 		.family		= NFPROTO_UNSPEC,
+		.checkentry	= fpga_mt_check_v0,
+		.match 		= fpga_mt_v0,
+		.matchsize	= sizeof(struct xt_fpga_info_v0),
+		.me 		= THIS_MODULE
+	},
+	{
+		.name 		= "fpga",
+		.revision	= 2,
+		.family		= NFPROTO_UNSPEC,
+		.checkentry	= fpga_mt_check_v2,
+		.match 		= fpga_mt_v2,
+		.destroy 	= fpga_mt_destroy_v2,
+		.matchsize	= sizeof(struct xt_fpga_info_v2),
+		.me 		= THIS_MODULE
+	},
+	{
+		.name 		= "fpga",
+		.revision	= 3,
+		.family		= NFPROTO_UNSPEC,
 		.checkentry	= fpga_mt_check,
 		.match 		= fpga_mt,
 		.destroy 	= fpga_mt_destroy,
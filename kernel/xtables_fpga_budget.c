@@ -0,0 +1,259 @@
+/**
+ * Admission Control of FPGA-Based String Match Module for Xtables
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include "xtables_fpga_budget.h"
+#include "xtables_fpga_field.h"
+#include "xtables_fpga_stats.h"
+#include "dpi_accel.h"
+
+
+/** Rules with state, for /proc/net/xt_fpga/rules */
+static LIST_HEAD(Xt_Fpga_Rules);
+static DEFINE_MUTEX(Xt_Fpga_Rules_Lock);
+
+/** Policy names, indexed by XT_FPGA_POLICY_* */
+static const char *const Xt_Fpga_Policy_Names[] =
+{
+	"open",
+	"closed",
+	"software",
+	"sample",
+};
+
+
+int xt_fpga_rule_register(struct xt_fpga_rule *rule)
+{
+	rule->counters = alloc_percpu(struct xt_fpga_rule_counters);
+	if(!rule->counters)
+	{
+		return -ENOMEM;
+	}
+
+	spin_lock_init(&rule->lock);
+
+	// Convert rates into nanoseconds of budget per packet and per byte
+	rule->byte_cost_fp = rule->rate_bytes ? div64_u64((u64) NSEC_PER_SEC << 16, rule->rate_bytes) : 0;
+	rule->packet_cost = rule->rate_packets ? div_u64(NSEC_PER_SEC, rule->rate_packets) : 0;
+	rule->limited = rule->rate_bytes || rule->rate_packets || rule->auto_percent;
+
+	// Start with full buckets
+	rule->byte_credit = rule->burst_ns;
+	rule->packet_credit = rule->burst_ns;
+	rule->last_ns = ktime_to_ns(ktime_get());
+	rule->cost_refresh_ns = rule->last_ns - XT_FPGA_COST_REFRESH_NS;
+
+	mutex_lock(&Xt_Fpga_Rules_Lock);
+	list_add_tail(&rule->list, &Xt_Fpga_Rules);
+	mutex_unlock(&Xt_Fpga_Rules_Lock);
+
+	return 0;
+}
+
+
+void xt_fpga_rule_unregister(struct xt_fpga_rule *rule)
+{
+	mutex_lock(&Xt_Fpga_Rules_Lock);
+	list_del(&rule->list);
+	mutex_unlock(&Xt_Fpga_Rules_Lock);
+
+	free_percpu(rule->counters);
+}
+
+
+void xt_fpga_rule_account(struct xt_fpga_rule *rule, unsigned int received, unsigned int inspected)
+{
+	struct xt_fpga_rule_counters *counters = this_cpu_ptr(rule->counters);
+
+	counters->received += received;
+	counters->inspected += inspected;
+}
+
+
+/** Function that applies the overload policy of a rule (called under rule lock) */
+static int xt_fpga_rule_overload(struct xt_fpga_rule *rule, struct xt_fpga_rule_counters *counters)
+{
+	switch(rule->policy)
+	{
+		case XT_FPGA_POLICY_CLOSED:
+			counters->fail_closed++;
+			return XT_FPGA_BLOCK;
+
+		case XT_FPGA_POLICY_SOFTWARE:
+			counters->software++;
+			return XT_FPGA_SOFTWARE;
+
+		case XT_FPGA_POLICY_SAMPLE:
+			// Sampled packets go to the accelerator without being charged
+			if(++rule->sample_count >= rule->sample_rate)
+			{
+				rule->sample_count = 0;
+				counters->sampled++;
+				return XT_FPGA_ADMIT;
+			}
+			counters->fail_open++;
+			return XT_FPGA_PASS;
+
+		default:
+			counters->fail_open++;
+			return XT_FPGA_PASS;
+	}
+}
+
+
+int xt_fpga_rule_admit(struct xt_fpga_rule *rule, unsigned int len)
+{
+	struct xt_fpga_rule_counters *counters = this_cpu_ptr(rule->counters);
+	s64 now, elapsed;
+	u64 byte_cost;
+	int decision = XT_FPGA_ADMIT;
+
+	counters->packets++;
+
+	if(!rule->limited)
+	{
+		counters->admitted++;
+		return XT_FPGA_ADMIT;
+	}
+
+	now = ktime_to_ns(ktime_get());
+
+	spin_lock(&rule->lock);
+
+	// Refill both buckets with the time passed since the last packet
+	elapsed = now - rule->last_ns;
+	rule->last_ns = now;
+	if(elapsed > 0)
+	{
+		rule->byte_credit = min_t(u64, rule->byte_credit + elapsed, rule->burst_ns);
+		rule->packet_credit = min_t(u64, rule->packet_credit + elapsed, rule->burst_ns);
+	}
+
+	// Auto budgets follow the measured time the accelerator spends per payload
+	if(rule->auto_percent && now - rule->cost_refresh_ns >= XT_FPGA_COST_REFRESH_NS)
+	{
+		rule->cost_refresh_ns = now;
+		rule->packet_cost = div_u64((u64) dpi_accel_scan_cost_ns() * 100, rule->auto_percent);
+	}
+
+	byte_cost = (len * rule->byte_cost_fp) >> 16;
+	if(rule->packet_credit >= rule->packet_cost && rule->byte_credit >= byte_cost)
+	{
+		rule->packet_credit -= rule->packet_cost;
+		rule->byte_credit -= byte_cost;
+		counters->admitted++;
+	}
+	else
+	{
+		// A sampled packet is admitted too, but counted as sampled only
+		decision = xt_fpga_rule_overload(rule, counters);
+	}
+
+	spin_unlock(&rule->lock);
+
+	return decision;
+}
+
+
+/** Function that prints settings, decision and byte counters of every rule */
+static int xt_fpga_rules_show(struct seq_file *m, void *v)
+{
+	const struct xt_fpga_rule_counters *counters;
+	struct xt_fpga_rule_counters sum;
+	struct xt_fpga_rule *rule;
+	int cpu;
+
+	seq_printf(m, "%-16s %-8s %-9s %12s %10s %12s %12s %12s %12s %12s %12s %14s %14s\n",
+		"name", "policy", "field", "rate_bytes", "rate_pkts", "packets", "admitted",
+		"fail_open", "fail_closed", "software", "sampled", "rx_bytes", "inspected");
+
+	mutex_lock(&Xt_Fpga_Rules_Lock);
+	list_for_each_entry(rule, &Xt_Fpga_Rules, list)
+	{
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu)
+		{
+			counters = per_cpu_ptr(rule->counters, cpu);
+			sum.packets += counters->packets;
+			sum.admitted += counters->admitted;
+			sum.fail_open += counters->fail_open;
+			sum.fail_closed += counters->fail_closed;
+			sum.software += counters->software;
+			sum.sampled += counters->sampled;
+			sum.received += counters->received;
+			sum.inspected += counters->inspected;
+		}
+
+		// Settings do not change after the rule is registered
+		seq_printf(m, "%-16s %-8s %-9s ", rule->name[0] ? rule->name : "-",
+			Xt_Fpga_Policy_Names[rule->policy], xt_fpga_field_name(rule->field));
+
+		if(rule->auto_percent)
+			seq_printf(m, "%11u%% %10s ", rule->auto_percent, "auto");
+		else
+			seq_printf(m, "%12llu %10u ", (unsigned long long) rule->rate_bytes, rule->rate_packets);
+
+		seq_printf(m, "%12llu %12llu %12llu %12llu %12llu %12llu %14llu %14llu\n",
+			(unsigned long long) sum.packets, (unsigned long long) sum.admitted,
+			(unsigned long long) sum.fail_open, (unsigned long long) sum.fail_closed,
+			(unsigned long long) sum.software, (unsigned long long) sum.sampled,
+			(unsigned long long) sum.received, (unsigned long long) sum.inspected);
+	}
+	mutex_unlock(&Xt_Fpga_Rules_Lock);
+
+	return 0;
+}
+
+
+static int xt_fpga_rules_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xt_fpga_rules_show, NULL);
+}
+
+
+/** File operations of /proc/net/xt_fpga/rules */
+static const struct file_operations Xt_Fpga_Rules_Fops =
+{
+	.owner		= THIS_MODULE,
+	.open		= xt_fpga_rules_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+
+int xt_fpga_rules_init(void)
+{
+	if(!proc_create("rules", 0444, xt_fpga_proc_dir, &Xt_Fpga_Rules_Fops))
+	{
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+
+void xt_fpga_rules_exit(void)
+{
+	remove_proc_entry("rules", xt_fpga_proc_dir);
+}
@@ -0,0 +1,127 @@
+#ifndef _XTABLES_FPGA_BUDGET_H
+#define _XTABLES_FPGA_BUDGET_H
+
+/**
+ * Admission Control of FPGA-Based String Match Module for Xtables
+ * Per-rule token buckets in front of the accelerator, listed in
+ * /proc/net/xt_fpga/rules
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+/** Overload policies: what a rule does with packets over its budget */
+#define XT_FPGA_POLICY_OPEN				0		// Let the packet pass uninspected
+#define XT_FPGA_POLICY_CLOSED			1		// Treat the packet as matching
+#define XT_FPGA_POLICY_SOFTWARE			2		// Inspect it with the software matcher
+#define XT_FPGA_POLICY_SAMPLE			3		// Inspect 1 in sample_rate, let others pass
+
+/** Rule setting limits */
+#define XT_FPGA_NAME_LEN				16
+#define XT_FPGA_DEFAULT_BURST_MS		100
+#define XT_FPGA_MAX_BURST_MS			1000
+
+/** Admission decisions */
+#define XT_FPGA_ADMIT					0		// Send the payload to the accelerator
+#define XT_FPGA_PASS					1		// Do not inspect, no match
+#define XT_FPGA_BLOCK					2		// Do not inspect, treat as match
+#define XT_FPGA_SOFTWARE				3		// Inspect with the software matcher
+
+/** Interval of refreshing the measured accelerator cost (auto budgets) */
+#define XT_FPGA_COST_REFRESH_NS			(100 * NSEC_PER_MSEC)
+
+/** Decisions and bytes of a rule on one CPU */
+struct xt_fpga_rule_counters
+{
+	u64 packets;
+	u64 admitted;
+	u64 fail_open;
+	u64 fail_closed;
+	u64 software;
+	u64 sampled;
+
+	// Bytes received and sent to the matcher
+	u64 received;
+	u64 inspected;
+};
+
+/** Kernel-private state of a revision 2 or 3 rule */
+struct xt_fpga_rule
+{
+	struct list_head list;
+	char name[XT_FPGA_NAME_LEN];
+
+	// Settings, copied from struct xt_fpga_info (read-only once registered)
+	u8 policy;
+	u8 auto_percent;
+	u32 sample_rate;
+	u64 rate_bytes;
+	u32 rate_packets;
+	u64 burst_ns;
+	u8 field;
+
+	// Token buckets. Credits are nanoseconds of budget, capped at burst_ns;
+	// a packet costs packet_cost and each byte costs byte_cost_fp >> 16.
+	// Unlimited rules never take the lock.
+	bool limited;
+	spinlock_t lock;
+	u64 byte_credit;
+	u64 packet_credit;
+	u64 byte_cost_fp;
+	u64 packet_cost;
+	s64 last_ns;
+	s64 cost_refresh_ns;
+	u32 sample_count;
+
+	// Counters of every CPU (lockless)
+	struct xt_fpga_rule_counters __percpu *counters;
+};
+
+/**
+ *	This function prepares the token buckets and counters of a rule
+ *	whose settings are filled in and makes it visible in
+ *	/proc/net/xt_fpga/rules.
+ *		returns 0 on success
+ *		returns -ENOMEM if the counters cannot be allocated
+ */
+int xt_fpga_rule_register(struct xt_fpga_rule *);
+
+/** The function that removes a rule from /proc/net/xt_fpga/rules and frees its counters */
+void xt_fpga_rule_unregister(struct xt_fpga_rule *);
+
+/**
+ *	This function counts the bytes a rule received and the bytes of them
+ *	that went to the matcher. Caller must run with bottom halves disabled.
+ */
+void xt_fpga_rule_account(struct xt_fpga_rule *, unsigned int, unsigned int);
+
+/**
+ *	This function charges a payload that would go to the accelerator
+ *	against the budget of its rule. Caller must run with bottom halves
+ *	disabled.
+ *		returns XT_FPGA_ADMIT if it fits in the budget
+ *		returns the decision of the overload policy otherwise
+ */
+int xt_fpga_rule_admit(struct xt_fpga_rule *, unsigned int);
+
+/** The function that creates /proc/net/xt_fpga/rules */
+int xt_fpga_rules_init(void);
+
+/** The function that removes /proc/net/xt_fpga/rules */
+void xt_fpga_rules_exit(void);
+
+#endif
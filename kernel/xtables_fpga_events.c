@@ -0,0 +1,305 @@
+/**
+ * Match Events of FPGA-Based String Match Module for Xtables
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/capability.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include "xtables_fpga_events.h"
+#include "xtables_fpga_stats.h"
+#include "xtables_fpga_budget.h"
+#include "xtables_fpga_field.h"
+
+
+/** Rings of all CPUs, XT_FPGA_EVENT_STRIDE bytes each */
+static void *Xt_Fpga_Events;
+
+#define XT_FPGA_EVENT_STRIDE			PAGE_ALIGN(sizeof(struct dpi_event_ring_ctrl) + \
+											XT_FPGA_EVENT_ENTRIES * sizeof(struct dpi_event))
+
+/** Reader waiting for events, and whether /dev/dpi_events is open */
+static DECLARE_WAIT_QUEUE_HEAD(Xt_Fpga_Events_Wait);
+static atomic_t Xt_Fpga_Events_Busy = ATOMIC_INIT(0);
+
+
+/** Function that returns the ring of a CPU */
+static struct dpi_event_ring_ctrl *xt_fpga_event_ring(int cpu)
+{
+	return Xt_Fpga_Events + cpu * XT_FPGA_EVENT_STRIDE;
+}
+
+
+/** Function that fills in addresses and ports of an event (IPv4 and IPv6 only) */
+static void xt_fpga_event_tuple(struct dpi_event *ev, const struct sk_buff *skb,
+								const struct xt_action_param *par)
+{
+	const struct iphdr *iph;
+	const __be16 *ports;
+	__be16 buf[2];
+	unsigned int thoff;
+#if IS_ENABLED(CONFIG_IPV6)
+	const struct ipv6hdr *ip6h;
+#endif
+
+	switch(par->family)
+	{
+		case NFPROTO_IPV4:
+			iph = ip_hdr(skb);
+			ev->family = AF_INET;
+			memcpy(ev->saddr, &iph->saddr, sizeof(iph->saddr));
+			memcpy(ev->daddr, &iph->daddr, sizeof(iph->daddr));
+			break;
+
+#if IS_ENABLED(CONFIG_IPV6)
+		case NFPROTO_IPV6:
+			ip6h = ipv6_hdr(skb);
+			ev->family = AF_INET6;
+			memcpy(ev->saddr, &ip6h->saddr, sizeof(ip6h->saddr));
+			memcpy(ev->daddr, &ip6h->daddr, sizeof(ip6h->daddr));
+			break;
+#endif
+
+		default:
+			return;
+	}
+
+	if(!xt_fpga_transport(skb, par, &thoff, &ev->protocol))
+	{
+		return;
+	}
+
+	switch(ev->protocol)
+	{
+		case IPPROTO_TCP:
+		case IPPROTO_UDP:
+		case IPPROTO_UDPLITE:
+		case IPPROTO_SCTP:
+		case IPPROTO_DCCP:
+			ports = skb_header_pointer(skb, thoff, sizeof(buf), buf);
+			if(ports)
+			{
+				ev->sport = ntohs(ports[0]);
+				ev->dport = ntohs(ports[1]);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+void xt_fpga_event_log(const struct sk_buff *skb, const struct xt_action_param *par, const char *rule,
+					const struct xt_fpga_hit *hit)
+{
+	struct dpi_event_ring_ctrl *ring;
+	struct dpi_event *ev;
+	u32 head, tail;
+
+	ring = xt_fpga_event_ring(smp_processor_id());
+	head = ring->head;
+	tail = ACCESS_ONCE(ring->tail);
+
+	// The reader owns tail; whatever it writes there, the kernel only
+	// writes inside the ring
+	if(head - tail >= XT_FPGA_EVENT_ENTRIES)
+	{
+		ring->dropped++;
+		XT_FPGA_STAT_INC(events_dropped);
+		return;
+	}
+
+	ev = (struct dpi_event *) (ring + 1) + (head & XT_FPGA_EVENT_MASK);
+	memset(ev, 0, sizeof(*ev));
+	ev->timestamp = ktime_to_ns(ktime_get_real());
+	ev->pattern_id = hit->pattern_id;
+	ev->offset = hit->offset;
+	ev->len = hit->len;
+	ev->field = hit->field;
+	ev->flags = hit->flags;
+	if(rule)
+	{
+		memcpy(ev->rule, rule, DPI_EVENT_RULE_LEN);
+	}
+	xt_fpga_event_tuple(ev, skb, par);
+
+	// Publish the event before the new head
+	smp_wmb();
+	ACCESS_ONCE(ring->head) = head + 1;
+	XT_FPGA_STAT_INC(events);
+
+	// A reader sleeps only when every ring is empty
+	if(head == tail)
+	{
+		smp_mb();
+		if(waitqueue_active(&Xt_Fpga_Events_Wait))
+		{
+			wake_up_interruptible(&Xt_Fpga_Events_Wait);
+		}
+	}
+}
+
+
+/** Function that returns true if some ring has events the reader has not consumed */
+static bool xt_fpga_events_ready(void)
+{
+	struct dpi_event_ring_ctrl *ring;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		ring = xt_fpga_event_ring(cpu);
+		if(ACCESS_ONCE(ring->head) != ACCESS_ONCE(ring->tail))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+static long xt_fpga_events_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct dpi_event_params params;
+
+	if(cmd != DPI_IOC_EVENT_PARAMS)
+	{
+		return -ENOTTY;
+	}
+
+	params.num_rings = nr_cpu_ids;
+	params.entries = XT_FPGA_EVENT_ENTRIES;
+	params.ring_stride = XT_FPGA_EVENT_STRIDE;
+	params.event_size = sizeof(struct dpi_event);
+
+	if(copy_to_user((void __user *) arg, &params, sizeof(params)))
+	{
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+
+static int xt_fpga_events_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if(vma->vm_pgoff || size > nr_cpu_ids * XT_FPGA_EVENT_STRIDE)
+	{
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, Xt_Fpga_Events, 0);
+}
+
+
+static unsigned int xt_fpga_events_poll(struct file *filp, poll_table *wait)
+{
+	poll_wait(filp, &Xt_Fpga_Events_Wait, wait);
+
+	return xt_fpga_events_ready() ? (POLLIN | POLLRDNORM) : 0;
+}
+
+
+static int xt_fpga_events_open(struct inode *inode, struct file *filp)
+{
+	// Events carry addresses of the traffic
+	if(!capable(CAP_NET_ADMIN))
+	{
+		return -EPERM;
+	}
+
+	// Tails have a single owner
+	if(atomic_cmpxchg(&Xt_Fpga_Events_Busy, 0, 1))
+	{
+		return -EBUSY;
+	}
+
+	return 0;
+}
+
+
+static int xt_fpga_events_release(struct inode *inode, struct file *filp)
+{
+	atomic_set(&Xt_Fpga_Events_Busy, 0);
+	return 0;
+}
+
+
+/** File operations of /dev/dpi_events */
+static const struct file_operations Xt_Fpga_Events_Fops =
+{
+	.owner			= THIS_MODULE,
+	.open			= xt_fpga_events_open,
+	.release		= xt_fpga_events_release,
+	.unlocked_ioctl	= xt_fpga_events_ioctl,
+	.mmap			= xt_fpga_events_mmap,
+	.poll			= xt_fpga_events_poll,
+	.llseek			= noop_llseek,
+};
+
+
+/** Misc device entry for /dev/dpi_events */
+static struct miscdevice Xt_Fpga_Events_Dev =
+{
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= DPI_EVENTS_DEVICE_NAME,
+	.fops		= &Xt_Fpga_Events_Fops,
+};
+
+
+int xt_fpga_events_init(void)
+{
+	int retval;
+
+	BUILD_BUG_ON(DPI_EVENT_RULE_LEN != XT_FPGA_NAME_LEN);
+	BUILD_BUG_ON(sizeof(struct dpi_event_ring_ctrl) != 128);
+	BUILD_BUG_ON(sizeof(struct dpi_event) % 8);
+
+	// Zeroed and mappable; rings are indexed by CPU number
+	Xt_Fpga_Events = vmalloc_user(nr_cpu_ids * XT_FPGA_EVENT_STRIDE);
+	if(!Xt_Fpga_Events)
+	{
+		return -ENOMEM;
+	}
+
+	retval = misc_register(&Xt_Fpga_Events_Dev);
+	if(retval)
+	{
+		vfree(Xt_Fpga_Events);
+		Xt_Fpga_Events = NULL;
+	}
+
+	return retval;
+}
+
+
+void xt_fpga_events_exit(void)
+{
+	misc_deregister(&Xt_Fpga_Events_Dev);
+	vfree(Xt_Fpga_Events);
+	Xt_Fpga_Events = NULL;
+}
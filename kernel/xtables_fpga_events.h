@@ -0,0 +1,60 @@
+#ifndef _XTABLES_FPGA_EVENTS_H
+#define _XTABLES_FPGA_EVENTS_H
+
+/**
+ * Match Events of FPGA-Based String Match Module for Xtables
+ *
+ * Rules with --print log every matching packet into a ring of the CPU that
+ * matched it, instead of the kernel log. A CPU is the only writer of its
+ * ring (netfilter hooks run with bottom halves disabled), so logging takes
+ * no lock and does not wait: when the reader falls behind, events are
+ * dropped and counted. The rings are read through mmap of /dev/dpi_events,
+ * see struct dpi_event_ring_ctrl.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/skbuff.h>
+#include <linux/netfilter/x_tables.h>
+#include "dpi_user.h"
+
+/** Events per CPU (power of two) */
+#define XT_FPGA_EVENT_ENTRIES			512
+#define XT_FPGA_EVENT_MASK				(XT_FPGA_EVENT_ENTRIES - 1)
+
+/** A match as the matcher reports it */
+struct xt_fpga_hit
+{
+	u32 pattern_id;
+	u32 offset;
+	unsigned int len;
+	u8 field;				// XT_FPGA_FIELD_* offset and len refer to
+	u8 flags;				// DPI_EVENT_*
+};
+
+/**
+ *	This function writes a match event into the ring of the current CPU.
+ *	Caller must run with bottom halves disabled (netfilter hooks do). The
+ *	rule name may be NULL.
+ */
+void xt_fpga_event_log(const struct sk_buff *, const struct xt_action_param *, const char *,
+					const struct xt_fpga_hit *);
+
+/** The function that allocates the rings and registers /dev/dpi_events */
+int xt_fpga_events_init(void);
+
+/** The function that deregisters /dev/dpi_events and frees the rings */
+void xt_fpga_events_exit(void);
+
+#endif
@@ -0,0 +1,350 @@
+/**
+ * Protocol Fields of FPGA-Based String Match Module for Xtables
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/in.h>
+#include <net/ipv6.h>
+#include "xtables_fpga_field.h"
+
+
+/** DNS name buffer of every CPU */
+static DEFINE_PER_CPU(u8 *, Xt_Fpga_Dns_Name);
+
+/** Field names, indexed by XT_FPGA_FIELD_* */
+static const char *const Xt_Fpga_Field_Names[] =
+{
+	"packet",
+	"http-host",
+	"http-uri",
+	"tls-sni",
+	"dns-qname",
+};
+
+
+bool xt_fpga_transport(const struct sk_buff *skb, const struct xt_action_param *par, unsigned int *thoff,
+					u8 *protocol)
+{
+#if IS_ENABLED(CONFIG_IPV6)
+	unsigned short fragoff = 0;
+	int nexthdr;
+#endif
+
+	switch(par->family)
+	{
+		case NFPROTO_IPV4:
+			*protocol = ip_hdr(skb)->protocol;
+
+			// Later fragments carry no transport header
+			if(par->fragoff)
+			{
+				return false;
+			}
+			*thoff = par->thoff;
+			return true;
+
+#if IS_ENABLED(CONFIG_IPV6)
+		case NFPROTO_IPV6:
+			// ip6tables sets thoff only for rules with a protocol
+			*thoff = 0;
+			nexthdr = ipv6_find_hdr(skb, thoff, -1, &fragoff, NULL);
+			if(nexthdr < 0)
+			{
+				return false;
+			}
+			*protocol = nexthdr;
+
+			return !fragoff;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+
+/** Function that returns the length of a line without its CR LF or LF */
+static unsigned int xt_fpga_line_len(const u8 *p, unsigned int len)
+{
+	const u8 *lf = memchr(p, '\n', len);
+	unsigned int n = lf ? lf - p : len;
+
+	return (n && p[n - 1] == '\r') ? n - 1 : n;
+}
+
+
+/**
+ *	Function that finds the request target or the Host header of an HTTP
+ *	request. Headers are read up to the empty line or the end of the segment.
+ */
+static bool xt_fpga_http(const u8 *p, unsigned int len, u8 field, const u8 **out, unsigned int *out_len)
+{
+	const u8 *lf;
+	unsigned int i, n;
+
+	// Request line: method SP request-target SP version
+	for(i = 0; i < len && i < XT_FPGA_HTTP_METHOD_MAX && p[i] >= 'A' && p[i] <= 'Z'; i++);
+	if(!i || i == len || p[i] != ' ')
+	{
+		return false;
+	}
+
+	p += i + 1;
+	len -= i + 1;
+
+	if(field == XT_FPGA_FIELD_HTTP_URI)
+	{
+		for(n = 0; n < len && p[n] != ' ' && p[n] != '\r' && p[n] != '\n'; n++);
+
+		*out = p;
+		*out_len = n;
+		return n > 0;
+	}
+
+	for(;;)
+	{
+		lf = memchr(p, '\n', len);
+		if(!lf)
+		{
+			return false;
+		}
+		len -= lf + 1 - p;
+		p = lf + 1;
+
+		n = xt_fpga_line_len(p, len);
+		if(!n)
+		{
+			return false;
+		}
+
+		if(n > 5 && !strncasecmp((const char *) p, "host:", 5))
+		{
+			for(i = 5; i < n && (p[i] == ' ' || p[i] == '\t'); i++);
+			for(; n > i && (p[n - 1] == ' ' || p[n - 1] == '\t'); n--);
+
+			*out = p + i;
+			*out_len = n - i;
+			return n > i;
+		}
+	}
+}
+
+
+/** Function that reads a big endian 16-bit length */
+static unsigned int xt_fpga_be16(const u8 *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+
+/**
+ *	Function that finds the host name of the server_name extension in a TLS
+ *	ClientHello. The hello must start in the first record of the segment.
+ */
+static bool xt_fpga_tls_sni(const u8 *p, unsigned int len, const u8 **out, unsigned int *out_len)
+{
+	unsigned int i, end, ext_end, type, n;
+
+	// Record header (handshake, TLS 1.x), handshake header (ClientHello)
+	if(len < 9 || p[0] != 22 || p[1] != 3 || p[5] != 1)
+	{
+		return false;
+	}
+	end = min(len, 5 + xt_fpga_be16(p + 3));
+
+	// Version and random, then session id, cipher suites, compression methods
+	i = 5 + 4 + 2 + 32;
+	if(i + 1 > end)
+	{
+		return false;
+	}
+	i += 1 + p[i];
+	if(i + 2 > end)
+	{
+		return false;
+	}
+	i += 2 + xt_fpga_be16(p + i);
+	if(i + 1 > end)
+	{
+		return false;
+	}
+	i += 1 + p[i];
+	if(i + 2 > end)
+	{
+		return false;
+	}
+
+	ext_end = min(end, i + 2 + xt_fpga_be16(p + i));
+	for(i += 2; i + 4 <= ext_end; i += 4 + n)
+	{
+		type = xt_fpga_be16(p + i);
+		n = xt_fpga_be16(p + i + 2);
+		if(type != 0)
+		{
+			continue;
+		}
+
+		// server_name_list: list length, then name type 0 (host_name) and name
+		if(n < 5 || i + 4 + n > ext_end || p[i + 6] != 0)
+		{
+			return false;
+		}
+
+		n = min(xt_fpga_be16(p + i + 7), n - 5);
+		*out = p + i + 9;
+		*out_len = n;
+		return n > 0;
+	}
+
+	return false;
+}
+
+
+/** Function that writes the first question name of a DNS message in dotted form */
+static bool xt_fpga_dns_qname(const u8 *p, unsigned int len, const u8 **out, unsigned int *out_len)
+{
+	u8 *name = this_cpu_read(Xt_Fpga_Dns_Name);
+	unsigned int i = 12, n = 0, label;
+
+	// Header with at least one question
+	if(len < 12 || !xt_fpga_be16(p + 4))
+	{
+		return false;
+	}
+
+	while(i < len && p[i])
+	{
+		label = p[i];
+
+		// Questions are not compressed; a pointer or a long name is malformed
+		if(label > 63 || i + 1 + label > len || n + label + 1 > XT_FPGA_DNS_NAME_MAX)
+		{
+			return false;
+		}
+
+		if(n)
+		{
+			name[n++] = '.';
+		}
+		memcpy(name + n, p + i + 1, label);
+		n += label;
+		i += 1 + label;
+	}
+
+	if(i == len || !n)
+	{
+		return false;
+	}
+
+	*out = name;
+	*out_len = n;
+	return true;
+}
+
+
+bool xt_fpga_field_find(const struct sk_buff *skb, const struct xt_action_param *par, u8 field,
+						const u8 **out, unsigned int *out_len)
+{
+	const struct tcphdr *th;
+	unsigned int thoff, off;
+	u8 protocol = 0;
+
+	if(!xt_fpga_transport(skb, par, &thoff, &protocol))
+	{
+		return false;
+	}
+
+	// Fields are taken from the linear part of the packet only
+	switch(field)
+	{
+		case XT_FPGA_FIELD_HTTP_HOST:
+		case XT_FPGA_FIELD_HTTP_URI:
+		case XT_FPGA_FIELD_TLS_SNI:
+			if(protocol != IPPROTO_TCP || thoff + sizeof(*th) > skb_headlen(skb))
+			{
+				return false;
+			}
+			th = (const struct tcphdr *) (skb->data + thoff);
+			off = thoff + th->doff * 4;
+			if(off >= skb_headlen(skb))
+			{
+				return false;
+			}
+
+			if(field == XT_FPGA_FIELD_TLS_SNI)
+			{
+				return xt_fpga_tls_sni(skb->data + off, skb_headlen(skb) - off, out, out_len);
+			}
+			return xt_fpga_http(skb->data + off, skb_headlen(skb) - off, field, out, out_len);
+
+		case XT_FPGA_FIELD_DNS_QNAME:
+			off = thoff + sizeof(struct udphdr);
+			if(protocol != IPPROTO_UDP || off >= skb_headlen(skb))
+			{
+				return false;
+			}
+			return xt_fpga_dns_qname(skb->data + off, skb_headlen(skb) - off, out, out_len);
+
+		default:
+			return false;
+	}
+}
+
+
+const char *xt_fpga_field_name(u8 field)
+{
+	return field <= XT_FPGA_FIELD_LAST ? Xt_Fpga_Field_Names[field] : "?";
+}
+
+
+int xt_fpga_field_init(void)
+{
+	int cpu;
+	u8 *name;
+
+	BUILD_BUG_ON(ARRAY_SIZE(Xt_Fpga_Field_Names) != XT_FPGA_FIELD_LAST + 1);
+
+	for_each_possible_cpu(cpu)
+	{
+		name = kmalloc(XT_FPGA_DNS_NAME_MAX, GFP_KERNEL);
+		if(!name)
+		{
+			xt_fpga_field_exit();
+			return -ENOMEM;
+		}
+		per_cpu(Xt_Fpga_Dns_Name, cpu) = name;
+	}
+
+	return 0;
+}
+
+
+void xt_fpga_field_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		kfree(per_cpu(Xt_Fpga_Dns_Name, cpu));
+		per_cpu(Xt_Fpga_Dns_Name, cpu) = NULL;
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef _XTABLES_FPGA_FIELD_H
+#define _XTABLES_FPGA_FIELD_H
+
+/**
+ * Protocol Fields of FPGA-Based String Match Module for Xtables
+ *
+ * A rule can inspect one field of the application protocol instead of the
+ * whole packet. Every parser makes a single bounded pass over the linear
+ * part of the packet and returns the field in place; DNS names are copied
+ * into a buffer of the CPU in dotted form. Only the field goes to the
+ * accelerator or the software matcher.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/skbuff.h>
+#include <linux/netfilter/x_tables.h>
+
+/** Inspected fields */
+#define XT_FPGA_FIELD_PACKET			0		// Whole packet from the network header
+#define XT_FPGA_FIELD_HTTP_HOST			1		// Host header of an HTTP request
+#define XT_FPGA_FIELD_HTTP_URI			2		// Request target of an HTTP request line
+#define XT_FPGA_FIELD_TLS_SNI			3		// Server name of a TLS ClientHello
+#define XT_FPGA_FIELD_DNS_QNAME			4		// First question name of a DNS message
+#define XT_FPGA_FIELD_LAST				XT_FPGA_FIELD_DNS_QNAME
+
+/** Longest method token of an HTTP request line */
+#define XT_FPGA_HTTP_METHOD_MAX			16
+
+/** Size of the buffer DNS names are written into (dotted, with terminating dot left out) */
+#define XT_FPGA_DNS_NAME_MAX			256
+
+/**
+ *	This function finds the transport header of an IPv4 or IPv6 packet.
+ *	The protocol is stored whenever it is known.
+ *		returns true if the transport header is in this packet
+ *		returns false for other families and later fragments
+ */
+bool xt_fpga_transport(const struct sk_buff *, const struct xt_action_param *, unsigned int *, u8 *);
+
+/**
+ *	This function finds a field (XT_FPGA_FIELD_*, not XT_FPGA_FIELD_PACKET)
+ *	in a packet. Caller must run with bottom halves disabled; a DNS name
+ *	stays valid until the next call on the CPU.
+ *		returns true and the bytes of the field if it is found
+ *		returns false otherwise
+ */
+bool xt_fpga_field_find(const struct sk_buff *, const struct xt_action_param *, u8, const u8 **, unsigned int *);
+
+/** The function that returns the name of a field, as in the --field option */
+const char *xt_fpga_field_name(u8);
+
+/** The function that allocates DNS name buffers of every CPU */
+int xt_fpga_field_init(void);
+
+/** The function that frees DNS name buffers */
+void xt_fpga_field_exit(void);
+
+#endif
@@ -0,0 +1,973 @@
+/**
+ * Compressed HTTP Bodies of FPGA-Based String Match Module for Xtables
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/zlib.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <net/tcp.h>
+#include "xtables_fpga_inflate.h"
+#include "xtables_fpga_field.h"
+#include "xtables_fpga_stats.h"
+#include "dpi_ruleset.h"
+
+
+/** Slots of the pool, each with its own inflate window */
+static unsigned int inflate_flows = 32;
+module_param(inflate_flows, uint, 0444);
+MODULE_PARM_DESC(inflate_flows, "Compressed HTTP bodies inspected at once (about 40 KB each, 0 disables --inflate)");
+
+/** Per-flow budget */
+static unsigned int inflate_flow_bytes = 1 << 20;
+module_param(inflate_flow_bytes, uint, 0644);
+MODULE_PARM_DESC(inflate_flow_bytes, "Decompressed bytes inspected per HTTP body");
+
+/** Module-wide budget */
+static unsigned int inflate_rate = 16 << 20;
+module_param(inflate_rate, uint, 0644);
+MODULE_PARM_DESC(inflate_rate, "Decompressed bytes per second inspected by all bodies together (0 is unlimited)");
+
+/** Largest pool that can be asked for */
+#define XT_FPGA_INFLATE_FLOWS_MAX		4096
+
+/** Stages of a body */
+#define XT_FPGA_BODY_GZIP				0		// gzip member header
+#define XT_FPGA_BODY_DEFLATE			1		// zlib or raw deflate, told by the first byte
+#define XT_FPGA_BODY_INFLATE			2		// Compressed data
+#define XT_FPGA_BODY_DONE				3		// Ended or given up
+
+/** Stages of chunked transfer coding */
+#define XT_FPGA_CHUNK_SIZE				0		// Hex digits of the size
+#define XT_FPGA_CHUNK_EXT				1		// Rest of the size line
+#define XT_FPGA_CHUNK_DATA				2
+#define XT_FPGA_CHUNK_DATA_END			3		// CR LF after the data
+
+/** Parts of a gzip member header (RFC 1952), in order */
+#define XT_FPGA_GZIP_FIXED				0		// ID1 ID2 CM FLG MTIME XFL OS
+#define XT_FPGA_GZIP_XLEN				1
+#define XT_FPGA_GZIP_EXTRA				2
+#define XT_FPGA_GZIP_NAME				3
+#define XT_FPGA_GZIP_COMMENT			4
+#define XT_FPGA_GZIP_HCRC				5
+
+#define XT_FPGA_GZIP_FHCRC				0x02
+#define XT_FPGA_GZIP_FEXTRA				0x04
+#define XT_FPGA_GZIP_FNAME				0x08
+#define XT_FPGA_GZIP_FCOMMENT			0x10
+
+/** Sender of a response; IPv4 addresses take the first 4 bytes */
+struct xt_fpga_flow_key
+{
+	u8 saddr[16];
+	u8 daddr[16];
+	__be16 sport;
+	__be16 dport;
+	u8 family;
+	u8 pad[3];
+};
+
+/** TCP payload of a packet */
+struct xt_fpga_segment
+{
+	struct xt_fpga_flow_key key;
+	u32 hash;
+	u32 seq;
+	const u8 *data;
+	unsigned int len;
+};
+
+/** A slot of the pool */
+struct xt_fpga_flow
+{
+	struct hlist_node node;		// Hash bucket, while hashed
+	struct list_head lru;		// Hashed slots by last use (ended bodies first), or the free list
+	struct xt_fpga_flow_key key;
+
+	// Everything below is under lock
+	spinlock_t lock;
+	unsigned long last_used;
+	u32 seq;					// Next sequence number of the body
+
+	// Decoding
+	u8 stage;
+	bool chunked;
+	u8 chunk_stage;
+	u32 chunk_left;
+	u8 gzip_part;
+	u8 gzip_flags;
+	u16 gzip_left;
+	z_stream zs;
+
+	// Matching
+	u32 generation;
+	u32 dfa_state;
+	u32 inflated;				// Decompressed bytes of the body
+	u32 packet_inflated;		// Of them, bytes of the current packet
+	bool packet_matched;
+
+	// Result of the last packet, for other rules and retransmissions
+	bool last_valid;
+	bool last_matched;
+	u32 last_seq;
+	unsigned int last_len;
+	struct xt_fpga_hit last_hit;
+};
+
+/** Slot pool, inflate windows and hash table; all allocated at module load */
+static struct xt_fpga_flow *Xt_Fpga_Flows;
+static void *Xt_Fpga_Flow_Workspaces;
+static struct hlist_head *Xt_Fpga_Flow_Hash;
+static unsigned int Xt_Fpga_Flow_Hash_Mask;
+static u32 Xt_Fpga_Flow_Seed;
+
+/** Hash table and slot lists; slot locks are only tried while it is held */
+static DEFINE_SPINLOCK(Xt_Fpga_Flow_Lock);
+static LIST_HEAD(Xt_Fpga_Flow_Lru);
+static LIST_HEAD(Xt_Fpga_Flow_Free);
+
+/** Decompressed byte budget of all flows, in bytes */
+static DEFINE_SPINLOCK(Xt_Fpga_Inflate_Budget_Lock);
+static s64 Xt_Fpga_Inflate_Credit;
+static s64 Xt_Fpga_Inflate_Last_Ns;
+
+/** Output buffer of every CPU */
+static DEFINE_PER_CPU(u8 *, Xt_Fpga_Inflate_Out);
+
+
+/** Function that finds the TCP payload and the sender of a packet (linear packets only) */
+static bool xt_fpga_inflate_segment(const struct sk_buff *skb, const struct xt_action_param *par,
+									struct xt_fpga_segment *seg)
+{
+	const struct tcphdr *th;
+	const struct iphdr *iph;
+	const struct ipv6hdr *ip6h;
+	unsigned int thoff, off;
+	u8 protocol = 0;
+
+	if(!xt_fpga_transport(skb, par, &thoff, &protocol) || protocol != IPPROTO_TCP ||
+		thoff + sizeof(*th) > skb_headlen(skb))
+	{
+		return false;
+	}
+
+	th = (const struct tcphdr *) (skb->data + thoff);
+	off = thoff + th->doff * 4;
+	if(off >= skb_headlen(skb))
+	{
+		return false;
+	}
+
+	memset(&seg->key, 0, sizeof(seg->key));
+	if(par->family == NFPROTO_IPV4)
+	{
+		iph = ip_hdr(skb);
+		memcpy(seg->key.saddr, &iph->saddr, sizeof(iph->saddr));
+		memcpy(seg->key.daddr, &iph->daddr, sizeof(iph->daddr));
+	}
+	else
+	{
+		ip6h = ipv6_hdr(skb);
+		memcpy(seg->key.saddr, &ip6h->saddr, sizeof(ip6h->saddr));
+		memcpy(seg->key.daddr, &ip6h->daddr, sizeof(ip6h->daddr));
+	}
+	seg->key.sport = th->source;
+	seg->key.dport = th->dest;
+	seg->key.family = par->family;
+	seg->hash = jhash2((const u32 *) &seg->key, sizeof(seg->key) / sizeof(u32), Xt_Fpga_Flow_Seed);
+
+	// Payload in fragments is not read; it shows up as a gap in the body
+	seg->seq = ntohl(th->seq);
+	seg->data = skb->data + off;
+	seg->len = skb_headlen(skb) - off;
+
+	return true;
+}
+
+
+/** Function that returns the length of a line without its CR LF or LF */
+static unsigned int xt_fpga_inflate_line_len(const u8 *p, unsigned int len)
+{
+	const u8 *lf = memchr(p, '\n', len);
+	unsigned int n = lf ? lf - p : len;
+
+	return (n && p[n - 1] == '\r') ? n - 1 : n;
+}
+
+
+/** Function that returns true if a header line has the name and stores its trimmed value */
+static bool xt_fpga_inflate_header(const u8 *line, unsigned int n, const char *name, const u8 **value,
+								unsigned int *value_len)
+{
+	unsigned int i = strlen(name);
+
+	if(n <= i || strncasecmp((const char *) line, name, i))
+	{
+		return false;
+	}
+
+	for(; i < n && (line[i] == ' ' || line[i] == '\t'); i++);
+	for(; n > i && (line[n - 1] == ' ' || line[n - 1] == '\t'); n--);
+
+	*value = line + i;
+	*value_len = n - i;
+	return true;
+}
+
+
+/**
+ *	Function that checks if a segment starts an HTTP response with a gzip or
+ *	deflate body, and stores the first stage and the transfer coding of the
+ *	body. The response header must end in the segment.
+ *		returns the offset of the body, 0 if the body is not inspected
+ */
+static unsigned int xt_fpga_inflate_response(const u8 *p, unsigned int len, u8 *stage, bool *chunked)
+{
+	const u8 *line, *lf, *value;
+	unsigned int n, value_len, status;
+
+	// Status line; 1xx, 204 and 304 responses have no body
+	if(len < 12 || memcmp(p, "HTTP/1.", 7) || p[8] != ' ' ||
+		p[9] < '1' || p[9] > '5' || p[10] < '0' || p[10] > '9' || p[11] < '0' || p[11] > '9')
+	{
+		return 0;
+	}
+	status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+	if(status < 200 || status == 204 || status == 304)
+	{
+		return 0;
+	}
+
+	*stage = XT_FPGA_BODY_DONE;
+	*chunked = false;
+
+	for(line = p; ; line = lf + 1)
+	{
+		lf = memchr(line, '\n', p + len - line);
+		if(!lf)
+		{
+			return 0;
+		}
+
+		// The status line is skipped, an empty line ends the header
+		if(line == p)
+		{
+			continue;
+		}
+
+		n = xt_fpga_inflate_line_len(line, lf + 1 - line);
+		if(!n)
+		{
+			break;
+		}
+
+		if(n > XT_FPGA_INFLATE_LINE_MAX)
+		{
+			continue;
+		}
+
+		// A single coding only; "gzip, br" and others are not inspected
+		if(xt_fpga_inflate_header(line, n, "content-encoding:", &value, &value_len))
+		{
+			if((value_len == 4 && !strncasecmp((const char *) value, "gzip", 4)) ||
+				(value_len == 6 && !strncasecmp((const char *) value, "x-gzip", 6)))
+				*stage = XT_FPGA_BODY_GZIP;
+			else if(value_len == 7 && !strncasecmp((const char *) value, "deflate", 7))
+				*stage = XT_FPGA_BODY_DEFLATE;
+			else
+				*stage = XT_FPGA_BODY_DONE;
+		}
+		else if(xt_fpga_inflate_header(line, n, "transfer-encoding:", &value, &value_len))
+		{
+			// chunked is the last transfer coding when present
+			*chunked = value_len >= 7 && !strncasecmp((const char *) value + value_len - 7, "chunked", 7);
+		}
+	}
+
+	return *stage == XT_FPGA_BODY_DONE ? 0 : lf + 1 - p;
+}
+
+
+/** Function that takes decompressed bytes from the module-wide budget */
+static bool xt_fpga_inflate_charge(u32 bytes)
+{
+	s64 now, elapsed, burst;
+	u32 rate = ACCESS_ONCE(inflate_rate);
+	bool admit;
+
+	if(!rate)
+	{
+		return true;
+	}
+
+	// Up to 100 ms of budget (at least one packet worth) can be saved up
+	burst = max_t(s64, rate / 10, XT_FPGA_INFLATE_PACKET_MAX);
+	now = ktime_to_ns(ktime_get());
+
+	spin_lock(&Xt_Fpga_Inflate_Budget_Lock);
+	elapsed = min_t(s64, now - Xt_Fpga_Inflate_Last_Ns, NSEC_PER_SEC);
+	Xt_Fpga_Inflate_Last_Ns = now;
+	if(elapsed > 0)
+	{
+		Xt_Fpga_Inflate_Credit = min_t(s64, Xt_Fpga_Inflate_Credit + div_u64((u64) elapsed * rate, NSEC_PER_SEC),
+									burst);
+	}
+
+	// A packet is charged after it is inflated; the credit may go below 0
+	Xt_Fpga_Inflate_Credit -= bytes;
+	admit = Xt_Fpga_Inflate_Credit > 0;
+	spin_unlock(&Xt_Fpga_Inflate_Budget_Lock);
+
+	return admit;
+}
+
+
+/** Function that gives up a body (called under slot lock) */
+static void xt_fpga_flow_abort(struct xt_fpga_flow *flow, bool over_budget)
+{
+	if(flow->stage == XT_FPGA_BODY_DONE)
+	{
+		return;
+	}
+
+	flow->stage = XT_FPGA_BODY_DONE;
+	if(over_budget)
+		XT_FPGA_STAT_INC(inflate_over_budget);
+	else
+		XT_FPGA_STAT_INC(inflate_lost);
+}
+
+
+/** Function that starts raw deflate or zlib decoding of a body */
+static void xt_fpga_flow_start_inflate(struct xt_fpga_flow *flow, int window_bits)
+{
+	if(zlib_inflateInit2(&flow->zs, window_bits) != Z_OK)
+	{
+		xt_fpga_flow_abort(flow, false);
+		return;
+	}
+
+	flow->stage = XT_FPGA_BODY_INFLATE;
+}
+
+
+/** Function that moves to the next optional part of a gzip header, or to the data */
+static void xt_fpga_flow_gzip_next(struct xt_fpga_flow *flow)
+{
+	for(flow->gzip_part++; flow->gzip_part <= XT_FPGA_GZIP_HCRC; flow->gzip_part++)
+	{
+		switch(flow->gzip_part)
+		{
+			case XT_FPGA_GZIP_XLEN:
+				if(flow->gzip_flags & XT_FPGA_GZIP_FEXTRA)
+				{
+					flow->gzip_left = 2;
+					return;
+				}
+				break;
+
+			case XT_FPGA_GZIP_NAME:
+				if(flow->gzip_flags & XT_FPGA_GZIP_FNAME)
+					return;
+				break;
+
+			case XT_FPGA_GZIP_COMMENT:
+				if(flow->gzip_flags & XT_FPGA_GZIP_FCOMMENT)
+					return;
+				break;
+
+			case XT_FPGA_GZIP_HCRC:
+				if(flow->gzip_flags & XT_FPGA_GZIP_FHCRC)
+				{
+					flow->gzip_left = 2;
+					return;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	// The member data is raw deflate
+	xt_fpga_flow_start_inflate(flow, -MAX_WBITS);
+}
+
+
+/**
+ *	Function that skips the gzip header at the start of a body. The header
+ *	may be split over segments.
+ *		returns the number of bytes used
+ */
+static unsigned int xt_fpga_flow_gzip(struct xt_fpga_flow *flow, const u8 *p, unsigned int len)
+{
+	unsigned int i = 0, pos;
+	u8 c;
+
+	while(i < len && flow->stage == XT_FPGA_BODY_GZIP)
+	{
+		c = p[i++];
+
+		switch(flow->gzip_part)
+		{
+			case XT_FPGA_GZIP_FIXED:
+				pos = 10 - flow->gzip_left;
+				if((pos == 0 && c != 0x1f) || (pos == 1 && c != 0x8b) || (pos == 2 && c != 8))
+				{
+					xt_fpga_flow_abort(flow, false);
+					break;
+				}
+				if(pos == 3)
+				{
+					flow->gzip_flags = c;
+				}
+				if(!--flow->gzip_left)
+				{
+					xt_fpga_flow_gzip_next(flow);
+				}
+				break;
+
+			case XT_FPGA_GZIP_XLEN:
+				// Little endian; the length to skip is counted in gzip_left
+				if(flow->gzip_left == 2)
+				{
+					flow->gzip_left = 1 | (c << 8);
+				}
+				else
+				{
+					flow->gzip_left = (flow->gzip_left >> 8) | (c << 8);
+					flow->gzip_part = XT_FPGA_GZIP_EXTRA;
+					if(!flow->gzip_left)
+					{
+						xt_fpga_flow_gzip_next(flow);
+					}
+				}
+				break;
+
+			case XT_FPGA_GZIP_EXTRA:
+			case XT_FPGA_GZIP_HCRC:
+				if(!--flow->gzip_left)
+				{
+					xt_fpga_flow_gzip_next(flow);
+				}
+				break;
+
+			default:
+				// Name and comment end with a zero byte
+				if(!c)
+				{
+					xt_fpga_flow_gzip_next(flow);
+				}
+				break;
+		}
+	}
+
+	return i;
+}
+
+
+/** Function that matches decompressed bytes of a body, carrying the matcher state */
+static void xt_fpga_flow_scan(struct xt_fpga_flow *flow, const struct dpi_ruleset *rs, const u8 *p,
+							unsigned int len, struct xt_fpga_hit *hit)
+{
+	unsigned int done = 0, end;
+	u32 match;
+
+	// Bytes after a match are scanned too, the state must stay in step
+	while(done < len)
+	{
+		match = dpi_dfa_stream(rs, &flow->dfa_state, p + done, len - done, &end);
+		if(!match)
+		{
+			break;
+		}
+
+		if(!flow->packet_matched)
+		{
+			flow->packet_matched = true;
+			hit->pattern_id = dpi_ruleset_pattern_id(rs, match);
+			hit->offset = flow->inflated + done + end;
+		}
+		done += end;
+	}
+
+	flow->inflated += len;
+	flow->packet_inflated += len;
+	XT_FPGA_STAT_ADD(inflate_bytes, len);
+}
+
+
+/** Function that decompresses and matches compressed bytes of a body */
+static void xt_fpga_flow_data(struct xt_fpga_flow *flow, const struct dpi_ruleset *rs, const u8 *p,
+							unsigned int len, struct xt_fpga_hit *hit)
+{
+	u8 *out = this_cpu_read(Xt_Fpga_Inflate_Out);
+	unsigned int n;
+	int ret;
+
+	if(flow->stage == XT_FPGA_BODY_GZIP)
+	{
+		n = xt_fpga_flow_gzip(flow, p, len);
+		p += n;
+		len -= n;
+	}
+
+	// zlib streams start with method 8 and a window of at most 32K,
+	// raw deflate blocks cannot start with such a byte
+	if(len && flow->stage == XT_FPGA_BODY_DEFLATE)
+	{
+		xt_fpga_flow_start_inflate(flow, ((p[0] & 0x0f) == 8 && (p[0] >> 4) <= 7) ? MAX_WBITS : -MAX_WBITS);
+	}
+
+	if(!len || flow->stage != XT_FPGA_BODY_INFLATE)
+	{
+		return;
+	}
+
+	flow->zs.next_in = p;
+	flow->zs.avail_in = len;
+
+	do
+	{
+		flow->zs.next_out = out;
+		flow->zs.avail_out = XT_FPGA_INFLATE_CHUNK;
+		ret = zlib_inflate(&flow->zs, Z_SYNC_FLUSH);
+
+		n = XT_FPGA_INFLATE_CHUNK - flow->zs.avail_out;
+		if(n)
+		{
+			xt_fpga_flow_scan(flow, rs, out, n, hit);
+		}
+
+		// The gzip trailer and anything after the stream are not inspected
+		if(ret == Z_STREAM_END)
+		{
+			flow->stage = XT_FPGA_BODY_DONE;
+			return;
+		}
+
+		if((ret != Z_OK && ret != Z_BUF_ERROR) || (ret == Z_BUF_ERROR && !n))
+		{
+			if(ret != Z_BUF_ERROR)
+			{
+				xt_fpga_flow_abort(flow, false);
+			}
+			return;
+		}
+
+		if(flow->packet_inflated > XT_FPGA_INFLATE_PACKET_MAX || flow->inflated >= inflate_flow_bytes)
+		{
+			xt_fpga_flow_abort(flow, true);
+			return;
+		}
+	}
+	while(flow->zs.avail_in || !flow->zs.avail_out);
+}
+
+
+/** Function that removes the transfer coding of body bytes */
+static void xt_fpga_flow_body(struct xt_fpga_flow *flow, const struct dpi_ruleset *rs, const u8 *p,
+							unsigned int len, struct xt_fpga_hit *hit)
+{
+	unsigned int n;
+	int digit;
+
+	if(!flow->chunked)
+	{
+		xt_fpga_flow_data(flow, rs, p, len, hit);
+		return;
+	}
+
+	while(len && flow->stage != XT_FPGA_BODY_DONE)
+	{
+		switch(flow->chunk_stage)
+		{
+			case XT_FPGA_CHUNK_SIZE:
+				digit = hex_to_bin(*p);
+				if(digit < 0)
+				{
+					flow->chunk_stage = XT_FPGA_CHUNK_EXT;
+					break;
+				}
+				if(flow->chunk_left >> 27)
+				{
+					xt_fpga_flow_abort(flow, false);
+					break;
+				}
+				flow->chunk_left = (flow->chunk_left << 4) | digit;
+				p++;
+				len--;
+				break;
+
+			case XT_FPGA_CHUNK_EXT:
+				if(*p == '\n')
+				{
+					// The last chunk (size 0) ends the body
+					if(!flow->chunk_left)
+					{
+						flow->stage = XT_FPGA_BODY_DONE;
+						break;
+					}
+					flow->chunk_stage = XT_FPGA_CHUNK_DATA;
+				}
+				p++;
+				len--;
+				break;
+
+			case XT_FPGA_CHUNK_DATA:
+				n = min(len, flow->chunk_left);
+				xt_fpga_flow_data(flow, rs, p, n, hit);
+				p += n;
+				len -= n;
+				flow->chunk_left -= n;
+				if(!flow->chunk_left)
+				{
+					flow->chunk_stage = XT_FPGA_CHUNK_DATA_END;
+				}
+				break;
+
+			default:
+				if(*p == '\n')
+				{
+					flow->chunk_stage = XT_FPGA_CHUNK_SIZE;
+				}
+				p++;
+				len--;
+				break;
+		}
+	}
+}
+
+
+/** Function that finds the slot of a sender (called under Xt_Fpga_Flow_Lock) */
+static struct xt_fpga_flow *xt_fpga_flow_find(const struct xt_fpga_segment *seg)
+{
+	struct xt_fpga_flow *flow;
+
+	hlist_for_each_entry(flow, &Xt_Fpga_Flow_Hash[seg->hash & Xt_Fpga_Flow_Hash_Mask], node)
+	{
+		if(!memcmp(&flow->key, &seg->key, sizeof(seg->key)))
+		{
+			return flow;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ *	Function that takes a free slot, or the least recently used one if its
+ *	body is over or idle, for a sender. Called under Xt_Fpga_Flow_Lock; the
+ *	slot is returned locked.
+ */
+static struct xt_fpga_flow *xt_fpga_flow_alloc(const struct xt_fpga_segment *seg)
+{
+	struct xt_fpga_flow *flow;
+
+	if(!list_empty(&Xt_Fpga_Flow_Free))
+	{
+		flow = list_first_entry(&Xt_Fpga_Flow_Free, struct xt_fpga_flow, lru);
+		spin_lock(&flow->lock);
+	}
+	else
+	{
+		flow = list_first_entry(&Xt_Fpga_Flow_Lru, struct xt_fpga_flow, lru);
+		if(!spin_trylock(&flow->lock))
+		{
+			return NULL;
+		}
+		if(flow->stage != XT_FPGA_BODY_DONE && time_before(jiffies, flow->last_used + XT_FPGA_INFLATE_IDLE))
+		{
+			spin_unlock(&flow->lock);
+			return NULL;
+		}
+		hlist_del(&flow->node);
+	}
+
+	flow->key = seg->key;
+	hlist_add_head(&flow->node, &Xt_Fpga_Flow_Hash[seg->hash & Xt_Fpga_Flow_Hash_Mask]);
+	list_move_tail(&flow->lru, &Xt_Fpga_Flow_Lru);
+
+	return flow;
+}
+
+
+/** Function that prepares a locked slot for a new body */
+static void xt_fpga_flow_reset(struct xt_fpga_flow *flow, u8 stage, bool chunked)
+{
+	flow->stage = stage;
+	flow->chunked = chunked;
+	flow->chunk_stage = XT_FPGA_CHUNK_SIZE;
+	flow->chunk_left = 0;
+	flow->gzip_part = XT_FPGA_GZIP_FIXED;
+	flow->gzip_flags = 0;
+	flow->gzip_left = 10;
+	flow->dfa_state = 0;
+	flow->inflated = 0;
+	flow->last_valid = false;
+}
+
+
+/** Function that unlocks a slot; a slot whose body ended is the first to be taken again */
+static void xt_fpga_flow_release(struct xt_fpga_flow *flow)
+{
+	// Slots are only tried while the table lock is held, so it can be
+	// taken under the slot lock
+	if(flow->stage == XT_FPGA_BODY_DONE)
+	{
+		spin_lock(&Xt_Fpga_Flow_Lock);
+		list_move(&flow->lru, &Xt_Fpga_Flow_Lru);
+		spin_unlock(&Xt_Fpga_Flow_Lock);
+	}
+
+	spin_unlock(&flow->lock);
+}
+
+
+bool xt_fpga_inflate_match(const struct sk_buff *skb, const struct xt_action_param *par, struct xt_fpga_hit *hit)
+{
+	struct xt_fpga_segment seg;
+	struct xt_fpga_flow *flow;
+	struct dpi_ruleset *rs;
+	unsigned int response, body;
+	bool chunked = false, matched;
+	u8 stage = XT_FPGA_BODY_DONE;
+
+	if(!Xt_Fpga_Flows || !xt_fpga_inflate_segment(skb, par, &seg))
+	{
+		return false;
+	}
+
+	// Parsed outside the lock; used if the packet is not part of a body
+	response = xt_fpga_inflate_response(seg.data, seg.len, &stage, &chunked);
+
+	spin_lock(&Xt_Fpga_Flow_Lock);
+	flow = xt_fpga_flow_find(&seg);
+
+	// A slot busy on another CPU means the body is reordered across CPUs
+	if(flow && !spin_trylock(&flow->lock))
+	{
+		spin_unlock(&Xt_Fpga_Flow_Lock);
+		return false;
+	}
+
+	if(!flow && response)
+	{
+		flow = xt_fpga_flow_alloc(&seg);
+		if(!flow)
+		{
+			spin_unlock(&Xt_Fpga_Flow_Lock);
+			XT_FPGA_STAT_INC(inflate_pool_full);
+			return false;
+		}
+		flow->seq = seg.seq;
+		flow->last_valid = false;
+	}
+	else if(flow && flow->stage != XT_FPGA_BODY_DONE)
+	{
+		list_move_tail(&flow->lru, &Xt_Fpga_Flow_Lru);
+	}
+	spin_unlock(&Xt_Fpga_Flow_Lock);
+
+	if(!flow)
+	{
+		return false;
+	}
+
+	// Another rule or a retransmission of the last packet
+	if(flow->last_valid && flow->last_seq == seg.seq && flow->last_len == seg.len)
+	{
+		*hit = flow->last_hit;
+		matched = flow->last_matched;
+		spin_unlock(&flow->lock);
+
+		return matched;
+	}
+
+	// A response starts where the previous body stopped (or after it
+	// ended); retransmitted headers must not restart a body
+	if(response && (flow->stage == XT_FPGA_BODY_DONE ? !before(seg.seq, flow->seq) : seg.seq == flow->seq))
+	{
+		xt_fpga_flow_reset(flow, stage, chunked);
+		XT_FPGA_STAT_INC(inflate_flows);
+		body = response;
+	}
+	else if(flow->stage == XT_FPGA_BODY_DONE || !after(seg.seq + seg.len, flow->seq))
+	{
+		// No body in progress, or old data
+		spin_unlock(&flow->lock);
+		return false;
+	}
+	else if(after(seg.seq, flow->seq))
+	{
+		// A segment is missing, the rest of the body cannot be decoded
+		xt_fpga_flow_abort(flow, false);
+		xt_fpga_flow_release(flow);
+		return false;
+	}
+	else
+	{
+		// Skip bytes of the segment that were inspected before
+		body = flow->seq - seg.seq;
+	}
+
+	flow->last_used = jiffies;
+	flow->seq = seg.seq + seg.len;
+	flow->packet_inflated = 0;
+	flow->packet_matched = false;
+
+	hit->pattern_id = DPI_PATTERN_UNKNOWN;
+	hit->offset = DPI_OFFSET_UNKNOWN;
+	hit->field = XT_FPGA_FIELD_PACKET;
+	hit->flags = 0;
+
+	rcu_read_lock();
+	rs = dpi_ruleset_get();
+
+	if(!rs || !rs->dfa)
+	{
+		xt_fpga_flow_abort(flow, false);
+	}
+	else if(flow->inflated >= inflate_flow_bytes || !xt_fpga_inflate_charge(0))
+	{
+		xt_fpga_flow_abort(flow, true);
+	}
+	else
+	{
+		// States of an older rule set mean nothing in this one
+		if(flow->generation != rs->generation)
+		{
+			flow->generation = rs->generation;
+			flow->dfa_state = 0;
+		}
+
+		xt_fpga_flow_body(flow, rs, seg.data + body, seg.len - body, hit);
+		xt_fpga_inflate_charge(flow->packet_inflated);
+	}
+
+	rcu_read_unlock();
+
+	matched = flow->packet_matched;
+	if(matched)
+	{
+		hit->len = flow->inflated;
+		hit->flags = DPI_EVENT_INFLATED;
+		XT_FPGA_STAT_INC(inflate_matches);
+	}
+
+	flow->last_valid = true;
+	flow->last_matched = matched;
+	flow->last_seq = seg.seq;
+	flow->last_len = seg.len;
+	flow->last_hit = *hit;
+	xt_fpga_flow_release(flow);
+
+	return matched;
+}
+
+
+bool xt_fpga_inflate_enabled(void)
+{
+	return Xt_Fpga_Flows != NULL;
+}
+
+
+int xt_fpga_inflate_init(void)
+{
+	struct xt_fpga_flow *flow;
+	size_t workspace = zlib_inflate_workspacesize();
+	unsigned int i;
+	int cpu;
+	u8 *out;
+
+	if(!inflate_flows)
+	{
+		return 0;
+	}
+
+	if(inflate_flows > XT_FPGA_INFLATE_FLOWS_MAX)
+	{
+		return -EINVAL;
+	}
+
+	Xt_Fpga_Flow_Hash_Mask = roundup_pow_of_two(inflate_flows) - 1;
+	Xt_Fpga_Flows = kcalloc(inflate_flows, sizeof(*Xt_Fpga_Flows), GFP_KERNEL);
+	Xt_Fpga_Flow_Workspaces = vmalloc(inflate_flows * workspace);
+	Xt_Fpga_Flow_Hash = kcalloc(Xt_Fpga_Flow_Hash_Mask + 1, sizeof(*Xt_Fpga_Flow_Hash), GFP_KERNEL);
+	if(!Xt_Fpga_Flows || !Xt_Fpga_Flow_Workspaces || !Xt_Fpga_Flow_Hash)
+	{
+		xt_fpga_inflate_exit();
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu)
+	{
+		out = kmalloc(XT_FPGA_INFLATE_CHUNK, GFP_KERNEL);
+		if(!out)
+		{
+			xt_fpga_inflate_exit();
+			return -ENOMEM;
+		}
+		per_cpu(Xt_Fpga_Inflate_Out, cpu) = out;
+	}
+
+	for(i = 0; i < inflate_flows; i++)
+	{
+		flow = &Xt_Fpga_Flows[i];
+		spin_lock_init(&flow->lock);
+		flow->stage = XT_FPGA_BODY_DONE;
+		flow->zs.workspace = Xt_Fpga_Flow_Workspaces + i * workspace;
+		list_add_tail(&flow->lru, &Xt_Fpga_Flow_Free);
+	}
+
+	get_random_bytes(&Xt_Fpga_Flow_Seed, sizeof(Xt_Fpga_Flow_Seed));
+	Xt_Fpga_Inflate_Credit = max_t(s64, inflate_rate / 10, XT_FPGA_INFLATE_PACKET_MAX);
+	Xt_Fpga_Inflate_Last_Ns = ktime_to_ns(ktime_get());
+
+	return 0;
+}
+
+
+void xt_fpga_inflate_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		kfree(per_cpu(Xt_Fpga_Inflate_Out, cpu));
+		per_cpu(Xt_Fpga_Inflate_Out, cpu) = NULL;
+	}
+
+	kfree(Xt_Fpga_Flow_Hash);
+	vfree(Xt_Fpga_Flow_Workspaces);
+	kfree(Xt_Fpga_Flows);
+	Xt_Fpga_Flow_Hash = NULL;
+	Xt_Fpga_Flow_Workspaces = NULL;
+	Xt_Fpga_Flows = NULL;
+	INIT_LIST_HEAD(&Xt_Fpga_Flow_Lru);
+	INIT_LIST_HEAD(&Xt_Fpga_Flow_Free);
+}
@@ -0,0 +1,65 @@
+#ifndef _XTABLES_FPGA_INFLATE_H
+#define _XTABLES_FPGA_INFLATE_H
+
+/**
+ * Compressed HTTP Bodies of FPGA-Based String Match Module for Xtables
+ *
+ * gzip and deflate response bodies are decompressed as their segments
+ * arrive and matched in pieces of XT_FPGA_INFLATE_CHUNK bytes, carrying
+ * the software matcher state from one piece to the next. Every body takes
+ * a slot of a pool allocated at module load (inflate_flows), so memory
+ * does not grow with traffic. A body is given up when it leaves its slot
+ * idle, skips a segment, or exceeds the per-flow (inflate_flow_bytes) or
+ * module-wide (inflate_rate) byte budget.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/skbuff.h>
+#include <linux/netfilter/x_tables.h>
+#include "xtables_fpga_events.h"
+
+/** Decompressed bytes matched at a time */
+#define XT_FPGA_INFLATE_CHUNK			2048
+
+/** Decompressed bytes one segment may produce; more is taken as a bomb */
+#define XT_FPGA_INFLATE_PACKET_MAX		(64 * 1024)
+
+/** A slot idle this long can be taken by a new body */
+#define XT_FPGA_INFLATE_IDLE			(10 * HZ)
+
+/** Longest response header line that is parsed */
+#define XT_FPGA_INFLATE_LINE_MAX		256
+
+/**
+ *	This function feeds the TCP payload of a packet to the decompressed
+ *	body it belongs to, or starts a body if it is an HTTP response with a
+ *	compressed one. A packet seen again (another rule, a retransmission)
+ *	gets the result it had. Caller must run with bottom halves disabled.
+ *		returns true and fills in the hit if decompressed bytes of the
+ *		packet complete a match
+ *		returns false otherwise
+ */
+bool xt_fpga_inflate_match(const struct sk_buff *, const struct xt_action_param *, struct xt_fpga_hit *);
+
+/** The function that returns true if the slot pool is allocated */
+bool xt_fpga_inflate_enabled(void);
+
+/** The function that allocates the slot pool (nothing if inflate_flows is 0) */
+int xt_fpga_inflate_init(void);
+
+/** The function that frees the slot pool */
+void xt_fpga_inflate_exit(void);
+
+#endif
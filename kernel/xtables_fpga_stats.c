@@ -0,0 +1,162 @@
+/**
+ * Statistics of FPGA-Based String Match Module for Xtables
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/math64.h>
+#include <net/net_namespace.h>
+#include "xtables_fpga_stats.h"
+#include "dpi_ruleset.h"
+#include "dpi_accel.h"
+
+
+/** Per-CPU counters */
+DEFINE_PER_CPU(struct xt_fpga_stats, xt_fpga_stats);
+
+/** /proc/net/xt_fpga */
+struct proc_dir_entry *xt_fpga_proc_dir;
+
+/** Counter names, in the order of struct xt_fpga_stats */
+static const char *const Xt_Fpga_Stat_Names[] =
+{
+	"packets",
+	"bytes",
+	"bloom_skipped",
+	"bloom_hits",
+	"bloom_false_positives",
+	"prefilter_skipped",
+	"prefilter_candidates",
+	"accel_scans",
+	"accel_matches",
+	"accel_errors",
+	"accel_confirms",
+	"accel_confirm_rejects",
+	"software_scans",
+	"software_matches",
+	"memo_hits",
+	"events",
+	"events_dropped",
+	"inflate_flows",
+	"inflate_bytes",
+	"inflate_matches",
+	"inflate_pool_full",
+	"inflate_lost",
+	"inflate_over_budget",
+};
+
+
+/** Function that prints the sum of all per-CPU counters */
+static int xt_fpga_stats_show(struct seq_file *m, void *v)
+{
+	u64 sums[ARRAY_SIZE(Xt_Fpga_Stat_Names)] = { 0 };
+	struct dpi_health health;
+	struct dpi_queue_stats queues;
+	const u64 *counters;
+	unsigned int i;
+	int cpu;
+
+	BUILD_BUG_ON(sizeof(struct xt_fpga_stats) != sizeof(sums));
+
+	for_each_possible_cpu(cpu)
+	{
+		counters = (const u64 *) &per_cpu(xt_fpga_stats, cpu);
+		for(i = 0; i < ARRAY_SIZE(sums); i++)
+		{
+			sums[i] += counters[i];
+		}
+	}
+
+	for(i = 0; i < ARRAY_SIZE(sums); i++)
+	{
+		seq_printf(m, "%-24s %llu\n", Xt_Fpga_Stat_Names[i], (unsigned long long) sums[i]);
+	}
+
+	seq_printf(m, "%-24s %u\n", "ruleset_generation", dpi_ruleset_generation());
+
+	// Accelerator watchdog
+	dpi_get_health(&health);
+	seq_printf(m, "%-24s %s\n", "accel_state", dpi_accel_emulated() ? "emulated" :
+				!dpi_get_dma_device() ? "absent" :
+				(health.device_status == STATUS_RECOVERING) ? "recovering" : "online");
+	seq_printf(m, "%-24s %u\n", "accel_reset_generation", health.reset_generation);
+	seq_printf(m, "%-24s %llu\n", "accel_timeouts", (unsigned long long) health.watchdog_timeouts);
+	seq_printf(m, "%-24s %llu\n", "accel_dma_errors", (unsigned long long) health.dma_errors);
+	seq_printf(m, "%-24s %llu\n", "accel_recoveries", (unsigned long long) health.recoveries);
+	seq_printf(m, "%-24s %llu\n", "accel_recovery_failures", (unsigned long long) health.recovery_failures);
+	seq_printf(m, "%-24s %llu\n", "accel_last_recovery_us", (unsigned long long) health.last_recovery_us);
+	seq_printf(m, "%-24s %llu\n", "accel_total_recovery_us", (unsigned long long) health.total_recovery_us);
+
+	// Measured capacity, the base of auto budgets
+	seq_printf(m, "%-24s %llu\n", "accel_busy_us", (unsigned long long) div_u64(health.busy_ns, NSEC_PER_USEC));
+	seq_printf(m, "%-24s %u\n", "accel_scan_cost_ns", health.scan_cost_ns);
+	seq_printf(m, "%-24s %llu\n", "accel_capacity_pps",
+		(unsigned long long) (health.scan_cost_ns ? NSEC_PER_SEC / health.scan_cost_ns : 0));
+	seq_printf(m, "%-24s %llu\n", "accel_capacity_bps", (unsigned long long) (health.scan_cost_ns ?
+		div64_u64(health.busy_bytes, health.busy_scans) * (NSEC_PER_SEC / health.scan_cost_ns) : 0));
+
+	// Per-CPU submission queues
+	dpi_queue_get_stats(&queues);
+	seq_printf(m, "%-24s %llu\n", "queue_net_submitted", (unsigned long long) queues.submitted[DPI_SQ_NET]);
+	seq_printf(m, "%-24s %llu\n", "queue_net_full", (unsigned long long) queues.full[DPI_SQ_NET]);
+	seq_printf(m, "%-24s %llu\n", "queue_user_submitted", (unsigned long long) queues.submitted[DPI_SQ_USER]);
+	seq_printf(m, "%-24s %llu\n", "queue_user_full", (unsigned long long) queues.full[DPI_SQ_USER]);
+	seq_printf(m, "%-24s %u\n", "queue_backlog", queues.backlog);
+	seq_printf(m, "%-24s %llu\n", "queue_dispatched", (unsigned long long) health.dispatched);
+
+	return 0;
+}
+
+
+static int xt_fpga_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xt_fpga_stats_show, NULL);
+}
+
+
+/** File operations of /proc/net/xt_fpga/stats */
+static const struct file_operations Xt_Fpga_Stats_Fops =
+{
+	.owner		= THIS_MODULE,
+	.open		= xt_fpga_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+
+int xt_fpga_stats_init(void)
+{
+	xt_fpga_proc_dir = proc_mkdir(XT_FPGA_PROC_DIR, init_net.proc_net);
+	if(!xt_fpga_proc_dir)
+	{
+		return -ENOMEM;
+	}
+
+	if(!proc_create("stats", 0444, xt_fpga_proc_dir, &Xt_Fpga_Stats_Fops))
+	{
+		remove_proc_entry(XT_FPGA_PROC_DIR, init_net.proc_net);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+
+void xt_fpga_stats_exit(void)
+{
+	remove_proc_entry("stats", xt_fpga_proc_dir);
+	remove_proc_entry(XT_FPGA_PROC_DIR, init_net.proc_net);
+}
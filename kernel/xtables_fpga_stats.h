@@ -0,0 +1,72 @@
+#ifndef _XTABLES_FPGA_STATS_H
+#define _XTABLES_FPGA_STATS_H
+
+/**
+ * Statistics of FPGA-Based String Match Module for Xtables
+ * Per-CPU counters, reported in /proc/net/xt_fpga/stats
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 or
+ * (at your option) version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+/** Name of the proc directory (under /proc/net) */
+#define XT_FPGA_PROC_DIR				"xt_fpga"
+
+/** Module-wide counters; keep in sync with Xt_Fpga_Stat_Names */
+struct xt_fpga_stats
+{
+	u64 packets;				// Packets seen by fpga_mt()
+	u64 bytes;					// Payload bytes seen by fpga_mt()
+	u64 bloom_skipped;			// Packets cleared by the bloom filter
+	u64 bloom_hits;				// Packets passed on by the bloom filter
+	u64 bloom_false_positives;	// Bloom filter hits that did not match
+	u64 prefilter_skipped;		// Packets cleared by the prefilter
+	u64 prefilter_candidates;	// Packets passed on by the prefilter
+	u64 accel_scans;			// Payloads sent to the accelerator
+	u64 accel_matches;			// Payloads the accelerator matched
+	u64 accel_errors;			// Accelerator errors and timeouts
+	u64 accel_confirms;			// Accelerator matches checked for regex tails
+	u64 accel_confirm_rejects;	// Accelerator matches whose regex tail failed
+	u64 software_scans;			// Payloads matched in software (accelerator down)
+	u64 software_matches;		// Payloads the software matcher matched
+	u64 memo_hits;				// Packets answered by the result of an earlier fpga rule
+	u64 events;					// Match events written for --print rules
+	u64 events_dropped;			// Match events lost on a full ring
+	u64 inflate_flows;			// Compressed HTTP bodies taken into a flow slot
+	u64 inflate_bytes;			// Decompressed bytes matched in software
+	u64 inflate_matches;		// Packets matched in decompressed bytes
+	u64 inflate_pool_full;		// Compressed bodies not inspected, no free slot
+	u64 inflate_lost;			// Flows given up on a sequence gap or a corrupt stream
+	u64 inflate_over_budget;	// Flows given up over the byte budgets
+};
+
+DECLARE_PER_CPU(struct xt_fpga_stats, xt_fpga_stats);
+
+/** Counter update macros (callers run with bottom halves disabled) */
+#define XT_FPGA_STAT_INC(field)			this_cpu_inc(xt_fpga_stats.field)
+#define XT_FPGA_STAT_ADD(field, n)		this_cpu_add(xt_fpga_stats.field, (n))
+
+/** The proc directory, for other files of the module */
+extern struct proc_dir_entry *xt_fpga_proc_dir;
+
+/** The function that creates /proc/net/xt_fpga/stats */
+int xt_fpga_stats_init(void);
+
+/** The function that removes /proc/net/xt_fpga */
+void xt_fpga_stats_exit(void);
+
+#endif
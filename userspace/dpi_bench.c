@@ -0,0 +1,686 @@
+/**
+ * Benchmark for FPGA matcher tools.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "dpi_bench.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define DPI_BENCH_HAVE_TSC
+#endif
+
+#ifdef DPI_HAVE_GEN
+#include "dpi_gen.h"
+#endif
+
+
+/** Benchmark settings */
+static struct dpi_bench_config Bench_Config =
+{
+	.repeat = DPI_BENCH_DEFAULT_REPEAT,
+	.bloom_bits = 1 << DPI_BLOOM_DEFAULT_BITS_LOG2,
+	.bloom_q = DPI_BLOOM_DEFAULT_Q,
+};
+
+/** Lets all submitters of a scaling step start at the same time */
+static pthread_barrier_t Bench_Barrier;
+
+/** L1 data cache read miss counter of the benchmark thread (-1 if unavailable) */
+static int Bench_Perf_Fd = -1;
+
+
+static void dpi_bench_help(const char *prog)
+{
+	printf(
+		"Usage: %s --patterns FILE --pcap FILE [options]\n"
+		"--patterns FILE       Signature file\n"
+		"--pcap FILE           Capture file to replay (classic pcap)\n"
+		"--repeat N            Passes over the capture (default %u)\n"
+		"--bloom-bits N        Bloom filter size in bits (default %u)\n"
+		"--bloom-q N           Bloom filter window length (default %u)\n"
+		"--device PATH         Also measure /dev/dpi with 1 to --threads submitters\n"
+		"--threads N           Most submitting threads (default: online CPUs)\n"
+		"--profile-out FILE    Record state visits of the software matcher on the capture\n"
+		"--profile FILE        Also measure the software matcher with states renumbered by FILE\n",
+		prog, DPI_BENCH_DEFAULT_REPEAT, 1 << DPI_BLOOM_DEFAULT_BITS_LOG2, DPI_BLOOM_DEFAULT_Q
+	);
+}
+
+
+static int dpi_bench_parse(int argc, char **argv)
+{
+	int c;
+
+	while((c = getopt_long(argc, argv, "", dpi_bench_opts, NULL)) != -1)
+	{
+		switch(c)
+		{
+			case 'P':
+				Bench_Config.patterns = optarg;
+				break;
+
+			case 'r':
+				Bench_Config.pcap = optarg;
+				break;
+
+			case 'n':
+				Bench_Config.repeat = strtoul(optarg, NULL, 0);
+				if(Bench_Config.repeat == 0)
+					return -1;
+				break;
+
+			case 'b':
+				Bench_Config.bloom_bits = strtoul(optarg, NULL, 0);
+				if(!Bench_Config.bloom_bits || (Bench_Config.bloom_bits & (Bench_Config.bloom_bits - 1)))
+					return -1;
+				break;
+
+			case 'q':
+				Bench_Config.bloom_q = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'd':
+				Bench_Config.device = optarg;
+				break;
+
+			case 'o':
+				Bench_Config.profile_out = optarg;
+				break;
+
+			case 'p':
+				Bench_Config.profile = optarg;
+				break;
+
+			case 't':
+				Bench_Config.threads = strtoul(optarg, NULL, 0);
+				if(Bench_Config.threads == 0 || Bench_Config.threads > DPI_BENCH_MAX_THREADS)
+					return -1;
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	if(!Bench_Config.patterns || !Bench_Config.pcap)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int dpi_bench_load(struct dpi_bench_trace *trace, const char *path)
+{
+	struct dpi_pcap pc;
+	struct dpi_pcap_packet pkt;
+	unsigned char **payloads;
+	size_t *lens;
+	int ret;
+
+	memset(trace, 0, sizeof(*trace));
+
+	if(dpi_pcap_open(&pc, path))
+	{
+		return -1;
+	}
+
+	while((ret = dpi_pcap_next(&pc, &pkt)) > 0)
+	{
+		if(!pkt.payload || !pkt.payload_len)
+		{
+			continue;
+		}
+
+		if(trace->count == trace->size)
+		{
+			trace->size = trace->size ? trace->size * 2 : 1024;
+			payloads = realloc(trace->payloads, trace->size * sizeof(*payloads));
+			lens = realloc(trace->lens, trace->size * sizeof(*lens));
+			if(payloads)
+				trace->payloads = payloads;
+			if(lens)
+				trace->lens = lens;
+			if(!payloads || !lens)
+			{
+				ret = -1;
+				break;
+			}
+		}
+
+		trace->payloads[trace->count] = malloc(pkt.payload_len);
+		if(!trace->payloads[trace->count])
+		{
+			ret = -1;
+			break;
+		}
+		memcpy(trace->payloads[trace->count], pkt.payload, pkt.payload_len);
+		trace->lens[trace->count] = pkt.payload_len;
+		trace->bytes += pkt.payload_len;
+		trace->count++;
+	}
+
+	dpi_pcap_close(&pc);
+	return ret < 0 ? -1 : 0;
+}
+
+
+/** Function that releases payloads of a trace */
+static void dpi_bench_trace_free(struct dpi_bench_trace *trace)
+{
+	unsigned int i;
+
+	for(i = 0; i < trace->count; i++)
+	{
+		free(trace->payloads[i]);
+	}
+	free(trace->payloads);
+	free(trace->lens);
+}
+
+
+static void dpi_bench_perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// Without PMU access (VMs, perf_event_paranoid) misses are not reported
+	Bench_Perf_Fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/** Function that starts or stops the clock of a benchmark pass */
+static void dpi_bench_clock(struct dpi_bench_time *t, int start)
+{
+	struct timespec ts;
+	double ns;
+	unsigned long long cycles = 0, misses = 0;
+
+	if(!start && Bench_Perf_Fd >= 0)
+	{
+		ioctl(Bench_Perf_Fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(Bench_Perf_Fd, &misses, sizeof(misses)) != sizeof(misses))
+		{
+			misses = 0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = ts.tv_sec * 1e9 + ts.tv_nsec;
+#ifdef DPI_BENCH_HAVE_TSC
+	cycles = __rdtsc();
+#endif
+
+	if(start)
+	{
+		t->ns = -ns;
+		t->cycles = -cycles;
+		t->misses = 0;
+	}
+	else
+	{
+		t->ns += ns;
+		t->cycles += cycles;
+		t->misses = misses;
+	}
+
+	if(start && Bench_Perf_Fd >= 0)
+	{
+		ioctl(Bench_Perf_Fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(Bench_Perf_Fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+
+static void dpi_bench_report(const char *name, const struct dpi_bench_time *t, unsigned long long bytes)
+{
+	printf("%-22s %10.1f MB/s", name, t->ns > 0 ? bytes / t->ns * 1e3 : 0.0);
+#ifdef DPI_BENCH_HAVE_TSC
+	printf("  %6.3f bytes/cycle", t->cycles ? (double) bytes / t->cycles : 0.0);
+#endif
+	if(Bench_Perf_Fd >= 0)
+	{
+		printf("  %8.2f L1D misses/KB", bytes ? t->misses * 1024.0 / bytes : 0.0);
+	}
+	printf("\n");
+}
+
+
+/** Function that scans a payload like dpi_matcher_scan() and counts the state that reads each byte */
+static int dpi_bench_profile_scan(const struct dpi_matcher *m, const unsigned char *buf, size_t len,
+								uint64_t *visits)
+{
+	uint32_t active[DPI_NFA_MAX_STATES / 32];
+	uint32_t s = 0, f;
+	bool tails = false;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		visits[s]++;
+
+		if(tails && dpi_regex_step(m->tails, active, buf[i], &tails))
+		{
+			return 1;
+		}
+
+		s = m->next[(s << 8) | buf[i]];
+		f = m->final[s];
+		if(f & DPI_DFA_FINAL_CONFIRM)
+		{
+			dpi_regex_start(m->tails, f & ~DPI_DFA_FINAL_CONFIRM, active, &tails);
+		}
+		else if(f)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int dpi_bench_profile(const struct dpi_matcher *m, const struct dpi_bench_trace *trace)
+{
+	struct dpi_profile prof;
+	unsigned int i;
+	int retval;
+
+	if(dpi_profile_init(&prof, m->num_states))
+	{
+		return -1;
+	}
+
+	for(i = 0; i < trace->count; i++)
+	{
+		dpi_bench_profile_scan(m, trace->payloads[i], trace->lens[i], prof.visits);
+	}
+
+	retval = dpi_profile_save(&prof, Bench_Config.profile_out);
+	if(!retval)
+	{
+		printf("** profile written to %s: %u of %u states take 90%% of visits, %u take 99%%\n",
+			Bench_Config.profile_out, dpi_profile_hot(&prof, 0.90), m->num_states,
+			dpi_profile_hot(&prof, 0.99));
+	}
+
+	dpi_profile_free(&prof);
+	return retval;
+}
+
+
+#ifdef DPI_HAVE_GEN
+/** Confirm callback of the generated matcher */
+static __u32 dpi_bench_gen_confirm(const void *ctx, __u32 list, const __u8 *p, unsigned int len)
+{
+	return dpi_regex_confirm(ctx, list, p, len);
+}
+#endif
+
+
+/** Submitter thread: replays every step-th payload through its own ring */
+static void *dpi_bench_worker_run(void *arg)
+{
+	struct dpi_bench_worker *w = (struct dpi_bench_worker *) arg;
+	const struct dpi_bench_trace *trace = w->trace;
+	struct dpi_cqe cqes[DPI_BENCH_RING_BATCH];
+	cpu_set_t cpus;
+	unsigned int r, i, k, n, c, queued;
+	size_t len;
+
+	// One submitter per CPU, so that every CPU feeds its own kernel queue
+	CPU_ZERO(&cpus);
+	CPU_SET(w->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	pthread_barrier_wait(&Bench_Barrier);
+
+	for(r = 0; r < Bench_Config.repeat && !w->failed; r++)
+	{
+		i = w->first;
+		while(i < trace->count)
+		{
+			// Fill a batch of buffers and hand it to the kernel in one call
+			for(queued = 0; queued < DPI_BENCH_RING_BATCH && i < trace->count; queued++, i += w->step)
+			{
+				len = trace->lens[i] < w->ring.params.buf_size ? trace->lens[i] : w->ring.params.buf_size;
+				memcpy(dpi_ring_buf(&w->ring, queued), trace->payloads[i], len);
+				dpi_ring_queue(&w->ring, queued, len, i);
+				w->bytes += len;
+			}
+
+			if(dpi_ring_submit(&w->ring, queued))
+			{
+				w->failed = 1;
+				break;
+			}
+
+			for(k = 0; k < queued; k += n)
+			{
+				n = dpi_ring_reap(&w->ring, cqes, queued - k);
+				if(!n)
+				{
+					w->failed = 1;
+					break;
+				}
+
+				w->payloads += n;
+				for(c = 0; c < n; c++)
+				{
+					w->matches += (cqes[c].result == DPI_RESULT_MATCH);
+					w->errors += (cqes[c].result < 0);
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+static int dpi_bench_scaling(const struct dpi_bench_trace *trace)
+{
+	struct dpi_bench_worker *workers;
+	struct dpi_bench_time t;
+	unsigned long long payloads, bytes, matches, errors;
+	unsigned int n, i, cpus, opened, buf_size = 0;
+	double pps, base = 0;
+	int retval = 0;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(!Bench_Config.threads)
+	{
+		Bench_Config.threads = cpus < DPI_BENCH_MAX_THREADS ? cpus : DPI_BENCH_MAX_THREADS;
+	}
+
+	for(i = 0; i < trace->count; i++)
+	{
+		if(trace->lens[i] > buf_size)
+			buf_size = trace->lens[i];
+	}
+	if(buf_size > DPI_RING_MAX_BUF_SIZE)
+	{
+		buf_size = DPI_RING_MAX_BUF_SIZE;
+	}
+
+	workers = calloc(Bench_Config.threads, sizeof(*workers));
+	if(!workers)
+	{
+		return -1;
+	}
+
+	printf("** %s, 1 to %u submitters, batch %u\n", Bench_Config.device, Bench_Config.threads,
+		DPI_BENCH_RING_BATCH);
+
+	for(n = 1; n <= Bench_Config.threads && !retval; n++)
+	{
+		memset(workers, 0, n * sizeof(*workers));
+
+		for(opened = 0; opened < n; opened++)
+		{
+			workers[opened].cpu = opened % cpus;
+			workers[opened].first = opened;
+			workers[opened].step = n;
+			workers[opened].trace = trace;
+
+			if(dpi_ring_open(&workers[opened].ring, Bench_Config.device, DPI_BENCH_RING_BATCH,
+							DPI_BENCH_RING_BATCH, buf_size, 0))
+			{
+				retval = -1;
+				break;
+			}
+		}
+
+		if(!retval)
+		{
+			pthread_barrier_init(&Bench_Barrier, NULL, n + 1);
+			for(i = 0; i < n; i++)
+			{
+				pthread_create(&workers[i].thread, NULL, dpi_bench_worker_run, &workers[i]);
+			}
+
+			pthread_barrier_wait(&Bench_Barrier);
+			dpi_bench_clock(&t, 1);
+			for(i = 0; i < n; i++)
+			{
+				pthread_join(workers[i].thread, NULL);
+			}
+			dpi_bench_clock(&t, 0);
+			pthread_barrier_destroy(&Bench_Barrier);
+
+			payloads = bytes = matches = errors = 0;
+			for(i = 0; i < n; i++)
+			{
+				payloads += workers[i].payloads;
+				bytes += workers[i].bytes;
+				matches += workers[i].matches;
+				errors += workers[i].errors;
+				retval |= -workers[i].failed;
+			}
+
+			// With one accelerator the total saturates; it must not drop as submitters are added
+			pps = t.ns > 0 ? payloads / t.ns * 1e9 : 0.0;
+			if(n == 1)
+				base = pps;
+
+			printf("threads %-3u %10.1f MB/s %12.0f payloads/s  x%-5.2f %8.0f ns/payload/thread  matches %llu errors %llu\n",
+				n, t.ns > 0 ? bytes / t.ns * 1e3 : 0.0, pps, base > 0 ? pps / base : 0.0,
+				payloads ? t.ns * n / payloads : 0.0, matches, errors);
+		}
+
+		for(i = 0; i < opened; i++)
+		{
+			dpi_ring_close(&workers[i].ring);
+		}
+	}
+
+	free(workers);
+	return retval;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct dpi_pattern_set set;
+	struct dpi_matcher *matcher;
+	struct dpi_prefilter_table pf;
+	struct dpi_bloom bloom;
+	struct dpi_bench_trace trace;
+	struct dpi_bench_time t;
+	unsigned long long bytes, candidates = 0, matches = 0, missed = 0;
+	unsigned long long bloom_hits = 0, bloom_missed = 0, gen_differs = 0, reordered;
+	struct dpi_profile prof;
+	volatile unsigned long long sink = 0;
+	unsigned int i, r;
+	int hit, bloom_hit;
+
+	if(dpi_bench_parse(argc, argv))
+	{
+		dpi_bench_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(dpi_pattern_set_load(&set, Bench_Config.patterns))
+	{
+		return EXIT_FAILURE;
+	}
+
+	matcher = dpi_matcher_compile(&set);
+	if(!matcher)
+	{
+		dpi_pattern_set_free(&set);
+		return EXIT_FAILURE;
+	}
+	dpi_prefilter_build(&set, &pf);
+
+	if(dpi_bloom_build(&set, __builtin_ctz(Bench_Config.bloom_bits), Bench_Config.bloom_q, &bloom))
+	{
+		dpi_matcher_free(matcher);
+		dpi_pattern_set_free(&set);
+		return EXIT_FAILURE;
+	}
+
+	if(dpi_bench_load(&trace, Bench_Config.pcap))
+	{
+		dpi_bloom_free(&bloom);
+		dpi_matcher_free(matcher);
+		dpi_pattern_set_free(&set);
+		return EXIT_FAILURE;
+	}
+
+	printf("** %u payloads, %llu bytes, %u patterns, %u states, prefilter %s width %u\n",
+		trace.count, trace.bytes, set.count, matcher->num_states, dpi_prefilter_impl(), pf.width);
+	printf("** bloom %u bits, q %u, %.2f%% of bits set\n",
+		1 << bloom.bits_log2, bloom.q, 100.0 * dpi_bloom_fill(&bloom));
+
+	// Correctness pass: filters must never reject a matching payload
+	for(i = 0; i < trace.count; i++)
+	{
+		hit = dpi_prefilter_scan(&pf, trace.payloads[i], trace.lens[i]);
+		candidates += hit;
+		bloom_hit = dpi_bloom_scan(&bloom, trace.payloads[i], trace.lens[i]);
+		bloom_hits += bloom_hit;
+
+		if(dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL))
+		{
+			matches++;
+			missed += !hit;
+			bloom_missed += !bloom_hit;
+		}
+	}
+
+	printf("** candidates %llu (%.2f%%), matches %llu, missed by prefilter %llu\n",
+		candidates, trace.count ? 100.0 * candidates / trace.count : 0.0, matches, missed);
+	printf("** bloom hits %llu (%.2f%%), false positive rate %.2f%%, missed by bloom %llu\n",
+		bloom_hits, trace.count ? 100.0 * bloom_hits / trace.count : 0.0,
+		trace.count > matches ? 100.0 * (bloom_hits - (matches - bloom_missed)) / (trace.count - matches) : 0.0,
+		bloom_missed);
+
+#ifdef DPI_HAVE_GEN
+	// Generated code must come from the same signatures (and dpi_compile limits)
+	if(dpi_gen_num_states != matcher->num_states)
+	{
+		fprintf(stderr, "dpi_bench: generated matcher has %u states, signatures compile to %u\n",
+			dpi_gen_num_states, matcher->num_states);
+		gen_differs++;
+	}
+	else
+	{
+		for(i = 0; i < trace.count; i++)
+		{
+			gen_differs += !dpi_gen_match(trace.payloads[i], trace.lens[i], dpi_bench_gen_confirm, matcher->tails) !=
+							!dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL);
+		}
+		printf("** generated matcher differs from the table on %llu payloads\n", gen_differs);
+	}
+#endif
+
+	if(Bench_Config.profile_out && dpi_bench_profile(matcher, &trace))
+	{
+		missed++;
+	}
+
+	bytes = trace.bytes * Bench_Config.repeat;
+	dpi_bench_perf_open();
+
+	dpi_bench_clock(&t, 1);
+	for(r = 0; r < Bench_Config.repeat; r++)
+		for(i = 0; i < trace.count; i++)
+			sink += dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL);
+	dpi_bench_clock(&t, 0);
+	dpi_bench_report("matcher", &t, bytes);
+
+#ifdef DPI_HAVE_GEN
+	if(!gen_differs)
+	{
+		dpi_bench_clock(&t, 1);
+		for(r = 0; r < Bench_Config.repeat; r++)
+			for(i = 0; i < trace.count; i++)
+				sink += dpi_gen_match(trace.payloads[i], trace.lens[i], dpi_bench_gen_confirm, matcher->tails);
+		dpi_bench_clock(&t, 0);
+		dpi_bench_report("generated matcher", &t, bytes);
+	}
+#endif
+
+	dpi_bench_clock(&t, 1);
+	for(r = 0; r < Bench_Config.repeat; r++)
+		for(i = 0; i < trace.count; i++)
+			sink += dpi_prefilter_scan(&pf, trace.payloads[i], trace.lens[i]);
+	dpi_bench_clock(&t, 0);
+	dpi_bench_report("prefilter", &t, bytes);
+
+	dpi_bench_clock(&t, 1);
+	for(r = 0; r < Bench_Config.repeat; r++)
+		for(i = 0; i < trace.count; i++)
+			sink += dpi_bloom_scan(&bloom, trace.payloads[i], trace.lens[i]);
+	dpi_bench_clock(&t, 0);
+	dpi_bench_report("bloom", &t, bytes);
+
+	dpi_bench_clock(&t, 1);
+	for(r = 0; r < Bench_Config.repeat; r++)
+		for(i = 0; i < trace.count; i++)
+			if(dpi_prefilter_scan(&pf, trace.payloads[i], trace.lens[i]))
+				sink += dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL);
+	dpi_bench_clock(&t, 0);
+	dpi_bench_report("prefilter+matcher", &t, bytes);
+
+	// Same automaton with hot states first; results must not change
+	if(Bench_Config.profile)
+	{
+		if(dpi_profile_load(&prof, Bench_Config.profile) || dpi_profile_reorder(matcher, &prof))
+		{
+			missed++;
+		}
+		else
+		{
+			for(i = 0, reordered = 0; i < trace.count; i++)
+			{
+				reordered += dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL);
+			}
+			if(reordered != matches)
+			{
+				fprintf(stderr, "dpi_bench: reordered matcher finds %llu matches, not %llu\n", reordered, matches);
+				missed++;
+			}
+
+			dpi_bench_clock(&t, 1);
+			for(r = 0; r < Bench_Config.repeat; r++)
+				for(i = 0; i < trace.count; i++)
+					sink += dpi_matcher_scan(matcher, trace.payloads[i], trace.lens[i], NULL);
+			dpi_bench_clock(&t, 0);
+			dpi_bench_report("matcher (profiled)", &t, bytes);
+		}
+		dpi_profile_free(&prof);
+	}
+
+	if(Bench_Config.device && dpi_bench_scaling(&trace))
+	{
+		fprintf(stderr, "dpi_bench: %s scaling benchmark failed\n", Bench_Config.device);
+		missed++;
+	}
+
+	dpi_bench_trace_free(&trace);
+	dpi_bloom_free(&bloom);
+	dpi_matcher_free(matcher);
+	dpi_pattern_set_free(&set);
+
+	return (missed || bloom_missed || gen_differs) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#ifndef _DPI_BENCH_H
+#define _DPI_BENCH_H
+
+/**
+ * Benchmark for FPGA matcher tools.
+ * Replays payloads of a capture file through the software engines and
+ * reports their throughput.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "dpi_matcher.h"
+#include "dpi_prefilter.h"
+#include "dpi_bloom.h"
+#include "dpi_pcap.h"
+#include "dpi_ring.h"
+#include "dpi_regex.h"
+#include "dpi_profile.h"
+
+/** Benchmark defaults */
+#define DPI_BENCH_DEFAULT_REPEAT		10
+#define DPI_BENCH_MAX_THREADS			64
+#define DPI_BENCH_RING_BATCH			16
+
+/** Benchmark settings */
+struct dpi_bench_config
+{
+	const char *patterns;
+	const char *pcap;
+	unsigned int repeat;
+
+	// Bloom filter parameters, as in dpi_compile
+	uint32_t bloom_bits;
+	uint32_t bloom_q;
+
+	// Scaling benchmark on /dev/dpi (1 to threads submitters)
+	const char *device;
+	unsigned int threads;
+
+	// Visit profile to record on the trace, and one to benchmark reordered states with
+	const char *profile_out;
+	const char *profile;
+};
+
+/** Payloads of the capture file, kept in memory during the benchmark */
+struct dpi_bench_trace
+{
+	unsigned int count;
+	unsigned int size;
+	unsigned long long bytes;
+
+	unsigned char **payloads;
+	size_t *lens;
+};
+
+/** Time spent in a benchmark pass */
+struct dpi_bench_time
+{
+	double ns;
+	unsigned long long cycles;
+
+	// L1 data cache read misses (when perf events are available)
+	unsigned long long misses;
+};
+
+/** One submitter of the scaling benchmark */
+struct dpi_bench_worker
+{
+	pthread_t thread;
+	unsigned int cpu;
+	unsigned int first;
+	unsigned int step;
+
+	struct dpi_ring ring;
+	const struct dpi_bench_trace *trace;
+
+	// Results
+	unsigned long long payloads;
+	unsigned long long bytes;
+	unsigned long long matches;
+	unsigned long long errors;
+	int failed;
+};
+
+/** The function that prints benchmark usage */
+static void dpi_bench_help(const char *);
+
+/** The function that parses command line arguments into benchmark settings */
+static int dpi_bench_parse(int, char **);
+
+/** The function that loads payloads of a capture file into memory */
+static int dpi_bench_load(struct dpi_bench_trace *, const char *);
+
+/** The function that prints throughput of a benchmark pass */
+static void dpi_bench_report(const char *, const struct dpi_bench_time *, unsigned long long);
+
+/** The function that opens the cache miss counter of this thread */
+static void dpi_bench_perf_open(void);
+
+/** The function that records the visit profile of the software matcher on a trace */
+static int dpi_bench_profile(const struct dpi_matcher *, const struct dpi_bench_trace *);
+
+/** The function that measures /dev/dpi throughput with 1 to N submitting threads */
+static int dpi_bench_scaling(const struct dpi_bench_trace *);
+
+/** The option struct for benchmark arguments */
+static const struct option dpi_bench_opts[] =
+{
+	{ "patterns", 1, NULL, 'P' },
+	{ "pcap", 1, NULL, 'r' },
+	{ "repeat", 1, NULL, 'n' },
+	{ "bloom-bits", 1, NULL, 'b' },
+	{ "bloom-q", 1, NULL, 'q' },
+	{ "device", 1, NULL, 'd' },
+	{ "threads", 1, NULL, 't' },
+	{ "profile-out", 1, NULL, 'o' },
+	{ "profile", 1, NULL, 'p' },
+	{ "help", 0, NULL, 'h' },
+	{ .name = NULL }
+};
+
+#endif
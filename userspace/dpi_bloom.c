@@ -0,0 +1,136 @@
+/**
+ * Q-gram bloom filter for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dpi_bloom.h"
+
+
+int dpi_bloom_build(const struct dpi_pattern_set *set, uint32_t bits_log2, uint32_t q,
+				struct dpi_bloom *bf)
+{
+	const struct dpi_pattern *p;
+	uint32_t i, k, hash, bit;
+
+	memset(bf, 0, sizeof(*bf));
+
+	if(bits_log2 < DPI_BLOOM_MIN_BITS_LOG2 || bits_log2 > DPI_BLOOM_MAX_BITS_LOG2 ||
+		q == 0 || q > DPI_BLOOM_MAX_Q)
+	{
+		fprintf(stderr, "dpi_bloom: invalid size or q\n");
+		return -1;
+	}
+
+	// Every pattern must contain at least one full window
+	for(i = 0; i < set->count; i++)
+	{
+		if(set->patterns[i].len < q)
+		{
+			q = set->patterns[i].len;
+		}
+	}
+
+	bf->q = q;
+	bf->bits_log2 = bits_log2;
+	bf->out_factor = 1;
+	for(k = 1; k < q; k++)
+	{
+		bf->out_factor *= DPI_BLOOM_BASE;
+	}
+
+	bf->bits = calloc(1, (1 << bits_log2) / 8);
+	if(!bf->bits)
+	{
+		return -1;
+	}
+
+	// One window per pattern is enough for the filter to be exact on
+	// negatives and keeps the array sparse. With q 0 (a regex without a
+	// literal start) the filter passes everything.
+	for(i = 0; i < set->count && q; i++)
+	{
+		p = &set->patterns[i];
+
+		hash = 0;
+		for(k = 0; k < q; k++)
+		{
+			hash = hash * DPI_BLOOM_BASE + p->bytes[k];
+		}
+
+		for(k = 0; k < DPI_BLOOM_PROBES; k++)
+		{
+			bit = dpi_bloom_bit(hash, bits_log2, k);
+			bf->bits[bit >> 3] |= 1 << (bit & 7);
+		}
+	}
+
+	return 0;
+}
+
+
+int dpi_bloom_scan(const struct dpi_bloom *bf, const unsigned char *buf, size_t len)
+{
+	uint32_t hash = 0, bit, q = bf->q;
+	unsigned int k;
+	size_t i;
+
+	if(!q)
+	{
+		return 1;
+	}
+
+	if(len < q)
+	{
+		return 0;
+	}
+
+	for(i = 0; i + 1 < q; i++)
+	{
+		hash = hash * DPI_BLOOM_BASE + buf[i];
+	}
+
+	for(i = q - 1; i < len; i++)
+	{
+		hash = hash * DPI_BLOOM_BASE + buf[i];
+
+		for(k = 0; k < DPI_BLOOM_PROBES; k++)
+		{
+			bit = dpi_bloom_bit(hash, bf->bits_log2, k);
+			if(!(bf->bits[bit >> 3] & (1 << (bit & 7))))
+			{
+				break;
+			}
+		}
+
+		if(k == DPI_BLOOM_PROBES)
+		{
+			return 1;
+		}
+
+		hash -= buf[i + 1 - q] * bf->out_factor;
+	}
+
+	return 0;
+}
+
+
+double dpi_bloom_fill(const struct dpi_bloom *bf)
+{
+	uint32_t i, set = 0, bytes = (1 << bf->bits_log2) / 8;
+
+	for(i = 0; i < bytes; i++)
+	{
+		set += __builtin_popcount(bf->bits[i]);
+	}
+
+	return (double) set / (1 << bf->bits_log2);
+}
+
+
+void dpi_bloom_free(struct dpi_bloom *bf)
+{
+	free(bf->bits);
+	bf->bits = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef _DPI_BLOOM_H
+#define _DPI_BLOOM_H
+
+/**
+ * Q-gram bloom filter for FPGA matcher tools.
+ * A negative filter: payloads without any hit cannot contain a pattern.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dpi_user.h"
+#include "dpi_matcher.h"
+
+/** Compiler defaults (16384 bits = 2KB, fits in the PPC440 L1 data cache) */
+#define DPI_BLOOM_DEFAULT_BITS_LOG2		14
+#define DPI_BLOOM_DEFAULT_Q				4
+
+/** A bloom filter in host byte order */
+struct dpi_bloom
+{
+	uint32_t q;
+	uint32_t bits_log2;
+	uint32_t out_factor;
+	uint8_t *bits;
+};
+
+/**
+ *	This function builds a bloom filter from a pattern set.
+ *	q is reduced to the length of the shortest pattern when needed. It is
+ *	0 if a regex has no literal start; such a filter passes every buffer.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_bloom_build(const struct dpi_pattern_set *, uint32_t, uint32_t, struct dpi_bloom *);
+
+/**
+ *	This function checks every q-byte window of a buffer against the filter.
+ *		returns 1 if some window hits the filter
+ *		returns 0 if the buffer contains no pattern
+ */
+int dpi_bloom_scan(const struct dpi_bloom *, const unsigned char *, size_t);
+
+/** The function that returns the fraction of bits set */
+double dpi_bloom_fill(const struct dpi_bloom *);
+
+/** The function that releases a bloom filter */
+void dpi_bloom_free(struct dpi_bloom *);
+
+#endif
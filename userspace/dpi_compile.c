@@ -0,0 +1,475 @@
+/**
+ * Pattern compiler for FPGA matcher.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dpi_compile.h"
+
+
+/** Compiler settings */
+static struct dpi_compile_config Compile_Config =
+{
+	.bloom_bits = 1 << DPI_BLOOM_DEFAULT_BITS_LOG2,
+	.bloom_q = DPI_BLOOM_DEFAULT_Q,
+	.dfa = true,
+	.regex =
+	{
+		.max_states = DPI_MAX_STATES,
+		.split_repeat = DPI_REGEX_DEFAULT_SPLIT_REPEAT,
+	},
+	.big_endian = true,
+};
+
+
+static void dpi_compile_help(const char *prog)
+{
+	printf(
+		"Usage: %s --patterns FILE --output IMAGE [options]\n"
+		"--patterns FILE       Signature file (\"<id> <pattern>\" or \"<id> pcre:/regex/flags\" per line)\n"
+		"--output IMAGE        Rule image to write\n"
+		"--bloom-bits N        Bloom filter size in bits, power of two from %u to %u (default %u, 0 disables)\n"
+		"--bloom-q N           Bloom filter window length, 1 to %u (default %u)\n"
+		"--no-dfa              Leave the software matcher out of the image (not with regexes)\n"
+		"--max-states N        State limit of the table with regex heads (default and maximum %u)\n"
+		"--split-repeat N      Regex repetitions longer than N go to the CPU-side tail (default %u)\n"
+		"--emit-c FILE         Also write the software matcher as C code (kernel/dpi_gen.c)\n"
+		"--profile FILE        Renumber states by a visit profile (dpi_bench --profile-out, dpi_ctl profile)\n"
+		"--big-endian          Compile for a big endian target (default, PowerPC 440)\n"
+		"--little-endian       Compile for a little endian target\n",
+		prog, 1 << DPI_BLOOM_MIN_BITS_LOG2, 1 << DPI_BLOOM_MAX_BITS_LOG2,
+		1 << DPI_BLOOM_DEFAULT_BITS_LOG2, DPI_BLOOM_MAX_Q, DPI_BLOOM_DEFAULT_Q,
+		DPI_MAX_STATES, DPI_REGEX_DEFAULT_SPLIT_REPEAT
+	);
+}
+
+
+static int dpi_compile_parse(int argc, char **argv)
+{
+	int c;
+
+	while((c = getopt_long(argc, argv, "", dpi_compile_opts, NULL)) != -1)
+	{
+		switch(c)
+		{
+			case 'P':
+				Compile_Config.patterns = optarg;
+				break;
+
+			case 'o':
+				Compile_Config.output = optarg;
+				break;
+
+			case 'b':
+				Compile_Config.bloom_bits = strtoul(optarg, NULL, 0);
+				if(Compile_Config.bloom_bits & (Compile_Config.bloom_bits - 1))
+					return -1;
+				break;
+
+			case 'q':
+				Compile_Config.bloom_q = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'N':
+				Compile_Config.dfa = false;
+				break;
+
+			case 'S':
+				Compile_Config.regex.max_states = strtoul(optarg, NULL, 0);
+				if(!Compile_Config.regex.max_states || Compile_Config.regex.max_states > DPI_MAX_STATES)
+					return -1;
+				break;
+
+			case 'R':
+				Compile_Config.regex.split_repeat = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'C':
+				Compile_Config.emit_c = optarg;
+				break;
+
+			case 'p':
+				Compile_Config.profile = optarg;
+				break;
+
+			case 'B':
+				Compile_Config.big_endian = true;
+				break;
+
+			case 'L':
+				Compile_Config.big_endian = false;
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	if(!Compile_Config.patterns || !Compile_Config.output)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int dpi_compile_prefilter(struct dpi_image *img, const struct dpi_pattern_set *set)
+{
+	struct dpi_prefilter_table pf;
+	unsigned int b, k, used = 0;
+
+	dpi_prefilter_build(set, &pf);
+
+	// The kernel needs at least one byte per pattern to check
+	if(!pf.width)
+	{
+		printf("\tprefilter: left out, a regex has no literal start\n");
+		return 0;
+	}
+
+	// Report how many of the 8 buckets are in use
+	for(b = 0; b < DPI_PREFILTER_BUCKETS; b++)
+	{
+		for(k = 0; k < 16; k++)
+		{
+			if(pf.lo[0][k] & (1 << b))
+			{
+				used++;
+				break;
+			}
+		}
+	}
+	printf("\tprefilter: width %u, %u of %u buckets used\n", pf.width, used, DPI_PREFILTER_BUCKETS);
+
+	pf.width = dpi_image_u32(img, pf.width);
+	return dpi_image_add(img, DPI_SECTION_PREFILTER, &pf, sizeof(pf));
+}
+
+
+static int dpi_compile_bloom(struct dpi_image *img, const struct dpi_pattern_set *set)
+{
+	struct dpi_bloom bloom;
+	struct dpi_bloom_filter *bf;
+	size_t size;
+	int retval = -1;
+
+	if(!Compile_Config.bloom_bits)
+	{
+		return 0;
+	}
+
+	if(dpi_bloom_build(set, __builtin_ctz(Compile_Config.bloom_bits), Compile_Config.bloom_q, &bloom))
+	{
+		return -1;
+	}
+
+	if(!bloom.q)
+	{
+		printf("\tbloom: left out, a regex has no literal start\n");
+		dpi_bloom_free(&bloom);
+		return 0;
+	}
+
+	printf("\tbloom: %u bits, q %u, %.2f%% of bits set\n", 1 << bloom.bits_log2, bloom.q,
+		100.0 * dpi_bloom_fill(&bloom));
+
+	size = sizeof(*bf) + (1 << bloom.bits_log2) / 8;
+	bf = malloc(size);
+	if(bf)
+	{
+		bf->q = dpi_image_u32(img, bloom.q);
+		bf->bits_log2 = dpi_image_u32(img, bloom.bits_log2);
+		memcpy(bf->bits, bloom.bits, size - sizeof(*bf));
+
+		retval = dpi_image_add(img, DPI_SECTION_BLOOM, bf, size);
+		free(bf);
+	}
+
+	dpi_bloom_free(&bloom);
+	return retval;
+}
+
+
+static int dpi_compile_dfa(struct dpi_image *img, const struct dpi_pattern_set *set,
+						const struct dpi_matcher *m)
+{
+	struct dpi_dfa_table *dfa;
+	uint32_t *final;
+	size_t size, i;
+	struct dpi_hw_table hw;
+	int retval = -1;
+
+	printf("\tsoftware matcher: %u states, %u final\n", m->num_states, m->num_finals);
+	if(m->tails)
+	{
+		dpi_compile_report(set);
+		printf("\tregex tails: %u positions, %u confirm lists\n", m->tails->num_states, m->tails->num_lists);
+	}
+
+	// The accelerator walks the same table, the image carries its registers
+	hw.num_states = dpi_image_u32(img, m->num_states);
+	hw.num_finals = dpi_image_u32(img, m->num_finals);
+	if(dpi_image_add(img, DPI_SECTION_HW_TABLE, &hw, sizeof(hw)))
+	{
+		return -1;
+	}
+
+	if(!Compile_Config.dfa)
+	{
+		return 0;
+	}
+
+	size = sizeof(*dfa) + m->num_states * (256 * sizeof(uint16_t) + sizeof(uint32_t));
+	dfa = calloc(1, size);
+	if(dfa)
+	{
+		dfa->num_states = dpi_image_u32(img, m->num_states);
+		dfa->flags = dpi_image_u32(img, Compile_Config.profile ? DPI_DFA_REORDERED : 0);
+		for(i = 0; i < (size_t) m->num_states * 256; i++)
+		{
+			dfa->next[i] = dpi_image_u16(img, m->next[i]);
+		}
+
+		final = (uint32_t *) (dfa->next + (size_t) m->num_states * 256);
+		for(i = 0; i < m->num_states; i++)
+		{
+			final[i] = dpi_image_u32(img, m->final[i]);
+		}
+
+		retval = dpi_image_add(img, DPI_SECTION_DFA, dfa, size);
+		free(dfa);
+	}
+
+	if(!retval && m->tails)
+	{
+		retval = dpi_compile_nfa(img, m->tails);
+	}
+
+	return retval;
+}
+
+
+static int dpi_compile_reorder(struct dpi_matcher *m)
+{
+	struct dpi_profile prof;
+	int retval;
+
+	if(dpi_profile_load(&prof, Compile_Config.profile))
+	{
+		return -1;
+	}
+
+	// Hot rows end up next to each other, starting with the start state
+	retval = dpi_profile_reorder(m, &prof);
+	if(!retval)
+	{
+		printf("\tprofile: %u states take 90%% of visits, %u take 99%% (%u KB of rows)\n",
+			dpi_profile_hot(&prof, 0.90), dpi_profile_hot(&prof, 0.99),
+			dpi_profile_hot(&prof, 0.99) * 256 * (unsigned int) sizeof(uint16_t) / 1024);
+	}
+
+	dpi_profile_free(&prof);
+	return retval;
+}
+
+
+static int dpi_compile_pattern_ids(struct dpi_image *img, const struct dpi_pattern_set *set)
+{
+	uint32_t *ids;
+	unsigned int i;
+	int retval;
+
+	ids = malloc(set->count * sizeof(*ids));
+	if(!ids)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < set->count; i++)
+	{
+		ids[i] = dpi_image_u32(img, set->patterns[i].id);
+	}
+
+	retval = dpi_image_add(img, DPI_SECTION_PATTERN_IDS, ids, set->count * sizeof(*ids));
+	free(ids);
+	return retval;
+}
+
+
+static int dpi_compile_nfa(struct dpi_image *img, const struct dpi_regex_tails *t)
+{
+	struct dpi_nfa_table *nfa;
+	uint32_t *words;
+	size_t size, n, i;
+	int retval = -1;
+
+	// Heads that never reach a tail leave no list to confirm
+	if(!t->num_lists)
+	{
+		return 0;
+	}
+
+	n = (size_t) t->num_states * (1 + t->words) + (size_t) t->num_lists * t->words;
+	size = sizeof(*nfa) + t->num_states * sizeof(*t->cls) + n * sizeof(uint32_t);
+	nfa = calloc(1, size);
+	if(!nfa)
+	{
+		return -1;
+	}
+
+	nfa->num_states = dpi_image_u32(img, t->num_states);
+	nfa->num_lists = dpi_image_u32(img, t->num_lists);
+	nfa->words = dpi_image_u32(img, t->words);
+	memcpy(nfa + 1, t->cls, t->num_states * sizeof(*t->cls));
+
+	// accept, follow and start are stored back to back
+	words = (uint32_t *) ((uint8_t *) (nfa + 1) + t->num_states * sizeof(*t->cls));
+	for(i = 0; i < t->num_states; i++)
+	{
+		*words++ = dpi_image_u32(img, t->accept[i]);
+	}
+	for(i = 0; i < (size_t) t->num_states * t->words; i++)
+	{
+		*words++ = dpi_image_u32(img, t->follow[i]);
+	}
+	for(i = 0; i < (size_t) t->num_lists * t->words; i++)
+	{
+		*words++ = dpi_image_u32(img, t->list_start[i]);
+	}
+
+	retval = dpi_image_add(img, DPI_SECTION_NFA, nfa, size);
+	free(nfa);
+	return retval;
+}
+
+
+static void dpi_compile_report_regex(uint32_t id, const struct dpi_regex *re)
+{
+	const struct dpi_re_piece *piece;
+	uint32_t i, head_end;
+
+	if(re->num_branches)
+	{
+		printf("\tregex %u: split into %u alternatives\n", id, re->num_branches);
+		for(i = 0; i < re->num_branches; i++)
+		{
+			dpi_compile_report_regex(id, &re->branches[i]);
+		}
+		return;
+	}
+
+	if(re->split == re->last)
+	{
+		printf("\tregex %u: table only (%u positions)\n", id, re->head_positions);
+		return;
+	}
+
+	// A branch has no source of its own
+	if(!re->source)
+	{
+		printf("\tregex %u: table %u positions, CPU %u positions\n", id, re->head_positions, re->tail_positions);
+		return;
+	}
+
+	// With split_inside, the first repetition of the split piece is in the table
+	piece = &re->pieces[re->split];
+	head_end = piece->offset;
+	printf("\tregex %u: table \"%.*s%s\" (%u positions), CPU \"%s\" (%u positions)\n",
+		id, (int) head_end, re->source, re->split_inside ? "<one repetition>" : "",
+		re->head_positions, re->source + head_end, re->tail_positions);
+}
+
+
+static void dpi_compile_report(const struct dpi_pattern_set *set)
+{
+	uint32_t i;
+
+	for(i = 0; i < set->count; i++)
+	{
+		if(set->patterns[i].regex)
+		{
+			dpi_compile_report_regex(set->patterns[i].id, set->patterns[i].regex);
+		}
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	struct dpi_pattern_set set;
+	struct dpi_matcher *m = NULL;
+	struct dpi_image img;
+	int retval = EXIT_FAILURE;
+
+	if(dpi_compile_parse(argc, argv))
+	{
+		dpi_compile_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(dpi_pattern_set_load(&set, Compile_Config.patterns))
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("** Compiling %u patterns (%u regexes) for a %s endian target...\n", set.count,
+		set.regexes, Compile_Config.big_endian ? "big" : "little");
+
+	dpi_image_init(&img, Compile_Config.big_endian);
+
+	// Accelerator matches of regex heads are confirmed with the software matcher
+	if(set.regexes && !Compile_Config.dfa)
+	{
+		fprintf(stderr, "--no-dfa cannot be used with regex signatures\n");
+		goto out;
+	}
+
+	// Generated code replaces the software matcher of the image, it does not stand alone
+	if(Compile_Config.emit_c && !Compile_Config.dfa)
+	{
+		fprintf(stderr, "--no-dfa cannot be used with --emit-c\n");
+		goto out;
+	}
+
+	m = set.regexes ? dpi_regex_compile(&set, &Compile_Config.regex) : dpi_matcher_compile(&set);
+	if(!m)
+	{
+		goto out;
+	}
+
+	if(Compile_Config.profile && dpi_compile_reorder(m))
+	{
+		goto out;
+	}
+
+	if(dpi_compile_bloom(&img, &set) || dpi_compile_prefilter(&img, &set) ||
+		dpi_compile_dfa(&img, &set, m) || dpi_compile_pattern_ids(&img, &set))
+	{
+		goto out;
+	}
+
+	if(dpi_image_write(&img, Compile_Config.output))
+	{
+		goto out;
+	}
+
+	printf("** Rule image is written to %s (checksum 0x%08x)\n", Compile_Config.output, img.crc);
+
+	if(Compile_Config.emit_c)
+	{
+		if(dpi_emit_c(m, img.crc, Compile_Config.patterns, Compile_Config.emit_c))
+		{
+			goto out;
+		}
+		printf("** Generated matcher is written to %s (used by the kernel with gen=1)\n", Compile_Config.emit_c);
+	}
+
+	retval = EXIT_SUCCESS;
+
+out:
+	dpi_matcher_free(m);
+	dpi_image_free(&img);
+	dpi_pattern_set_free(&set);
+	return retval;
+}
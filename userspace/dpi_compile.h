@@ -0,0 +1,95 @@
+#ifndef _DPI_COMPILE_H
+#define _DPI_COMPILE_H
+
+/**
+ * Pattern compiler for FPGA matcher.
+ * Compiles a signature file into a rule image for DPI_IOC_LOAD_IMAGE or
+ * the firmware path of the kernel module.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include "dpi_matcher.h"
+#include "dpi_prefilter.h"
+#include "dpi_bloom.h"
+#include "dpi_image.h"
+#include "dpi_regex.h"
+#include "dpi_emit.h"
+#include "dpi_profile.h"
+
+/** Compiler settings */
+struct dpi_compile_config
+{
+	const char *patterns;
+	const char *output;
+
+	// Bloom filter size in bits (0 disables it) and window length
+	uint32_t bloom_bits;
+	uint32_t bloom_q;
+
+	// Include the software matcher used while the accelerator is down
+	bool dfa;
+
+	// Limits of the hybrid automaton built for regex signatures
+	struct dpi_regex_limits regex;
+
+	// Generated matcher source to write (NULL for none)
+	const char *emit_c;
+
+	// Visit profile that orders the states (NULL keeps compiler order)
+	const char *profile;
+
+	// Byte order of the target CPU (PowerPC 440 is big endian)
+	bool big_endian;
+};
+
+/** The function that prints compiler usage */
+static void dpi_compile_help(const char *);
+
+/** The function that parses command line arguments into compiler settings */
+static int dpi_compile_parse(int, char **);
+
+/** The function that adds the prefilter section */
+static int dpi_compile_prefilter(struct dpi_image *, const struct dpi_pattern_set *);
+
+/** The function that adds the bloom filter section */
+static int dpi_compile_bloom(struct dpi_image *, const struct dpi_pattern_set *);
+
+/** The function that adds the software matcher and accelerator table sections */
+static int dpi_compile_dfa(struct dpi_image *, const struct dpi_pattern_set *, const struct dpi_matcher *);
+
+/** The function that adds the regex tail section */
+static int dpi_compile_nfa(struct dpi_image *, const struct dpi_regex_tails *);
+
+/** The function that renumbers states by the visit profile */
+static int dpi_compile_reorder(struct dpi_matcher *);
+
+/** The function that adds the signature id of every pattern */
+static int dpi_compile_pattern_ids(struct dpi_image *, const struct dpi_pattern_set *);
+
+/** The function that reports where one regex (or each of its alternatives) is split */
+static void dpi_compile_report_regex(uint32_t, const struct dpi_regex *);
+
+/** The function that reports where regex signatures are split */
+static void dpi_compile_report(const struct dpi_pattern_set *);
+
+/** The option struct for compiler arguments */
+static const struct option dpi_compile_opts[] =
+{
+	{ "patterns", 1, NULL, 'P' },
+	{ "output", 1, NULL, 'o' },
+	{ "bloom-bits", 1, NULL, 'b' },
+	{ "bloom-q", 1, NULL, 'q' },
+	{ "no-dfa", 0, NULL, 'N' },
+	{ "max-states", 1, NULL, 'S' },
+	{ "split-repeat", 1, NULL, 'R' },
+	{ "emit-c", 1, NULL, 'C' },
+	{ "profile", 1, NULL, 'p' },
+	{ "big-endian", 0, NULL, 'B' },
+	{ "little-endian", 0, NULL, 'L' },
+	{ "help", 0, NULL, 'h' },
+	{ .name = NULL }
+};
+
+#endif
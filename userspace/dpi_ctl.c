@@ -0,0 +1,445 @@
+/**
+ * Control tool for FPGA matcher.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dpi_ctl.h"
+
+
+/** Available commands */
+static const struct dpi_ctl_cmd Dpi_Ctl_Cmds[] =
+{
+	{ "load", "IMAGE", 1, dpi_ctl_load },
+	{ "reload", "[NAME]", 0, dpi_ctl_reload },
+	{ "unload", "", 0, dpi_ctl_unload },
+	{ "stats", "", 0, dpi_ctl_stats },
+	{ "profile", "FILE", 1, dpi_ctl_profile },
+	{ "events", "[COUNT]", 0, dpi_ctl_events },
+};
+
+
+/** Function that passes an image (NULL to unload) to the kernel module */
+static int dpi_ctl_push_image(const void *data, size_t size)
+{
+	struct dpi_image_blob blob;
+	int fd, retval = 0;
+
+	fd = open(DPI_CTL_DEVICE, O_RDWR);
+	if(fd < 0)
+	{
+		perror(DPI_CTL_DEVICE);
+		return -1;
+	}
+
+	memset(&blob, 0, sizeof(blob));
+	blob.data = (uint64_t) (uintptr_t) data;
+	blob.size = (uint32_t) size;
+
+	if(ioctl(fd, DPI_IOC_LOAD_IMAGE, &blob) < 0)
+	{
+		perror("DPI_IOC_LOAD_IMAGE");
+		retval = -1;
+	}
+
+	close(fd);
+	return retval;
+}
+
+
+static int dpi_ctl_load(int argc, char **argv)
+{
+	struct stat st;
+	void *data;
+	int fd, retval = -1;
+
+	(void) argc;
+
+	fd = open(argv[0], O_RDONLY);
+	if(fd < 0 || fstat(fd, &st))
+	{
+		perror(argv[0]);
+		if(fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+
+	if(st.st_size == 0 || st.st_size > DPI_IMAGE_MAX_SIZE)
+	{
+		fprintf(stderr, "%s: invalid image size %lld\n", argv[0], (long long) st.st_size);
+		close(fd);
+		return -1;
+	}
+
+	data = malloc(st.st_size);
+	if(data && read(fd, data, st.st_size) == st.st_size)
+	{
+		retval = dpi_ctl_push_image(data, st.st_size);
+	}
+	else
+	{
+		fprintf(stderr, "%s: read failed\n", argv[0]);
+	}
+
+	if(!retval)
+	{
+		printf("Loaded %s (%lld bytes)\n", argv[0], (long long) st.st_size);
+	}
+
+	free(data);
+	close(fd);
+	return retval;
+}
+
+
+static int dpi_ctl_reload(int argc, char **argv)
+{
+	struct dpi_firmware_name fw;
+	int fd, retval = 0;
+
+	memset(&fw, 0, sizeof(fw));
+	if(argc > 0)
+	{
+		if(strlen(argv[0]) >= sizeof(fw.name))
+		{
+			fprintf(stderr, "%s: name too long\n", argv[0]);
+			return -1;
+		}
+		strcpy(fw.name, argv[0]);
+	}
+
+	fd = open(DPI_CTL_DEVICE, O_RDWR);
+	if(fd < 0)
+	{
+		perror(DPI_CTL_DEVICE);
+		return -1;
+	}
+
+	// The kernel reads the image from its firmware path (/lib/firmware)
+	if(ioctl(fd, DPI_IOC_LOAD_FIRMWARE, &fw) < 0)
+	{
+		perror("DPI_IOC_LOAD_FIRMWARE");
+		retval = -1;
+	}
+	else
+	{
+		printf("Loaded %s from the firmware path\n", fw.name[0] ? fw.name : "the default image");
+	}
+
+	close(fd);
+	return retval;
+}
+
+
+static int dpi_ctl_unload(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+
+	return dpi_ctl_push_image(NULL, 0);
+}
+
+
+static int dpi_ctl_stats(int argc, char **argv)
+{
+	char line[256];
+	FILE *fp;
+
+	(void) argc;
+	(void) argv;
+
+	fp = fopen(DPI_CTL_PROC_DIR "/stats", "r");
+	if(!fp)
+	{
+		perror(DPI_CTL_PROC_DIR "/stats");
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		fputs(line, stdout);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+
+static int dpi_ctl_profile(int argc, char **argv)
+{
+	struct dpi_profile_query query;
+	struct dpi_profile prof;
+	uint32_t *counts = NULL, i;
+	int fd, retval = -1;
+
+	(void) argc;
+
+	fd = open(DPI_CTL_DEVICE, O_RDWR);
+	if(fd < 0)
+	{
+		perror(DPI_CTL_DEVICE);
+		return -1;
+	}
+
+	// First call only returns the size of the table
+	memset(&query, 0, sizeof(query));
+	if(ioctl(fd, DPI_IOC_GET_PROFILE, &query) < 0)
+	{
+		perror(errno == ENOENT ? "DPI_IOC_GET_PROFILE (load the image with profile=1 set)" :
+				"DPI_IOC_GET_PROFILE");
+		goto out;
+	}
+
+	// Profiles must be in compiler order, dpi_compile applies them to a fresh automaton
+	if(query.flags & DPI_DFA_REORDERED)
+	{
+		fprintf(stderr, "The loaded image is already reordered; profile an image compiled without --profile\n");
+		goto out;
+	}
+
+	counts = calloc(query.num_states, sizeof(*counts));
+	if(!counts || dpi_profile_init(&prof, query.num_states))
+	{
+		goto out;
+	}
+
+	// Counters restart after every read
+	query.data = (uint64_t) (uintptr_t) counts;
+	query.flags = DPI_PROFILE_RESET;
+	if(ioctl(fd, DPI_IOC_GET_PROFILE, &query) < 0 || query.num_states != prof.num_states)
+	{
+		perror("DPI_IOC_GET_PROFILE");
+		dpi_profile_free(&prof);
+		goto out;
+	}
+
+	for(i = 0; i < prof.num_states; i++)
+	{
+		prof.visits[i] = counts[i];
+	}
+
+	retval = dpi_profile_save(&prof, argv[0]);
+	if(!retval)
+	{
+		printf("Profile of generation %u (%u states) is written to %s\n", query.generation,
+			prof.num_states, argv[0]);
+	}
+	dpi_profile_free(&prof);
+
+out:
+	free(counts);
+	close(fd);
+	return retval;
+}
+
+
+/** Function that prints one match event */
+/** Field names of events, in the order of XT_FPGA_FIELD_* */
+static const char *const dpi_ctl_field_names[] =
+{
+	"packet",
+	"http-host",
+	"http-uri",
+	"tls-sni",
+	"dns-qname",
+};
+
+
+static void dpi_ctl_print_event(unsigned int cpu, const struct dpi_event *ev)
+{
+	char src[INET6_ADDRSTRLEN] = "-", dst[INET6_ADDRSTRLEN] = "-", when[32];
+	time_t sec = ev->timestamp / 1000000000ULL;
+	struct tm tm;
+
+	if(ev->family == AF_INET || ev->family == AF_INET6)
+	{
+		inet_ntop(ev->family, ev->saddr, src, sizeof(src));
+		inet_ntop(ev->family, ev->daddr, dst, sizeof(dst));
+	}
+
+	localtime_r(&sec, &tm);
+	strftime(when, sizeof(when), "%H:%M:%S", &tm);
+
+	printf("%s.%06u cpu %u rule %-*.*s proto %u %s:%u -> %s:%u pattern %u", when,
+		(unsigned int) (ev->timestamp % 1000000000ULL / 1000), cpu, DPI_EVENT_RULE_LEN,
+		DPI_EVENT_RULE_LEN, ev->rule[0] ? ev->rule : "-", ev->protocol, src, ev->sport, dst,
+		ev->dport, ev->pattern_id);
+
+	if(ev->field && ev->field < sizeof(dpi_ctl_field_names) / sizeof(dpi_ctl_field_names[0]))
+	{
+		printf(" %s", dpi_ctl_field_names[ev->field]);
+	}
+
+	if(ev->flags & DPI_EVENT_INFLATED)
+	{
+		printf(" inflated");
+	}
+
+	if(ev->offset != DPI_OFFSET_UNKNOWN)
+	{
+		printf(" offset %u/%u\n", ev->offset, ev->len);
+	}
+	else
+	{
+		printf(" offset -/%u\n", ev->len);
+	}
+}
+
+
+static int dpi_ctl_events(int argc, char **argv)
+{
+	struct dpi_event_params params;
+	struct dpi_event_ring_ctrl *ring;
+	const struct dpi_event *events;
+	struct pollfd pfd;
+	unsigned long count = 0, printed = 0;
+	uint64_t *dropped = NULL;
+	uint32_t head, tail, n;
+	size_t size;
+	uint8_t *region;
+	int fd, retval = -1;
+
+	if(argc > 0)
+	{
+		count = strtoul(argv[0], NULL, 0);
+	}
+
+	fd = open(DPI_EVENTS_DEVICE_PATH, O_RDWR);
+	if(fd < 0)
+	{
+		perror(DPI_EVENTS_DEVICE_PATH);
+		return -1;
+	}
+
+	if(ioctl(fd, DPI_IOC_EVENT_PARAMS, &params) < 0)
+	{
+		perror("DPI_IOC_EVENT_PARAMS");
+		close(fd);
+		return -1;
+	}
+
+	if(params.event_size != sizeof(struct dpi_event))
+	{
+		fprintf(stderr, "Kernel events are %u bytes, this tool reads %zu\n", params.event_size,
+			sizeof(struct dpi_event));
+		close(fd);
+		return -1;
+	}
+
+	size = (size_t) params.num_rings * params.ring_stride;
+	region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	dropped = calloc(params.num_rings, sizeof(*dropped));
+	if(region == MAP_FAILED || !dropped)
+	{
+		perror("mmap");
+		goto out;
+	}
+
+	// Only drops from now on are reported
+	for(n = 0; n < params.num_rings; n++)
+	{
+		ring = (struct dpi_event_ring_ctrl *) (region + (size_t) n * params.ring_stride);
+		dropped[n] = ring->dropped;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while(!count || printed < count)
+	{
+		for(n = 0; n < params.num_rings && (!count || printed < count); n++)
+		{
+			ring = (struct dpi_event_ring_ctrl *) (region + (size_t) n * params.ring_stride);
+			events = (const struct dpi_event *) (ring + 1);
+
+			// Read events only after the head that published them
+			head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			for(tail = ring->tail; tail != head && (!count || printed < count); tail++, printed++)
+			{
+				dpi_ctl_print_event(n, &events[tail & (params.entries - 1)]);
+			}
+
+			// Give the slots back after they are read
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+			if(ring->dropped != dropped[n])
+			{
+				printf("cpu %u: %llu events dropped\n", n, (unsigned long long) (ring->dropped - dropped[n]));
+				dropped[n] = ring->dropped;
+			}
+		}
+		fflush(stdout);
+
+		if((!count || printed < count) && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+		{
+			perror("poll");
+			goto out;
+		}
+	}
+	retval = 0;
+
+out:
+	if(region != MAP_FAILED)
+	{
+		munmap(region, size);
+	}
+	free(dropped);
+	close(fd);
+	return retval;
+}
+
+
+/** Function that prints available commands */
+static void dpi_ctl_help(const char *prog)
+{
+	unsigned int i;
+
+	printf("Usage: %s COMMAND [ARGS]\n", prog);
+	for(i = 0; i < sizeof(Dpi_Ctl_Cmds) / sizeof(Dpi_Ctl_Cmds[0]); i++)
+	{
+		printf("\t%s %s\n", Dpi_Ctl_Cmds[i].name, Dpi_Ctl_Cmds[i].args);
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	if(argc < 2)
+	{
+		dpi_ctl_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for(i = 0; i < sizeof(Dpi_Ctl_Cmds) / sizeof(Dpi_Ctl_Cmds[0]); i++)
+	{
+		if(strcmp(argv[1], Dpi_Ctl_Cmds[i].name))
+		{
+			continue;
+		}
+
+		if(argc - 2 < Dpi_Ctl_Cmds[i].argc)
+		{
+			dpi_ctl_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		return Dpi_Ctl_Cmds[i].run(argc - 2, argv + 2) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	dpi_ctl_help(argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,45 @@
+#ifndef _DPI_CTL_H
+#define _DPI_CTL_H
+
+/**
+ * Control tool for FPGA matcher.
+ * Loads rule images into the kernel module and shows its statistics and
+ * match events.
+ */
+
+#include <stdio.h>
+#include "dpi_user.h"
+#include "dpi_profile.h"
+
+/** Default locations of the module interfaces */
+#define DPI_CTL_DEVICE					"/dev/dpi"
+#define DPI_CTL_PROC_DIR				"/proc/net/xt_fpga"
+
+/** A dpi_ctl command */
+struct dpi_ctl_cmd
+{
+	const char *name;
+	const char *args;
+	int argc;
+	int (*run)(int, char **);
+};
+
+/** The function that loads a rule image from a file */
+static int dpi_ctl_load(int, char **);
+
+/** The function that has the kernel load a rule image from its firmware path */
+static int dpi_ctl_reload(int, char **);
+
+/** The function that removes the loaded rule image */
+static int dpi_ctl_unload(int, char **);
+
+/** The function that prints module statistics */
+static int dpi_ctl_stats(int, char **);
+
+/** The function that saves the visit profile of the loaded rule image */
+static int dpi_ctl_profile(int, char **);
+
+/** The function that prints match events of --print rules (COUNT of them, or until interrupted) */
+static int dpi_ctl_events(int, char **);
+
+#endif
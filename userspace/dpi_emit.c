@@ -0,0 +1,252 @@
+/**
+ * C code generator for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dpi_user.h"
+#include "dpi_emit.h"
+
+
+/** Function that returns the most frequent next state of a row */
+static uint32_t dpi_emit_default(const uint16_t *row)
+{
+	uint32_t best = row[0], count, best_count = 0;
+	unsigned int b, k;
+
+	for(b = 0; b < 256; b++)
+	{
+		// Rows have few distinct targets; count each one at its first byte
+		for(k = 0; k < b && row[k] != row[b]; k++);
+		if(k < b)
+		{
+			continue;
+		}
+
+		count = 0;
+		for(k = b; k < 256; k++)
+		{
+			count += (row[k] == row[b]);
+		}
+
+		if(count > best_count)
+		{
+			best = row[b];
+			best_count = count;
+		}
+	}
+
+	return best;
+}
+
+
+/**
+ *	Function that marks the states the generated code can enter. Complete
+ *	finals return at once, states only reachable through them are left out.
+ *	Returns the number of marked states, 0 on error.
+ */
+static uint32_t dpi_emit_reach(const struct dpi_matcher *m, uint8_t *reached)
+{
+	uint32_t *queue, head = 0, tail = 0, s, t;
+	unsigned int b;
+
+	queue = malloc(m->num_states * sizeof(*queue));
+	if(!queue)
+	{
+		return 0;
+	}
+
+	queue[tail++] = 0;
+	reached[0] = 1;
+	while(head < tail)
+	{
+		s = queue[head++];
+		if(m->final[s] && !(m->final[s] & DPI_DFA_FINAL_CONFIRM))
+		{
+			continue;
+		}
+
+		for(b = 0; b < 256; b++)
+		{
+			t = m->next[(size_t) s * 256 + b];
+
+			// Bit 1 tells whether a jump to the state is emitted
+			if(!reached[t])
+			{
+				queue[tail++] = t;
+			}
+			reached[t] |= 3;
+		}
+	}
+
+	free(queue);
+	return tail;
+}
+
+
+/** Function that writes the code of one state */
+static void dpi_emit_state(FILE *fp, const struct dpi_matcher *m, uint32_t s, bool label, unsigned long *cases)
+{
+	const uint16_t *row = m->next + (size_t) s * 256;
+	uint32_t final = m->final[s], def;
+	unsigned int b, e;
+
+	if(label)
+	{
+		fprintf(fp, "s%u:\n", s);
+	}
+
+	// Complete finals return on arrival, as in the table matcher
+	if(final && !(final & DPI_DFA_FINAL_CONFIRM))
+	{
+		fprintf(fp, "\treturn %u;\n", final);
+		return;
+	}
+
+	if(final)
+	{
+		fprintf(fp, "\tm = confirm(ctx, %u, p, end - p);\n\tif(m)\n\t\treturn m;\n",
+			final & ~DPI_DFA_FINAL_CONFIRM);
+	}
+
+	def = dpi_emit_default(row);
+
+	// Most payload bytes leave the start state where it is
+	if(s == 0 && def == 0)
+	{
+		fprintf(fp, "\twhile(p < end && !Dpi_Gen_Wake[*p])\n\t\tp++;\n");
+	}
+
+	fprintf(fp, "\tif(p == end)\n\t\treturn 0;\n");
+
+	for(b = 0; b < 256 && row[b] == def; b++);
+	if(b == 256)
+	{
+		fprintf(fp, "\tp++;\n\tgoto s%u;\n", def);
+		return;
+	}
+
+	fprintf(fp, "\tswitch(*p++)\n\t{\n");
+	for(b = 0; b < 256; b = e)
+	{
+		for(e = b + 1; e < 256 && row[e] == row[b]; e++);
+		if(row[b] == def)
+		{
+			continue;
+		}
+
+		if(e - b == 1)
+		{
+			fprintf(fp, "\t\tcase 0x%02x: goto s%u;\n", b, row[b]);
+		}
+		else
+		{
+			fprintf(fp, "\t\tcase 0x%02x ... 0x%02x: goto s%u;\n", b, e - 1, row[b]);
+		}
+		(*cases)++;
+	}
+	fprintf(fp, "\t\tdefault: goto s%u;\n\t}\n", def);
+}
+
+
+int dpi_emit_c(const struct dpi_matcher *m, uint32_t crc, const char *source, const char *path)
+{
+	unsigned long cases = 0;
+	unsigned int b;
+	uint32_t s, states;
+	uint8_t *reached;
+	bool confirms = false;
+	FILE *fp;
+
+	if(m->num_states > DPI_EMIT_MAX_STATES)
+	{
+		fprintf(stderr, "dpi_emit: %u states, code is generated for at most %u\n", m->num_states,
+			DPI_EMIT_MAX_STATES);
+		return -1;
+	}
+
+	// The start state is entered without a byte, it cannot report a match
+	if(m->final[0])
+	{
+		fprintf(stderr, "dpi_emit: start state is final\n");
+		return -1;
+	}
+
+	reached = calloc(m->num_states, 1);
+	if(!reached)
+	{
+		return -1;
+	}
+
+	states = dpi_emit_reach(m, reached);
+	if(!states)
+	{
+		free(reached);
+		return -1;
+	}
+
+	for(s = 0; s < m->num_states; s++)
+	{
+		confirms |= reached[s] && (m->final[s] & DPI_DFA_FINAL_CONFIRM);
+	}
+
+	fp = fopen(path, "w");
+	if(!fp)
+	{
+		perror(path);
+		free(reached);
+		return -1;
+	}
+
+	fprintf(fp,
+		"/**\n"
+		" * Generated by dpi_compile --emit-c from %s; do not edit.\n"
+		" * %u states, %u final. Used only with the rule image of checksum 0x%08x.\n"
+		" */\n\n"
+		"#include \"dpi_gen.h\"\n\n\n"
+		"const __u32 dpi_gen_image_crc = 0x%08x;\n"
+		"const __u32 dpi_gen_num_states = %u;\n",
+		source, m->num_states, m->num_finals, crc, crc, m->num_states);
+
+	// Skip loop of the start state, see dpi_emit_state()
+	if(dpi_emit_default(m->next) == 0)
+	{
+		fprintf(fp, "\n/** Bytes that leave the start state */\nstatic const __u8 Dpi_Gen_Wake[256] =\n{");
+		for(b = 0; b < 256; b++)
+		{
+			fprintf(fp, "%s%u,", (b % 32) ? " " : "\n\t", m->next[b] != 0);
+		}
+		fprintf(fp, "\n};\n");
+	}
+
+	fprintf(fp,
+		"\n\n__u32 dpi_gen_match(const __u8 *p, unsigned int len, dpi_gen_confirm_t confirm, const void *ctx)\n"
+		"{\n"
+		"\tconst __u8 *end = p + len;\n");
+	if(confirms)
+	{
+		fprintf(fp, "\t__u32 m;\n");
+	}
+	fprintf(fp, "\n");
+
+	// State 0 comes first, the function starts in it
+	for(s = 0; s < m->num_states; s++)
+	{
+		if(reached[s])
+		{
+			dpi_emit_state(fp, m, s, reached[s] & 2, &cases);
+		}
+	}
+
+	fprintf(fp, "}\n");
+	free(reached);
+
+	if(fclose(fp))
+	{
+		perror(path);
+		return -1;
+	}
+
+	printf("\tgenerated matcher: %u of %u states, %lu switch cases\n", states, m->num_states, cases);
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef _DPI_EMIT_H
+#define _DPI_EMIT_H
+
+/**
+ * C code generator for FPGA matcher tools.
+ * Writes a compiled automaton as C code for a fixed signature set: one
+ * label per state and a switch over the next byte with case ranges, so
+ * transitions become constants in the code instead of table loads. The
+ * interface of the generated code is in kernel/dpi_gen.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "dpi_matcher.h"
+
+/** Largest automaton written as code; compile time of the code grows faster than its size */
+#define DPI_EMIT_MAX_STATES				4096
+
+/**
+ *	This function writes the generated matcher of an automaton into a file.
+ *	crc is the checksum of the rule image compiled from the same automaton;
+ *	the kernel module uses the code only with that image.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_emit_c(const struct dpi_matcher *, uint32_t, const char *, const char *);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * Rule image writer for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dpi_image.h"
+
+
+/** Function that returns true on big endian hosts */
+static bool dpi_host_big_endian(void)
+{
+	const uint16_t probe = 1;
+
+	return *(const uint8_t *) &probe == 0;
+}
+
+
+/** Function that continues a CRC-32 (zlib polynomial, bit reflected) over a buffer */
+static uint32_t dpi_image_crc(uint32_t crc, const void *data, size_t size)
+{
+	static uint32_t table[256];
+	const uint8_t *p = data;
+	uint32_t c;
+	size_t i;
+	int k;
+
+	if(!table[1])
+	{
+		for(i = 0; i < 256; i++)
+		{
+			c = (uint32_t) i;
+			for(k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	}
+
+	for(i = 0; i < size; i++)
+	{
+		crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+
+void dpi_image_init(struct dpi_image *img, bool big_endian)
+{
+	memset(img, 0, sizeof(*img));
+	img->swap = (big_endian != dpi_host_big_endian());
+}
+
+
+uint32_t dpi_image_u32(const struct dpi_image *img, uint32_t v)
+{
+	return img->swap ? __builtin_bswap32(v) : v;
+}
+
+
+uint16_t dpi_image_u16(const struct dpi_image *img, uint16_t v)
+{
+	return img->swap ? __builtin_bswap16(v) : v;
+}
+
+
+int dpi_image_add(struct dpi_image *img, uint32_t type, const void *data, size_t size)
+{
+	void *copy;
+
+	if(img->num_sections == DPI_IMAGE_MAX_SECTIONS)
+	{
+		fprintf(stderr, "dpi_image: too many sections\n");
+		return -1;
+	}
+
+	copy = malloc(size ? size : 1);
+	if(!copy)
+	{
+		return -1;
+	}
+	memcpy(copy, data, size);
+
+	// Offsets are assigned when the image is written
+	img->sections[img->num_sections].type = type;
+	img->sections[img->num_sections].size = (uint32_t) size;
+	img->data[img->num_sections] = copy;
+	img->num_sections++;
+
+	return 0;
+}
+
+
+int dpi_image_write(struct dpi_image *img, const char *path)
+{
+	struct dpi_image_header hdr;
+	struct dpi_image_section table[DPI_IMAGE_MAX_SECTIONS] = { { 0 } };
+	static const unsigned char pad[DPI_IMAGE_ALIGN];
+	size_t offset, padding;
+	unsigned int i;
+	uint32_t crc;
+	FILE *fp;
+
+	// Place sections after the section table, each one aligned
+	offset = sizeof(hdr) + img->num_sections * sizeof(table[0]);
+	for(i = 0; i < img->num_sections; i++)
+	{
+		offset = (offset + DPI_IMAGE_ALIGN - 1) & ~((size_t) DPI_IMAGE_ALIGN - 1);
+
+		table[i].type = dpi_image_u32(img, img->sections[i].type);
+		table[i].offset = dpi_image_u32(img, (uint32_t) offset);
+		table[i].size = dpi_image_u32(img, img->sections[i].size);
+		table[i].reserved = 0;
+
+		offset += img->sections[i].size;
+	}
+
+	if(offset > DPI_IMAGE_MAX_SIZE)
+	{
+		fprintf(stderr, "dpi_image: image too large (%zu bytes)\n", offset);
+		return -1;
+	}
+
+	// Checksum covers everything after the header, in file order
+	crc = dpi_image_crc(~0u, table, img->num_sections * sizeof(table[0]));
+	offset = sizeof(hdr) + img->num_sections * sizeof(table[0]);
+	for(i = 0; i < img->num_sections; i++)
+	{
+		padding = (DPI_IMAGE_ALIGN - offset % DPI_IMAGE_ALIGN) % DPI_IMAGE_ALIGN;
+		crc = dpi_image_crc(crc, pad, padding);
+		crc = dpi_image_crc(crc, img->data[i], img->sections[i].size);
+		offset += padding + img->sections[i].size;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = dpi_image_u32(img, DPI_IMAGE_MAGIC);
+	hdr.version = dpi_image_u16(img, DPI_IMAGE_VERSION);
+	hdr.num_sections = dpi_image_u16(img, img->num_sections);
+	hdr.image_size = dpi_image_u32(img, (uint32_t) offset);
+	img->crc = ~crc;
+	hdr.crc32 = dpi_image_u32(img, img->crc);
+
+	fp = fopen(path, "wb");
+	if(!fp)
+	{
+		perror(path);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(table, sizeof(table[0]), img->num_sections, fp);
+
+	offset = sizeof(hdr) + img->num_sections * sizeof(table[0]);
+	for(i = 0; i < img->num_sections; i++)
+	{
+		padding = (DPI_IMAGE_ALIGN - offset % DPI_IMAGE_ALIGN) % DPI_IMAGE_ALIGN;
+		fwrite(pad, 1, padding, fp);
+		fwrite(img->data[i], 1, img->sections[i].size, fp);
+		offset += padding + img->sections[i].size;
+	}
+
+	if(fclose(fp))
+	{
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void dpi_image_free(struct dpi_image *img)
+{
+	unsigned int i;
+
+	for(i = 0; i < img->num_sections; i++)
+	{
+		free(img->data[i]);
+	}
+
+	img->num_sections = 0;
+}
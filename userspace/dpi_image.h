@@ -0,0 +1,52 @@
+#ifndef _DPI_IMAGE_H
+#define _DPI_IMAGE_H
+
+/**
+ * Rule image writer for FPGA matcher tools.
+ * Lays out compiled tables as described in dpi_user.h, in the byte order
+ * of the target CPU.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "dpi_user.h"
+
+/** An image under construction */
+struct dpi_image
+{
+	// Target byte order differs from host byte order
+	bool swap;
+
+	uint16_t num_sections;
+	struct dpi_image_section sections[DPI_IMAGE_MAX_SECTIONS];
+	void *data[DPI_IMAGE_MAX_SECTIONS];
+
+	// Header checksum, set when the image is written
+	uint32_t crc;
+};
+
+/** The function that starts an empty image for a big or little endian target */
+void dpi_image_init(struct dpi_image *, bool);
+
+/** The function that converts a host value into target byte order */
+uint32_t dpi_image_u32(const struct dpi_image *, uint32_t);
+uint16_t dpi_image_u16(const struct dpi_image *, uint16_t);
+
+/**
+ *	This function appends a section. Data must already be in target byte
+ *	order; the image keeps its own copy.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_image_add(struct dpi_image *, uint32_t, const void *, size_t);
+
+/**
+ *	This function writes the image into a file.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_image_write(struct dpi_image *, const char *);
+
+/** The function that releases section copies */
+void dpi_image_free(struct dpi_image *);
+
+#endif
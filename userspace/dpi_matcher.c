@@ -0,0 +1,375 @@
+/**
+ * Software pattern engine for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "dpi_matcher.h"
+#include "dpi_regex.h"
+
+
+/** Function that converts a hexadecimal digit into its value */
+static int dpi_hex_value(int c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+
+/** Function that decodes an escaped pattern string into raw bytes */
+static int dpi_decode_pattern(const char *src, unsigned char *dst, uint32_t *len)
+{
+	uint32_t n = 0;
+	int hi, lo;
+
+	while(*src)
+	{
+		if(n == DPI_MAX_PATTERN_LEN)
+		{
+			return -1;
+		}
+
+		if(*src != '\\')
+		{
+			dst[n++] = (unsigned char) *src++;
+			continue;
+		}
+
+		// Escaped byte
+		src++;
+		switch(*src)
+		{
+			case '\\':	dst[n++] = '\\'; src++; break;
+			case 'n':	dst[n++] = '\n'; src++; break;
+			case 'r':	dst[n++] = '\r'; src++; break;
+			case 't':	dst[n++] = '\t'; src++; break;
+
+			case 'x':
+				hi = dpi_hex_value(src[1]);
+				lo = (hi < 0) ? -1 : dpi_hex_value(src[2]);
+				if(lo < 0)
+				{
+					return -1;
+				}
+				dst[n++] = (unsigned char) ((hi << 4) | lo);
+				src += 3;
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	*len = n;
+	return (n > 0) ? 0 : -1;
+}
+
+
+int dpi_pattern_set_load(struct dpi_pattern_set *set, const char *path)
+{
+	FILE *fp;
+	char line[4 * DPI_MAX_PATTERN_LEN + 64];
+	unsigned char bytes[DPI_MAX_PATTERN_LEN];
+	unsigned int line_no = 0;
+	uint32_t capacity = 0;
+	struct dpi_pattern *pattern;
+	char *cursor, *end;
+	unsigned long id;
+
+	memset(set, 0, sizeof(*set));
+
+	fp = fopen(path, "r");
+	if(!fp)
+	{
+		perror(path);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		line_no++;
+
+		// Strip line ending
+		line[strcspn(line, "\r\n")] = '\0';
+
+		// Skip leading whitespace, comments and empty lines
+		cursor = line;
+		while(isspace((unsigned char) *cursor))
+			cursor++;
+		if(*cursor == '\0' || *cursor == '#')
+			continue;
+
+		// Parse "<id> <pattern>"
+		id = strtoul(cursor, &end, 10);
+		if(end == cursor || !isspace((unsigned char) *end))
+		{
+			fprintf(stderr, "%s:%u: expected \"<id> <pattern>\"\n", path, line_no);
+			goto error;
+		}
+		while(isspace((unsigned char) *end))
+			end++;
+
+		// Grow pattern array when needed
+		if(set->count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 64;
+			pattern = realloc(set->patterns, capacity * sizeof(*pattern));
+			if(!pattern)
+			{
+				goto error;
+			}
+			set->patterns = pattern;
+		}
+
+		pattern = &set->patterns[set->count];
+		pattern->regex = NULL;
+		if(!strncmp(end, DPI_REGEX_PREFIX, strlen(DPI_REGEX_PREFIX)))
+		{
+			pattern->regex = dpi_regex_parse(end + strlen(DPI_REGEX_PREFIX));
+			if(!pattern->regex)
+			{
+				fprintf(stderr, "%s:%u: invalid regex\n", path, line_no);
+				goto error;
+			}
+			pattern->len = dpi_regex_prefix(pattern->regex, bytes, DPI_MAX_PATTERN_LEN);
+			set->regexes++;
+		}
+		else if(dpi_decode_pattern(end, bytes, &pattern->len))
+		{
+			fprintf(stderr, "%s:%u: invalid or too long pattern\n", path, line_no);
+			goto error;
+		}
+
+		pattern->id = (uint32_t) id;
+		pattern->bytes = malloc(pattern->len + 1);
+		if(!pattern->bytes)
+		{
+			dpi_regex_free(pattern->regex);
+			goto error;
+		}
+		memcpy(pattern->bytes, bytes, pattern->len);
+		set->count++;
+	}
+
+	fclose(fp);
+
+	if(!set->count)
+	{
+		fprintf(stderr, "%s: no patterns found\n", path);
+		return -1;
+	}
+
+	return 0;
+
+error:
+	fclose(fp);
+	dpi_pattern_set_free(set);
+	return -1;
+}
+
+
+void dpi_pattern_set_free(struct dpi_pattern_set *set)
+{
+	uint32_t i;
+
+	for(i = 0; i < set->count; i++)
+	{
+		free(set->patterns[i].bytes);
+		dpi_regex_free(set->patterns[i].regex);
+	}
+
+	free(set->patterns);
+	memset(set, 0, sizeof(*set));
+}
+
+
+struct dpi_matcher *dpi_matcher_compile(const struct dpi_pattern_set *set)
+{
+	struct dpi_matcher *m;
+	uint32_t *fail = NULL, *queue = NULL;
+	uint32_t max_states = 1, qhead = 0, qtail = 0;
+	uint32_t i, j, s, t, c;
+	uint16_t *row;
+
+	if(set->regexes)
+	{
+		return dpi_regex_compile(set, NULL);
+	}
+
+	// Every pattern byte adds at most one state to the trie
+	for(i = 0; i < set->count; i++)
+	{
+		max_states += set->patterns[i].len;
+	}
+	if(max_states > DPI_MAX_STATES)
+	{
+		max_states = DPI_MAX_STATES;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if(!m)
+	{
+		return NULL;
+	}
+
+	m->set = set;
+	m->next = calloc((size_t) max_states * 256, sizeof(*m->next));
+	m->final = calloc(max_states, sizeof(*m->final));
+	fail = calloc(max_states, sizeof(*fail));
+	queue = calloc(max_states, sizeof(*queue));
+	if(!m->next || !m->final || !fail || !queue)
+	{
+		goto error;
+	}
+
+	// Build the keyword trie. Only the root can transition to state 0,
+	// so 0 marks a missing goto edge at this point.
+	m->num_states = 1;
+	for(i = 0; i < set->count; i++)
+	{
+		s = 0;
+		for(j = 0; j < set->patterns[i].len; j++)
+		{
+			row = &m->next[(size_t) s * 256];
+			c = set->patterns[i].bytes[j];
+
+			if(!row[c])
+			{
+				if(m->num_states == max_states)
+				{
+					fprintf(stderr, "dpi_matcher: state limit (%u) exceeded\n", DPI_MAX_STATES);
+					goto error;
+				}
+				row[c] = (uint16_t) m->num_states++;
+			}
+			s = row[c];
+		}
+
+		// The first pattern ending at a state owns it
+		if(!m->final[s])
+		{
+			m->final[s] = i + 1;
+		}
+	}
+
+	// Complete the automaton in breadth-first order so that every failure
+	// state's row is already final when it is copied from
+	for(c = 0; c < 256; c++)
+	{
+		t = m->next[c];
+		if(t)
+		{
+			fail[t] = 0;
+			queue[qtail++] = t;
+		}
+	}
+
+	while(qhead < qtail)
+	{
+		s = queue[qhead++];
+		row = &m->next[(size_t) s * 256];
+
+		for(c = 0; c < 256; c++)
+		{
+			t = row[c];
+			if(t)
+			{
+				fail[t] = m->next[(size_t) fail[s] * 256 + c];
+				if(!m->final[t])
+				{
+					m->final[t] = m->final[fail[t]];
+				}
+				queue[qtail++] = t;
+			}
+			else
+			{
+				row[c] = m->next[(size_t) fail[s] * 256 + c];
+			}
+		}
+	}
+
+	for(s = 0; s < m->num_states; s++)
+	{
+		if(m->final[s])
+		{
+			m->num_finals++;
+		}
+	}
+
+	free(fail);
+	free(queue);
+	return m;
+
+error:
+	free(fail);
+	free(queue);
+	dpi_matcher_free(m);
+	return NULL;
+}
+
+
+void dpi_matcher_free(struct dpi_matcher *m)
+{
+	if(!m)
+	{
+		return;
+	}
+
+	free(m->next);
+	free(m->final);
+	dpi_regex_tails_free(m->tails);
+	free(m);
+}
+
+
+int dpi_matcher_scan(const struct dpi_matcher *m, const unsigned char *buf, size_t len,
+					uint32_t *pattern_id)
+{
+	const uint16_t *next = m->next;
+	const unsigned char *end = buf + len;
+	uint32_t active[DPI_NFA_MAX_STATES / 32];
+	uint32_t s = 0, f = 0;
+	bool tails = false;
+
+	while(buf < end)
+	{
+		// Tails of the heads that ended so far take the byte in one pass
+		if(tails)
+		{
+			f = dpi_regex_step(m->tails, active, *buf, &tails);
+			if(f)
+			{
+				break;
+			}
+		}
+
+		s = next[(s << 8) | *buf++];
+
+		f = m->final[s];
+		if(f)
+		{
+			// End of a regex head; its tails start with the next byte
+			if(!(f & DPI_DFA_FINAL_CONFIRM))
+			{
+				break;
+			}
+
+			dpi_regex_start(m->tails, f & ~DPI_DFA_FINAL_CONFIRM, active, &tails);
+			f = 0;
+		}
+	}
+
+	if(pattern_id)
+	{
+		*pattern_id = f ? m->set->patterns[f - 1].id : DPI_PATTERN_ID_NONE;
+	}
+	return f != 0;
+}
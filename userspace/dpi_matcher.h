@@ -0,0 +1,94 @@
+#ifndef _DPI_MATCHER_H
+#define _DPI_MATCHER_H
+
+/**
+ * Software pattern engine for FPGA matcher tools.
+ * Compiles a signature set into the same kind of state table that the
+ * DPI hardware walks, so userspace tools can match without the accelerator.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Limits of the signature compiler */
+#define DPI_MAX_PATTERN_LEN				256
+#define DPI_MAX_STATES					65535
+
+/** Returned as pattern id when nothing matched */
+#define DPI_PATTERN_ID_NONE				0
+
+/** Prefix of a regex signature ("<id> pcre:/regex/flags") */
+#define DPI_REGEX_PREFIX				"pcre:"
+
+struct dpi_regex;
+struct dpi_regex_tails;
+
+/** A single signature as read from the signature file */
+struct dpi_pattern
+{
+	uint32_t id;					// External pattern id (e.g. signature id)
+	uint32_t len;
+	unsigned char *bytes;			// Literal bytes; for a regex, the bytes every match starts with
+
+	struct dpi_regex *regex;		// NULL for a literal
+};
+
+/** The whole signature set */
+struct dpi_pattern_set
+{
+	uint32_t count;
+	uint32_t regexes;
+	struct dpi_pattern *patterns;
+};
+
+/** Compiled deterministic automaton (one full 256-wide row per state) */
+struct dpi_matcher
+{
+	uint32_t num_states;
+	uint32_t num_finals;
+
+	// Transition table: next[state * 256 + byte]
+	uint16_t *next;
+
+	// Per-state output: 0 if not final, else (pattern index + 1), or
+	// DPI_DFA_FINAL_CONFIRM | list if regex tails must confirm it
+	uint32_t *final;
+
+	// Regex tails run after a confirm final (NULL without regexes)
+	struct dpi_regex_tails *tails;
+
+	// Pattern set the automaton is compiled from
+	const struct dpi_pattern_set *set;
+};
+
+/**
+ *	This function reads a signature file into a pattern set.
+ *	Each non-empty line is "<id> <pattern>", '#' starts a comment line and
+ *	the pattern may use \xHH and \\ escapes. "<id> pcre:/regex/flags" is a
+ *	regex signature (see dpi_regex.h).
+ *		returns 0 on success, -1 on error
+ */
+int dpi_pattern_set_load(struct dpi_pattern_set *, const char *);
+
+/** The function that releases a pattern set */
+void dpi_pattern_set_free(struct dpi_pattern_set *);
+
+/**
+ *	This function compiles a pattern set into an automaton. Sets with
+ *	regexes are compiled by dpi_regex_compile() with default limits.
+ *		returns the matcher on success, NULL on error
+ */
+struct dpi_matcher *dpi_matcher_compile(const struct dpi_pattern_set *);
+
+/** The function that releases a compiled matcher */
+void dpi_matcher_free(struct dpi_matcher *);
+
+/**
+ *	This function scans a buffer with the compiled matcher.
+ *		returns 1 if any pattern matches (pattern id stored if pointer given)
+ *		returns 0 otherwise
+ */
+int dpi_matcher_scan(const struct dpi_matcher *, const unsigned char *, size_t,
+					uint32_t *);
+
+#endif
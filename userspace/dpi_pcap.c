@@ -0,0 +1,265 @@
+/**
+ * Minimal capture file reader for FPGA matcher tools.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dpi_pcap.h"
+
+/** Capture file magics (microsecond and nanosecond resolution) */
+#define DPI_PCAP_MAGIC					0xa1b2c3d4
+#define DPI_PCAP_MAGIC_NS				0xa1b23c4d
+
+/** On-disk file header */
+struct dpi_pcap_file_header
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+/** On-disk record header */
+struct dpi_pcap_record_header
+{
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+
+static uint32_t dpi_pcap_u32(const struct dpi_pcap *pc, uint32_t v)
+{
+	return pc->swap ? __builtin_bswap32(v) : v;
+}
+
+
+static uint16_t dpi_get16(const unsigned char *p)
+{
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+
+int dpi_pcap_open(struct dpi_pcap *pc, const char *path)
+{
+	struct dpi_pcap_file_header fh;
+
+	memset(pc, 0, sizeof(*pc));
+
+	pc->fp = fopen(path, "rb");
+	if(!pc->fp)
+	{
+		perror(path);
+		return -1;
+	}
+
+	if(fread(&fh, sizeof(fh), 1, pc->fp) != 1)
+	{
+		fprintf(stderr, "%s: short capture file\n", path);
+		goto err;
+	}
+
+	if(fh.magic == DPI_PCAP_MAGIC || fh.magic == DPI_PCAP_MAGIC_NS)
+	{
+		pc->swap = false;
+	}
+	else if(fh.magic == __builtin_bswap32(DPI_PCAP_MAGIC) || fh.magic == __builtin_bswap32(DPI_PCAP_MAGIC_NS))
+	{
+		pc->swap = true;
+	}
+	else
+	{
+		fprintf(stderr, "%s: not a pcap file (pcapng is not supported)\n", path);
+		goto err;
+	}
+
+	pc->linktype = dpi_pcap_u32(pc, fh.linktype);
+	pc->buf = malloc(DPI_PCAP_MAX_SNAPLEN);
+	if(!pc->buf)
+	{
+		goto err;
+	}
+
+	return 0;
+
+err:
+	fclose(pc->fp);
+	pc->fp = NULL;
+	return -1;
+}
+
+
+/** Function that locates the network header for the link type of the file */
+static const unsigned char *dpi_pcap_l3(const struct dpi_pcap *pc, const unsigned char *p,
+									size_t len, size_t *l3_len)
+{
+	size_t off;
+	uint16_t proto;
+
+	switch(pc->linktype)
+	{
+		case DPI_PCAP_LINKTYPE_ETHERNET:
+			if(len < 14)
+				return NULL;
+			off = 12;
+			proto = dpi_get16(p + off);
+
+			// Skip VLAN tags
+			while((proto == 0x8100 || proto == 0x88a8) && off + 6 <= len)
+			{
+				off += 4;
+				proto = dpi_get16(p + off);
+			}
+			off += 2;
+			break;
+
+		case DPI_PCAP_LINKTYPE_LINUX_SLL:
+			if(len < 16)
+				return NULL;
+			off = 16;
+			proto = dpi_get16(p + 14);
+			break;
+
+		case DPI_PCAP_LINKTYPE_NULL:
+			// Address family in host byte order of the capturing machine
+			if(len < 4)
+				return NULL;
+			off = 4;
+			proto = 0;
+			break;
+
+		case DPI_PCAP_LINKTYPE_RAW:
+		case DPI_PCAP_LINKTYPE_RAW_OLD:
+		case DPI_PCAP_LINKTYPE_RAW_OLD2:
+			off = 0;
+			proto = 0;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	if(off > len || (proto && proto != 0x0800 && proto != 0x86dd))
+	{
+		return NULL;
+	}
+
+	*l3_len = len - off;
+	return p + off;
+}
+
+
+/** Function that locates the transport payload of an IP packet */
+static const unsigned char *dpi_pcap_payload(const unsigned char *ip, size_t len, size_t *payload_len)
+{
+	size_t hl, total, off;
+	uint8_t proto;
+
+	if(len < 1)
+	{
+		return NULL;
+	}
+
+	if((ip[0] >> 4) == 4)
+	{
+		hl = (ip[0] & 0xf) * 4;
+		if(len < 20 || hl < 20 || hl > len)
+			return NULL;
+
+		total = dpi_get16(ip + 2);
+		if(total < hl || total > len)
+			total = len;
+		proto = ip[9];
+		off = hl;
+	}
+	else if((ip[0] >> 4) == 6)
+	{
+		if(len < 40)
+			return NULL;
+
+		total = 40 + dpi_get16(ip + 4);
+		if(total > len)
+			total = len;
+		proto = ip[6];
+		off = 40;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	switch(proto)
+	{
+		case 6:
+			if(off + 20 > total || off + (ip[off + 12] >> 4) * 4 > total)
+				return NULL;
+			off += (ip[off + 12] >> 4) * 4;
+			break;
+
+		case 17:
+			if(off + 8 > total)
+				return NULL;
+			off += 8;
+			break;
+
+		default:
+			break;
+	}
+
+	*payload_len = total - off;
+	return ip + off;
+}
+
+
+int dpi_pcap_next(struct dpi_pcap *pc, struct dpi_pcap_packet *pkt)
+{
+	struct dpi_pcap_record_header rh;
+	const unsigned char *l3;
+	size_t l3_len;
+	uint32_t caplen;
+
+	if(fread(&rh, sizeof(rh), 1, pc->fp) != 1)
+	{
+		return 0;
+	}
+
+	caplen = dpi_pcap_u32(pc, rh.caplen);
+	if(caplen > DPI_PCAP_MAX_SNAPLEN)
+	{
+		fprintf(stderr, "dpi_pcap: record too large (%u bytes)\n", caplen);
+		return -1;
+	}
+
+	if(fread(pc->buf, 1, caplen, pc->fp) != caplen)
+	{
+		return 0;
+	}
+
+	pkt->data = pc->buf;
+	pkt->len = caplen;
+	pkt->payload = NULL;
+	pkt->payload_len = 0;
+
+	l3 = dpi_pcap_l3(pc, pc->buf, caplen, &l3_len);
+	if(l3)
+	{
+		pkt->payload = dpi_pcap_payload(l3, l3_len, &pkt->payload_len);
+	}
+
+	return 1;
+}
+
+
+void dpi_pcap_close(struct dpi_pcap *pc)
+{
+	if(pc->fp)
+	{
+		fclose(pc->fp);
+	}
+	free(pc->buf);
+	memset(pc, 0, sizeof(*pc));
+}
@@ -0,0 +1,61 @@
+#ifndef _DPI_PCAP_H
+#define _DPI_PCAP_H
+
+/**
+ * Minimal capture file reader for FPGA matcher tools.
+ * Reads classic pcap files and returns the transport payload of each
+ * IPv4/IPv6 packet, which is what the kernel module hands to the matcher.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Link types understood by the reader */
+#define DPI_PCAP_LINKTYPE_NULL			0
+#define DPI_PCAP_LINKTYPE_ETHERNET		1
+#define DPI_PCAP_LINKTYPE_RAW			101
+#define DPI_PCAP_LINKTYPE_LINUX_SLL		113
+#define DPI_PCAP_LINKTYPE_RAW_OLD		12
+#define DPI_PCAP_LINKTYPE_RAW_OLD2		14
+
+/** Largest capture length accepted */
+#define DPI_PCAP_MAX_SNAPLEN			262144
+
+/** An open capture file */
+struct dpi_pcap
+{
+	FILE *fp;
+	bool swap;
+	uint32_t linktype;
+	unsigned char *buf;
+};
+
+/** A packet returned by the reader (valid until the next read) */
+struct dpi_pcap_packet
+{
+	const unsigned char *data;
+	size_t len;
+
+	// Transport payload (NULL when not IPv4/IPv6)
+	const unsigned char *payload;
+	size_t payload_len;
+};
+
+/**
+ *	This function opens a capture file.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_pcap_open(struct dpi_pcap *, const char *);
+
+/**
+ *	This function reads the next packet.
+ *		returns 1 on success, 0 at end of file, -1 on error
+ */
+int dpi_pcap_next(struct dpi_pcap *, struct dpi_pcap_packet *);
+
+/** The function that closes a capture file */
+void dpi_pcap_close(struct dpi_pcap *);
+
+#endif
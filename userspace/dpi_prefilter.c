@@ -0,0 +1,187 @@
+/**
+ * Vectorized prefilter for FPGA matcher tools.
+ */
+
+#include <string.h>
+#include "dpi_prefilter.h"
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+
+void dpi_prefilter_build(const struct dpi_pattern_set *set, struct dpi_prefilter_table *pf)
+{
+	const struct dpi_pattern *p;
+	uint32_t i, k, width = DPI_PREFILTER_MAX_WIDTH;
+	unsigned int bucket;
+
+	memset(pf, 0, sizeof(*pf));
+
+	// Every pattern must cover all checked positions
+	for(i = 0; i < set->count; i++)
+	{
+		if(set->patterns[i].len < width)
+		{
+			width = set->patterns[i].len;
+		}
+	}
+	pf->width = width;
+
+	for(i = 0; i < set->count; i++)
+	{
+		p = &set->patterns[i];
+
+		// Patterns sharing a prefix share a bucket, which keeps
+		// unrelated prefixes from combining into false candidates
+		bucket = 0;
+		for(k = 0; k < width; k++)
+		{
+			bucket = bucket * 31 + p->bytes[k];
+		}
+		bucket %= DPI_PREFILTER_BUCKETS;
+
+		for(k = 0; k < width; k++)
+		{
+			pf->lo[k][p->bytes[k] & 0xf] |= 1 << bucket;
+			pf->hi[k][p->bytes[k] >> 4] |= 1 << bucket;
+		}
+	}
+}
+
+
+/** Function that scans positions [0, len - width] one byte at a time */
+static int dpi_prefilter_scan_scalar(const struct dpi_prefilter_table *pf,
+								const unsigned char *buf, size_t len)
+{
+	size_t i;
+	uint32_t k;
+	uint8_t m;
+
+	for(i = 0; i + pf->width <= len; i++)
+	{
+		m = 0xff;
+		for(k = 0; k < pf->width && m; k++)
+		{
+			m &= pf->lo[k][buf[i + k] & 0xf] & pf->hi[k][buf[i + k] >> 4];
+		}
+
+		if(m)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+#if defined(__AVX2__)
+
+/** Function that checks 32 start positions per iteration with AVX2 */
+static int dpi_prefilter_scan_simd(const struct dpi_prefilter_table *pf,
+								const unsigned char *buf, size_t len)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i lo[DPI_PREFILTER_MAX_WIDTH], hi[DPI_PREFILTER_MAX_WIDTH];
+	__m256i acc, v;
+	uint32_t k, width = pf->width;
+	size_t i = 0;
+
+	// PSHUFB works per 128-bit lane, so repeat the masks in both lanes
+	for(k = 0; k < width; k++)
+	{
+		lo[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) pf->lo[k]));
+		hi[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) pf->hi[k]));
+	}
+
+	for(; i + 32 + width - 1 <= len; i += 32)
+	{
+		acc = _mm256_set1_epi8(-1);
+		for(k = 0; k < width; k++)
+		{
+			v = _mm256_loadu_si256((const __m256i *) (buf + i + k));
+			acc = _mm256_and_si256(acc,
+					_mm256_and_si256(
+						_mm256_shuffle_epi8(lo[k], _mm256_and_si256(v, nibble)),
+						_mm256_shuffle_epi8(hi[k], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble))));
+		}
+
+		if(!_mm256_testz_si256(acc, acc))
+		{
+			return 1;
+		}
+	}
+
+	return dpi_prefilter_scan_scalar(pf, buf + i, len - i);
+}
+
+#elif defined(__SSSE3__)
+
+/** Function that checks 16 start positions per iteration with SSSE3 */
+static int dpi_prefilter_scan_simd(const struct dpi_prefilter_table *pf,
+								const unsigned char *buf, size_t len)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo[DPI_PREFILTER_MAX_WIDTH], hi[DPI_PREFILTER_MAX_WIDTH];
+	__m128i acc, v;
+	uint32_t k, width = pf->width;
+	size_t i = 0;
+
+	for(k = 0; k < width; k++)
+	{
+		lo[k] = _mm_loadu_si128((const __m128i *) pf->lo[k]);
+		hi[k] = _mm_loadu_si128((const __m128i *) pf->hi[k]);
+	}
+
+	for(; i + 16 + width - 1 <= len; i += 16)
+	{
+		acc = _mm_set1_epi8(-1);
+		for(k = 0; k < width; k++)
+		{
+			v = _mm_loadu_si128((const __m128i *) (buf + i + k));
+			acc = _mm_and_si128(acc,
+					_mm_and_si128(
+						_mm_shuffle_epi8(lo[k], _mm_and_si128(v, nibble)),
+						_mm_shuffle_epi8(hi[k], _mm_and_si128(_mm_srli_epi16(v, 4), nibble))));
+		}
+
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xffff)
+		{
+			return 1;
+		}
+	}
+
+	return dpi_prefilter_scan_scalar(pf, buf + i, len - i);
+}
+
+#endif
+
+
+int dpi_prefilter_scan(const struct dpi_prefilter_table *pf, const unsigned char *buf, size_t len)
+{
+	// A regex without a literal start leaves nothing to check
+	if(!pf->width)
+	{
+		return 1;
+	}
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+	return dpi_prefilter_scan_simd(pf, buf, len);
+#else
+	return dpi_prefilter_scan_scalar(pf, buf, len);
+#endif
+}
+
+
+const char *dpi_prefilter_impl(void)
+{
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSSE3__)
+	return "ssse3";
+#else
+	return "scalar";
+#endif
+}
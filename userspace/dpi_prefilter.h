@@ -0,0 +1,30 @@
+#ifndef _DPI_PREFILTER_H
+#define _DPI_PREFILTER_H
+
+/**
+ * Vectorized prefilter for FPGA matcher tools.
+ * Decides quickly whether any pattern can start in a buffer, so clean
+ * payloads never reach the full matcher or the accelerator.
+ */
+
+#include <stddef.h>
+#include "dpi_user.h"
+#include "dpi_matcher.h"
+
+/**
+ *	This function builds the prefilter masks from a pattern set.
+ *	Width is the length of the shortest pattern, at most DPI_PREFILTER_MAX_WIDTH.
+ */
+void dpi_prefilter_build(const struct dpi_pattern_set *, struct dpi_prefilter_table *);
+
+/**
+ *	This function runs the prefilter over a buffer.
+ *		returns 1 if some pattern may start in the buffer
+ *		returns 0 if no pattern can match
+ */
+int dpi_prefilter_scan(const struct dpi_prefilter_table *, const unsigned char *, size_t);
+
+/** The function that returns the name of the compiled-in scan implementation */
+const char *dpi_prefilter_impl(void);
+
+#endif
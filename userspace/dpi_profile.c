@@ -0,0 +1,222 @@
+/**
+ * State visit profiles for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dpi_profile.h"
+
+
+/** A state and its visits, sorted to get the new numbering */
+struct dpi_profile_rank
+{
+	uint64_t visits;
+	uint32_t state;
+};
+
+
+int dpi_profile_init(struct dpi_profile *prof, uint32_t num_states)
+{
+	prof->num_states = num_states;
+	prof->visits = calloc(num_states ? num_states : 1, sizeof(*prof->visits));
+
+	return prof->visits ? 0 : -1;
+}
+
+
+int dpi_profile_load(struct dpi_profile *prof, const char *path)
+{
+	char line[128];
+	unsigned long long v;
+	unsigned int n;
+	uint32_t i = 0;
+	FILE *fp;
+
+	memset(prof, 0, sizeof(*prof));
+
+	fp = fopen(path, "r");
+	if(!fp)
+	{
+		perror(path);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+
+		if(!prof->visits)
+		{
+			if(sscanf(line, "states %u", &n) != 1 || !n || n > DPI_MAX_STATES ||
+				dpi_profile_init(prof, n))
+			{
+				break;
+			}
+			continue;
+		}
+
+		if(i == prof->num_states || sscanf(line, "%llu", &v) != 1)
+		{
+			i = prof->num_states + 1;
+			break;
+		}
+		prof->visits[i++] = v;
+	}
+
+	fclose(fp);
+
+	if(!prof->visits || i != prof->num_states)
+	{
+		fprintf(stderr, "%s: invalid profile\n", path);
+		dpi_profile_free(prof);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int dpi_profile_save(const struct dpi_profile *prof, const char *path)
+{
+	uint32_t i;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if(!fp)
+	{
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "# dpi profile\nstates %u\n", prof->num_states);
+	for(i = 0; i < prof->num_states; i++)
+	{
+		fprintf(fp, "%llu\n", (unsigned long long) prof->visits[i]);
+	}
+
+	if(fclose(fp))
+	{
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void dpi_profile_free(struct dpi_profile *prof)
+{
+	free(prof->visits);
+	prof->visits = NULL;
+	prof->num_states = 0;
+}
+
+
+/** Function that orders states by visits, most visited first, then by number */
+static int dpi_profile_rank_cmp(const void *a, const void *b)
+{
+	const struct dpi_profile_rank *x = a, *y = b;
+
+	if(x->visits != y->visits)
+	{
+		return x->visits < y->visits ? 1 : -1;
+	}
+
+	return x->state < y->state ? -1 : (x->state > y->state);
+}
+
+
+uint32_t dpi_profile_hot(const struct dpi_profile *prof, double fraction)
+{
+	struct dpi_profile_rank *rank;
+	uint64_t total = 0, sum = 0;
+	uint32_t i;
+
+	rank = malloc(prof->num_states * sizeof(*rank));
+	if(!rank)
+	{
+		return prof->num_states;
+	}
+
+	for(i = 0; i < prof->num_states; i++)
+	{
+		rank[i].visits = prof->visits[i];
+		rank[i].state = i;
+		total += prof->visits[i];
+	}
+	qsort(rank, prof->num_states, sizeof(*rank), dpi_profile_rank_cmp);
+
+	for(i = 0; i < prof->num_states && sum < total * fraction; i++)
+	{
+		sum += rank[i].visits;
+	}
+
+	free(rank);
+	return i;
+}
+
+
+int dpi_profile_reorder(struct dpi_matcher *m, const struct dpi_profile *prof)
+{
+	struct dpi_profile_rank *rank;
+	uint32_t *new_of, *final, i, b;
+	uint16_t *next;
+	int retval = -1;
+
+	if(prof->num_states != m->num_states)
+	{
+		fprintf(stderr, "dpi_profile: profile has %u states, matcher has %u\n",
+			prof->num_states, m->num_states);
+		return -1;
+	}
+
+	rank = malloc(m->num_states * sizeof(*rank));
+	new_of = malloc(m->num_states * sizeof(*new_of));
+	next = malloc((size_t) m->num_states * 256 * sizeof(*next));
+	final = malloc(m->num_states * sizeof(*final));
+	if(!rank || !new_of || !next || !final)
+	{
+		goto out;
+	}
+
+	// The start state keeps number 0 whatever its visits
+	for(i = 0; i < m->num_states; i++)
+	{
+		rank[i].visits = i ? prof->visits[i] : UINT64_MAX;
+		rank[i].state = i;
+	}
+	qsort(rank, m->num_states, sizeof(*rank), dpi_profile_rank_cmp);
+
+	for(i = 0; i < m->num_states; i++)
+	{
+		new_of[rank[i].state] = i;
+	}
+
+	for(i = 0; i < m->num_states; i++)
+	{
+		for(b = 0; b < 256; b++)
+		{
+			next[(size_t) i * 256 + b] = new_of[m->next[(size_t) rank[i].state * 256 + b]];
+		}
+		final[i] = m->final[rank[i].state];
+	}
+
+	free(m->next);
+	free(m->final);
+	m->next = next;
+	m->final = final;
+	next = NULL;
+	final = NULL;
+	retval = 0;
+
+out:
+	free(rank);
+	free(new_of);
+	free(next);
+	free(final);
+	return retval;
+}
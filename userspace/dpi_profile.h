@@ -0,0 +1,57 @@
+#ifndef _DPI_PROFILE_H
+#define _DPI_PROFILE_H
+
+/**
+ * State visit profiles for FPGA matcher tools.
+ * A profile counts how often every state of the software matcher reads a
+ * byte, on replayed (dpi_bench) or live (kernel module) traffic. The
+ * compiler renumbers states by it, so the rows of hot states share
+ * contiguous cache lines.
+ *
+ * File format (text): a "# dpi profile" line, a "states N" line and one
+ * visit count per line for states 0 to N-1.
+ */
+
+#include <stdint.h>
+#include "dpi_matcher.h"
+
+/** A visit profile */
+struct dpi_profile
+{
+	uint32_t num_states;
+	uint64_t *visits;
+};
+
+/**
+ *	This function allocates an empty profile.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_profile_init(struct dpi_profile *, uint32_t);
+
+/**
+ *	This function reads a profile file.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_profile_load(struct dpi_profile *, const char *);
+
+/**
+ *	This function writes a profile file.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_profile_save(const struct dpi_profile *, const char *);
+
+/** The function that releases a profile */
+void dpi_profile_free(struct dpi_profile *);
+
+/** The function that returns the fewest states that take a fraction of all visits */
+uint32_t dpi_profile_hot(const struct dpi_profile *, double);
+
+/**
+ *	This function renumbers the states of a matcher by the profile:
+ *	state 0 stays the start state, the rest follow by visits, most visited
+ *	first. The profile must come from a matcher with the same numbering.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_profile_reorder(struct dpi_matcher *, const struct dpi_profile *);
+
+#endif
@@ -0,0 +1,2277 @@
+/**
+ * Regex signatures for FPGA matcher tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "dpi_regex.h"
+
+
+/** Parser state */
+struct dpi_re_parser
+{
+	const char *src;
+	uint32_t pos;
+	uint32_t len;
+	uint32_t nodes;
+	bool icase;
+	bool dotall;
+	const char *error;
+};
+
+/** Growable list of positions */
+struct dpi_re_list
+{
+	uint32_t *v;
+	uint32_t n;
+	uint32_t cap;
+};
+
+/** First and last positions of a subexpression */
+struct dpi_re_info
+{
+	bool nullable;
+	struct dpi_re_list first;
+	struct dpi_re_list last;
+};
+
+/** Position (Glushkov) automaton under construction */
+struct dpi_glushkov
+{
+	uint32_t num;
+	uint32_t cap;
+	uint32_t limit;
+	bool error;
+
+	uint8_t (*cls)[32];
+	struct dpi_re_list *follow;
+
+	// Pattern index plus one on the last positions of a head or tail
+	uint32_t *accept;
+};
+
+/** A regex or literal of the head table; a branched regex is replaced by its branches */
+struct dpi_re_unit
+{
+	struct dpi_regex *re;
+	uint32_t pattern;
+};
+
+/** Subset construction of the head automaton */
+struct dpi_re_dfa
+{
+	const struct dpi_glushkov *g;
+	const struct dpi_re_unit *units;
+	const bool *has_tail;
+	uint32_t max_states;
+
+	// Position set of every state, stored back to back
+	uint32_t num_states;
+	uint32_t cap;
+	uint32_t *set_off;
+	uint32_t *set_len;
+	struct dpi_re_list sets;
+
+	// Open addressing table of state ids plus one
+	uint32_t *hash;
+	uint32_t hash_mask;
+
+	uint16_t *next;
+	uint32_t *final;
+
+	// Sets of patterns whose tail must confirm a head match
+	uint32_t num_lists;
+	struct dpi_re_list *lists;
+
+	// Bytes of every position class, stored back to back
+	uint32_t *bytes_off;
+	uint8_t *bytes;
+
+	// Scratch space of one state expansion
+	uint32_t *mark;
+	uint32_t stamp;
+	struct dpi_re_list cand;
+	struct dpi_re_list bucket[256];
+};
+
+
+/** Functions that test and set a byte of a class */
+static inline bool dpi_cls_test(const uint8_t *cls, unsigned int b)
+{
+	return cls[b >> 3] & (1 << (b & 7));
+}
+
+static inline void dpi_cls_set(uint8_t *cls, unsigned int b)
+{
+	cls[b >> 3] |= 1 << (b & 7);
+}
+
+
+/** Function that returns number of bytes in a class */
+static unsigned int dpi_cls_count(const uint8_t *cls)
+{
+	unsigned int i, n = 0;
+
+	for(i = 0; i < 32; i++)
+	{
+		n += __builtin_popcount(cls[i]);
+	}
+
+	return n;
+}
+
+
+/** Function that adds the other case of every letter in a class */
+static void dpi_cls_fold(uint8_t *cls)
+{
+	unsigned int b;
+
+	for(b = 'a'; b <= 'z'; b++)
+	{
+		if(dpi_cls_test(cls, b) || dpi_cls_test(cls, b - 'a' + 'A'))
+		{
+			dpi_cls_set(cls, b);
+			dpi_cls_set(cls, b - 'a' + 'A');
+		}
+	}
+}
+
+
+/** Function that converts a hexadecimal digit into its value */
+static int dpi_re_hex(int c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+
+static struct dpi_re_node *dpi_re_new(struct dpi_re_parser *ps, uint8_t type)
+{
+	struct dpi_re_node *node;
+
+	if(ps->nodes == DPI_REGEX_MAX_NODES)
+	{
+		ps->error = "expression is too large";
+		return NULL;
+	}
+
+	node = calloc(1, sizeof(*node));
+	if(!node)
+	{
+		ps->error = "out of memory";
+		return NULL;
+	}
+
+	ps->nodes++;
+	node->type = type;
+	return node;
+}
+
+
+static void dpi_re_node_free(struct dpi_re_node *node)
+{
+	if(!node)
+	{
+		return;
+	}
+
+	dpi_re_node_free(node->left);
+	dpi_re_node_free(node->right);
+	free(node);
+}
+
+
+/** Function that parses an escape (after the backslash) into a class */
+static int dpi_re_escape(struct dpi_re_parser *ps, uint8_t *cls)
+{
+	uint8_t set[32];
+	unsigned int b;
+	int c, hi, lo;
+
+	if(ps->pos == ps->len)
+	{
+		ps->error = "trailing backslash";
+		return -1;
+	}
+
+	c = (unsigned char) ps->src[ps->pos++];
+	memset(set, 0, sizeof(set));
+
+	switch(c)
+	{
+		case 'd':
+		case 'D':
+			for(b = '0'; b <= '9'; b++)
+				dpi_cls_set(set, b);
+			break;
+
+		case 'w':
+		case 'W':
+			for(b = 0; b < 256; b++)
+				if(isalnum(b) || b == '_')
+					dpi_cls_set(set, b);
+			break;
+
+		case 's':
+		case 'S':
+			for(b = 0; b < 256; b++)
+				if(b == ' ' || (b >= '\t' && b <= '\r'))
+					dpi_cls_set(set, b);
+			break;
+
+		case 'n':	dpi_cls_set(cls, '\n'); return 0;
+		case 'r':	dpi_cls_set(cls, '\r'); return 0;
+		case 't':	dpi_cls_set(cls, '\t'); return 0;
+		case 'f':	dpi_cls_set(cls, '\f'); return 0;
+		case 'v':	dpi_cls_set(cls, '\v'); return 0;
+		case 'e':	dpi_cls_set(cls, 0x1b); return 0;
+		case '0':	dpi_cls_set(cls, 0); return 0;
+
+		case 'x':
+			hi = (ps->pos < ps->len) ? dpi_re_hex(ps->src[ps->pos]) : -1;
+			lo = (hi < 0 || ps->pos + 1 >= ps->len) ? -1 : dpi_re_hex(ps->src[ps->pos + 1]);
+			if(lo < 0)
+			{
+				ps->error = "\\x needs two hexadecimal digits";
+				return -1;
+			}
+			dpi_cls_set(cls, (hi << 4) | lo);
+			ps->pos += 2;
+			return 0;
+
+		default:
+			// Escaped metacharacters stand for themselves
+			if(isalnum(c))
+			{
+				ps->error = "unsupported escape";
+				return -1;
+			}
+			dpi_cls_set(cls, c);
+			return 0;
+	}
+
+	// Upper case class escapes are negated
+	for(b = 0; b < 32; b++)
+	{
+		cls[b] |= isupper(c) ? (uint8_t) ~set[b] : set[b];
+	}
+
+	return 0;
+}
+
+
+/**
+ *	Function that parses one item of a bracket class.
+ *		returns the byte, 256 if the item is a set (stored in set), -1 on error
+ */
+static int dpi_re_class_item(struct dpi_re_parser *ps, uint8_t *set)
+{
+	unsigned int b;
+	int c;
+
+	c = (unsigned char) ps->src[ps->pos++];
+	if(c != '\\')
+	{
+		return c;
+	}
+
+	memset(set, 0, 32);
+	if(dpi_re_escape(ps, set))
+	{
+		return -1;
+	}
+
+	if(dpi_cls_count(set) != 1)
+	{
+		return 256;
+	}
+
+	for(b = 0; !dpi_cls_test(set, b); b++)
+		;
+	return b;
+}
+
+
+static struct dpi_re_node *dpi_re_class(struct dpi_re_parser *ps)
+{
+	struct dpi_re_node *node;
+	uint8_t set[32];
+	bool negate = false, first = true;
+	unsigned int b;
+	int lo, hi;
+
+	node = dpi_re_new(ps, DPI_RE_CLASS);
+	if(!node)
+	{
+		return NULL;
+	}
+
+	if(ps->pos < ps->len && ps->src[ps->pos] == '^')
+	{
+		negate = true;
+		ps->pos++;
+	}
+
+	for(;;)
+	{
+		if(ps->pos == ps->len)
+		{
+			ps->error = "missing ]";
+			goto error;
+		}
+
+		// ']' right after the opening bracket is a literal
+		if(ps->src[ps->pos] == ']' && !first)
+		{
+			ps->pos++;
+			break;
+		}
+		first = false;
+
+		lo = dpi_re_class_item(ps, set);
+		if(lo < 0)
+		{
+			goto error;
+		}
+		if(lo == 256)
+		{
+			for(b = 0; b < 32; b++)
+				node->cls[b] |= set[b];
+			continue;
+		}
+
+		// Range unless the '-' is the last character of the class
+		if(ps->pos + 1 < ps->len && ps->src[ps->pos] == '-' && ps->src[ps->pos + 1] != ']')
+		{
+			ps->pos++;
+			hi = dpi_re_class_item(ps, set);
+			if(hi < 0)
+			{
+				goto error;
+			}
+			if(hi == 256 || hi < lo)
+			{
+				ps->error = "invalid range in class";
+				goto error;
+			}
+
+			for(b = lo; b <= (unsigned int) hi; b++)
+				dpi_cls_set(node->cls, b);
+		}
+		else
+		{
+			dpi_cls_set(node->cls, lo);
+		}
+	}
+
+	if(ps->icase)
+	{
+		dpi_cls_fold(node->cls);
+	}
+
+	if(negate)
+	{
+		for(b = 0; b < 32; b++)
+			node->cls[b] = ~node->cls[b];
+	}
+
+	if(!dpi_cls_count(node->cls))
+	{
+		ps->error = "class matches no byte";
+		goto error;
+	}
+
+	return node;
+
+error:
+	dpi_re_node_free(node);
+	return NULL;
+}
+
+
+static struct dpi_re_node *dpi_re_alt(struct dpi_re_parser *);
+
+
+static struct dpi_re_node *dpi_re_atom(struct dpi_re_parser *ps)
+{
+	struct dpi_re_node *node;
+	int c = (unsigned char) ps->src[ps->pos];
+
+	switch(c)
+	{
+		case '(':
+			ps->pos++;
+			if(ps->pos < ps->len && ps->src[ps->pos] == '?')
+			{
+				if(ps->pos + 1 >= ps->len || ps->src[ps->pos + 1] != ':')
+				{
+					ps->error = "only (?: ) groups are supported";
+					return NULL;
+				}
+				ps->pos += 2;
+			}
+
+			node = dpi_re_alt(ps);
+			if(!node)
+			{
+				return NULL;
+			}
+
+			if(ps->pos == ps->len || ps->src[ps->pos] != ')')
+			{
+				ps->error = "missing )";
+				dpi_re_node_free(node);
+				return NULL;
+			}
+			ps->pos++;
+			return node;
+
+		case '[':
+			ps->pos++;
+			return dpi_re_class(ps);
+
+		case '*':
+		case '+':
+		case '?':
+			ps->error = "nothing to repeat";
+			return NULL;
+
+		case '^':
+			ps->error = "^ is only supported at the start";
+			return NULL;
+
+		case '$':
+			ps->error = "$ is not supported";
+			return NULL;
+
+		case ')':
+			ps->error = "unmatched )";
+			return NULL;
+	}
+
+	node = dpi_re_new(ps, DPI_RE_CLASS);
+	if(!node)
+	{
+		return NULL;
+	}
+	ps->pos++;
+
+	if(c == '.')
+	{
+		memset(node->cls, 0xff, sizeof(node->cls));
+		if(!ps->dotall)
+		{
+			node->cls['\n' >> 3] &= ~(1 << ('\n' & 7));
+		}
+		return node;
+	}
+
+	if(c == '\\')
+	{
+		if(dpi_re_escape(ps, node->cls))
+		{
+			dpi_re_node_free(node);
+			return NULL;
+		}
+	}
+	else
+	{
+		dpi_cls_set(node->cls, c);
+	}
+
+	if(ps->icase)
+	{
+		dpi_cls_fold(node->cls);
+	}
+
+	return node;
+}
+
+
+/**
+ *	Function that parses an optional quantifier.
+ *		returns 1 if one is parsed, 0 if there is none, -1 on error
+ */
+static int dpi_re_quantifier(struct dpi_re_parser *ps, uint32_t *min, uint32_t *max)
+{
+	char *end;
+	int c;
+
+	if(ps->pos == ps->len)
+	{
+		return 0;
+	}
+
+	c = ps->src[ps->pos];
+	switch(c)
+	{
+		case '*':	*min = 0; *max = DPI_REGEX_INFINITE; ps->pos++; break;
+		case '+':	*min = 1; *max = DPI_REGEX_INFINITE; ps->pos++; break;
+		case '?':	*min = 0; *max = 1; ps->pos++; break;
+
+		case '{':
+			// '{' not followed by a count is a literal
+			if(!isdigit((unsigned char) ps->src[ps->pos + 1]))
+			{
+				return 0;
+			}
+
+			*min = *max = strtoul(ps->src + ps->pos + 1, &end, 10);
+			if(*end == ',')
+			{
+				end++;
+				*max = isdigit((unsigned char) *end) ? strtoul(end, &end, 10) : DPI_REGEX_INFINITE;
+			}
+			if(*end != '}')
+			{
+				ps->error = "invalid quantifier";
+				return -1;
+			}
+			if(*min > DPI_REGEX_MAX_REPEAT || (*max != DPI_REGEX_INFINITE && *max > DPI_REGEX_MAX_REPEAT))
+			{
+				ps->error = "repeat count is too large";
+				return -1;
+			}
+			if(*max < *min)
+			{
+				ps->error = "repeat counts out of order";
+				return -1;
+			}
+			ps->pos = end + 1 - ps->src;
+			break;
+
+		default:
+			return 0;
+	}
+
+	// Lazy quantifiers match the same payloads
+	if(ps->pos < ps->len && ps->src[ps->pos] == '?')
+	{
+		ps->pos++;
+	}
+	else if(ps->pos < ps->len && ps->src[ps->pos] == '+')
+	{
+		ps->error = "possessive quantifiers are not supported";
+		return -1;
+	}
+
+	return 1;
+}
+
+
+/** Function that parses an atom and its quantifier */
+static int dpi_re_piece(struct dpi_re_parser *ps, struct dpi_re_node **atom, uint32_t *min, uint32_t *max)
+{
+	int retval;
+
+	*atom = dpi_re_atom(ps);
+	if(!*atom)
+	{
+		return -1;
+	}
+
+	*min = *max = 1;
+	retval = dpi_re_quantifier(ps, min, max);
+	if(retval < 0)
+	{
+		dpi_re_node_free(*atom);
+		*atom = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static struct dpi_re_node *dpi_re_seq(struct dpi_re_parser *ps)
+{
+	struct dpi_re_node *seq = NULL, *atom, *node;
+	uint32_t min, max;
+
+	while(ps->pos < ps->len && ps->src[ps->pos] != '|' && ps->src[ps->pos] != ')')
+	{
+		if(dpi_re_piece(ps, &atom, &min, &max))
+		{
+			goto error;
+		}
+
+		if(min != 1 || max != 1)
+		{
+			node = dpi_re_new(ps, DPI_RE_REPEAT);
+			if(!node)
+			{
+				dpi_re_node_free(atom);
+				goto error;
+			}
+			node->min = min;
+			node->max = max;
+			node->left = atom;
+			atom = node;
+		}
+
+		if(!seq)
+		{
+			seq = atom;
+			continue;
+		}
+
+		node = dpi_re_new(ps, DPI_RE_CAT);
+		if(!node)
+		{
+			dpi_re_node_free(atom);
+			goto error;
+		}
+		node->left = seq;
+		node->right = atom;
+		seq = node;
+	}
+
+	if(!seq)
+	{
+		seq = dpi_re_new(ps, DPI_RE_EMPTY);
+	}
+	return seq;
+
+error:
+	dpi_re_node_free(seq);
+	return NULL;
+}
+
+
+static struct dpi_re_node *dpi_re_alt(struct dpi_re_parser *ps)
+{
+	struct dpi_re_node *alt, *right, *node;
+
+	alt = dpi_re_seq(ps);
+	while(alt && ps->pos < ps->len && ps->src[ps->pos] == '|')
+	{
+		ps->pos++;
+
+		right = dpi_re_seq(ps);
+		node = right ? dpi_re_new(ps, DPI_RE_ALT) : NULL;
+		if(!node)
+		{
+			dpi_re_node_free(right);
+			dpi_re_node_free(alt);
+			return NULL;
+		}
+		node->left = alt;
+		node->right = right;
+		alt = node;
+	}
+
+	return alt;
+}
+
+
+static bool dpi_re_nullable(const struct dpi_re_node *node)
+{
+	switch(node->type)
+	{
+		case DPI_RE_EMPTY:
+			return true;
+		case DPI_RE_CAT:
+			return dpi_re_nullable(node->left) && dpi_re_nullable(node->right);
+		case DPI_RE_ALT:
+			return dpi_re_nullable(node->left) || dpi_re_nullable(node->right);
+		case DPI_RE_REPEAT:
+			return !node->min || dpi_re_nullable(node->left);
+		default:
+			return false;
+	}
+}
+
+
+static bool dpi_re_piece_nullable(const struct dpi_re_piece *piece)
+{
+	return !piece->min || dpi_re_nullable(piece->atom);
+}
+
+
+/** Function that returns true for a repetition that multiplies table states */
+static bool dpi_re_explosive(const struct dpi_re_node *atom, uint32_t max, uint32_t split_repeat)
+{
+	// Repeating a single byte only lengthens a chain of states
+	if(atom->type == DPI_RE_CLASS && dpi_cls_count(atom->cls) == 1)
+	{
+		return false;
+	}
+
+	return (max == DPI_REGEX_INFINITE || max > split_repeat);
+}
+
+
+static bool dpi_re_node_explosive(const struct dpi_re_node *node, uint32_t split_repeat)
+{
+	switch(node->type)
+	{
+		case DPI_RE_CAT:
+		case DPI_RE_ALT:
+			return dpi_re_node_explosive(node->left, split_repeat) ||
+				dpi_re_node_explosive(node->right, split_repeat);
+		case DPI_RE_REPEAT:
+			return dpi_re_explosive(node->left, node->max, split_repeat) ||
+				dpi_re_node_explosive(node->left, split_repeat);
+		default:
+			return false;
+	}
+}
+
+
+/** Function that appends a piece to a regex, NULL if out of memory */
+static struct dpi_re_piece *dpi_re_piece_add(struct dpi_regex *re, uint32_t *capacity)
+{
+	struct dpi_re_piece *piece;
+
+	if(re->num_pieces == *capacity)
+	{
+		*capacity = *capacity ? 2 * *capacity : 16;
+		piece = realloc(re->pieces, *capacity * sizeof(*piece));
+		if(!piece)
+		{
+			return NULL;
+		}
+		re->pieces = piece;
+	}
+
+	piece = &re->pieces[re->num_pieces++];
+	memset(piece, 0, sizeof(*piece));
+	return piece;
+}
+
+
+/** Function that parses the top level of a regex into pieces */
+static int dpi_re_top(struct dpi_re_parser *ps, struct dpi_regex *re)
+{
+	struct dpi_re_piece *piece;
+	uint32_t start = ps->pos, capacity = 0;
+
+	while(ps->pos < ps->len && ps->src[ps->pos] != '|')
+	{
+		piece = dpi_re_piece_add(re, &capacity);
+		if(!piece)
+		{
+			ps->error = "out of memory";
+			return -1;
+		}
+
+		piece->offset = ps->pos;
+		if(dpi_re_piece(ps, &piece->atom, &piece->min, &piece->max))
+		{
+			re->num_pieces--;
+			return -1;
+		}
+		piece->end = ps->pos;
+	}
+
+	if(ps->pos == ps->len)
+	{
+		return 0;
+	}
+
+	// Alternation at the top level: the whole regex is one piece
+	while(re->num_pieces)
+	{
+		dpi_re_node_free(re->pieces[--re->num_pieces].atom);
+	}
+	if(!re->pieces)
+	{
+		re->pieces = malloc(sizeof(*re->pieces));
+		if(!re->pieces)
+		{
+			ps->error = "out of memory";
+			return -1;
+		}
+	}
+
+	ps->pos = start;
+	ps->nodes = 0;
+	piece = &re->pieces[0];
+	piece->atom = dpi_re_alt(ps);
+	if(!piece->atom)
+	{
+		return -1;
+	}
+	if(ps->pos != ps->len)
+	{
+		ps->error = "unmatched )";
+		dpi_re_node_free(piece->atom);
+		return -1;
+	}
+
+	piece->min = piece->max = 1;
+	piece->offset = start;
+	piece->end = ps->len;
+	piece->explosive = false;
+	re->num_pieces = 1;
+	return 0;
+}
+
+
+/**
+ *	Function that sets the needed pieces [first, last) of a regex. An
+ *	unanchored match may start anywhere and may end anywhere, so optional
+ *	pieces at both ends never decide whether a payload matches.
+ */
+static void dpi_regex_trim(struct dpi_regex *re)
+{
+	re->first = 0;
+	re->last = re->num_pieces;
+	while(!re->anchored && re->first < re->last && dpi_re_piece_nullable(&re->pieces[re->first]))
+	{
+		re->first++;
+	}
+	while(re->last > re->first && dpi_re_piece_nullable(&re->pieces[re->last - 1]))
+	{
+		re->last--;
+	}
+
+	re->split = re->last;
+}
+
+
+struct dpi_regex *dpi_regex_parse(const char *text)
+{
+	struct dpi_re_parser ps;
+	struct dpi_regex *re;
+	const char *close, *flag;
+
+	memset(&ps, 0, sizeof(ps));
+
+	close = strrchr(text, '/');
+	if(text[0] != '/' || close == text)
+	{
+		fprintf(stderr, "dpi_regex: expected /regex/flags\n");
+		return NULL;
+	}
+
+	for(flag = close + 1; *flag; flag++)
+	{
+		switch(*flag)
+		{
+			case 'i':	ps.icase = true; break;
+			case 's':	ps.dotall = true; break;
+
+			default:
+				fprintf(stderr, "dpi_regex: unsupported flag '%c'\n", *flag);
+				return NULL;
+		}
+	}
+
+	re = calloc(1, sizeof(*re));
+	if(!re)
+	{
+		return NULL;
+	}
+
+	re->source = strndup(text + 1, close - text - 1);
+	if(!re->source)
+	{
+		free(re);
+		return NULL;
+	}
+
+	ps.src = re->source;
+	ps.len = strlen(re->source);
+	if(ps.len && ps.src[0] == '^')
+	{
+		re->anchored = true;
+		ps.pos = 1;
+	}
+
+	if(dpi_re_top(&ps, re))
+	{
+		goto error;
+	}
+
+	dpi_regex_trim(re);
+	if(re->first == re->last)
+	{
+		ps.error = "regex matches every payload";
+		goto error;
+	}
+
+	return re;
+
+error:
+	fprintf(stderr, "dpi_regex: /%s/: %s at offset %u\n", re->source, ps.error ? ps.error : "parse error", ps.pos);
+	dpi_regex_free(re);
+	return NULL;
+}
+
+
+/** Function that releases the branches of a regex */
+static void dpi_regex_free_branches(struct dpi_regex *re)
+{
+	uint32_t i;
+
+	for(i = 0; i < re->num_branches; i++)
+	{
+		// Syntax trees belong to the regex that was branched
+		dpi_regex_free_branches(&re->branches[i]);
+		free(re->branches[i].pieces);
+	}
+
+	free(re->branches);
+	re->branches = NULL;
+	re->num_branches = 0;
+}
+
+
+void dpi_regex_free(struct dpi_regex *re)
+{
+	uint32_t i;
+
+	if(!re)
+	{
+		return;
+	}
+
+	dpi_regex_free_branches(re);
+	for(i = 0; i < re->num_pieces; i++)
+	{
+		dpi_re_node_free(re->pieces[i].atom);
+	}
+
+	free(re->pieces);
+	free(re->source);
+	free(re);
+}
+
+
+uint32_t dpi_regex_prefix(const struct dpi_regex *re, unsigned char *bytes, uint32_t max)
+{
+	const struct dpi_re_piece *piece;
+	uint32_t i, k, n = 0;
+	unsigned int b;
+
+	for(i = re->first; i < re->last; i++)
+	{
+		piece = &re->pieces[i];
+		if(piece->atom->type != DPI_RE_CLASS || dpi_cls_count(piece->atom->cls) != 1)
+		{
+			break;
+		}
+
+		for(b = 0; !dpi_cls_test(piece->atom->cls, b); b++)
+			;
+		for(k = 0; k < piece->min && n < max; k++)
+		{
+			bytes[n++] = b;
+		}
+
+		if(piece->max != piece->min)
+		{
+			break;
+		}
+	}
+
+	return n;
+}
+
+
+/** Functions that handle position lists */
+static int dpi_re_list_push(struct dpi_re_list *l, uint32_t v)
+{
+	uint32_t *p;
+
+	if(l->n == l->cap)
+	{
+		l->cap = l->cap ? 2 * l->cap : 8;
+		p = realloc(l->v, l->cap * sizeof(*p));
+		if(!p)
+		{
+			return -1;
+		}
+		l->v = p;
+	}
+
+	l->v[l->n++] = v;
+	return 0;
+}
+
+static int dpi_re_list_append(struct dpi_re_list *l, const struct dpi_re_list *from)
+{
+	uint32_t i;
+
+	for(i = 0; i < from->n; i++)
+	{
+		if(dpi_re_list_push(l, from->v[i]))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void dpi_re_list_free(struct dpi_re_list *l)
+{
+	free(l->v);
+	memset(l, 0, sizeof(*l));
+}
+
+static int dpi_re_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/** Function that sorts a list and removes duplicates */
+static void dpi_re_list_unique(struct dpi_re_list *l)
+{
+	uint32_t i, n = 0;
+
+	if(l->n < 2)
+	{
+		return;
+	}
+
+	qsort(l->v, l->n, sizeof(*l->v), dpi_re_cmp);
+	for(i = 0; i < l->n; i++)
+	{
+		if(!n || l->v[n - 1] != l->v[i])
+		{
+			l->v[n++] = l->v[i];
+		}
+	}
+	l->n = n;
+}
+
+
+static void dpi_re_info_free(struct dpi_re_info *info)
+{
+	dpi_re_list_free(&info->first);
+	dpi_re_list_free(&info->last);
+}
+
+
+/** Function that adds every position of 'to' to the follow sets of 'from' */
+static void dpi_glushkov_follow(struct dpi_glushkov *g, const struct dpi_re_list *from,
+							const struct dpi_re_list *to)
+{
+	uint32_t i;
+
+	for(i = 0; i < from->n; i++)
+	{
+		if(dpi_re_list_append(&g->follow[from->v[i]], to))
+		{
+			g->error = true;
+		}
+	}
+}
+
+
+/** Function that concatenates b to a (b is released) */
+static void dpi_glushkov_cat(struct dpi_glushkov *g, struct dpi_re_info *a, struct dpi_re_info *b)
+{
+	struct dpi_re_list last;
+
+	dpi_glushkov_follow(g, &a->last, &b->first);
+
+	if(a->nullable && dpi_re_list_append(&a->first, &b->first))
+	{
+		g->error = true;
+	}
+
+	last = b->last;
+	if(b->nullable && dpi_re_list_append(&last, &a->last))
+	{
+		g->error = true;
+	}
+	dpi_re_list_free(&a->last);
+	a->last = last;
+	memset(&b->last, 0, sizeof(b->last));
+
+	a->nullable = a->nullable && b->nullable;
+	dpi_re_info_free(b);
+}
+
+
+static struct dpi_re_info dpi_re_info_empty(void)
+{
+	struct dpi_re_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.nullable = true;
+	return info;
+}
+
+
+static void dpi_glushkov_node(struct dpi_glushkov *, const struct dpi_re_node *, struct dpi_re_info *);
+
+
+/** Function that builds min to max copies of an atom */
+static void dpi_glushkov_repeat(struct dpi_glushkov *g, const struct dpi_re_node *atom,
+							uint32_t min, uint32_t max, struct dpi_re_info *out)
+{
+	struct dpi_re_info part, opt;
+	uint32_t i;
+
+	*out = dpi_re_info_empty();
+
+	for(i = 0; i < min; i++)
+	{
+		dpi_glushkov_node(g, atom, &part);
+
+		// X{n,} is X{n-1} followed by X+
+		if(i + 1 == min && max == DPI_REGEX_INFINITE)
+		{
+			dpi_glushkov_follow(g, &part.last, &part.first);
+		}
+		dpi_glushkov_cat(g, out, &part);
+	}
+
+	if(max == DPI_REGEX_INFINITE)
+	{
+		if(!min)
+		{
+			dpi_glushkov_node(g, atom, &part);
+			dpi_glushkov_follow(g, &part.last, &part.first);
+			part.nullable = true;
+			dpi_glushkov_cat(g, out, &part);
+		}
+		return;
+	}
+
+	// X{0,k} is (X(X(...)?)?)?, which needs k copies
+	opt = dpi_re_info_empty();
+	for(i = min; i < max; i++)
+	{
+		dpi_glushkov_node(g, atom, &part);
+		dpi_glushkov_cat(g, &part, &opt);
+		part.nullable = true;
+		opt = part;
+	}
+	dpi_glushkov_cat(g, out, &opt);
+}
+
+
+static void dpi_glushkov_node(struct dpi_glushkov *g, const struct dpi_re_node *node,
+							struct dpi_re_info *out)
+{
+	struct dpi_re_info right;
+	uint32_t pos;
+	void *p;
+
+	*out = dpi_re_info_empty();
+
+	switch(node->type)
+	{
+		case DPI_RE_CLASS:
+			if(g->num == g->limit)
+			{
+				g->error = true;
+				return;
+			}
+
+			if(g->num == g->cap)
+			{
+				g->cap = g->cap ? 2 * g->cap : 256;
+
+				p = realloc(g->cls, g->cap * sizeof(*g->cls));
+				if(p)
+					g->cls = p;
+				p = p ? realloc(g->follow, g->cap * sizeof(*g->follow)) : NULL;
+				if(p)
+					g->follow = p;
+				p = p ? realloc(g->accept, g->cap * sizeof(*g->accept)) : NULL;
+				if(!p)
+				{
+					g->cap = g->num;
+					g->error = true;
+					return;
+				}
+				g->accept = p;
+			}
+
+			pos = g->num++;
+			memcpy(g->cls[pos], node->cls, sizeof(g->cls[pos]));
+			memset(&g->follow[pos], 0, sizeof(g->follow[pos]));
+			g->accept[pos] = 0;
+
+			out->nullable = false;
+			if(dpi_re_list_push(&out->first, pos) || dpi_re_list_push(&out->last, pos))
+			{
+				g->error = true;
+			}
+			break;
+
+		case DPI_RE_CAT:
+			dpi_glushkov_node(g, node->left, out);
+			dpi_glushkov_node(g, node->right, &right);
+			dpi_glushkov_cat(g, out, &right);
+			break;
+
+		case DPI_RE_ALT:
+			dpi_glushkov_node(g, node->left, out);
+			dpi_glushkov_node(g, node->right, &right);
+			if(dpi_re_list_append(&out->first, &right.first) || dpi_re_list_append(&out->last, &right.last))
+			{
+				g->error = true;
+			}
+			out->nullable = out->nullable || right.nullable;
+			dpi_re_info_free(&right);
+			break;
+
+		case DPI_RE_REPEAT:
+			dpi_glushkov_repeat(g, node->left, node->min, node->max, out);
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+static void dpi_glushkov_free(struct dpi_glushkov *g)
+{
+	uint32_t i;
+
+	for(i = 0; i < g->num; i++)
+	{
+		dpi_re_list_free(&g->follow[i]);
+	}
+
+	free(g->cls);
+	free(g->follow);
+	free(g->accept);
+	memset(g, 0, sizeof(*g));
+}
+
+
+/** Function that builds the pieces [from, to) of a regex, the first one maybe split */
+static void dpi_glushkov_pieces(struct dpi_glushkov *g, const struct dpi_regex *re, uint32_t from,
+								uint32_t to, int split, struct dpi_re_info *out)
+{
+	const struct dpi_re_piece *piece;
+	struct dpi_re_info part;
+	uint32_t i, max;
+
+	*out = dpi_re_info_empty();
+
+	for(i = from; i < to; i++)
+	{
+		piece = &re->pieces[i];
+
+		// split > 0: first repetition only, split < 0: all but the first
+		if(i == from && split > 0)
+		{
+			dpi_glushkov_repeat(g, piece->atom, 1, 1, &part);
+		}
+		else if(i == from && split < 0)
+		{
+			max = (piece->max == DPI_REGEX_INFINITE) ? piece->max : piece->max - 1;
+			dpi_glushkov_repeat(g, piece->atom, piece->min - 1, max, &part);
+		}
+		else
+		{
+			dpi_glushkov_repeat(g, piece->atom, piece->min, piece->max, &part);
+		}
+
+		dpi_glushkov_cat(g, out, &part);
+	}
+}
+
+
+/** Function that returns true if a regex needs a tail after its head */
+static bool dpi_regex_has_tail(const struct dpi_regex *re)
+{
+	uint32_t i = re->split;
+
+	if(re->split_inside)
+	{
+		// The rest of the split piece is optional if it had one mandatory copy
+		if(re->pieces[i].min > 1 && !dpi_re_nullable(re->pieces[i].atom))
+		{
+			return true;
+		}
+		i++;
+	}
+
+	for(; i < re->last; i++)
+	{
+		if(!dpi_re_piece_nullable(&re->pieces[i]))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/** Function that returns true if the head of a regex can match an empty string */
+static bool dpi_regex_head_nullable(const struct dpi_regex *re, uint32_t split)
+{
+	uint32_t i;
+
+	for(i = re->first; i < split; i++)
+	{
+		if(!dpi_re_piece_nullable(&re->pieces[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/** Function that chooses the initial split of a regex: the first explosive piece after the first one */
+static void dpi_regex_split(struct dpi_regex *re, uint32_t split_repeat)
+{
+	struct dpi_re_piece *piece;
+	uint32_t i;
+
+	for(i = 0; i < re->num_pieces; i++)
+	{
+		piece = &re->pieces[i];
+		piece->explosive = dpi_re_explosive(piece->atom, piece->max, split_repeat) ||
+			dpi_re_node_explosive(piece->atom, split_repeat);
+	}
+
+	re->split = re->first + 1;
+	re->split_inside = false;
+	while(re->split < re->last && (!re->pieces[re->split].explosive ||
+		dpi_regex_head_nullable(re, re->split)))
+	{
+		re->split++;
+	}
+}
+
+
+/** Function that collects the alternatives of an alternation; n counts all of them */
+static void dpi_re_alternatives(struct dpi_re_node *node, struct dpi_re_node **alts, uint32_t *n)
+{
+	if(node->type == DPI_RE_ALT)
+	{
+		dpi_re_alternatives(node->left, alts, n);
+		dpi_re_alternatives(node->right, alts, n);
+		return;
+	}
+
+	if(*n < DPI_REGEX_MAX_BRANCHES)
+	{
+		alts[*n] = node;
+	}
+	(*n)++;
+}
+
+
+/** Function that appends the pieces of a sequence to a branch */
+static int dpi_re_branch_seq(struct dpi_regex *br, uint32_t *capacity, struct dpi_re_node *node)
+{
+	struct dpi_re_piece *piece;
+
+	if(node->type == DPI_RE_CAT)
+	{
+		return (dpi_re_branch_seq(br, capacity, node->left) || dpi_re_branch_seq(br, capacity, node->right)) ? -1 : 0;
+	}
+
+	piece = dpi_re_piece_add(br, capacity);
+	if(!piece)
+	{
+		return -1;
+	}
+
+	if(node->type == DPI_RE_REPEAT)
+	{
+		piece->atom = node->left;
+		piece->min = node->min;
+		piece->max = node->max;
+	}
+	else
+	{
+		piece->atom = node;
+		piece->min = piece->max = 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ *	Function that branches a regex whose first piece is an alternation:
+ *	every alternative followed by the rest of the pieces is split on its
+ *	own, so an alternative that blows up the table leaves the others in it.
+ *	A repeated alternation (A|B){m,n} becomes A(A|B){m-1,n-1}... and so on.
+ *	Returns false if the first piece is not an alternation.
+ */
+static bool dpi_regex_branch(struct dpi_regex *re, uint32_t split_repeat)
+{
+	struct dpi_re_node *alts[DPI_REGEX_MAX_BRANCHES];
+	const struct dpi_re_piece *piece = &re->pieces[re->first];
+	struct dpi_re_piece *copy;
+	struct dpi_regex *br;
+	uint32_t i, k, n = 0, capacity;
+
+	if(re->num_branches || !piece->min || piece->atom->type != DPI_RE_ALT)
+	{
+		return false;
+	}
+
+	dpi_re_alternatives(piece->atom, alts, &n);
+	if(n > DPI_REGEX_MAX_BRANCHES)
+	{
+		return false;
+	}
+
+	re->branches = calloc(n, sizeof(*re->branches));
+	if(!re->branches)
+	{
+		return false;
+	}
+	re->num_branches = n;
+
+	for(i = 0; i < n; i++)
+	{
+		br = &re->branches[i];
+		br->anchored = re->anchored;
+		capacity = 0;
+
+		if(dpi_re_branch_seq(br, &capacity, alts[i]))
+		{
+			goto error;
+		}
+
+		if(piece->max > 1)
+		{
+			copy = dpi_re_piece_add(br, &capacity);
+			if(!copy)
+			{
+				goto error;
+			}
+			copy->atom = piece->atom;
+			copy->min = piece->min - 1;
+			copy->max = (piece->max == DPI_REGEX_INFINITE) ? piece->max : piece->max - 1;
+		}
+
+		for(k = re->first + 1; k < re->last; k++)
+		{
+			copy = dpi_re_piece_add(br, &capacity);
+			if(!copy)
+			{
+				goto error;
+			}
+			*copy = re->pieces[k];
+		}
+
+		// The alternation is not nullable, so neither is any alternative
+		dpi_regex_trim(br);
+		dpi_regex_split(br, split_repeat);
+	}
+
+	return true;
+
+error:
+	dpi_regex_free_branches(re);
+	return false;
+}
+
+
+/** Function that moves the last piece of a head into its tail; returns false if it cannot */
+static bool dpi_regex_shrink(struct dpi_regex *re, uint32_t split_repeat)
+{
+	const struct dpi_re_piece *piece;
+
+	if(re->split_inside)
+	{
+		return dpi_regex_branch(re, split_repeat);
+	}
+
+	if(re->split - 1 > re->first && !dpi_regex_head_nullable(re, re->split - 1))
+	{
+		re->split--;
+		return true;
+	}
+
+	// Last resort: keep only the first repetition of the first piece
+	piece = &re->pieces[re->first];
+	if(re->split - 1 == re->first && piece->min >= 1 && piece->max > 1)
+	{
+		re->split = re->first;
+		re->split_inside = true;
+		return true;
+	}
+
+	// An alternation that does not fit by itself is split per alternative
+	return dpi_regex_branch(re, split_repeat);
+}
+
+
+/** Function that builds the head positions of every unit */
+static int dpi_regex_heads(struct dpi_glushkov *g, const struct dpi_pattern_set *set,
+						const struct dpi_re_unit *units, uint32_t num_units,
+						struct dpi_re_list *first, struct dpi_re_list *anchored)
+{
+	const struct dpi_pattern *pattern;
+	struct dpi_re_info info;
+	struct dpi_regex *re;
+	uint32_t i, k, pos, start;
+
+	for(i = 0; i < num_units; i++)
+	{
+		pattern = &set->patterns[units[i].pattern];
+		re = units[i].re;
+		start = g->num;
+
+		if(re)
+		{
+			dpi_glushkov_pieces(g, re, re->first, re->split + re->split_inside, re->split_inside, &info);
+			re->head_positions = g->num - start;
+		}
+		else
+		{
+			// A literal is a chain of single byte positions
+			info = dpi_re_info_empty();
+			for(k = 0; k < pattern->len && !g->error; k++)
+			{
+				struct dpi_re_node byte = { .type = DPI_RE_CLASS };
+				struct dpi_re_info part;
+
+				dpi_cls_set(byte.cls, pattern->bytes[k]);
+				dpi_glushkov_node(g, &byte, &part);
+				dpi_glushkov_cat(g, &info, &part);
+			}
+		}
+
+		if(g->error)
+		{
+			dpi_re_info_free(&info);
+			return -1;
+		}
+
+		for(k = 0; k < info.last.n; k++)
+		{
+			pos = info.last.v[k];
+			if(!g->accept[pos])
+			{
+				g->accept[pos] = i + 1;
+			}
+		}
+
+		if(dpi_re_list_append((re && re->anchored) ? anchored : first, &info.first))
+		{
+			dpi_re_info_free(&info);
+			return -1;
+		}
+		dpi_re_info_free(&info);
+	}
+
+	for(i = 0; i < g->num; i++)
+	{
+		dpi_re_list_unique(&g->follow[i]);
+	}
+
+	return 0;
+}
+
+
+/** Function that makes room for more states */
+static int dpi_re_dfa_grow(struct dpi_re_dfa *d)
+{
+	uint32_t cap = d->cap ? 2 * d->cap : 1024;
+	void *p;
+
+	if(cap > d->max_states)
+	{
+		cap = d->max_states;
+	}
+
+	p = realloc(d->set_off, cap * sizeof(*d->set_off));
+	if(!p)
+		return -1;
+	d->set_off = p;
+
+	p = realloc(d->set_len, cap * sizeof(*d->set_len));
+	if(!p)
+		return -1;
+	d->set_len = p;
+
+	p = realloc(d->next, (size_t) cap * 256 * sizeof(*d->next));
+	if(!p)
+		return -1;
+	d->next = p;
+
+	p = realloc(d->final, cap * sizeof(*d->final));
+	if(!p)
+		return -1;
+	d->final = p;
+
+	d->cap = cap;
+	return 0;
+}
+
+
+/** Function that returns the id of a state for a sorted position set, adding it if new */
+static int dpi_re_dfa_state(struct dpi_re_dfa *d, const struct dpi_re_list *set, uint32_t *id)
+{
+	const struct dpi_glushkov *g = d->g;
+	struct dpi_re_list confirm;
+	uint32_t hash = 2166136261u, slot, s, i, p, complete = 0;
+
+	for(i = 0; i < set->n; i++)
+	{
+		hash = (hash ^ set->v[i]) * 16777619u;
+	}
+
+	for(slot = hash & d->hash_mask; d->hash[slot]; slot = (slot + 1) & d->hash_mask)
+	{
+		s = d->hash[slot] - 1;
+		if(d->set_len[s] == set->n && (!set->n || !memcmp(d->sets.v + d->set_off[s], set->v, set->n * sizeof(*set->v))))
+		{
+			*id = s;
+			return 0;
+		}
+	}
+
+	if(d->num_states == d->max_states)
+	{
+		return 1;
+	}
+
+	if(d->num_states == d->cap && dpi_re_dfa_grow(d))
+	{
+		return -1;
+	}
+
+	s = d->num_states++;
+	d->hash[slot] = s + 1;
+	d->set_off[s] = d->sets.n;
+	d->set_len[s] = set->n;
+	if(dpi_re_list_append(&d->sets, set))
+	{
+		return -1;
+	}
+
+	// The lowest complete pattern wins; heads with tails make a confirm list.
+	// Units are in pattern order, so the lowest unit has the lowest pattern.
+	memset(&confirm, 0, sizeof(confirm));
+	for(i = 0; i < set->n; i++)
+	{
+		p = g->accept[set->v[i]];
+		if(!p)
+		{
+			continue;
+		}
+
+		if(!d->has_tail[p - 1])
+		{
+			if(!complete || p < complete)
+				complete = p;
+		}
+		else if(dpi_re_list_push(&confirm, p - 1))
+		{
+			return -1;
+		}
+	}
+
+	d->final[s] = complete ? d->units[complete - 1].pattern + 1 : 0;
+	if(!complete && confirm.n)
+	{
+		dpi_re_list_unique(&confirm);
+
+		for(i = 0; i < d->num_lists; i++)
+		{
+			if(d->lists[i].n == confirm.n && !memcmp(d->lists[i].v, confirm.v, confirm.n * sizeof(*confirm.v)))
+			{
+				break;
+			}
+		}
+
+		if(i == d->num_lists)
+		{
+			struct dpi_re_list *lists = realloc(d->lists, (d->num_lists + 1) * sizeof(*lists));
+
+			if(!lists)
+			{
+				dpi_re_list_free(&confirm);
+				return -1;
+			}
+			d->lists = lists;
+			d->lists[d->num_lists++] = confirm;
+			memset(&confirm, 0, sizeof(confirm));
+		}
+
+		d->final[s] = DPI_DFA_FINAL_CONFIRM | i;
+	}
+
+	dpi_re_list_free(&confirm);
+	*id = s;
+	return 0;
+}
+
+
+/**
+ *	Function that runs the subset construction over the head positions.
+ *	Every state is unanchored: the first positions of all unanchored
+ *	heads are added on every step. Anchored heads start from state 0 only.
+ *		returns 0 on success, 1 if the state limit is hit, -1 on error
+ */
+static int dpi_re_dfa_build(struct dpi_re_dfa *d, const struct dpi_re_list *first,
+						const struct dpi_re_list *anchored)
+{
+	const struct dpi_glushkov *g = d->g;
+	struct dpi_re_list start;
+	uint32_t s, i, k, p, q, b, id, n;
+	size_t total = 0;
+	int retval;
+
+	// Bytes of every position class
+	d->bytes_off = malloc((g->num + 1) * sizeof(*d->bytes_off));
+	for(p = 0; p < g->num; p++)
+	{
+		total += dpi_cls_count(g->cls[p]);
+	}
+	d->bytes = malloc(total + 1);
+	d->mark = calloc(g->num + 1, sizeof(*d->mark));
+	if(!d->bytes_off || !d->bytes || !d->mark)
+	{
+		return -1;
+	}
+
+	total = 0;
+	for(p = 0; p < g->num; p++)
+	{
+		d->bytes_off[p] = total;
+		for(b = 0; b < 256; b++)
+		{
+			if(dpi_cls_test(g->cls[p], b))
+				d->bytes[total++] = b;
+		}
+	}
+	d->bytes_off[g->num] = total;
+
+	for(n = 1; n < 2 * d->max_states; n <<= 1)
+		;
+	d->hash_mask = n - 1;
+	d->hash = calloc(n, sizeof(*d->hash));
+	if(!d->hash || dpi_re_dfa_grow(d))
+	{
+		return -1;
+	}
+
+	// State 0 is the start; it is hashed only when no head is anchored,
+	// otherwise the empty set reached later is a different state
+	memset(&start, 0, sizeof(start));
+	d->num_states = 1;
+	d->set_off[0] = 0;
+	d->set_len[0] = 0;
+	d->final[0] = 0;
+	if(!anchored->n)
+	{
+		d->hash[2166136261u & d->hash_mask] = 1;
+	}
+
+	for(s = 0; s < d->num_states; s++)
+	{
+		// Complete matches end the scan, so their states need no successors
+		if(d->final[s] && !(d->final[s] & DPI_DFA_FINAL_CONFIRM))
+		{
+			for(b = 0; b < 256; b++)
+				d->next[(size_t) s * 256 + b] = s;
+			continue;
+		}
+
+		// Candidate positions: successors of the set and the head starts
+		d->stamp++;
+		d->cand.n = 0;
+		for(i = 0; i < d->set_len[s]; i++)
+		{
+			p = d->sets.v[d->set_off[s] + i];
+			for(k = 0; k < g->follow[p].n; k++)
+			{
+				q = g->follow[p].v[k];
+				if(d->mark[q] != d->stamp)
+				{
+					d->mark[q] = d->stamp;
+					if(dpi_re_list_push(&d->cand, q))
+						return -1;
+				}
+			}
+		}
+		for(k = 0; k < first->n + (s ? 0 : anchored->n); k++)
+		{
+			q = (k < first->n) ? first->v[k] : anchored->v[k - first->n];
+			if(d->mark[q] != d->stamp)
+			{
+				d->mark[q] = d->stamp;
+				if(dpi_re_list_push(&d->cand, q))
+					return -1;
+			}
+		}
+		if(d->cand.n > 1)
+		{
+			qsort(d->cand.v, d->cand.n, sizeof(*d->cand.v), dpi_re_cmp);
+		}
+
+		// Distribute candidates over the bytes they accept (kept sorted)
+		for(b = 0; b < 256; b++)
+		{
+			d->bucket[b].n = 0;
+		}
+		for(i = 0; i < d->cand.n; i++)
+		{
+			q = d->cand.v[i];
+			for(k = d->bytes_off[q]; k < d->bytes_off[q + 1]; k++)
+			{
+				if(dpi_re_list_push(&d->bucket[d->bytes[k]], q))
+					return -1;
+			}
+		}
+
+		for(b = 0; b < 256; b++)
+		{
+			retval = dpi_re_dfa_state(d, &d->bucket[b], &id);
+			if(retval)
+			{
+				return retval;
+			}
+			d->next[(size_t) s * 256 + b] = id;
+		}
+	}
+
+	return 0;
+}
+
+
+static void dpi_re_dfa_free(struct dpi_re_dfa *d)
+{
+	uint32_t i;
+
+	for(i = 0; i < d->num_lists; i++)
+	{
+		dpi_re_list_free(&d->lists[i]);
+	}
+	for(i = 0; i < 256; i++)
+	{
+		dpi_re_list_free(&d->bucket[i]);
+	}
+
+	dpi_re_list_free(&d->sets);
+	dpi_re_list_free(&d->cand);
+	free(d->lists);
+	free(d->set_off);
+	free(d->set_len);
+	free(d->hash);
+	free(d->next);
+	free(d->final);
+	free(d->bytes_off);
+	free(d->bytes);
+	free(d->mark);
+	memset(d, 0, sizeof(*d));
+}
+
+
+/** Function that builds the tail automaton and the start set of every confirm list */
+static struct dpi_regex_tails *dpi_regex_tails_build(const struct dpi_re_unit *units, uint32_t num_units,
+								const bool *has_tail, const struct dpi_re_dfa *d)
+{
+	struct dpi_regex_tails *t;
+	struct dpi_glushkov g;
+	struct dpi_re_info *info;
+	struct dpi_regex *re;
+	uint32_t i, k, p, w;
+
+	memset(&g, 0, sizeof(g));
+	g.limit = DPI_NFA_MAX_STATES;
+
+	t = calloc(1, sizeof(*t));
+	info = calloc(num_units + 1, sizeof(*info));
+	if(!t || !info)
+	{
+		goto error;
+	}
+
+	for(i = 0; i < num_units; i++)
+	{
+		re = units[i].re;
+		if(!has_tail[i])
+		{
+			continue;
+		}
+
+		p = g.num;
+		dpi_glushkov_pieces(&g, re, re->split, re->last, re->split_inside ? -1 : 0, &info[i]);
+		re->tail_positions = g.num - p;
+		if(g.error)
+		{
+			if(g.num == g.limit)
+			{
+				fprintf(stderr, "dpi_regex: tails need more than %u positions\n", DPI_NFA_MAX_STATES);
+			}
+			goto error;
+		}
+
+		for(k = 0; k < info[i].last.n; k++)
+		{
+			g.accept[info[i].last.v[k]] = units[i].pattern + 1;
+		}
+	}
+
+	t->num_states = g.num;
+	t->num_lists = d->num_lists;
+	t->words = (g.num + 31) / 32;
+	t->cls = malloc(g.num * sizeof(*t->cls) + 1);
+	t->accept = malloc(g.num * sizeof(*t->accept) + 1);
+	t->follow = calloc((size_t) g.num * t->words + 1, sizeof(*t->follow));
+	t->list_start = calloc((size_t) t->num_lists * t->words + 1, sizeof(*t->list_start));
+	if(!t->cls || !t->accept || !t->follow || !t->list_start)
+	{
+		goto error;
+	}
+
+	if(g.num)
+	{
+		memcpy(t->cls, g.cls, g.num * sizeof(*t->cls));
+		memcpy(t->accept, g.accept, g.num * sizeof(*t->accept));
+	}
+	for(p = 0; p < g.num; p++)
+	{
+		for(k = 0; k < g.follow[p].n; k++)
+		{
+			w = g.follow[p].v[k];
+			t->follow[p * t->words + w / 32] |= 1u << (w % 32);
+		}
+	}
+
+	for(i = 0; i < d->num_lists; i++)
+	{
+		for(k = 0; k < d->lists[i].n; k++)
+		{
+			const struct dpi_re_list *f = &info[d->lists[i].v[k]].first;
+
+			for(p = 0; p < f->n; p++)
+			{
+				t->list_start[i * t->words + f->v[p] / 32] |= 1u << (f->v[p] % 32);
+			}
+		}
+	}
+
+	for(i = 0; i < num_units; i++)
+	{
+		dpi_re_info_free(&info[i]);
+	}
+	free(info);
+	dpi_glushkov_free(&g);
+	return t;
+
+error:
+	if(info)
+	{
+		for(i = 0; i < num_units; i++)
+			dpi_re_info_free(&info[i]);
+	}
+	free(info);
+	dpi_glushkov_free(&g);
+	dpi_regex_tails_free(t);
+	return NULL;
+}
+
+
+/** Function that adds a pattern, or the branches of its regex, to the units */
+static int dpi_regex_unit_add(struct dpi_re_unit **units, uint32_t *n, uint32_t *capacity,
+							struct dpi_regex *re, uint32_t pattern)
+{
+	struct dpi_re_unit *p;
+	uint32_t i;
+
+	if(re && re->num_branches)
+	{
+		for(i = 0; i < re->num_branches; i++)
+		{
+			if(dpi_regex_unit_add(units, n, capacity, &re->branches[i], pattern))
+				return -1;
+		}
+		return 0;
+	}
+
+	if(*n == *capacity)
+	{
+		*capacity = *capacity ? 2 * *capacity : 64;
+		p = realloc(*units, *capacity * sizeof(*p));
+		if(!p)
+		{
+			return -1;
+		}
+		*units = p;
+	}
+
+	(*units)[*n].re = re;
+	(*units)[*n].pattern = pattern;
+	(*n)++;
+	return 0;
+}
+
+
+/** Function that lists the units of a pattern set in pattern order, NULL if out of memory */
+static struct dpi_re_unit *dpi_regex_units(const struct dpi_pattern_set *set, uint32_t *n)
+{
+	struct dpi_re_unit *units = NULL;
+	uint32_t i, capacity = 0;
+
+	*n = 0;
+	for(i = 0; i < set->count; i++)
+	{
+		if(dpi_regex_unit_add(&units, n, &capacity, set->patterns[i].regex, i))
+		{
+			free(units);
+			return NULL;
+		}
+	}
+
+	return units;
+}
+
+
+struct dpi_matcher *dpi_regex_compile(const struct dpi_pattern_set *set, const struct dpi_regex_limits *limits)
+{
+	struct dpi_regex_limits defaults = { DPI_MAX_STATES, DPI_REGEX_DEFAULT_SPLIT_REPEAT };
+	struct dpi_re_list first, anchored;
+	struct dpi_glushkov g;
+	struct dpi_re_dfa d;
+	struct dpi_matcher *m = NULL;
+	struct dpi_regex *re, *largest;
+	struct dpi_re_unit *units = NULL;
+	bool *has_tail = NULL, *stuck = NULL;
+	uint32_t i, s, n, num_units = 0;
+	void *p;
+	int retval;
+
+	if(!limits)
+	{
+		limits = &defaults;
+	}
+
+	for(i = 0; i < set->count; i++)
+	{
+		if(set->patterns[i].regex)
+			dpi_regex_split(set->patterns[i].regex, limits->split_repeat);
+	}
+
+	memset(&first, 0, sizeof(first));
+	memset(&anchored, 0, sizeof(anchored));
+	memset(&g, 0, sizeof(g));
+	memset(&d, 0, sizeof(d));
+
+	// Build the head table; while it is too large, move the last head
+	// piece of the regex with the largest head into its tail
+	for(;;)
+	{
+		g.limit = UINT32_MAX;
+		first.n = anchored.n = 0;
+
+		// Branching a regex adds units; nothing is stuck among new ones
+		free(units);
+		units = dpi_regex_units(set, &n);
+		if(units && n != num_units)
+		{
+			p = realloc(has_tail, 2 * n * sizeof(*has_tail));
+			if(p)
+			{
+				has_tail = p;
+				stuck = has_tail + n;
+				memset(stuck, 0, n * sizeof(*stuck));
+				num_units = n;
+			}
+		}
+		if(!units || n != num_units)
+		{
+			fprintf(stderr, "dpi_regex: out of memory\n");
+			goto out;
+		}
+
+		for(i = 0; i < num_units; i++)
+		{
+			re = units[i].re;
+			has_tail[i] = re && dpi_regex_has_tail(re);
+		}
+
+		if(dpi_regex_heads(&g, set, units, num_units, &first, &anchored))
+		{
+			fprintf(stderr, "dpi_regex: out of memory\n");
+			goto out;
+		}
+
+		d.g = &g;
+		d.units = units;
+		d.has_tail = has_tail;
+		d.max_states = limits->max_states;
+		retval = dpi_re_dfa_build(&d, &first, &anchored);
+		if(retval < 0)
+		{
+			fprintf(stderr, "dpi_regex: out of memory\n");
+			goto out;
+		}
+		if(!retval)
+		{
+			break;
+		}
+
+		dpi_re_dfa_free(&d);
+		dpi_glushkov_free(&g);
+
+		do
+		{
+			largest = NULL;
+			s = 0;
+			for(i = 0; i < num_units; i++)
+			{
+				re = units[i].re;
+				if(re && !stuck[i] && (!largest || re->head_positions > largest->head_positions))
+				{
+					largest = re;
+					s = i;
+				}
+			}
+
+			if(!largest)
+			{
+				fprintf(stderr, "dpi_regex: state limit (%u) exceeded\n", limits->max_states);
+				goto out;
+			}
+			stuck[s] = !dpi_regex_shrink(largest, limits->split_repeat);
+		}
+		while(stuck[s]);
+	}
+
+	m = calloc(1, sizeof(*m));
+	if(!m)
+	{
+		goto out;
+	}
+
+	m->set = set;
+	m->num_states = d.num_states;
+	m->next = d.next;
+	m->final = d.final;
+	d.next = NULL;
+	d.final = NULL;
+
+	for(s = 0; s < m->num_states; s++)
+	{
+		if(m->final[s])
+			m->num_finals++;
+	}
+
+	m->tails = dpi_regex_tails_build(units, num_units, has_tail, &d);
+	if(!m->tails)
+	{
+		dpi_matcher_free(m);
+		m = NULL;
+	}
+
+out:
+	dpi_re_dfa_free(&d);
+	dpi_glushkov_free(&g);
+	dpi_re_list_free(&first);
+	dpi_re_list_free(&anchored);
+	free(units);
+	free(has_tail);
+	return m;
+}
+
+
+void dpi_regex_tails_free(struct dpi_regex_tails *t)
+{
+	if(!t)
+	{
+		return;
+	}
+
+	free(t->cls);
+	free(t->accept);
+	free(t->follow);
+	free(t->list_start);
+	free(t);
+}
+
+
+void dpi_regex_start(const struct dpi_regex_tails *t, uint32_t list, uint32_t *active, bool *tails)
+{
+	const uint32_t *start = t->list_start + (size_t) list * t->words;
+	uint32_t w;
+
+	if(!*tails)
+	{
+		memcpy(active, start, t->words * sizeof(*active));
+		*tails = true;
+		return;
+	}
+
+	for(w = 0; w < t->words; w++)
+	{
+		active[w] |= start[w];
+	}
+}
+
+
+uint32_t dpi_regex_step(const struct dpi_regex_tails *t, uint32_t *active, unsigned char c, bool *tails)
+{
+	uint32_t next[DPI_NFA_MAX_STATES / 32];
+	uint32_t w, k, p, bits, words = t->words, any = 0;
+
+	memset(next, 0, words * sizeof(*next));
+
+	// active holds the positions that may take the byte
+	for(w = 0; w < words; w++)
+	{
+		for(bits = active[w]; bits; bits &= bits - 1)
+		{
+			p = w * 32 + __builtin_ctz(bits);
+			if(!dpi_cls_test(t->cls[p], c))
+			{
+				continue;
+			}
+
+			if(t->accept[p])
+			{
+				return t->accept[p];
+			}
+
+			for(k = 0; k < words; k++)
+			{
+				next[k] |= t->follow[p * words + k];
+			}
+		}
+	}
+
+	for(w = 0; w < words; w++)
+	{
+		active[w] = next[w];
+		any |= next[w];
+	}
+	*tails = any != 0;
+
+	return 0;
+}
+
+
+uint32_t dpi_regex_confirm(const struct dpi_regex_tails *t, uint32_t list, const unsigned char *buf, size_t len)
+{
+	uint32_t active[DPI_NFA_MAX_STATES / 32], f;
+	bool tails = false;
+	size_t i;
+
+	dpi_regex_start(t, list, active, &tails);
+	for(i = 0; i < len && tails; i++)
+	{
+		f = dpi_regex_step(t, active, buf[i], &tails);
+		if(f)
+		{
+			return f;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+#ifndef _DPI_REGEX_H
+#define _DPI_REGEX_H
+
+/**
+ * Regex signatures for FPGA matcher tools.
+ * Parses a PCRE subset and compiles regexes together with literal patterns
+ * into a hybrid automaton: the head of every regex goes into the state
+ * table the accelerator walks, and the tail from the first part that would
+ * blow up the table (dot-star, wide or long repetitions) is left to an NFA
+ * that the CPU runs only where a head has matched. A leading alternation
+ * that blows up the table by itself is split per alternative.
+ *
+ * Supported syntax: literals, escapes (\xHH \n \r \t \f \v \d \D \w \W \s \S
+ * and escaped metacharacters), '.', classes with ranges and negation,
+ * groups ( ) and (?: ), alternation, quantifiers * + ? {n} {n,} {n,m}
+ * (lazy forms are accepted), '^' at the start. Flags: i (case-insensitive)
+ * and s (dot matches newline).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "dpi_user.h"
+#include "dpi_matcher.h"
+
+/** Limits of the regex compiler */
+#define DPI_REGEX_MAX_NODES				4096
+#define DPI_REGEX_MAX_REPEAT			255
+#define DPI_REGEX_INFINITE				UINT32_MAX
+#define DPI_REGEX_MAX_BRANCHES			64
+
+/** Default limits of the hybrid automaton */
+#define DPI_REGEX_DEFAULT_SPLIT_REPEAT	16
+
+/** Syntax tree node types */
+#define DPI_RE_EMPTY					0
+#define DPI_RE_CLASS					1
+#define DPI_RE_CAT						2
+#define DPI_RE_ALT						3
+#define DPI_RE_REPEAT					4
+
+/** Syntax tree node */
+struct dpi_re_node
+{
+	uint8_t type;
+
+	// DPI_RE_CLASS: bit (b & 7) of cls[b >> 3] is set for every byte b of the class
+	uint8_t cls[32];
+
+	// DPI_RE_REPEAT: child repeated min to max (DPI_REGEX_INFINITE) times
+	uint32_t min;
+	uint32_t max;
+
+	// DPI_RE_CAT, DPI_RE_ALT: both; DPI_RE_REPEAT: left
+	struct dpi_re_node *left;
+	struct dpi_re_node *right;
+};
+
+/** A top-level piece of a regex (atom with its quantifier) */
+struct dpi_re_piece
+{
+	struct dpi_re_node *atom;
+	uint32_t min;
+	uint32_t max;
+
+	// Span in the regex source
+	uint32_t offset;
+	uint32_t end;
+
+	// Would multiply the states of the combined table
+	bool explosive;
+};
+
+/** A parsed regex and where the compiler split it */
+struct dpi_regex
+{
+	char *source;
+	bool anchored;
+
+	uint32_t num_pieces;
+	struct dpi_re_piece *pieces;
+
+	// Pieces [first, last) are needed; leading and trailing optional
+	// pieces never change whether a payload matches
+	uint32_t first;
+	uint32_t last;
+
+	// Set by the compiler: pieces [first, split) are the head. With
+	// split_inside, the first repetition of piece 'split' is in the head too.
+	uint32_t split;
+	bool split_inside;
+
+	uint32_t head_positions;
+	uint32_t tail_positions;
+
+	// Set by the compiler when the first piece is an alternation that the
+	// table cannot hold: one regex per alternative, followed by the rest
+	// of the pieces, is split instead of this one. Branches have no source
+	// and share the syntax trees of this regex.
+	uint32_t num_branches;
+	struct dpi_regex *branches;
+};
+
+/** Compiler limits */
+struct dpi_regex_limits
+{
+	// States of the combined table (at most DPI_MAX_STATES)
+	uint32_t max_states;
+
+	// Repetitions wider than one byte and longer than this go to the tail
+	uint32_t split_repeat;
+};
+
+/** CPU-side part of a hybrid automaton, laid out as DPI_SECTION_NFA */
+struct dpi_regex_tails
+{
+	uint32_t num_states;
+	uint32_t num_lists;
+	uint32_t words;
+
+	uint8_t (*cls)[32];
+	uint32_t *accept;
+	uint32_t *follow;
+	uint32_t *list_start;
+};
+
+/**
+ *	This function parses "/regex/flags" (the part after "pcre:").
+ *		returns the regex on success, NULL on error (message printed)
+ */
+struct dpi_regex *dpi_regex_parse(const char *);
+
+/** The function that releases a parsed regex */
+void dpi_regex_free(struct dpi_regex *);
+
+/**
+ *	This function returns the bytes every match starts with. Prefilter and
+ *	bloom filter use them as the pattern bytes of the regex.
+ *		returns number of bytes stored (at most max)
+ */
+uint32_t dpi_regex_prefix(const struct dpi_regex *, unsigned char *, uint32_t);
+
+/**
+ *	This function compiles a pattern set that contains regexes into a
+ *	hybrid matcher. Regex pattern split points are stored in the regexes.
+ *		returns the matcher on success, NULL on error
+ */
+struct dpi_matcher *dpi_regex_compile(const struct dpi_pattern_set *, const struct dpi_regex_limits *);
+
+/** The function that releases the CPU-side part of a hybrid automaton */
+void dpi_regex_tails_free(struct dpi_regex_tails *);
+
+/**
+ *	This function adds the positions of a confirm list to the active tail
+ *	positions (words of the tails). If tails is false, active is overwritten
+ *	instead; tails is set.
+ */
+void dpi_regex_start(const struct dpi_regex_tails *, uint32_t, uint32_t *, bool *);
+
+/**
+ *	This function feeds one byte to the active tail positions; tails is
+ *	cleared when none is left. Heads that end at different bytes share the
+ *	positions, so a scan does this once per byte however many heads end.
+ *		returns index of the matched pattern plus one, 0 if no tail ends
+ *		at the byte
+ */
+uint32_t dpi_regex_step(const struct dpi_regex_tails *, uint32_t *, unsigned char, bool *);
+
+/**
+ *	This function runs the tails of a confirm list on the bytes following
+ *	a head match, up to the end of the buffer if needed. A scan should use
+ *	dpi_regex_start() and dpi_regex_step() instead, one run per head takes
+ *	quadratic time on a payload with many heads.
+ *		returns index of the matched pattern plus one, 0 if no tail matches
+ */
+uint32_t dpi_regex_confirm(const struct dpi_regex_tails *, uint32_t, const unsigned char *, size_t);
+
+#endif
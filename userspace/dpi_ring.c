@@ -0,0 +1,168 @@
+/**
+ * Userspace access to /dev/dpi submission/completion rings.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "dpi_ring.h"
+
+
+int dpi_ring_open(struct dpi_ring *ring, const char *path, uint32_t entries,
+				uint32_t buf_count, uint32_t buf_size, uint32_t flags)
+{
+	unsigned char *base;
+
+	memset(ring, 0, sizeof(*ring));
+
+	ring->fd = open(path, O_RDWR);
+	if(ring->fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+
+	ring->params.sq_entries = entries;
+	ring->params.buf_count = buf_count;
+	ring->params.buf_size = buf_size;
+	ring->params.flags = flags;
+
+	if(ioctl(ring->fd, DPI_IOC_SETUP, &ring->params) < 0)
+	{
+		perror("dpi_ring: DPI_IOC_SETUP");
+		goto error;
+	}
+
+	ring->region = mmap(NULL, ring->params.region_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, ring->fd, 0);
+	if(ring->region == MAP_FAILED)
+	{
+		perror("dpi_ring: mmap");
+		goto error;
+	}
+
+	base = (unsigned char *) ring->region;
+	ring->sq_ctrl = (struct dpi_ring_ctrl *) (base + ring->params.sq_off);
+	ring->sqes = (struct dpi_sqe *) (ring->sq_ctrl + 1);
+	ring->cq_ctrl = (struct dpi_ring_ctrl *) (base + ring->params.cq_off);
+	ring->cqes = (struct dpi_cqe *) (ring->cq_ctrl + 1);
+	ring->bufs = base + ring->params.buf_off;
+
+	return 0;
+
+error:
+	close(ring->fd);
+	ring->fd = -1;
+	ring->region = NULL;
+	return -1;
+}
+
+
+void dpi_ring_close(struct dpi_ring *ring)
+{
+	if(ring->region)
+	{
+		munmap(ring->region, ring->params.region_size);
+		ring->region = NULL;
+	}
+
+	if(ring->fd >= 0)
+	{
+		close(ring->fd);
+		ring->fd = -1;
+	}
+}
+
+
+unsigned char *dpi_ring_buf(struct dpi_ring *ring, uint32_t index)
+{
+	return ring->bufs + (size_t) index * ring->params.buf_size;
+}
+
+
+int dpi_ring_queue(struct dpi_ring *ring, uint32_t buf_index, uint32_t len, uint64_t user_data)
+{
+	struct dpi_sqe *sqe;
+	uint32_t head = __atomic_load_n(&ring->sq_ctrl->head, __ATOMIC_ACQUIRE);
+
+	if(ring->sq_tail - head >= ring->params.sq_entries)
+	{
+		return -1;
+	}
+
+	sqe = &ring->sqes[ring->sq_tail & (ring->params.sq_entries - 1)];
+	sqe->user_data = user_data;
+	sqe->buf_index = buf_index;
+	sqe->len = len;
+	ring->sq_tail++;
+
+	return 0;
+}
+
+
+int dpi_ring_submit(struct dpi_ring *ring, uint32_t min_complete)
+{
+	struct dpi_enter enter;
+
+	memset(&enter, 0, sizeof(enter));
+
+	// Publish the entries (and the buffer contents) to the kernel
+	__atomic_store_n(&ring->sq_ctrl->tail, ring->sq_tail, __ATOMIC_RELEASE);
+	enter.to_submit = ring->sq_tail - ring->sq_flushed;
+	ring->sq_flushed = ring->sq_tail;
+
+	if(ring->params.flags & DPI_SETUP_SQPOLL)
+	{
+		// Order the tail store against the flag load, see DPI_SQ_NEED_WAKEUP
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if(__atomic_load_n(&ring->sq_ctrl->flags, __ATOMIC_RELAXED) & DPI_SQ_NEED_WAKEUP)
+		{
+			enter.flags |= DPI_ENTER_SQ_WAKEUP;
+		}
+
+		if(min_complete)
+		{
+			enter.flags |= DPI_ENTER_GETEVENTS;
+			enter.min_complete = min_complete;
+		}
+
+		// Poll thread is awake and nobody waits: no syscall at all
+		if(!enter.flags)
+		{
+			return 0;
+		}
+	}
+
+	while(ioctl(ring->fd, DPI_IOC_ENTER, &enter) < 0)
+	{
+		if(errno != EINTR)
+		{
+			perror("dpi_ring: DPI_IOC_ENTER");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+unsigned int dpi_ring_reap(struct dpi_ring *ring, struct dpi_cqe *out, unsigned int max)
+{
+	uint32_t head = ring->cq_ctrl->head;
+	uint32_t tail = __atomic_load_n(&ring->cq_ctrl->tail, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	while(head != tail && n < max)
+	{
+		out[n++] = ring->cqes[head & (ring->params.cq_entries - 1)];
+		head++;
+	}
+
+	__atomic_store_n(&ring->cq_ctrl->head, head, __ATOMIC_RELEASE);
+	return n;
+}
@@ -0,0 +1,63 @@
+#ifndef _DPI_RING_H
+#define _DPI_RING_H
+
+/**
+ * Userspace access to /dev/dpi submission/completion rings.
+ */
+
+#include <stdint.h>
+#include "dpi_user.h"
+
+/** A mapped ring pair on an open /dev/dpi */
+struct dpi_ring
+{
+	int fd;
+	struct dpi_ring_params params;
+
+	// Mapped region and its parts
+	void *region;
+	struct dpi_ring_ctrl *sq_ctrl;
+	struct dpi_ring_ctrl *cq_ctrl;
+	struct dpi_sqe *sqes;
+	struct dpi_cqe *cqes;
+	unsigned char *bufs;
+
+	// Entries queued but not yet handed to the kernel
+	uint32_t sq_tail;
+	uint32_t sq_flushed;
+};
+
+/**
+ *	This function opens the device, sets up the rings and maps them.
+ *	Pass DPI_SETUP_SQPOLL in flags to submit without syscalls.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_ring_open(struct dpi_ring *, const char *, uint32_t, uint32_t, uint32_t, uint32_t);
+
+/** The function that unmaps and closes the rings */
+void dpi_ring_close(struct dpi_ring *);
+
+/** The function that returns the data buffer with given index */
+unsigned char *dpi_ring_buf(struct dpi_ring *, uint32_t);
+
+/**
+ *	This function queues a filled buffer for matching.
+ *		returns 0 on success, -1 if the SQ is full
+ */
+int dpi_ring_queue(struct dpi_ring *, uint32_t, uint32_t, uint64_t);
+
+/**
+ *	This function hands queued entries to the kernel and, with min_complete,
+ *	waits until that many completions are available. It makes no syscall
+ *	when a running SQ poll thread picks the entries up by itself.
+ *		returns 0 on success, -1 on error
+ */
+int dpi_ring_submit(struct dpi_ring *, uint32_t);
+
+/**
+ *	This function copies up to max completions out of the CQ.
+ *		returns number of completions copied
+ */
+unsigned int dpi_ring_reap(struct dpi_ring *, struct dpi_cqe *, unsigned int);
+
+#endif
@@ -3,19 +3,80 @@
  * Written by Engin Ertas <engin.ertas@ceng.metu.edu.tr>
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
 #include "xt_fpga.h"
 
 
+/** Overload policy names, indexed by XT_FPGA_POLICY_* */
+static const char *const fpga_policy_names[] =
+{
+	"open",
+	"closed",
+	"software",
+	"sample",
+};
+
+/** Characters allowed in rule names */
+#define FPGA_NAME_CHARS		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.-"
+
+/** Field names, indexed by XT_FPGA_FIELD_* */
+static const char *const fpga_field_names[] =
+{
+	"packet",
+	"http-host",
+	"http-uri",
+	"tls-sni",
+	"dns-qname",
+};
+
+
 static void fpga_help(void)
 {
 	printf(
 		"fpga match options:\n"
 		"--filter      				Enables filter for matching packets\n"
-		"--print 					Enables logging for matching packets\n"
+		"--print 					Logs matching packets (dpi_ctl events)\n"
+		"--budget-bytes RATE 		Accelerator budget in bytes/s (k/m/g suffixes)\n"
+		"--budget-packets RATE 		Accelerator budget in packets/s (k/m/g suffixes)\n"
+		"--budget-auto PERCENT 		Budget as a share of measured accelerator time\n"
+		"--budget-burst MS 			Budget that can be saved up, in ms (default %u)\n"
+		"--overload POLICY 			What to do over budget: open, closed, software or sample\n"
+		"--sample N 				With sample policy, inspect 1 in N packets (default %u)\n"
+		"--name NAME 				Rule name in /proc/net/xt_fpga/rules\n"
+		"--field FIELD 				Inspect only http-host, http-uri, tls-sni or dns-qname\n"
+		"--inflate 					Also inspect gzip and deflate HTTP response bodies\n",
+		XT_FPGA_DEFAULT_BURST_MS, XT_FPGA_DEFAULT_SAMPLE
 	);
 }
 
 
+/** Function that parses a rate with an optional k, m or g suffix */
+static uint64_t fpga_parse_rate(const char *opt, const char *arg)
+{
+	unsigned long long rate, unit = 1;
+	char *end;
+
+	rate = strtoull(arg, &end, 0);
+	switch(*end)
+	{
+		case 'k': case 'K': unit = 1000ULL; end++; break;
+		case 'm': case 'M': unit = 1000000ULL; end++; break;
+		case 'g': case 'G': unit = 1000000000ULL; end++; break;
+		default: break;
+	}
+
+	if(*end != '\0' || rate == 0 || rate > ULLONG_MAX / unit)
+	{
+		xtables_error(PARAMETER_PROBLEM, "fpga: bad value \"%s\" for %s", arg, opt);
+	}
+
+	return rate * unit;
+}
+
+
 static void fpga_init(struct xt_entry_match *m)
 {
 	printf("** FPGA rule is being initialized... \n");
@@ -27,10 +88,24 @@ static void fpga_init(struct xt_entry_match *m)
 }
 
 
+static void fpga_init_v2(struct xt_entry_match *m)
+{
+	struct xt_fpga_info *shared_info = (struct xt_fpga_info *) m->data;
+
+	fpga_init(m);
+
+	shared_info->policy = XT_FPGA_POLICY_OPEN;
+	shared_info->sample_rate = XT_FPGA_DEFAULT_SAMPLE;
+	shared_info->burst_ms = XT_FPGA_DEFAULT_BURST_MS;
+}
+
+
 static int fpga_parse(int c, char **argv, int invert, unsigned int *flags,
              const void *entry, struct xt_entry_match **match)
 {
 	struct xt_fpga_info *shared_info = (struct xt_fpga_info *)(*match)->data;
+	unsigned int value, i;
+	uint64_t rate;
 	printf("** Parsing FPGA rule arguments... \n");
 
 	switch (c) 
@@ -45,6 +120,81 @@ static int fpga_parse(int c, char **argv, int invert, unsigned int *flags,
 			shared_info->print_enabled = 1;
 			break;
 
+		// Options below exist from revision 2 on
+		case '3':
+			shared_info->rate_bytes = fpga_parse_rate("--budget-bytes", optarg);
+			break;
+
+		case '4':
+			// An auto budget replaces the packet cost, so the two cannot be combined
+			if(shared_info->auto_percent)
+				xtables_error(PARAMETER_PROBLEM, "fpga: --budget-packets cannot be used with --budget-auto");
+			rate = fpga_parse_rate("--budget-packets", optarg);
+			if(rate > UINT32_MAX)
+				xtables_error(PARAMETER_PROBLEM, "fpga: --budget-packets takes at most %u", UINT32_MAX);
+			shared_info->rate_packets = rate;
+			break;
+
+		case '5':
+			if(shared_info->rate_packets)
+				xtables_error(PARAMETER_PROBLEM, "fpga: --budget-auto cannot be used with --budget-packets");
+			if(!xtables_strtoui(optarg, NULL, &value, 1, 100))
+				xtables_error(PARAMETER_PROBLEM, "fpga: --budget-auto takes 1 to 100");
+			shared_info->auto_percent = value;
+			break;
+
+		case '6':
+			if(!xtables_strtoui(optarg, NULL, &value, 1, XT_FPGA_MAX_BURST_MS))
+				xtables_error(PARAMETER_PROBLEM, "fpga: --budget-burst takes 1 to %u", XT_FPGA_MAX_BURST_MS);
+			shared_info->burst_ms = value;
+			break;
+
+		case '7':
+			for(i = 0; i < sizeof(fpga_policy_names) / sizeof(fpga_policy_names[0]); i++)
+			{
+				if(!strcmp(optarg, fpga_policy_names[i]))
+					break;
+			}
+			if(i == sizeof(fpga_policy_names) / sizeof(fpga_policy_names[0]))
+				xtables_error(PARAMETER_PROBLEM, "fpga: unknown --overload policy \"%s\"", optarg);
+			shared_info->policy = i;
+			printf("\tOverload policy is %s. \n", optarg);
+			break;
+
+		case '8':
+			if(!xtables_strtoui(optarg, NULL, &value, 1, UINT32_MAX))
+				xtables_error(PARAMETER_PROBLEM, "fpga: bad --sample value \"%s\"", optarg);
+			shared_info->sample_rate = value;
+			break;
+
+		case '9':
+			if(strlen(optarg) >= XT_FPGA_NAME_LEN)
+				xtables_error(PARAMETER_PROBLEM, "fpga: --name is longer than %u characters", XT_FPGA_NAME_LEN - 1);
+
+			// Saved rules print the name unquoted, so it must survive iptables-restore
+			if(optarg[strspn(optarg, FPGA_NAME_CHARS)] != '\0')
+				xtables_error(PARAMETER_PROBLEM, "fpga: --name takes only letters, digits, '_', '.' and '-'");
+			strcpy(shared_info->name, optarg);
+			break;
+
+		// Options below exist in revision 3 only
+		case 'a':
+			for(i = 0; i < sizeof(fpga_field_names) / sizeof(fpga_field_names[0]); i++)
+			{
+				if(!strcmp(optarg, fpga_field_names[i]))
+					break;
+			}
+			if(i == sizeof(fpga_field_names) / sizeof(fpga_field_names[0]))
+				xtables_error(PARAMETER_PROBLEM, "fpga: unknown --field \"%s\"", optarg);
+			shared_info->field = i;
+			printf("\tInspected field is %s. \n", optarg);
+			break;
+
+		case 'b':
+			printf("\tCompressed HTTP bodies are inspected. \n");
+			shared_info->flags |= XT_FPGA_F_INFLATE;
+			break;
+
 		default:
 			return 0;
 	}
@@ -59,9 +209,80 @@ static void fpga_final_check(unsigned int flags)
 }
 
 
+static void fpga_save(const void *ip, const struct xt_entry_match *match)
+{
+	const struct xt_fpga_info_v0 *info = (const struct xt_fpga_info_v0 *) match->data;
+
+	if(info->filter_enabled)
+		printf(" --filter");
+	if(info->print_enabled)
+		printf(" --print");
+}
+
+
+static void fpga_print(const void *ip, const struct xt_entry_match *match, int numeric)
+{
+	printf(" fpga");
+	fpga_save(ip, match);
+}
+
+
+static void fpga_save_v2(const void *ip, const struct xt_entry_match *match)
+{
+	const struct xt_fpga_info_v2 *info = (const struct xt_fpga_info_v2 *) match->data;
+
+	fpga_save(ip, match);
+
+	if(info->rate_bytes)
+		printf(" --budget-bytes %llu", (unsigned long long) info->rate_bytes);
+	if(info->rate_packets)
+		printf(" --budget-packets %u", info->rate_packets);
+	if(info->auto_percent)
+		printf(" --budget-auto %u", info->auto_percent);
+	if(info->burst_ms != XT_FPGA_DEFAULT_BURST_MS)
+		printf(" --budget-burst %u", info->burst_ms);
+	if(info->policy != XT_FPGA_POLICY_OPEN && info->policy <= XT_FPGA_POLICY_SAMPLE)
+		printf(" --overload %s", fpga_policy_names[info->policy]);
+	if(info->policy == XT_FPGA_POLICY_SAMPLE)
+		printf(" --sample %u", info->sample_rate);
+	if(info->name[0])
+		printf(" --name %.*s", XT_FPGA_NAME_LEN, info->name);
+}
+
+
+static void fpga_print_v2(const void *ip, const struct xt_entry_match *match, int numeric)
+{
+	printf(" fpga");
+	fpga_save_v2(ip, match);
+}
+
+
+static void fpga_save_v3(const void *ip, const struct xt_entry_match *match)
+{
+	const struct xt_fpga_info *info = (const struct xt_fpga_info *) match->data;
+
+	// Settings of revision 2 are at the same offsets
+	fpga_save_v2(ip, match);
+
+	if(info->field != XT_FPGA_FIELD_PACKET && info->field <= XT_FPGA_FIELD_LAST)
+		printf(" --field %s", fpga_field_names[info->field]);
+	if(info->flags & XT_FPGA_F_INFLATE)
+		printf(" --inflate");
+}
+
+
+static void fpga_print_v3(const void *ip, const struct xt_entry_match *match, int numeric)
+{
+	printf(" fpga");
+	fpga_save_v3(ip, match);
+}
+
+
 void _init(void)
 {
 	printf("** Userspace shared library for Xtables is loaded.\n");
 	xtables_register_match(&fpga_mt_reg[0]);
 	xtables_register_match(&fpga_mt_reg[1]);
+	xtables_register_match(&fpga_mt_reg[2]);
+	xtables_register_match(&fpga_mt_reg[3]);
 }
\ No newline at end of file
@@ -0,0 +1,571 @@
+/**
+ * NFQUEUE daemon for FPGA matching.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <linux/netfilter.h>
+#include <linux/netlink.h>
+#include "nfq_fpga.h"
+
+
+/** Daemon settings */
+static struct nfq_fpga_config Nfq_Config =
+{
+	.queue_count	= 1,
+	.queue_maxlen	= NFQ_FPGA_DEFAULT_MAXLEN,
+	.mark			= NFQ_FPGA_DEFAULT_MARK,
+	.batch_size		= NFQ_FPGA_DEFAULT_BATCH,
+};
+
+/** Compiled signature set shared by all workers (read-only after start) */
+static struct dpi_pattern_set Nfq_Patterns;
+static struct dpi_matcher *Nfq_Matcher;
+static struct dpi_prefilter_table Nfq_Prefilter;
+
+/** Set by signal handler to stop workers */
+static volatile sig_atomic_t Nfq_Stop;
+
+
+static void nfq_fpga_help(const char *prog)
+{
+	printf(
+		"Usage: %s --patterns FILE [options]\n"
+		"--filter              Enables verdict (mark/drop) for matching packets\n"
+		"--print               Enables logging for matching packets\n"
+		"--patterns FILE       Signature file for the software matcher\n"
+		"--queue-num N         First queue number (default 0)\n"
+		"--queues N            Number of queues, one worker per queue (default 1)\n"
+		"                      Pair it with iptables -j NFQUEUE --queue-balance\n"
+		"--queue-maxlen N      Kernel queue length (default %u)\n"
+		"--fail-open           Accept packets when a queue is full\n"
+		"--mark N              Mark set on matching packets (default 0x%x)\n"
+		"--drop                Drop matching packets instead of marking them\n"
+		"--batch N             Maximum packets per batch verdict (default %u)\n"
+		"--device PATH         Match on the accelerator (e.g. %s) instead of software\n"
+		"                      Packets it cannot take or answer still use --patterns\n"
+		"--sqpoll              Let a kernel thread pick up submissions (no syscalls)\n",
+		prog, NFQ_FPGA_DEFAULT_MAXLEN, NFQ_FPGA_DEFAULT_MARK, NFQ_FPGA_DEFAULT_BATCH,
+		DPI_DEVICE_PATH
+	);
+}
+
+
+static int nfq_fpga_parse(int argc, char **argv)
+{
+	int c;
+
+	while((c = getopt_long(argc, argv, "", nfq_fpga_opts, NULL)) != -1)
+	{
+		switch(c)
+		{
+			case 'f':
+				Nfq_Config.filter_enabled = true;
+				break;
+
+			case 'p':
+				Nfq_Config.print_enabled = true;
+				break;
+
+			case 'P':
+				Nfq_Config.patterns = optarg;
+				break;
+
+			case 'q':
+				Nfq_Config.queue_num = (uint16_t) strtoul(optarg, NULL, 0);
+				break;
+
+			case 'n':
+				Nfq_Config.queue_count = (uint16_t) strtoul(optarg, NULL, 0);
+				break;
+
+			case 'l':
+				Nfq_Config.queue_maxlen = (uint32_t) strtoul(optarg, NULL, 0);
+				break;
+
+			case 'o':
+				Nfq_Config.fail_open = true;
+				break;
+
+			case 'm':
+				Nfq_Config.mark = (uint32_t) strtoul(optarg, NULL, 0);
+				break;
+
+			case 'd':
+				Nfq_Config.drop = true;
+				break;
+
+			case 'b':
+				Nfq_Config.batch_size = (unsigned int) strtoul(optarg, NULL, 0);
+				break;
+
+			case 'D':
+				Nfq_Config.device = optarg;
+				break;
+
+			case 'S':
+				Nfq_Config.sqpoll = true;
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	if(!Nfq_Config.patterns ||
+		!Nfq_Config.queue_count || !Nfq_Config.batch_size)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void nfq_fpga_software(struct nfq_fpga_entry *entry, const unsigned char *payload, unsigned int len)
+{
+	if(dpi_prefilter_scan(&Nfq_Prefilter, payload, len))
+	{
+		entry->matched = dpi_matcher_scan(Nfq_Matcher, payload, len, &entry->pattern_id);
+	}
+}
+
+
+static int nfq_fpga_packet(struct nfq_q_handle *qh, struct nfgenmsg *nfmsg,
+					struct nfq_data *nfa, void *data)
+{
+	struct nfq_fpga_worker *worker = (struct nfq_fpga_worker *) data;
+	struct nfqnl_msg_packet_hdr *ph;
+	struct nfq_fpga_entry *entry;
+	unsigned char *payload;
+	uint64_t user_data;
+	int p_len;
+
+	(void) qh;
+	(void) nfmsg;
+
+	ph = nfq_get_msg_packet_hdr(nfa);
+	if(!ph)
+	{
+		return -1;
+	}
+
+	entry = &worker->batch[worker->batch_len];
+	entry->id = ntohl(ph->packet_id);
+	entry->matched = false;
+	entry->pattern_id = DPI_PATTERN_ID_NONE;
+	entry->pending = false;
+	entry->len = 0;
+
+	// Scan the network-layer payload, the same bytes fpga_mt() inspects
+	p_len = nfq_get_payload(nfa, &payload);
+	if(p_len > 0 && Nfq_Config.device && p_len <= (int) worker->ring.params.buf_size)
+	{
+		// Stage it in the DMA-able buffer owned by this batch slot
+		memcpy(dpi_ring_buf(&worker->ring, worker->batch_len), payload, p_len);
+		user_data = ((uint64_t) worker->generation << 32) | worker->batch_len;
+
+		if(!dpi_ring_queue(&worker->ring, worker->batch_len, p_len, user_data))
+		{
+			entry->pending = true;
+			entry->len = p_len;
+		}
+		else
+		{
+			worker->fallback++;
+			nfq_fpga_software(entry, payload, p_len);
+		}
+	}
+	else if(p_len > 0)
+	{
+		// Larger than a ring buffer: match all of it here rather than a prefix
+		if(Nfq_Config.device)
+		{
+			worker->fallback++;
+		}
+		nfq_fpga_software(entry, payload, p_len);
+	}
+
+	worker->batch_len++;
+
+	// Flush early when the batch is full
+	if(worker->batch_len == Nfq_Config.batch_size)
+	{
+		nfq_fpga_flush(worker);
+	}
+
+	return 0;
+}
+
+
+static void nfq_fpga_complete(struct nfq_fpga_worker *worker)
+{
+	struct nfq_fpga_entry *entry;
+	struct timespec start, now;
+	unsigned int i, n, slot, queued, reaped = 0;
+
+	// Hand the whole batch to the accelerator with one submission
+	if(Nfq_Config.device)
+	{
+		queued = worker->ring.sq_tail - worker->ring.sq_flushed;
+
+		if(queued && !dpi_ring_submit(&worker->ring, queued))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			while(reaped < queued)
+			{
+				n = dpi_ring_reap(&worker->ring, worker->cqes, queued - reaped);
+				for(i = 0; i < n; i++)
+				{
+					// Completions of an earlier batch that gave up on them are dropped
+					slot = (uint32_t) worker->cqes[i].user_data;
+					if((uint32_t) (worker->cqes[i].user_data >> 32) != worker->generation ||
+						slot >= worker->batch_len || !worker->batch[slot].pending)
+					{
+						continue;
+					}
+					reaped++;
+
+					// Failed ones stay pending and are matched below
+					if(worker->cqes[i].result < 0)
+					{
+						continue;
+					}
+
+					entry = &worker->batch[slot];
+					entry->pending = false;
+					entry->matched = (worker->cqes[i].result == DPI_RESULT_MATCH);
+					entry->pattern_id = worker->cqes[i].pattern_id;
+				}
+
+				// Completions are synchronous unless a poll thread submits
+				if(!n && !Nfq_Config.sqpoll)
+				{
+					break;
+				}
+
+				// A stalled device leaves the rest pending for the software matcher
+				if(!n)
+				{
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					if((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) >=
+						NFQ_FPGA_SQPOLL_TIMEOUT_NS)
+					{
+						break;
+					}
+				}
+			}
+		}
+		worker->generation++;
+	}
+
+	for(i = 0; i < worker->batch_len; i++)
+	{
+		entry = &worker->batch[i];
+
+		// Not answered by the accelerator; its buffer still holds the payload
+		if(entry->pending)
+		{
+			entry->pending = false;
+			worker->fallback++;
+			nfq_fpga_software(entry, dpi_ring_buf(&worker->ring, i), entry->len);
+		}
+
+		worker->packets++;
+		if(!entry->matched)
+		{
+			continue;
+		}
+
+		worker->matched++;
+		if(Nfq_Config.print_enabled)
+		{
+			printf("nfq_fpga: queue %u packet %u matches pattern %u\n",
+				worker->queue_num, entry->id, entry->pattern_id);
+		}
+	}
+}
+
+
+static void nfq_fpga_flush(struct nfq_fpga_worker *worker)
+{
+	struct nfq_fpga_entry *entry;
+	bool marked;
+	unsigned int i;
+
+	nfq_fpga_complete(worker);
+
+	for(i = 0; i < worker->batch_len; i++)
+	{
+		entry = &worker->batch[i];
+		marked = entry->matched && Nfq_Config.filter_enabled;
+
+		// Extend the run while the next packet gets the same verdict.
+		// A batch verdict covers every queued id up to the given one.
+		if(i + 1 < worker->batch_len &&
+			marked == (worker->batch[i + 1].matched && Nfq_Config.filter_enabled))
+		{
+			continue;
+		}
+
+		if(!marked)
+		{
+			nfq_set_verdict_batch(worker->qh, entry->id, NF_ACCEPT);
+		}
+		else if(Nfq_Config.drop)
+		{
+			nfq_set_verdict_batch(worker->qh, entry->id, NF_DROP);
+		}
+		else
+		{
+			nfq_set_verdict_batch2(worker->qh, entry->id, NF_ACCEPT, Nfq_Config.mark);
+		}
+
+		worker->verdict_msgs++;
+	}
+
+	worker->batch_len = 0;
+}
+
+
+static int nfq_fpga_open(struct nfq_fpga_worker *worker)
+{
+	int fd, on = 1;
+	struct timeval tv = { .tv_sec = 1 };
+
+	worker->h = nfq_open();
+	if(!worker->h)
+	{
+		fprintf(stderr, "nfq_fpga: nfq_open failed\n");
+		return -1;
+	}
+
+	// Rebind queue handler for both families (needed by older kernels)
+	nfq_unbind_pf(worker->h, AF_INET);
+	nfq_unbind_pf(worker->h, AF_INET6);
+	if(nfq_bind_pf(worker->h, AF_INET) < 0 || nfq_bind_pf(worker->h, AF_INET6) < 0)
+	{
+		fprintf(stderr, "nfq_fpga: nfq_bind_pf failed\n");
+		goto error;
+	}
+
+	worker->qh = nfq_create_queue(worker->h, worker->queue_num, &nfq_fpga_packet, worker);
+	if(!worker->qh)
+	{
+		fprintf(stderr, "nfq_fpga: cannot bind queue %u\n", worker->queue_num);
+		goto error;
+	}
+
+	// Whole packets in device mode too; larger ones are matched in software
+	if(nfq_set_mode(worker->qh, NFQNL_COPY_PACKET, 0xffff) < 0)
+	{
+		fprintf(stderr, "nfq_fpga: cannot set copy mode on queue %u\n", worker->queue_num);
+		goto error;
+	}
+
+	nfq_set_queue_maxlen(worker->qh, Nfq_Config.queue_maxlen);
+	if(Nfq_Config.fail_open)
+	{
+		nfq_set_queue_flags(worker->qh, NFQA_CFG_F_FAIL_OPEN, NFQA_CFG_F_FAIL_OPEN);
+	}
+
+	// Overruns are counted by the kernel; never fail recv() because of them.
+	// Periodic timeout lets the worker notice a stop request.
+	fd = nfq_fd(worker->h);
+	setsockopt(fd, SOL_NETLINK, NETLINK_NO_ENOBUFS, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	return 0;
+
+error:
+	if(worker->qh)
+	{
+		nfq_destroy_queue(worker->qh);
+		worker->qh = NULL;
+	}
+	nfq_close(worker->h);
+	worker->h = NULL;
+	return -1;
+}
+
+
+static void *nfq_fpga_worker_run(void *arg)
+{
+	struct nfq_fpga_worker *worker = (struct nfq_fpga_worker *) arg;
+	char buf[NFQ_FPGA_RECV_BUFSIZE] __attribute__((aligned));
+	cpu_set_t cpus;
+	int fd, n;
+
+	// Keep each queue on its own CPU, matching --queue-balance fan-out
+	CPU_ZERO(&cpus);
+	CPU_SET(worker->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	fd = nfq_fd(worker->h);
+
+	while(!Nfq_Stop)
+	{
+		// Block for the first message of a batch
+		n = recv(fd, buf, sizeof(buf), 0);
+		if(n < 0)
+		{
+			if(errno == EAGAIN || errno == EINTR)
+				continue;
+
+			perror("nfq_fpga: recv");
+			break;
+		}
+		nfq_handle_packet(worker->h, buf, n);
+
+		// Drain everything already queued, then answer it all at once
+		while((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+		{
+			nfq_handle_packet(worker->h, buf, n);
+		}
+
+		nfq_fpga_flush(worker);
+	}
+
+	return NULL;
+}
+
+
+static void nfq_fpga_signal(int sig)
+{
+	(void) sig;
+	Nfq_Stop = 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct nfq_fpga_worker *workers;
+	struct sigaction sa;
+	long num_cpus;
+	unsigned int i, started = 0;
+	int retval = EXIT_FAILURE;
+
+	if(nfq_fpga_parse(argc, argv))
+	{
+		nfq_fpga_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Compile the signature set once for all workers, also as the fallback of --device
+	if(dpi_pattern_set_load(&Nfq_Patterns, Nfq_Config.patterns))
+	{
+		return EXIT_FAILURE;
+	}
+
+	Nfq_Matcher = dpi_matcher_compile(&Nfq_Patterns);
+	if(!Nfq_Matcher)
+	{
+		dpi_pattern_set_free(&Nfq_Patterns);
+		return EXIT_FAILURE;
+	}
+
+	dpi_prefilter_build(&Nfq_Patterns, &Nfq_Prefilter);
+
+	printf("** %u patterns compiled into %u states (%u final)\n",
+		Nfq_Patterns.count, Nfq_Matcher->num_states, Nfq_Matcher->num_finals);
+
+	workers = calloc(Nfq_Config.queue_count, sizeof(*workers));
+	if(!workers)
+	{
+		goto out;
+	}
+
+	// Without SA_RESTART, so a blocked recv() returns at once on a stop request
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = nfq_fpga_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_cpus < 1)
+	{
+		num_cpus = 1;
+	}
+
+	for(i = 0; i < Nfq_Config.queue_count; i++)
+	{
+		workers[i].ring.fd = -1;
+	}
+
+	// One worker per queue, spread over CPUs
+	for(i = 0; i < Nfq_Config.queue_count; i++)
+	{
+		workers[i].queue_num = Nfq_Config.queue_num + i;
+		workers[i].cpu = i % num_cpus;
+		workers[i].batch = calloc(Nfq_Config.batch_size, sizeof(*workers[i].batch));
+
+		if(!workers[i].batch || nfq_fpga_open(&workers[i]))
+		{
+			goto stop;
+		}
+
+		// Each worker gets its own rings, one buffer per batch slot
+		if(Nfq_Config.device)
+		{
+			workers[i].cqes = calloc(Nfq_Config.batch_size, sizeof(*workers[i].cqes));
+			if(!workers[i].cqes ||
+				dpi_ring_open(&workers[i].ring, Nfq_Config.device, Nfq_Config.batch_size,
+							Nfq_Config.batch_size, NFQ_FPGA_DEV_BUFSIZE,
+							Nfq_Config.sqpoll ? DPI_SETUP_SQPOLL : 0))
+			{
+				goto stop;
+			}
+		}
+
+		if(pthread_create(&workers[i].thread, NULL, nfq_fpga_worker_run, &workers[i]))
+		{
+			goto stop;
+		}
+		started++;
+	}
+
+	printf("** Serving queues %u-%u\n", Nfq_Config.queue_num,
+		Nfq_Config.queue_num + Nfq_Config.queue_count - 1);
+	retval = EXIT_SUCCESS;
+
+stop:
+	if(retval != EXIT_SUCCESS)
+	{
+		Nfq_Stop = 1;
+	}
+
+	for(i = 0; i < started; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		printf("** queue %u: %llu packets, %llu matched, %llu verdict messages, %llu in software\n",
+			workers[i].queue_num, workers[i].packets, workers[i].matched,
+			workers[i].verdict_msgs, workers[i].fallback);
+	}
+
+	for(i = 0; i < Nfq_Config.queue_count; i++)
+	{
+		if(workers[i].qh)
+			nfq_destroy_queue(workers[i].qh);
+		if(workers[i].h)
+			nfq_close(workers[i].h);
+		dpi_ring_close(&workers[i].ring);
+		free(workers[i].cqes);
+		free(workers[i].batch);
+	}
+	free(workers);
+
+out:
+	dpi_matcher_free(Nfq_Matcher);
+	dpi_pattern_set_free(&Nfq_Patterns);
+	return retval;
+}
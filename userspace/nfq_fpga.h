@@ -0,0 +1,153 @@
+#ifndef _NFQ_FPGA_H
+#define _NFQ_FPGA_H
+
+/**
+ * NFQUEUE daemon for FPGA matching.
+ * Pulls packets from one or more netfilter queues in batches, runs them
+ * through the FPGA pattern engine and issues batched verdicts.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <libnetfilter_queue/libnetfilter_queue.h>
+#include "dpi_matcher.h"
+#include "dpi_prefilter.h"
+#include "dpi_ring.h"
+
+/** Daemon defaults */
+#define NFQ_FPGA_DEFAULT_BATCH			64
+#define NFQ_FPGA_DEFAULT_MAXLEN			4096
+#define NFQ_FPGA_DEFAULT_MARK			0x1
+#define NFQ_FPGA_RECV_BUFSIZE			65536
+#define NFQ_FPGA_DEV_BUFSIZE			2048
+
+/** Longest wait for poll thread completions before the batch is matched in software */
+#define NFQ_FPGA_SQPOLL_TIMEOUT_NS		(100 * 1000000L)
+
+/** Daemon settings (filter/print mirror struct xt_fpga_info) */
+struct nfq_fpga_config
+{
+	bool filter_enabled;
+	bool print_enabled;
+
+	// Queue layout: queues [queue_num, queue_num + queue_count)
+	uint16_t queue_num;
+	uint16_t queue_count;
+	uint32_t queue_maxlen;
+	bool fail_open;
+
+	// Verdict for matching packets when filter is enabled
+	uint32_t mark;
+	bool drop;
+
+	// Maximum packets per verdict batch
+	unsigned int batch_size;
+
+	// Signature file for the software matcher
+	const char *patterns;
+
+	// Accelerator device (software matcher is used when not set, and for
+	// packets the accelerator cannot take or does not answer)
+	const char *device;
+	bool sqpoll;
+};
+
+/** Per-packet scan result, kept until the batch verdict is sent */
+struct nfq_fpga_entry
+{
+	uint32_t id;
+	bool matched;
+	uint32_t pattern_id;
+
+	// Queued on the accelerator and not answered yet; len bytes in its buffer
+	bool pending;
+	uint32_t len;
+};
+
+/** One worker thread serving one queue */
+struct nfq_fpga_worker
+{
+	pthread_t thread;
+	uint16_t queue_num;
+	int cpu;
+
+	struct nfq_handle *h;
+	struct nfq_q_handle *qh;
+
+	// Pending batch
+	struct nfq_fpga_entry *batch;
+	unsigned int batch_len;
+
+	// Accelerator rings (one buffer per batch entry)
+	struct dpi_ring ring;
+	struct dpi_cqe *cqes;
+
+	// Batch number in the upper half of user_data; stale completions are dropped
+	uint32_t generation;
+
+	// Statistics
+	unsigned long long packets;
+	unsigned long long matched;
+	unsigned long long verdict_msgs;
+	unsigned long long fallback;	// Matched in software in device mode
+};
+
+/** The function that prints daemon usage */
+static void nfq_fpga_help(const char *);
+
+/** The function that parses command line arguments into daemon settings */
+static int nfq_fpga_parse(int, char **);
+
+/** The function that matches a payload with the software matcher */
+static void nfq_fpga_software(struct nfq_fpga_entry *, const unsigned char *, unsigned int);
+
+/**
+ *	This function scans the payload of a queued packet and appends it
+ *	to the pending batch of its worker.
+ *		returns 0 on success, a negative value on error
+ */
+static int nfq_fpga_packet(struct nfq_q_handle *, struct nfgenmsg *,
+					struct nfq_data *, void *);
+
+/**
+ *	This function collects accelerator results for the pending batch
+ *	and accounts/logs its matches. Entries the accelerator failed or did
+ *	not answer are matched in software.
+ */
+static void nfq_fpga_complete(struct nfq_fpga_worker *);
+
+/**
+ *	This function sends verdicts for the pending batch.
+ *	Consecutive packets with the same verdict share a single batch verdict.
+ */
+static void nfq_fpga_flush(struct nfq_fpga_worker *);
+
+/** The function that opens and configures the queue of a worker */
+static int nfq_fpga_open(struct nfq_fpga_worker *);
+
+/** Worker thread main loop */
+static void *nfq_fpga_worker_run(void *);
+
+/** The option struct for daemon arguments */
+static const struct option nfq_fpga_opts[] =
+{
+	{ "filter", 0, NULL, 'f' },
+	{ "print", 0, NULL, 'p' },
+	{ "patterns", 1, NULL, 'P' },
+	{ "queue-num", 1, NULL, 'q' },
+	{ "queues", 1, NULL, 'n' },
+	{ "queue-maxlen", 1, NULL, 'l' },
+	{ "fail-open", 0, NULL, 'o' },
+	{ "mark", 1, NULL, 'm' },
+	{ "drop", 0, NULL, 'd' },
+	{ "batch", 1, NULL, 'b' },
+	{ "device", 1, NULL, 'D' },
+	{ "sqpoll", 0, NULL, 'S' },
+	{ "help", 0, NULL, 'h' },
+	{ .name = NULL }
+};
+
+#endif
@@ -0,0 +1,699 @@
+/**
+ * AF_XDP front-end for FPGA matching.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include "xsk_fpga.h"
+
+#ifndef AF_XDP
+#define AF_XDP							44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP							283
+#endif
+
+
+/** Front-end settings */
+static struct xsk_fpga_config Xsk_Config;
+
+/** Pattern engine (read-only after start) */
+static struct dpi_pattern_set Xsk_Patterns;
+static struct dpi_matcher *Xsk_Matcher;
+static struct dpi_prefilter_table Xsk_Prefilter;
+static struct dpi_bloom Xsk_Bloom;
+
+/** Set by signal handler to stop the front-end */
+static volatile sig_atomic_t Xsk_Stop;
+
+
+static void xsk_fpga_help(const char *prog)
+{
+	printf(
+		"Usage: %s --dev IFACE --patterns FILE [options]\n"
+		"--dev IFACE           Interface to take frames from\n"
+		"--queue N             Queue of the interface (default 0)\n"
+		"--peer IFACE          Interface to forward clean frames to\n"
+		"                      Without it, frames are only counted (sink mode)\n"
+		"--patterns FILE       Signature file\n"
+		"--skb-mode            Attach the XDP program in generic (skb) mode\n"
+		"--zerocopy            Bind the socket in zero-copy mode (driver support needed)\n",
+		prog
+	);
+}
+
+
+static int xsk_fpga_parse(int argc, char **argv)
+{
+	int c;
+
+	while((c = getopt_long(argc, argv, "", xsk_fpga_opts, NULL)) != -1)
+	{
+		switch(c)
+		{
+			case 'i':
+				Xsk_Config.dev = optarg;
+				break;
+
+			case 'o':
+				Xsk_Config.peer = optarg;
+				break;
+
+			case 'q':
+				Xsk_Config.queue = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'P':
+				Xsk_Config.patterns = optarg;
+				break;
+
+			case 'S':
+				Xsk_Config.skb_mode = true;
+				break;
+
+			case 'z':
+				Xsk_Config.zerocopy = true;
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	if(!Xsk_Config.dev || !Xsk_Config.patterns || (Xsk_Config.skb_mode && Xsk_Config.zerocopy))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/** Function that maps one ring of a socket */
+static int xsk_ring_map(int fd, struct xsk_ring *ring, const struct xdp_ring_offset *off,
+					uint32_t size, size_t desc_size, off_t pgoff)
+{
+	ring->map_len = off->desc + size * desc_size;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if(ring->map == MAP_FAILED)
+	{
+		ring->map = NULL;
+		return -1;
+	}
+
+	ring->producer = (uint32_t *) ((char *) ring->map + off->producer);
+	ring->consumer = (uint32_t *) ((char *) ring->map + off->consumer);
+	ring->flags = (uint32_t *) ((char *) ring->map + off->flags);
+	ring->descs = (char *) ring->map + off->desc;
+	ring->size = size;
+	ring->mask = size - 1;
+	ring->cached_prod = *ring->producer;
+	ring->cached_cons = *ring->consumer;
+
+	return 0;
+}
+
+
+/** Function that returns number of entries a consumer can take (up to max) */
+static uint32_t xsk_ring_peek(struct xsk_ring *ring, uint32_t max)
+{
+	uint32_t entries = ring->cached_prod - ring->cached_cons;
+
+	if(entries == 0)
+	{
+		ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+		entries = ring->cached_prod - ring->cached_cons;
+	}
+
+	return entries < max ? entries : max;
+}
+
+
+/** Function that gives consumed entries back to the producer */
+static void xsk_ring_release(struct xsk_ring *ring, uint32_t n)
+{
+	ring->cached_cons += n;
+	__atomic_store_n(ring->consumer, ring->cached_cons, __ATOMIC_RELEASE);
+}
+
+
+/** Function that publishes produced entries to the consumer */
+static void xsk_ring_submit(struct xsk_ring *ring, uint32_t n)
+{
+	ring->cached_prod += n;
+	__atomic_store_n(ring->producer, ring->cached_prod, __ATOMIC_RELEASE);
+}
+
+
+static int xsk_port_open(struct xsk_port *port, const char *dev, uint32_t queue,
+					bool copy, bool zerocopy)
+{
+	struct xdp_umem_reg mr;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen = sizeof(off);
+	uint32_t frames = XSK_FPGA_NUM_FRAMES, ring = XSK_FPGA_RING_SIZE, i;
+
+	memset(port, 0, sizeof(*port));
+	port->fd = -1;
+
+	port->ifindex = if_nametoindex(dev);
+	if(!port->ifindex)
+	{
+		perror(dev);
+		return -1;
+	}
+
+	port->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if(port->fd < 0)
+	{
+		perror("socket(AF_XDP)");
+		return -1;
+	}
+
+	// UMEM: frames shared by the kernel and this process
+	port->umem_len = (size_t) XSK_FPGA_NUM_FRAMES * XSK_FPGA_FRAME_SIZE;
+	port->umem = mmap(NULL, port->umem_len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if(port->umem == MAP_FAILED)
+	{
+		port->umem = NULL;
+		perror("mmap(umem)");
+		return -1;
+	}
+
+	memset(&mr, 0, sizeof(mr));
+	mr.addr = (uintptr_t) port->umem;
+	mr.len = port->umem_len;
+	mr.chunk_size = XSK_FPGA_FRAME_SIZE;
+
+	if(setsockopt(port->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+		setsockopt(port->fd, SOL_XDP, XDP_UMEM_FILL_RING, &frames, sizeof(frames)) ||
+		setsockopt(port->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &frames, sizeof(frames)) ||
+		setsockopt(port->fd, SOL_XDP, XDP_RX_RING, &ring, sizeof(ring)) ||
+		setsockopt(port->fd, SOL_XDP, XDP_TX_RING, &ring, sizeof(ring)))
+	{
+		perror("setsockopt(SOL_XDP)");
+		return -1;
+	}
+
+	// Ring flags (need-wakeup) are reported since Linux 5.4
+	if(getsockopt(port->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) || optlen != sizeof(off))
+	{
+		fprintf(stderr, "xsk_fpga: kernel does not report AF_XDP ring offsets\n");
+		return -1;
+	}
+
+	if(xsk_ring_map(port->fd, &port->fill, &off.fr, frames, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+		xsk_ring_map(port->fd, &port->comp, &off.cr, frames, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+		xsk_ring_map(port->fd, &port->rx, &off.rx, ring, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+		xsk_ring_map(port->fd, &port->tx, &off.tx, ring, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+	{
+		perror("mmap(ring)");
+		return -1;
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = port->ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (zerocopy ? XDP_ZEROCOPY : copy ? XDP_COPY : 0);
+
+	if(bind(port->fd, (struct sockaddr *) &sxdp, sizeof(sxdp)))
+	{
+		fprintf(stderr, "xsk_fpga: cannot bind to %s queue %u: %s\n", dev, queue, strerror(errno));
+		return -1;
+	}
+
+	port->free_frames = malloc(XSK_FPGA_NUM_FRAMES * sizeof(uint64_t));
+	if(!port->free_frames)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < XSK_FPGA_NUM_FRAMES; i++)
+	{
+		port->free_frames[i] = (uint64_t) i * XSK_FPGA_FRAME_SIZE;
+	}
+	port->num_free = XSK_FPGA_NUM_FRAMES;
+
+	return 0;
+}
+
+
+static void xsk_port_close(struct xsk_port *port)
+{
+	struct xsk_ring *rings[] = { &port->fill, &port->comp, &port->rx, &port->tx };
+	unsigned int i;
+
+	for(i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+	{
+		if(rings[i]->map)
+		{
+			munmap(rings[i]->map, rings[i]->map_len);
+		}
+	}
+
+	if(port->fd >= 0)
+	{
+		close(port->fd);
+	}
+
+	if(port->umem)
+	{
+		munmap(port->umem, port->umem_len);
+	}
+
+	free(port->free_frames);
+	memset(port, 0, sizeof(*port));
+	port->fd = -1;
+}
+
+
+/** Function that hands all free frames of a port to the kernel for reception */
+static void xsk_port_fill(struct xsk_port *port)
+{
+	uint64_t *fill = port->fill.descs;
+	uint32_t i;
+
+	for(i = 0; i < port->num_free; i++)
+	{
+		fill[(port->fill.cached_prod + i) & port->fill.mask] = port->free_frames[i];
+	}
+
+	xsk_ring_submit(&port->fill, port->num_free);
+	port->num_free = 0;
+}
+
+
+/** Function that issues a bpf() system call */
+static int xsk_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/** Function that sets (fd >= 0) or clears (fd -1) the XDP program of an interface */
+static int xsk_fpga_set_xdp(int ifindex, int fd, uint32_t flags)
+{
+	struct
+	{
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[64];
+	} req;
+	struct
+	{
+		struct nlmsghdr nh;
+		struct nlmsgerr err;
+		char payload[256];
+	} ack;
+	struct sockaddr_nl sa;
+	struct rtattr *xdp, *rta;
+	int sock, retval = -1;
+
+	sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if(sock < 0)
+	{
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_SETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+
+	// IFLA_XDP { IFLA_XDP_FD, IFLA_XDP_FLAGS }
+	xdp = (struct rtattr *) ((char *) &req + NLMSG_ALIGN(req.nh.nlmsg_len));
+	xdp->rta_type = IFLA_XDP | NLA_F_NESTED;
+	xdp->rta_len = RTA_LENGTH(0);
+
+	rta = (struct rtattr *) ((char *) xdp + RTA_ALIGN(xdp->rta_len));
+	rta->rta_type = IFLA_XDP_FD;
+	rta->rta_len = RTA_LENGTH(sizeof(int));
+	memcpy(RTA_DATA(rta), &fd, sizeof(int));
+	xdp->rta_len += RTA_ALIGN(rta->rta_len);
+
+	rta = (struct rtattr *) ((char *) xdp + RTA_ALIGN(xdp->rta_len));
+	rta->rta_type = IFLA_XDP_FLAGS;
+	rta->rta_len = RTA_LENGTH(sizeof(uint32_t));
+	memcpy(RTA_DATA(rta), &flags, sizeof(uint32_t));
+	xdp->rta_len += RTA_ALIGN(rta->rta_len);
+
+	req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + RTA_ALIGN(xdp->rta_len);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	if(sendto(sock, &req, req.nh.nlmsg_len, 0, (struct sockaddr *) &sa, sizeof(sa)) < 0)
+	{
+		goto out;
+	}
+
+	if(recv(sock, &ack, sizeof(ack), 0) < (ssize_t) NLMSG_LENGTH(sizeof(struct nlmsgerr)) ||
+		ack.nh.nlmsg_type != NLMSG_ERROR)
+	{
+		goto out;
+	}
+
+	errno = -ack.err.error;
+	retval = ack.err.error ? -1 : 0;
+
+out:
+	close(sock);
+	return retval;
+}
+
+
+static int xsk_fpga_attach(int ifindex, uint32_t queue, int xsk_fd, bool skb_mode)
+{
+	union bpf_attr attr;
+	char log[4096];
+	int map_fd, prog_fd;
+	uint32_t key = queue;
+
+	// Queue index -> socket
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(int);
+	attr.max_entries = queue + 1;
+
+	map_fd = xsk_bpf(BPF_MAP_CREATE, &attr);
+	if(map_fd < 0)
+	{
+		perror("bpf(BPF_MAP_CREATE)");
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uintptr_t) &key;
+	attr.value = (uintptr_t) &xsk_fd;
+
+	if(xsk_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+	{
+		perror("bpf(BPF_MAP_UPDATE_ELEM)");
+		close(map_fd);
+		return -1;
+	}
+
+	// return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+	// Frames of other queues (no socket in the map) go to the stack.
+	{
+		struct bpf_insn prog[] =
+		{
+			{ .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+			  .off = offsetof(struct xdp_md, rx_queue_index) },
+			{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+			  .imm = map_fd },
+			{ .code = 0 },
+			{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+			{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+			{ .code = BPF_JMP | BPF_EXIT },
+		};
+
+		memset(&attr, 0, sizeof(attr));
+		attr.prog_type = BPF_PROG_TYPE_XDP;
+		attr.insns = (uintptr_t) prog;
+		attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+		attr.license = (uintptr_t) "GPL";
+		attr.log_buf = (uintptr_t) log;
+		attr.log_size = sizeof(log);
+		attr.log_level = 1;
+		log[0] = '\0';
+
+		prog_fd = xsk_bpf(BPF_PROG_LOAD, &attr);
+	}
+
+	if(prog_fd < 0)
+	{
+		fprintf(stderr, "bpf(BPF_PROG_LOAD): %s\n%s\n", strerror(errno), log);
+		close(map_fd);
+		return -1;
+	}
+
+	if(xsk_fpga_set_xdp(ifindex, prog_fd, XDP_FLAGS_UPDATE_IF_NOEXIST |
+						(skb_mode ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE)))
+	{
+		fprintf(stderr, "xsk_fpga: cannot attach XDP program: %s\n", strerror(errno));
+		close(prog_fd);
+		close(map_fd);
+		return -1;
+	}
+
+	// The interface holds the program, which holds the map
+	close(prog_fd);
+	return map_fd;
+}
+
+
+static void xsk_fpga_detach(int ifindex, bool skb_mode)
+{
+	xsk_fpga_set_xdp(ifindex, -1, skb_mode ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE);
+}
+
+
+static bool xsk_fpga_match(const unsigned char *frame, uint32_t len)
+{
+	const unsigned char *payload;
+	uint32_t off = 12;
+	uint16_t proto;
+
+	// Skip the Ethernet header (and VLAN tags): the xtables path sees
+	// the same bytes starting from the network header
+	if(len < 14)
+	{
+		return false;
+	}
+
+	proto = frame[off] << 8 | frame[off + 1];
+	while((proto == 0x8100 || proto == 0x88a8) && off + 6 <= len)
+	{
+		off += 4;
+		proto = frame[off] << 8 | frame[off + 1];
+	}
+	off += 2;
+
+	payload = frame + off;
+	len -= off;
+
+	if(!dpi_bloom_scan(&Xsk_Bloom, payload, len) ||
+		!dpi_prefilter_scan(&Xsk_Prefilter, payload, len))
+	{
+		return false;
+	}
+
+	return dpi_matcher_scan(Xsk_Matcher, payload, len, NULL);
+}
+
+
+/**
+ *	Function that takes a batch of received frames, forwards clean ones
+ *	to the peer and recycles all of them into the fill ring.
+ */
+static void xsk_fpga_process(struct xsk_port *in, struct xsk_port *out, struct xsk_fpga_stats *stats)
+{
+	const struct xdp_desc *rx = in->rx.descs;
+	struct xdp_desc *tx;
+	uint64_t *fill = in->fill.descs, *comp;
+	uint32_t n, i, done, sent = 0;
+	const unsigned char *frame;
+	uint64_t addr;
+
+	n = xsk_ring_peek(&in->rx, XSK_FPGA_BATCH);
+	if(!n)
+	{
+		return;
+	}
+
+	// Take back frames the peer has finished sending
+	if(out)
+	{
+		comp = out->comp.descs;
+		done = xsk_ring_peek(&out->comp, XSK_FPGA_NUM_FRAMES);
+		for(i = 0; i < done; i++)
+		{
+			out->free_frames[out->num_free++] = comp[(out->comp.cached_cons + i) & out->comp.mask];
+		}
+		xsk_ring_release(&out->comp, done);
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		addr = rx[(in->rx.cached_cons + i) & in->rx.mask].addr;
+		frame = (const unsigned char *) in->umem + addr;
+
+		stats->rx++;
+		stats->rx_bytes += rx[(in->rx.cached_cons + i) & in->rx.mask].len;
+
+		if(xsk_fpga_match(frame, rx[(in->rx.cached_cons + i) & in->rx.mask].len))
+		{
+			stats->matched++;
+		}
+		else if(out)
+		{
+			if(!out->num_free || out->tx.cached_prod + sent - *out->tx.consumer >= out->tx.size)
+			{
+				stats->tx_full++;
+			}
+			else
+			{
+				// The two interfaces have their own UMEM, so clean frames are copied
+				tx = out->tx.descs;
+				tx = &tx[(out->tx.cached_prod + sent) & out->tx.mask];
+				tx->addr = out->free_frames[--out->num_free];
+				tx->len = rx[(in->rx.cached_cons + i) & in->rx.mask].len;
+				tx->options = 0;
+				memcpy((unsigned char *) out->umem + tx->addr, frame, tx->len);
+				sent++;
+				stats->forwarded++;
+			}
+		}
+
+		// Give the frame back for reception
+		fill[(in->fill.cached_prod + i) & in->fill.mask] = addr & ~((uint64_t) XSK_FPGA_FRAME_SIZE - 1);
+	}
+
+	xsk_ring_release(&in->rx, n);
+	xsk_ring_submit(&in->fill, n);
+
+	if(sent)
+	{
+		xsk_ring_submit(&out->tx, sent);
+		if(__atomic_load_n(out->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+		{
+			sendto(out->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+		}
+	}
+}
+
+
+static void xsk_fpga_signal(int sig)
+{
+	(void) sig;
+	Xsk_Stop = 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct xsk_port in, out;
+	struct xsk_fpga_stats stats, last;
+	struct sigaction sa;
+	struct pollfd pfd;
+	struct timespec now, report;
+	double elapsed;
+	int map_fd = -1, retval = EXIT_FAILURE;
+
+	if(xsk_fpga_parse(argc, argv))
+	{
+		xsk_fpga_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(dpi_pattern_set_load(&Xsk_Patterns, Xsk_Config.patterns))
+	{
+		return EXIT_FAILURE;
+	}
+
+	Xsk_Matcher = dpi_matcher_compile(&Xsk_Patterns);
+	if(!Xsk_Matcher || dpi_bloom_build(&Xsk_Patterns, DPI_BLOOM_DEFAULT_BITS_LOG2,
+									DPI_BLOOM_DEFAULT_Q, &Xsk_Bloom))
+	{
+		goto out_engine;
+	}
+	dpi_prefilter_build(&Xsk_Patterns, &Xsk_Prefilter);
+
+	memset(&out, 0, sizeof(out));
+	out.fd = -1;
+
+	if(xsk_port_open(&in, Xsk_Config.dev, Xsk_Config.queue, Xsk_Config.skb_mode, Xsk_Config.zerocopy))
+	{
+		goto out_ports;
+	}
+
+	if(Xsk_Config.peer && xsk_port_open(&out, Xsk_Config.peer, Xsk_Config.queue, true, false))
+	{
+		goto out_ports;
+	}
+
+	xsk_port_fill(&in);
+
+	map_fd = xsk_fpga_attach(in.ifindex, Xsk_Config.queue, in.fd, Xsk_Config.skb_mode);
+	if(map_fd < 0)
+	{
+		goto out_ports;
+	}
+
+	// Without SA_RESTART, so poll() returns at once on a stop request
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = xsk_fpga_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("** %s queue %u -> %s, %u patterns, prefilter %s\n", Xsk_Config.dev, Xsk_Config.queue,
+		Xsk_Config.peer ? Xsk_Config.peer : "(sink)", Xsk_Patterns.count, dpi_prefilter_impl());
+
+	memset(&stats, 0, sizeof(stats));
+	last = stats;
+	clock_gettime(CLOCK_MONOTONIC, &report);
+
+	pfd.fd = in.fd;
+	pfd.events = POLLIN;
+
+	while(!Xsk_Stop)
+	{
+		// Sleep only when there is nothing to do
+		if(!xsk_ring_peek(&in.rx, 1))
+		{
+			poll(&pfd, 1, 100);
+		}
+
+		xsk_fpga_process(&in, Xsk_Config.peer ? &out : NULL, &stats);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - report.tv_sec) + (now.tv_nsec - report.tv_nsec) / 1e9;
+		if(elapsed >= 1.0)
+		{
+			printf("rx %10.0f pps %8.1f Mbps  matched %8.0f pps  forwarded %10.0f pps  tx full %llu\n",
+				(stats.rx - last.rx) / elapsed, (stats.rx_bytes - last.rx_bytes) * 8 / elapsed / 1e6,
+				(stats.matched - last.matched) / elapsed, (stats.forwarded - last.forwarded) / elapsed,
+				stats.tx_full);
+			last = stats;
+			report = now;
+		}
+	}
+
+	printf("** %llu frames, %llu matched, %llu forwarded\n", stats.rx, stats.matched, stats.forwarded);
+	retval = EXIT_SUCCESS;
+
+	xsk_fpga_detach(in.ifindex, Xsk_Config.skb_mode);
+	close(map_fd);
+
+out_ports:
+	xsk_port_close(&out);
+	xsk_port_close(&in);
+out_engine:
+	dpi_bloom_free(&Xsk_Bloom);
+	dpi_matcher_free(Xsk_Matcher);
+	dpi_pattern_set_free(&Xsk_Patterns);
+	return retval;
+}
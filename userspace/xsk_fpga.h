@@ -0,0 +1,134 @@
+#ifndef _XSK_FPGA_H
+#define _XSK_FPGA_H
+
+/**
+ * AF_XDP front-end for FPGA matching.
+ * Takes raw frames from an interface queue at the XDP stage, before any
+ * skb is allocated, runs them through the pattern engine and forwards
+ * clean frames to a peer interface (bump in the wire). Matching frames
+ * are dropped.
+ *
+ * Needs a kernel with AF_XDP (4.18 or later). The PowerPC 440 board runs
+ * 3.14, so this front-end is meant for a host placed in front of it, or
+ * for comparing against the xtables path on veth pairs.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <linux/if_xdp.h>
+#include "dpi_matcher.h"
+#include "dpi_prefilter.h"
+#include "dpi_bloom.h"
+
+/** Front-end defaults */
+#define XSK_FPGA_NUM_FRAMES				4096
+#define XSK_FPGA_FRAME_SIZE				2048
+#define XSK_FPGA_RING_SIZE				2048
+#define XSK_FPGA_BATCH					64
+
+/** Front-end settings */
+struct xsk_fpga_config
+{
+	const char *dev;
+	const char *peer;
+	uint32_t queue;
+	const char *patterns;
+
+	// XDP attach and socket bind modes
+	bool skb_mode;
+	bool zerocopy;
+};
+
+/** A single-producer/single-consumer ring shared with the kernel */
+struct xsk_ring
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *descs;
+	uint32_t mask;
+	uint32_t size;
+
+	// Local copies, synchronized with the shared indices in batches
+	uint32_t cached_prod;
+	uint32_t cached_cons;
+
+	// Mapping, for munmap
+	void *map;
+	size_t map_len;
+};
+
+/** An AF_XDP socket with its own UMEM, bound to one interface queue */
+struct xsk_port
+{
+	int fd;
+	int ifindex;
+
+	void *umem;
+	size_t umem_len;
+
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+
+	// Frames not owned by the kernel (TX side only)
+	uint64_t *free_frames;
+	uint32_t num_free;
+};
+
+/** Front-end counters */
+struct xsk_fpga_stats
+{
+	unsigned long long rx;
+	unsigned long long rx_bytes;
+	unsigned long long matched;
+	unsigned long long forwarded;
+	unsigned long long tx_full;
+};
+
+/** The function that prints front-end usage */
+static void xsk_fpga_help(const char *);
+
+/** The function that parses command line arguments into front-end settings */
+static int xsk_fpga_parse(int, char **);
+
+/**
+ *	This function creates an AF_XDP socket with its UMEM and rings and
+ *	binds it to a queue of an interface.
+ *		returns 0 on success, -1 on error
+ */
+static int xsk_port_open(struct xsk_port *, const char *, uint32_t, bool, bool);
+
+/** The function that releases an AF_XDP socket and its UMEM */
+static void xsk_port_close(struct xsk_port *);
+
+/**
+ *	This function loads an XDP program that redirects every frame of a
+ *	queue into the socket stored in an XSKMAP, and attaches it.
+ *		returns the XSKMAP descriptor on success, -1 on error
+ */
+static int xsk_fpga_attach(int, uint32_t, int, bool);
+
+/** The function that detaches the XDP program from an interface */
+static void xsk_fpga_detach(int, bool);
+
+/** The function that runs the pattern engine over a frame */
+static bool xsk_fpga_match(const unsigned char *, uint32_t);
+
+/** The option struct for front-end arguments */
+static const struct option xsk_fpga_opts[] =
+{
+	{ "dev", 1, NULL, 'i' },
+	{ "peer", 1, NULL, 'o' },
+	{ "queue", 1, NULL, 'q' },
+	{ "patterns", 1, NULL, 'P' },
+	{ "skb-mode", 0, NULL, 'S' },
+	{ "zerocopy", 0, NULL, 'z' },
+	{ "help", 0, NULL, 'h' },
+	{ .name = NULL }
+};
+
+#endif
@@ -7,14 +7,82 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <xtables.h>
 #include <getopt.h>
 
-/** Packet-specific filter info */
+/** Packet-specific filter info (revisions 0 and 1) */
+struct xt_fpga_info_v0
+{
+	bool filter_enabled;
+	bool print_enabled;
+};
+
+/** Overload policies: what a rule does with packets over its budget */
+#define XT_FPGA_POLICY_OPEN				0		// Let the packet pass uninspected
+#define XT_FPGA_POLICY_CLOSED			1		// Treat the packet as matching
+#define XT_FPGA_POLICY_SOFTWARE			2		// Inspect it with the software matcher
+#define XT_FPGA_POLICY_SAMPLE			3		// Inspect 1 in sample_rate, let others pass
+
+/** Rule setting limits */
+#define XT_FPGA_NAME_LEN				16
+#define XT_FPGA_DEFAULT_BURST_MS		100
+#define XT_FPGA_MAX_BURST_MS			1000
+#define XT_FPGA_DEFAULT_SAMPLE			100
+
+/** Inspected fields */
+#define XT_FPGA_FIELD_PACKET			0		// Whole packet from the network header
+#define XT_FPGA_FIELD_HTTP_HOST			1		// Host header of an HTTP request
+#define XT_FPGA_FIELD_HTTP_URI			2		// Request target of an HTTP request line
+#define XT_FPGA_FIELD_TLS_SNI			3		// Server name of a TLS ClientHello
+#define XT_FPGA_FIELD_DNS_QNAME			4		// First question name of a DNS message
+#define XT_FPGA_FIELD_LAST				XT_FPGA_FIELD_DNS_QNAME
+
+struct xt_fpga_rule;
+
+/** Packet-specific filter info (revision 2) */
+struct xt_fpga_info_v2
+{
+	bool filter_enabled;
+	bool print_enabled;
+	uint8_t policy;
+	uint8_t auto_percent;
+	uint32_t sample_rate;
+	uint64_t rate_bytes;
+	uint32_t rate_packets;
+	uint32_t burst_ms;
+	char name[XT_FPGA_NAME_LEN];
+
+	// Kernel-private rule state
+	struct xt_fpga_rule *rule __attribute__((aligned(8)));
+};
+
+/** Rule flags (revision 3) */
+#define XT_FPGA_F_INFLATE				0x01	// Also match decompressed HTTP response bodies
+
+/** Packet-specific filter info (revision 3) */
 struct xt_fpga_info 
 {
 	bool filter_enabled;
 	bool print_enabled;
+
+	// Admission control in front of the accelerator (0 rates are unlimited).
+	// With auto_percent, the budget is that share of measured accelerator time.
+	uint8_t policy;
+	uint8_t auto_percent;
+	uint32_t sample_rate;
+	uint64_t rate_bytes;
+	uint32_t rate_packets;
+	uint32_t burst_ms;
+	char name[XT_FPGA_NAME_LEN];
+
+	// Inspected field (XT_FPGA_FIELD_*), the whole packet by default
+	uint8_t field;
+	uint8_t flags;
+	uint8_t reserved[6];
+
+	// Kernel-private rule state
+	struct xt_fpga_rule *rule __attribute__((aligned(8)));
 };
 
 /** The function that prints the fpga match arguments */
@@ -22,6 +90,7 @@ static void fpga_help(void);
 
 /** The function that initializes the shared fpga info struct. */
 static void fpga_init(struct xt_entry_match *);
+static void fpga_init_v2(struct xt_entry_match *);
 
 /** The function that parses the arguments of fpga match */
 static int fpga_parse(int c, char **, int, unsigned int *,
@@ -33,6 +102,14 @@ static int fpga_parse(int c, char **, int, unsigned int *,
  */
 static void fpga_final_check(unsigned int);
 
+/** The functions that print a rule for "iptables -L" and "iptables -S" */
+static void fpga_print(const void *, const struct xt_entry_match *, int);
+static void fpga_save(const void *, const struct xt_entry_match *);
+static void fpga_print_v2(const void *, const struct xt_entry_match *, int);
+static void fpga_save_v2(const void *, const struct xt_entry_match *);
+static void fpga_print_v3(const void *, const struct xt_entry_match *, int);
+static void fpga_save_v3(const void *, const struct xt_entry_match *);
+
 /** The option struct for iptables rule arguments */
 static const struct option fpga_opts[] = 
 {
@@ -41,6 +118,38 @@ static const struct option fpga_opts[] =
 	{ .name = NULL }
 };
 
+/** The option struct for revision 2 rule arguments */
+static const struct option fpga_opts_v2[] = 
+{
+	{ "filter", 0, NULL, '1' },
+	{ "print", 0, NULL, '2' },
+	{ "budget-bytes", 1, NULL, '3' },
+	{ "budget-packets", 1, NULL, '4' },
+	{ "budget-auto", 1, NULL, '5' },
+	{ "budget-burst", 1, NULL, '6' },
+	{ "overload", 1, NULL, '7' },
+	{ "sample", 1, NULL, '8' },
+	{ "name", 1, NULL, '9' },
+	{ .name = NULL }
+};
+
+/** The option struct for revision 3 rule arguments */
+static const struct option fpga_opts_v3[] = 
+{
+	{ "filter", 0, NULL, '1' },
+	{ "print", 0, NULL, '2' },
+	{ "budget-bytes", 1, NULL, '3' },
+	{ "budget-packets", 1, NULL, '4' },
+	{ "budget-auto", 1, NULL, '5' },
+	{ "budget-burst", 1, NULL, '6' },
+	{ "overload", 1, NULL, '7' },
+	{ "sample", 1, NULL, '8' },
+	{ "name", 1, NULL, '9' },
+	{ "field", 1, NULL, 'a' },
+	{ "inflate", 0, NULL, 'b' },
+	{ .name = NULL }
+};
+
 /** Userspace Xtables entry for FPGA matcher */
 static struct xtables_match fpga_mt_reg[] = 
 {
@@ -49,11 +158,14 @@ static struct xtables_match fpga_mt_reg[] =
 		.revision      = 0,
 		.family        = NFPROTO_UNSPEC,
 		.version       = XTABLES_VERSION,
-		.size          = XT_ALIGN(sizeof(struct xt_fpga_info)),
+		.size          = XT_ALIGN(sizeof(struct xt_fpga_info_v0)),
+		.userspacesize = XT_ALIGN(sizeof(struct xt_fpga_info_v0)),
 		.help          = fpga_help,
 		.init          = fpga_init,
 		.parse         = fpga_parse,
 		.final_check   = fpga_final_check,
+		.print         = fpga_print,
+		.save          = fpga_save,
 		.extra_opts    = fpga_opts,
 	},
 	{
@@ -61,13 +173,46 @@ static struct xtables_match fpga_mt_reg[] =
 		.revision      = 1,
 		.family        = NFPROTO_UNSPEC,
 		.version       = XTABLES_VERSION,
-		.size          = XT_ALIGN(sizeof(struct xt_fpga_info)),
+		.size          = XT_ALIGN(sizeof(struct xt_fpga_info_v0)),
+		.userspacesize = XT_ALIGN(sizeof(struct xt_fpga_info_v0)),
 		.help          = fpga_help,
 		.init          = fpga_init,
 		.parse         = fpga_parse,
 		.final_check   = fpga_final_check,
+		.print         = fpga_print,
+		.save          = fpga_save,
 		.extra_opts    = fpga_opts,
 	},
+	{
+		.name          = "fpga",
+		.revision      = 2,
+		.family        = NFPROTO_UNSPEC,
+		.version       = XTABLES_VERSION,
+		.size          = XT_ALIGN(sizeof(struct xt_fpga_info_v2)),
+		.userspacesize = offsetof(struct xt_fpga_info_v2, rule),
+		.help          = fpga_help,
+		.init          = fpga_init_v2,
+		.parse         = fpga_parse,
+		.final_check   = fpga_final_check,
+		.print         = fpga_print_v2,
+		.save          = fpga_save_v2,
+		.extra_opts    = fpga_opts_v2,
+	},
+	{
+		.name          = "fpga",
+		.revision      = 3,
+		.family        = NFPROTO_UNSPEC,
+		.version       = XTABLES_VERSION,
+		.size          = XT_ALIGN(sizeof(struct xt_fpga_info)),
+		.userspacesize = offsetof(struct xt_fpga_info, rule),
+		.help          = fpga_help,
+		.init          = fpga_init_v2,
+		.parse         = fpga_parse,
+		.final_check   = fpga_final_check,
+		.print         = fpga_print_v3,
+		.save          = fpga_save_v3,
+		.extra_opts    = fpga_opts_v3,
+	},
 };
 
 /** Called when FPGA Xtables module is loaded */